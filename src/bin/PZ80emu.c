@@ -17,63 +17,591 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include <ncurses.h>
 #include "z80.h"
 #include "memory.h"
 #include "display.h"
+#include "profile.h"
+#include "opstats.h"
+#include "cpm.h"
+#include "difftest.h"
+#include "monitor.h"
+#include "observer.h"
+#include "shmexport.h"
+#include "replay.h"
+#include "throttle.h"
+#include "hwcount.h"
+
+/** Command line usage text */
+#define USAGE "Usage: PZ80emu -f <filename> -r <runcycles> [-s] [-p <report>] [-g <folded>]" \
+              " [-G <callgraph>] [-l <symbols>] [-o <opstats.csv>]\n" \
+              "       PZ80emu -c -f <program.com> [-r <runcycles>] [...]\n" \
+              "       PZ80emu [-c] -f <filename> -r <runcycles> -D <interval>\n" \
+              "       PZ80emu -m [-s] -f <filename> [-r <runcycles>]\n" \
+              "       -x <name> exports memory and registers as shared memory /<name>\n" \
+              "       -R <file> records the run's inputs, -P <file> replays them\n" \
+              "       -C, --clock <rate> runs in real time at a clock rate such as 4MHz\n" \
+              "       -H reports host hardware counters per instruction for the run\n"
+
+/** Instructions per run() call in CP/M mode, between checks for the program's end */
+#define CPM_SLICE 1000000L
+
+/** Long forms of the command line options */
+static const struct option long_options[] = {
+	{ "clock", required_argument, NULL, 'C' },
+	{ NULL, 0, NULL, 0 }
+};
+
+/** Size of the stdout buffer in CP/M mode */
+#define CPM_OUTPUT_BUFFER 65536
+
+/**
+ * Reports the instruction a run stopped on
+ * \param cpu cpu that trapped
+ */
+static void report_trap(const z80 *cpu) {
+	(void) fflush(stdout);
+	fprintf(stderr, "PZ80emu: %s at 0x%04X:", trap_reason(cpu->trap.reason), cpu->trap.pc);
+	for (int i = 0; i < cpu->trap.length; i++) {
+		fprintf(stderr, " %02X", cpu->trap.bytes[i]);
+	}
+	fprintf(stderr, " after %d instructions\n", cpu->trap.instructions);
+}
+
+/**
+ * UI thread of monitor mode: shows the latest snapshot at most
+ * MONITOR_FPS times a second and turns keys into commands. Space pauses
+ * and resumes, s steps, b toggles a breakpoint at the top of the memory
+ * view and q quits.
+ * \param context observer of the cpu
+ * \return NULL
+ */
+static void *monitor_thread(void *context) {
+	observer *obs = context;
+	observer_snapshot *snapshot;
+	WINDOW *registers, *memory_window;
+	monitor *mon;
+	int quit = 0;
+
+	// keys can come before the first snapshot, they see an all zero one
+	if ((snapshot = calloc(1, sizeof(observer_snapshot))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	create_newscreen(0, 0);
+	(void) nodelay(stdscr, true);
+	(void) refresh();
+	registers = create_newwin(MONITOR_REGISTER_LINES, COLS, 0, 0);
+	memory_window = create_newwin(LINES - MONITOR_REGISTER_LINES, COLS, MONITOR_REGISTER_LINES, 0);
+	mon = monitor_new(registers, memory_window, MONITOR_FPS);
+
+	// keep showing the final state after the run until q
+	while (!quit || !atomic_load(&obs->done)) {
+		int key;
+
+		if (observer_read(obs, snapshot) > 0) {
+			char status[80];
+
+			(void) snprintf(status, sizeof(status), " %s, %ld instructions, %d breakpoints ",
+			                atomic_load(&obs->done) ? "stopped" : snapshot->paused ? "paused" : "running",
+			                snapshot->instructions, snapshot->breakpoints);
+			monitor_status(mon, status);
+			(void) monitor_frame(mon, &snapshot->cpu, snapshot->memory);
+		}
+
+		while ((key = getch()) != ERR) {
+			switch (key) {
+			case 'q': quit = 1; (void) observer_push(obs, OBSERVER_QUIT, 0); break;
+			case ' ': (void) observer_push(obs, snapshot->paused ? OBSERVER_RESUME : OBSERVER_PAUSE, 0); break;
+			case 's': (void) observer_push(obs, OBSERVER_STEP, 0); break;
+			case 'b': (void) observer_push(obs, OBSERVER_BREAK, mon->top); break;
+			default: (void) monitor_key(mon, &snapshot->cpu, key); break;
+			}
+		}
+
+		napms(1000 / MONITOR_FPS);
+	}
+
+	monitor_free(mon);
+	(void) delwin(registers);
+	(void) delwin(memory_window);
+	(void) endwin();
+	free(snapshot);
+
+	return NULL;
+}
+
+/**
+ * Snapshot hook updating the shared register mirror
+ */
+static void export_registers(void *context, const z80 *cpu, long instructions) {
+	shmexport_update(context, cpu, instructions);
+}
+
+/**
+ * Runs the cpu at full speed on this thread, watched and steered by the
+ * monitor on its own thread
+ * \param cpu cpu to run
+ * \param memory memory of the cpu
+ * \param runcycles instructions to run, 0 or less to run until q
+ * \param paused starts paused when non-zero
+ * \param exp shared memory export to keep updated, or NULL
+ * \param executed set to the instructions run in all
+ * \return Result of the last run(), -1 if it stopped on a trap.
+ */
+static int run_monitor(z80 *cpu, uint8_t *memory, long runcycles, int paused, shmexport *exp, long *executed) {
+	observer *obs = observer_new(MONITOR_FPS);
+	pthread_t ui;
+	int count;
+
+	// the shared register mirror follows the snapshots
+	if (exp != NULL) {
+		obs->on_publish = export_registers;
+		obs->publish_context = exp;
+	}
+
+	if (pthread_create(&ui, NULL, monitor_thread, obs) != 0) {
+		observer_free(obs);
+		count = run(cpu, memory, runcycles, 0);
+		*executed = (count >= 0) ? count : cpu->trap.instructions;
+		return count;
+	}
+
+	count = observer_run(obs, cpu, memory, runcycles, paused);
+	(void) pthread_join(ui, NULL);
+	*executed = obs->executed;
+	observer_free(obs);
+
+	return count;
+}
+
+/**
+ * Runs the cpu, through the replay when recording or replaying
+ */
+static int run_slice(z80 *cpu, uint8_t *memory, long runcycles, int s_flag, replay *rep) {
+	return (rep != NULL) ? replay_run(rep, memory, runcycles) : run(cpu, memory, runcycles, s_flag);
+}
+
+/**
+ * CP/M console input in differential mode. Both machines have to read
+ * the same characters, also when the bisection runs them again, so
+ * there is nothing to read: the console is at end of file.
+ */
+static int difftest_console_in(void *context) {
+	(void) context;
+	return EOF;
+}
+
+/** Engine's console in differential mode */
+typedef struct {
+	cpm *machine; /** machine of the engine under test */
+	FILE *console; /** where its output goes the first time */
+	FILE *null_output; /** where it goes when instructions are run again */
+} difftest_console;
+
+/**
+ * Mutes the engine's console while the bisection runs instructions
+ * again, so their output isn't printed twice
+ */
+static void difftest_mute(void *context, int rerunning) {
+	difftest_console *console = context;
+
+	(void) fflush(console->machine->out);
+	console->machine->out = rerunning ? console->null_output : console->console;
+}
+
+/**
+ * CP/M console input hook, recording or replaying the characters read
+ */
+static int replay_console(void *context) {
+	replay *rep = context;
+
+	return replay_input(rep, 0, (rep->mode == REPLAY_RECORD) ? fgetc(stdin) : EOF);
+}
 
 /** PZ80 Machine Emulator */
 int main(int argc, char *argv[]) {
 	long runcycles = 0, filesize = 0;
-    int s_flag = 0;
-	int c;
+    int s_flag = 0, c_flag = 0, m_flag = 0, h_flag = 0;
+	long difftest_interval = 0;
+	int c, exit_status = EXIT_SUCCESS;
+	char *filename = NULL;
+	char *report_file = NULL, *folded_file = NULL, *functions_file = NULL, *symbols_file = NULL;
+	char *opstats_file = NULL;
+	char *export_name = NULL;
+	shmexport *exp = NULL;
+	char *record_file = NULL, *replay_file = NULL;
+	FILE *replay_stream = NULL;
+	replay *rep = NULL;
+	long clock_hz = 0;
+	throttle *thr = NULL;
+	hwcount *hw = NULL;
+	long executed = 0;
+	uint8_t *ram;
     
     extern char *optarg;
     extern int optind, optopt;
 
     z80 *cpu = new_cpu();
 	memory *mem = memory_new();
+	cpm *machine = NULL;
 
-	while ((c = getopt(argc, argv, "sr:f:")) != -1) {
+	while ((c = getopt_long(argc, argv, "sr:f:p:g:G:l:o:cD:mx:R:P:C:H", long_options, NULL)) != -1) {
 		switch (c) {
 			case 'r':
 				runcycles = strtol(optarg, NULL, 0);
 				break;
                 
             case 'f':
-                filesize = mem->memory_load(mem, optarg);
+                filename = optarg;
+                break;
+
+            case 'c':
+                c_flag = 1;
+                break;
+
+            case 'm':
+                m_flag = 1;
+                break;
+
+            case 'x':
+                export_name = optarg;
+                break;
+
+            case 'R':
+                record_file = optarg;
+                break;
+
+            case 'P':
+                replay_file = optarg;
+                break;
+
+            case 'C':
+                if ((clock_hz = throttle_parse(optarg)) <= 0) {
+                    printf(USAGE);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'H':
+                h_flag = 1;
+                break;
+
+            case 'D':
+                difftest_interval = strtol(optarg, NULL, 0);
                 break;
                 
             case 's':
                 s_flag = 1;
                 break;
+
+            case 'p':
+                report_file = optarg;
+                break;
+
+            case 'g':
+                folded_file = optarg;
+                break;
+
+            case 'G':
+                functions_file = optarg;
+                break;
+
+            case 'l':
+                symbols_file = optarg;
+                break;
+
+            case 'o':
+                opstats_file = optarg;
+                break;
                 
         }
     }
     
     // make sure we got the required options, display help text if not
-    if (runcycles <= 0) {
-        printf("Usage: PZ80emu -f <filename> -r <runcycles>\n");
+    if (runcycles <= 0 && !c_flag && !m_flag) {
+        printf(USAGE);
         exit(EXIT_FAILURE);
     }
-    
+
+    if (filename == NULL) {
+        printf(USAGE);
+        exit(EXIT_FAILURE);
+    }
+
+	if (c_flag) {
+		machine = cpm_new(cpu, mem->memory);
+		filesize = cpm_load(machine, filename);
+	} else {
+		filesize = mem->memory_load(mem, filename);
+	}
+
     if (filesize <= 0) {
-        printf("Usage: PZ80emu -f <filename> -r <runcycles>\n");
+        printf(USAGE);
         exit(EXIT_FAILURE);
     }
 
+	// differential mode: run the reference and the fast interpreter in lockstep
+	if (difftest_interval > 0) {
+		difftest *test = difftest_new(mem->memory, MEMSIZE, difftest_interval);
+		cpm *reference_machine = NULL, *engine_machine = NULL;
+		FILE *null_output = NULL;
+		difftest_console console;
+		int diverged;
+
+		if (runcycles <= 0) {
+			printf(USAGE);
+			exit(EXIT_FAILURE);
+		}
+
+		// both run the program, only the engine under test prints and neither reads the console
+		if (c_flag) {
+			reference_machine = cpm_new(test->reference, test->reference_memory);
+			engine_machine = cpm_new(test->engine, test->engine_memory);
+
+			reference_machine->console_in = difftest_console_in;
+			engine_machine->console_in = difftest_console_in;
+
+			if ((null_output = fopen("/dev/null", "w")) != NULL) {
+				reference_machine->out = null_output;
+
+				console.machine = engine_machine;
+				console.console = engine_machine->out;
+				console.null_output = null_output;
+				test->on_rerun = difftest_mute;
+				test->rerun_context = &console;
+			}
+		}
+
+		diverged = difftest_run(test, runcycles);
+		(void) fflush(stdout);
+		difftest_write_report(test, stderr);
+
+		if (c_flag) {
+			cpm_free(reference_machine);
+			cpm_free(engine_machine);
+			cpm_free(machine);
+			if (null_output != NULL) {
+				(void) fclose(null_output);
+			}
+		}
+		difftest_free(test);
+		free(cpu);
+		mem->memory_free(mem);
+
+		return diverged ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	// move the loaded memory into the shared segment and run on it there
+	ram = mem->memory;
+	if (export_name != NULL) {
+		if ((exp = shmexport_new(export_name)) == NULL) {
+			perror(export_name);
+			exit(EXIT_FAILURE);
+		}
+
+		memcpy(exp->memory, mem->memory, MEMSIZE);
+		ram = exp->memory;
+		if (machine != NULL) {
+			machine->memory = ram;
+		}
+		shmexport_update(exp, cpu, 0);
+	}
+
+	// attach the profiler if any of its outputs were asked for
+	if (report_file != NULL || folded_file != NULL || functions_file != NULL) {
+		cpu->prof = profile_new();
+
+		if (symbols_file != NULL && profile_load_symbols(cpu->prof, symbols_file) < 0) {
+			perror(symbols_file);
+		}
+	}
+
+	if (opstats_file != NULL) {
+		cpu->ops = opstats_new();
+	}
+
+	// log or feed back every input from outside the cpu
+	if (record_file != NULL || replay_file != NULL) {
+		if ((replay_stream = fopen((record_file != NULL) ? record_file : replay_file,
+		                           (record_file != NULL) ? "wb" : "rb")) == NULL) {
+			perror((record_file != NULL) ? record_file : replay_file);
+			exit(EXIT_FAILURE);
+		}
+
+		rep = (record_file != NULL) ? replay_record(cpu, replay_stream) : replay_play(cpu, replay_stream);
+		if (rep == NULL) {
+			fprintf(stderr, "PZ80emu: %s is not a recording\n", replay_file);
+			exit(EXIT_FAILURE);
+		}
+
+		if (machine != NULL) {
+			machine->console_in = replay_console;
+			machine->console_context = rep;
+		}
+	}
+
+	// pace the run against the wall clock
+	if (clock_hz > 0) {
+		thr = throttle_new(clock_hz, cpu);
+	}
+
+	// count the host's work for the run, profiler and all
+	if (h_flag) {
+		hw = hwcount_new();
+		hwcount_start(hw);
+	}
+
 	// execute!
-	(void) run(cpu, mem->memory, runcycles, s_flag);
+	if (c_flag) {
+		(void) setvbuf(stdout, NULL, _IOFBF, CPM_OUTPUT_BUFFER);
+
+		// run until the program exits, or for runcycles if given
+		while (!machine->done && (runcycles <= 0 || executed < runcycles)) {
+			long slice = (runcycles > 0 && runcycles - executed < CPM_SLICE) ? runcycles - executed : CPM_SLICE;
+			int count = run_slice(cpu, ram, (thr != NULL) ? throttle_budget(thr, cpu, slice) : slice, s_flag, rep);
+
+			if (count < 0) {
+				if (cpu->trap.reason != TRAP_NONE) {
+					executed += cpu->trap.instructions;
+					report_trap(cpu);
+				}
+				break;
+			}
+
+			executed += count;
+			if (exp != NULL) {
+				shmexport_update(exp, cpu, executed);
+			}
+			if (thr != NULL) {
+				throttle_pace(thr, cpu);
+			}
+		}
+
+		(void) fflush(stdout);
+	} else if (m_flag) {
+		if (run_monitor(cpu, ram, runcycles, s_flag, exp, &executed) < 0) {
+			report_trap(cpu);
+		}
+	} else if (exp != NULL || thr != NULL) {
+		// update the register mirror or wait for the clock between slices
+		while (executed < runcycles) {
+			long slice = (runcycles - executed < SHMEXPORT_SLICE) ? runcycles - executed : SHMEXPORT_SLICE;
+			int count = run_slice(cpu, ram, (thr != NULL) ? throttle_budget(thr, cpu, slice) : slice, s_flag, rep);
+
+			if (count < 0) {
+				if (cpu->trap.reason != TRAP_NONE) {
+					executed += cpu->trap.instructions;
+					report_trap(cpu);
+				}
+				break;
+			}
+
+			executed += count;
+			if (exp != NULL) {
+				shmexport_update(exp, cpu, executed);
+			}
+			if (thr != NULL) {
+				throttle_pace(thr, cpu);
+			}
+		}
+	} else if ((executed = run_slice(cpu, ram, runcycles, s_flag, rep)) < 0) {
+		executed = 0;
+		if (cpu->trap.reason != TRAP_NONE) {
+			executed = cpu->trap.instructions;
+			report_trap(cpu);
+		}
+	}
+
+	if (hw != NULL) {
+		hwcount_stop(hw);
+		hwcount_write_report(hw, (rep != NULL) ? "replay" : "run", executed, stderr);
+		hwcount_free(hw);
+	}
+
+	if (thr != NULL) {
+		throttle_write_report(thr, cpu, stderr);
+		throttle_free(thr);
+	}
+
+	if (rep != NULL) {
+		int status = replay_finish(rep, ram);
+
+		if (status != REPLAY_OK) {
+			fprintf(stderr, "PZ80emu: replay %s after %ld events\n", replay_status(status), rep->events);
+			exit_status = EXIT_FAILURE;
+		}
+		replay_free(rep);
+		(void) fclose(replay_stream);
+	}
+
+	// write profiler output
+	if (report_file != NULL) {
+		FILE *out = fopen(report_file, "w");
+		if (out == NULL) {
+			perror(report_file);
+		} else {
+			profile_write_report(cpu->prof, out, 0);
+			(void) fclose(out);
+		}
+	}
+
+	if (functions_file != NULL) {
+		FILE *out = fopen(functions_file, "w");
+		if (out == NULL) {
+			perror(functions_file);
+		} else {
+			profile_write_functions(cpu->prof, out, 0);
+			(void) fclose(out);
+		}
+	}
+
+	if (folded_file != NULL) {
+		FILE *out = fopen(folded_file, "w");
+		if (out == NULL) {
+			perror(folded_file);
+		} else {
+			profile_write_folded(cpu->prof, out);
+			(void) fclose(out);
+		}
+	}
+
+	if (opstats_file != NULL) {
+		FILE *out = fopen(opstats_file, "w");
+		if (out == NULL) {
+			perror(opstats_file);
+		} else {
+			opstats_write_csv(cpu->ops, out, 0);
+			(void) fclose(out);
+		}
+	}
 
 	// display stuff
-	display_registers(cpu);
-	display_mem(mem->memory);
+	if (machine != NULL) {
+		cpm_free(machine);
+	} else {
+		display_registers(cpu);
+		display_mem(ram);
+	}
 
 	// memory cleanup (leaks are bad, mmkay?)
+	if (cpu->prof != NULL) {
+		profile_free(cpu->prof);
+	}
+	if (cpu->ops != NULL) {
+		opstats_free(cpu->ops);
+	}
+	if (exp != NULL) {
+		shmexport_free(exp);
+	}
 	free(cpu);
 	mem->memory_free(mem);
 
-	return 0;
+	return exit_status;
 }
@@ -0,0 +1,302 @@
+/** \file pz80dis.c
+ *  \brief Disassembler for memory images and instruction traces
+ *
+ * Writes one line per instruction: address, bytes and the instruction.
+ * Lines are built by hand into a large output buffer, so the run is
+ * bound by the disk rather than by printf. With -a, an image is first
+ * run through code discovery and only what is reached from its entry
+ * points is disassembled, the rest is written as data; -c keeps the
+ * maps in a directory so an image is only analysed once.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "disasm.h"
+#include "discover.h"
+
+/** Command line usage text */
+#define USAGE "Usage: pz80dis -f <image> [-o <origin>] [-a [-c <cache dir>]]\n" \
+              "       pz80dis -t <trace>\n"
+
+/** Size of the output buffer */
+#define OUTPUT_BUFFER (1 << 20)
+
+/** Longest line written for an instruction */
+#define LINE_LENGTH (6 + 3 * DISASM_MAX_LENGTH + 1 + DISASM_TEXT + 1)
+
+/** Most data bytes written on one line */
+#define DATA_PER_LINE DISASM_MAX_LENGTH
+
+/** Trace records read at a time */
+#define TRACE_CHUNK 65536
+
+/** Hex digits, for the address and byte columns */
+static const char digits[] = "0123456789ABCDEF";
+
+/** Output buffer and how much of it is used */
+static char output[OUTPUT_BUFFER];
+static size_t output_used;
+
+/**
+ * Writes out the output buffer
+ */
+static void flush_output(void) {
+	if (fwrite(output, 1, output_used, stdout) != output_used) {
+		perror("pz80dis");
+		exit(EXIT_FAILURE);
+	}
+	output_used = 0;
+}
+
+/**
+ * Writes bytes as a db directive
+ * \return Number of bytes written.
+ */
+static int write_data(const uint8_t *bytes, int count, char *text) {
+	*text++ = 'd';
+	*text++ = 'b';
+	*text++ = ' ';
+	for (int i = 0; i < count; i++) {
+		if (i > 0) {
+			*text++ = ',';
+		}
+		*text++ = '0';
+		*text++ = 'x';
+		*text++ = digits[bytes[i] >> 4];
+		*text++ = digits[bytes[i] & 0x0F];
+	}
+	*text = '\0';
+
+	return count;
+}
+
+/**
+ * Disassembles one instruction into a line of the output buffer
+ * \param data number of bytes to write as data instead, 0 for an instruction
+ * \return Number of bytes disassembled.
+ */
+static int write_line(const uint8_t *bytes, size_t available, uint16_t address, int data) {
+	char *out;
+	int length;
+
+	if (output_used + LINE_LENGTH > OUTPUT_BUFFER) {
+		flush_output();
+	}
+	out = &output[output_used];
+
+	// the instruction goes straight into the buffer, after the columns it sizes
+	if (data > 0) {
+		length = write_data(bytes, data, &out[6 + 3 * DISASM_MAX_LENGTH + 1]);
+	} else {
+		length = disasm(bytes, available, address, &out[6 + 3 * DISASM_MAX_LENGTH + 1]);
+	}
+
+	*out++ = digits[address >> 12];
+	*out++ = digits[(address >> 8) & 0x0F];
+	*out++ = digits[(address >> 4) & 0x0F];
+	*out++ = digits[address & 0x0F];
+	*out++ = ' ';
+	*out++ = ' ';
+
+	for (int i = 0; i < DISASM_MAX_LENGTH; i++) {
+		if (i < length) {
+			*out++ = digits[bytes[i] >> 4];
+			*out++ = digits[bytes[i] & 0x0F];
+		} else {
+			*out++ = ' ';
+			*out++ = ' ';
+		}
+		*out++ = ' ';
+	}
+	*out++ = ' ';
+
+	out += strlen(out);
+	*out++ = '\n';
+
+	output_used = (size_t)(out - output);
+
+	return length;
+}
+
+/**
+ * Reads a whole file
+ * \return Contents of the file, NULL if it can't be read.
+ */
+static uint8_t *read_file(const char *filename, size_t *size) {
+	FILE *in = fopen(filename, "rb");
+	size_t capacity = OUTPUT_BUFFER;
+	uint8_t *data;
+
+	if (in == NULL) {
+		return NULL;
+	}
+
+	if ((data = malloc(capacity)) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	*size = 0;
+	for (size_t read; (read = fread(&data[*size], 1, capacity - *size, in)) > 0; ) {
+		*size += read;
+		if (*size == capacity && (data = realloc(data, capacity *= 2)) == NULL) {
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	(void) fclose(in);
+	return data;
+}
+
+/**
+ * Disassembles an image in one sweep, as if loaded at origin
+ * \return 0 on success, -1 if the image can't be read.
+ */
+static int disassemble_image(const char *filename, uint16_t origin) {
+	size_t size, offset = 0;
+	uint8_t *image = read_file(filename, &size);
+
+	if (image == NULL) {
+		return -1;
+	}
+
+	while (offset < size) {
+		offset += (size_t)write_line(&image[offset], size - offset, (uint16_t)(origin + offset), 0);
+	}
+
+	free(image);
+	return 0;
+}
+
+/**
+ * Disassembles the code discovery finds in an image loaded at origin,
+ * and writes the rest as data
+ * \param cache directory of cached maps, NULL to always analyse
+ * \return 0 on success, -1 if the image can't be read or doesn't fit
+ * in 64K at origin, with errno set.
+ */
+static int disassemble_code(const char *filename, uint16_t origin, const char *cache) {
+	size_t size;
+	uint8_t *image = read_file(filename, &size), *memory;
+	discover *map;
+
+	if (image == NULL) {
+		return -1;
+	}
+
+	if (size > 0x10000 - (size_t)origin) {
+		free(image);
+		errno = EFBIG;
+		return -1;
+	}
+
+	if ((memory = calloc(0x10000, sizeof(uint8_t))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+	memcpy(&memory[origin], image, size);
+	free(image);
+
+	map = (cache != NULL) ? discover_cached(cache, memory, origin, size) : discover_new(memory, origin, size);
+
+	for (uint32_t address = origin, end = origin + (uint32_t)size; address < end; ) {
+		int data = 0;
+
+		// data runs up to the next instruction
+		while (address + (uint32_t)data < end && data < DATA_PER_LINE && !DISCOVER_IS_SET(map->code, address + (uint32_t)data)) {
+			data++;
+		}
+
+		address += (uint32_t)write_line(&memory[address], end - address, (uint16_t)address, data);
+	}
+
+	discover_free(map);
+	free(memory);
+	return 0;
+}
+
+/**
+ * Disassembles every record of a binary instruction trace
+ * \return 0 on success, -1 if the trace can't be read.
+ */
+static int disassemble_trace(const char *filename) {
+	FILE *in = fopen(filename, "rb");
+	uint8_t *records;
+	size_t count;
+
+	if (in == NULL) {
+		return -1;
+	}
+
+	if ((records = malloc(TRACE_CHUNK * DISASM_TRACE_RECORD)) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	while ((count = fread(records, DISASM_TRACE_RECORD, TRACE_CHUNK, in)) > 0) {
+		for (size_t i = 0; i < count; i++) {
+			const uint8_t *record = &records[i * DISASM_TRACE_RECORD];
+
+			(void) write_line(&record[2], DISASM_MAX_LENGTH, (uint16_t)(record[0] | (record[1] << 8)), 0);
+		}
+	}
+
+	free(records);
+	(void) fclose(in);
+	return 0;
+}
+
+/** PZ80 disassembler */
+int main(int argc, char *argv[]) {
+	int c, result, analyse = 0;
+	char *image_file = NULL, *trace_file = NULL, *cache = NULL;
+	long origin = 0;
+
+	while ((c = getopt(argc, argv, "ac:f:o:t:")) != -1) {
+		switch (c) {
+			case 'a':
+				analyse = 1;
+				break;
+
+			case 'c':
+				cache = optarg;
+				break;
+
+			case 'f':
+				image_file = optarg;
+				break;
+
+			case 'o':
+				origin = strtol(optarg, NULL, 0);
+				break;
+
+			case 't':
+				trace_file = optarg;
+				break;
+
+			default:
+				printf(USAGE);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if ((image_file == NULL) == (trace_file == NULL) || origin < 0 || origin > 0xFFFF
+	    || (analyse && image_file == NULL) || (cache != NULL && !analyse)) {
+		printf(USAGE);
+		exit(EXIT_FAILURE);
+	}
+
+	if (analyse) {
+		result = disassemble_code(image_file, (uint16_t)origin, cache);
+	} else {
+		result = (image_file != NULL) ? disassemble_image(image_file, (uint16_t)origin) : disassemble_trace(trace_file);
+	}
+	if (result != 0) {
+		perror((image_file != NULL) ? image_file : trace_file);
+		exit(EXIT_FAILURE);
+	}
+
+	flush_output();
+	return 0;
+}
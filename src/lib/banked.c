@@ -0,0 +1,147 @@
+/** \file banked.c
+ * Keeps banked RAM in one private anonymous mapping reserved without
+ * swap, so a board with megabytes of banks costs only the pages its
+ * program wrote: untouched pages read as the kernel's shared zero page
+ * and get storage on their first write. Selecting a bank moves its page
+ * table entries into the slot with mremap(), which keeps the pages
+ * untouched ones, keeps the cpu on a flat 64K and costs nothing per
+ * access. A bank can only be in one slot at a time.
+ */
+//
+//  banked.c
+//  PZ80emu
+//
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include "banked.h"
+#include "probes.h"
+
+/**
+ * Moves the pages of a bank or slot to another place in the mapping
+ * \return 0 on success, -1 on failure, with errno set.
+ */
+static int banked_move(uint8_t *from, uint8_t *to) {
+	return (mremap(from, BANKED_BANK_SIZE, BANKED_BANK_SIZE, MREMAP_MAYMOVE | MREMAP_FIXED, to) == MAP_FAILED) ? -1 : 0;
+}
+
+/**
+ * Creates banked RAM, all zero, with banks 0 to BANKED_SLOTS - 1
+ * selected into the slots in order
+ * \param count number of banks, at least BANKED_SLOTS
+ * \return Pointer to the allocated banked RAM, NULL if there are too
+ * few banks to fill the slots or it can't be mapped, with errno set.
+ */
+banked *banked_new(size_t count) {
+	banked *b;
+
+	if (count < BANKED_SLOTS) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if ((b = calloc(1, sizeof (banked))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	b->count = count;
+	b->size = (BANKED_SLOTS + count) * BANKED_BANK_SIZE;
+
+	b->memory = mmap(NULL, b->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (b->memory == MAP_FAILED) {
+		free(b);
+		return NULL;
+	}
+	b->banks = &b->memory[BANKED_SLOTS * BANKED_BANK_SIZE];
+
+	// a write to a transparent huge page would allocate 2M of banks at once
+	(void) madvise(b->memory, b->size, MADV_NOHUGEPAGE);
+
+	for (int slot = 0; slot < BANKED_SLOTS; slot++) {
+		b->slots[slot] = -1;
+	}
+
+	for (int slot = 0; slot < BANKED_SLOTS; slot++) {
+		if (banked_move(&b->banks[slot * BANKED_BANK_SIZE], &b->memory[slot * BANKED_BANK_SIZE]) != 0) {
+			banked_free(b);
+			return NULL;
+		}
+		b->slots[slot] = slot;
+	}
+
+	return b;
+}
+
+/**
+ * Frees banked RAM and every bank in it
+ * \param b banked RAM to free
+ */
+void banked_free(banked *b) {
+	// the holes selected banks left behind are skipped
+	(void) munmap(b->memory, b->size);
+	free(b);
+}
+
+/**
+ * Selects a bank into a slot of the 64K, putting the bank that was there
+ * back where it lives
+ * \param b banked RAM
+ * \param slot slot to select into, 0 to BANKED_SLOTS - 1
+ * \param bank bank to select
+ * \return 0 on success, -1 if the slot or bank is out of range, the bank
+ * is selected into another slot or its pages can't be moved.
+ */
+int banked_select(banked *b, int slot, int bank) {
+	uint8_t *window, *home;
+
+	if (slot < 0 || slot >= BANKED_SLOTS || bank < 0 || (size_t)bank >= b->count) {
+		return -1;
+	}
+
+	if (b->slots[slot] == bank) {
+		return 0;
+	}
+
+	for (int other = 0; other < BANKED_SLOTS; other++) {
+		if (b->slots[other] == bank) {
+			return -1;
+		}
+	}
+
+	window = &b->memory[slot * BANKED_BANK_SIZE];
+	home = &b->banks[(size_t)b->slots[slot] * BANKED_BANK_SIZE];
+
+	if (banked_move(window, home) != 0) {
+		return -1;
+	}
+
+	if (banked_move(&b->banks[(size_t)bank * BANKED_BANK_SIZE], window) != 0) {
+		(void) banked_move(home, window);
+		return -1;
+	}
+	b->slots[slot] = bank;
+	PROBE2(bank_select, slot, bank);
+
+	return 0;
+}
+
+/**
+ * Finds the bytes of a bank, selected or not, to load or inspect it.
+ * The pointer is good until the next banked_select().
+ * \param b banked RAM
+ * \param bank bank to find, 0 to count - 1
+ * \return Start of the bank.
+ */
+uint8_t *banked_bank(banked *b, int bank) {
+	for (int slot = 0; slot < BANKED_SLOTS; slot++) {
+		if (b->slots[slot] == bank) {
+			return &b->memory[slot * BANKED_BANK_SIZE];
+		}
+	}
+
+	return &b->banks[(size_t)bank * BANKED_BANK_SIZE];
+}
@@ -0,0 +1,41 @@
+/** \file banked.h
+ *  \brief Banked RAM behind the 64K address space, allocated as it is written
+ */
+//
+//  banked.h
+//  PZ80emu
+//
+
+#ifndef __PZ80emu__banked__
+#define __PZ80emu__banked__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Size of a bank, and of the slots of the address space banks are selected into */
+#define BANKED_BANK_SIZE 0x4000
+
+/** Number of slots in the 64K address space */
+#define BANKED_SLOTS 4
+
+/**
+ * Banked RAM. The cpu runs on memory, a flat 64K made of the banks
+ * selected into each slot. Selecting a bank moves its pages rather than
+ * copying them, and no page is allocated until it is written: pages
+ * only ever read are the kernel's shared zero page.
+ * \brief Banks and the 64K they are selected into
+ */
+typedef struct {
+	uint8_t *memory; /** the 64K the cpu sees, run the cpu on this */
+	uint8_t *banks; /** where each bank lives while it isn't selected */
+	size_t count; /** number of banks */
+	size_t size; /** size of the mapping, the 64K and every bank */
+	int slots[BANKED_SLOTS]; /** bank selected into each slot */
+} banked;
+
+banked *banked_new(size_t count);
+void banked_free(banked *b);
+int banked_select(banked *b, int slot, int bank);
+uint8_t *banked_bank(banked *b, int bank);
+
+#endif /* defined(__PZ80emu__banked__) */
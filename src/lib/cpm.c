@@ -0,0 +1,214 @@
+/** \file cpm.c
+ * Minimal CP/M 2.2 environment: page zero, a BDOS stub that traps into
+ * the emulator through an OUT instruction, and the console functions
+ * used by instruction exercisers and benchmarks
+ */
+//
+//  cpm.c
+//  PZ80emu
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "cpm.h"
+
+/**
+ * Port write handler, trapping the BDOS stub and the warm boot code
+ * \param context CP/M machine
+ * \param port 16-bit port address, the port number in the low byte
+ * \param value byte written, unused
+ */
+static void cpm_port_out(void *context, uint16_t port, uint8_t value) {
+	cpm *machine = context;
+	(void)value;
+
+	switch (port & 0xFF) {
+	case CPM_BDOS_PORT:
+		cpm_bdos(machine);
+		break;
+
+	case CPM_BOOT_PORT:
+		machine->done = 1;
+		break;
+	}
+}
+
+/**
+ * Sets up a cpu and its memory to run a CP/M program
+ *
+ * Page zero gets warm boot code at 0x0000 and a jump to the BDOS stub at
+ * 0x0005, which also tells programs the top of the TPA. The stack starts
+ * below the BDOS with 0x0000 pushed, so a program can end with RET.
+ * \param cpu cpu to run the program on, its port handlers are replaced
+ * \param memory 64K of memory to set up
+ * \return Pointer to the allocated CP/M machine.
+ */
+cpm *cpm_new(z80 *cpu, uint8_t *memory) {
+	static const uint8_t boot[] = {
+		0xD3, CPM_BOOT_PORT, // out (CPM_BOOT_PORT),a
+		0x76                 // halt
+	};
+	static const uint8_t bdos[] = {
+		0xD3, CPM_BDOS_PORT, // out (CPM_BDOS_PORT),a
+		0xC9                 // ret
+	};
+	cpm *machine;
+
+	if ((machine = calloc(1, sizeof (cpm))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	machine->cpu = cpu;
+	machine->memory = memory;
+	machine->in = stdin;
+	machine->out = stdout;
+
+	for (size_t i = 0; i < sizeof(boot); i++) {
+		memory[i] = boot[i];
+	}
+
+	memory[0x0005] = 0xC3; // jp CPM_BDOS
+	memory[0x0006] = CPM_BDOS & 0xFF;
+	memory[0x0007] = CPM_BDOS >> 8;
+
+	for (size_t i = 0; i < sizeof(bdos); i++) {
+		memory[CPM_BDOS + i] = bdos[i];
+	}
+
+	cpu->sp.W = CPM_BDOS - 2;
+	memory[cpu->sp.W] = 0x00;
+	memory[cpu->sp.W + 1] = 0x00;
+	cpu->pc.W = CPM_TPA;
+
+	// for pooled memory, which only clears what was written
+	mark_dirty(cpu, 0x0000, 0x0008);
+	mark_dirty(cpu, CPM_BDOS - 2, 2 + sizeof(bdos));
+
+	cpu->port_in = NULL;
+	cpu->port_out = cpm_port_out;
+	cpu->port_context = machine;
+
+	return machine;
+}
+
+/**
+ * Frees a CP/M machine, leaving its cpu and memory alone
+ * \param machine machine to free
+ */
+void cpm_free(cpm *machine) {
+	machine->cpu->port_out = NULL;
+	machine->cpu->port_context = NULL;
+	free(machine);
+}
+
+/**
+ * Loads a .COM program into the TPA
+ * \param machine machine to load the program into
+ * \param filename name of the .COM file
+ * \return Number of bytes loaded, -1 if the file can't be read or doesn't fit.
+ */
+long cpm_load(cpm *machine, const char *filename) {
+	long size;
+	FILE *infile = fopen(filename, "rb");
+
+	if (infile == NULL) {
+		return -1;
+	}
+
+	size = (long)fread(&machine->memory[CPM_TPA], 1, CPM_BDOS - CPM_TPA, infile);
+	mark_dirty(machine->cpu, CPM_TPA, size);
+
+	// anything left over doesn't fit below the BDOS
+	if (ferror(infile) || fgetc(infile) != EOF) {
+		(void)fclose(infile);
+		return -1;
+	}
+
+	if (fclose(infile) != 0) {
+		return -1;
+	}
+
+	return size;
+}
+
+/**
+ * Sets a BDOS byte result, returned in both A and L
+ * \param cpu cpu to return the result to
+ * \param value result
+ */
+static void cpm_result(z80 *cpu, uint8_t value) {
+	cpu->a = value;
+	cpu->hl.B.l = value;
+	cpu->hl.B.h = 0;
+	cpu->bc.B.h = 0;
+}
+
+/**
+ * Runs the BDOS function in C, with its parameter in DE or E
+ * \param machine machine whose cpu made the call
+ */
+void cpm_bdos(cpm *machine) {
+	z80 *cpu = machine->cpu;
+
+	switch (cpu->bc.B.l) {
+	case 0:
+		// system reset, the stub's ret goes to the warm boot code instead of back
+		machine->memory[cpu->sp.W] = 0x00;
+		machine->memory[(uint16_t)(cpu->sp.W + 1)] = 0x00;
+		mark_dirty(cpu, cpu->sp.W, 2);
+		break;
+
+	case 1:
+		// console input, read blocking, the terminal does the echo
+	{
+		int c;
+
+		(void)fflush(machine->out);
+		c = (machine->console_in != NULL) ? machine->console_in(machine->console_context) : fgetc(machine->in);
+		cpm_result(cpu, (c == EOF) ? 0x1A : (uint8_t)c);
+	}
+	break;
+
+	case 2:
+		// console output
+		(void)putc(cpu->de.B.l, machine->out);
+		break;
+
+	case 6:
+		// direct console i/o, input never has a key ready
+		if (cpu->de.B.l >= 0xFE) {
+			cpm_result(cpu, 0x00);
+		} else {
+			(void)putc(cpu->de.B.l, machine->out);
+		}
+		break;
+
+	case 9:
+		// print string, terminated by '$'
+	{
+		uint16_t address = cpu->de.W;
+
+		while (machine->memory[address] != '$' && address != (uint16_t)(cpu->de.W - 1)) {
+			(void)putc(machine->memory[address++], machine->out);
+		}
+	}
+	break;
+
+	case 11:
+		// console status, no key ready
+		cpm_result(cpu, 0x00);
+		break;
+
+	case 12:
+		// version number, CP/M 2.2
+		cpm_result(cpu, 0x22);
+		break;
+
+	default:
+		fprintf(stderr, "cpm: unsupported BDOS function %d called from 0x%04X\n", cpu->bc.B.l,
+		        machine->memory[cpu->sp.W] | (machine->memory[(uint16_t)(cpu->sp.W + 1)] << 8));
+		cpm_result(cpu, 0xFF);
+		break;
+	}
+}
@@ -0,0 +1,47 @@
+/** \file cpm.h
+ *  \brief Minimal CP/M 2.2 environment for running .COM programs
+ */
+//
+//  cpm.h
+//  PZ80emu
+//
+
+#ifndef __PZ80emu__cpm__
+#define __PZ80emu__cpm__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "z80.h"
+
+/** Load address of .COM programs, the start of the transient program area */
+#define CPM_TPA 0x0100
+
+/** Address of the BDOS stub that CALL 5 jumps to, also the top of the TPA */
+#define CPM_BDOS 0xFE00
+
+/** Port the BDOS stub writes to, trapping into cpm_bdos() */
+#define CPM_BDOS_PORT 0xFF
+
+/** Port the warm boot code at 0x0000 writes to, ending the program */
+#define CPM_BOOT_PORT 0xFE
+
+/**
+ * CP/M machine around a z80 cpu
+ * \brief Page zero, BDOS console functions and program loading
+ */
+typedef struct cpm {
+	z80 *cpu; /** cpu running the program */
+	uint8_t *memory; /** 64K of memory the program runs in */
+	FILE *in; /** console input, stdin by default */
+	FILE *out; /** console output, stdout by default */
+	int done; /** set when the program reaches the warm boot code, by returning or through BDOS function 0 */
+	int (*console_in)(void *context); /** reads a console character or EOF, NULL reads in */
+	void *console_context; /** passed to console_in */
+} cpm;
+
+cpm *cpm_new(z80 *cpu, uint8_t *memory);
+void cpm_free(cpm *machine);
+long cpm_load(cpm *machine, const char *filename);
+void cpm_bdos(cpm *machine);
+
+#endif /* defined(__PZ80emu__cpm__) */
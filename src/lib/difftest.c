@@ -0,0 +1,334 @@
+/** \file difftest.c
+ * Differential testing: runs a reference engine and an engine under test
+ * on copies of the same image, compares the full cpu state and memory
+ * every interval, and bisects a disagreement down to the first
+ * instruction with a short trace leading up to it
+ */
+//
+//  difftest.c
+//  PZ80emu
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "difftest.h"
+#include "disasm.h"
+
+/** Size of the memory given to each engine */
+#define DIFFTEST_MEMORY 65536
+
+/**
+ * Default engine under test, the interpreter with all its fast paths
+ */
+static int difftest_run_engine(z80 *cpu, uint8_t *memory, long instructions) {
+	return run(cpu, memory, instructions, 0);
+}
+
+/**
+ * Allocates one engine's memory, loaded with the image
+ */
+static uint8_t *difftest_memory(const uint8_t *image, size_t length) {
+	uint8_t *memory;
+
+	if ((memory = calloc(DIFFTEST_MEMORY, sizeof(uint8_t))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	memcpy(memory, image, (length < DIFFTEST_MEMORY) ? length : DIFFTEST_MEMORY);
+
+	return memory;
+}
+
+/**
+ * Sets up a differential test of run() against run_reference()
+ *
+ * Both cpus start from reset with the image loaded at 0x0000. Engines,
+ * cpu state and port handlers can be changed before the first
+ * difftest_run(); port handlers must give the same results when called
+ * again, as checkpoints are replayed while bisecting.
+ * \param image memory image to run
+ * \param length number of bytes in the image
+ * \param interval instructions between comparisons, at least 1
+ * \return Pointer to the allocated test.
+ */
+difftest *difftest_new(const uint8_t *image, size_t length, long interval) {
+	difftest *test;
+
+	if ((test = calloc(1, sizeof (difftest))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	test->reference_run = run_reference;
+	test->engine_run = difftest_run_engine;
+	test->reference = new_cpu();
+	test->engine = new_cpu();
+	test->reference_memory = difftest_memory(image, length);
+	test->engine_memory = difftest_memory(image, length);
+	test->reference_checkpoint_memory = difftest_memory(image, 0);
+	test->engine_checkpoint_memory = difftest_memory(image, 0);
+	test->interval = (interval > 0) ? interval : 1;
+	test->address = -1;
+
+	return test;
+}
+
+/**
+ * Frees a differential test and both of its cpus
+ * \param test test to free
+ */
+void difftest_free(difftest *test) {
+	free(test->reference);
+	free(test->engine);
+	free(test->reference_memory);
+	free(test->engine_memory);
+	free(test->reference_checkpoint_memory);
+	free(test->engine_checkpoint_memory);
+	free(test);
+}
+
+/**
+ * Compares the architectural and bookkeeping state of two cpus
+ * \param a first cpu
+ * \param b second cpu
+ * \return Name of the first field that differs, NULL if they agree.
+ */
+const char *difftest_compare(const z80 *a, const z80 *b) {
+	if (a->pc.W != b->pc.W) return "pc";
+	if (a->a != b->a) return "a";
+	if (a->flags != b->flags) return "flags";
+	if (a->bc.W != b->bc.W) return "bc";
+	if (a->de.W != b->de.W) return "de";
+	if (a->hl.W != b->hl.W) return "hl";
+	if (a->ix.W != b->ix.W) return "ix";
+	if (a->iy.W != b->iy.W) return "iy";
+	if (a->sp.W != b->sp.W) return "sp";
+	if (a->ir.W != b->ir.W) return "ir";
+	if (a->_a != b->_a) return "a'";
+	if (a->_flags != b->_flags) return "flags'";
+	if (a->_bc.W != b->_bc.W) return "bc'";
+	if (a->_de.W != b->_de.W) return "de'";
+	if (a->_hl.W != b->_hl.W) return "hl'";
+	if (a->iff1 != b->iff1 || a->iff2 != b->iff2) return "iff";
+	if (a->im != b->im) return "im";
+	if (a->int_pending != b->int_pending) return "int_pending";
+	if (a->halted != b->halted) return "halted";
+	if (a->counter != b->counter) return "counter";
+	if (a->cycles != b->cycles) return "cycles";
+
+	return NULL;
+}
+
+/**
+ * Finds the first address where the two engines' memories differ
+ * \return Address, -1 if the memories agree.
+ */
+static int difftest_compare_memory(difftest *test) {
+	if (memcmp(test->reference_memory, test->engine_memory, DIFFTEST_MEMORY) == 0) {
+		return -1;
+	}
+
+	for (int address = 0; address < DIFFTEST_MEMORY; address++) {
+		if (test->reference_memory[address] != test->engine_memory[address]) {
+			return address;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Saves both engines' state as the checkpoint to replay from
+ */
+static void difftest_checkpoint(difftest *test) {
+	test->reference_checkpoint = *test->reference;
+	test->engine_checkpoint = *test->engine;
+	memcpy(test->reference_checkpoint_memory, test->reference_memory, DIFFTEST_MEMORY);
+	memcpy(test->engine_checkpoint_memory, test->engine_memory, DIFFTEST_MEMORY);
+}
+
+/**
+ * Puts both engines back to the checkpoint
+ */
+static void difftest_restore(difftest *test) {
+	*test->reference = test->reference_checkpoint;
+	*test->engine = test->engine_checkpoint;
+	memcpy(test->reference_memory, test->reference_checkpoint_memory, DIFFTEST_MEMORY);
+	memcpy(test->engine_memory, test->engine_checkpoint_memory, DIFFTEST_MEMORY);
+}
+
+/**
+ * Runs both engines for the same number of instructions and compares them
+ * \param test test to run
+ * \param instructions number of instructions, 0 to only compare
+ * \return 1 if the engines agree afterwards, 0 otherwise.
+ */
+static int difftest_step_both(difftest *test, long instructions) {
+	if (instructions > 0) {
+		int reference = test->reference_run(test->reference, test->reference_memory, instructions);
+		int engine = test->engine_run(test->engine, test->engine_memory, instructions);
+
+		if (reference != engine) {
+			test->field = "instruction count";
+			return 0;
+		}
+	}
+
+	test->field = difftest_compare(test->reference, test->engine);
+	test->address = difftest_compare_memory(test);
+
+	return test->field == NULL && test->address < 0;
+}
+
+/**
+ * Narrows a disagreement within one interval down to its first
+ * instruction, and records the states and trace around it
+ * \param test test whose engines disagree after \p disagree instructions
+ * \param disagree instructions after the checkpoint the engines disagreed at
+ */
+static void difftest_bisect(difftest *test, long disagree) {
+	long agree = 0;
+	long start;
+
+	// everything from here on repeats instructions, and any output they make
+	if (test->on_rerun != NULL) {
+		test->on_rerun(test->rerun_context, 1);
+	}
+
+	// the engines agree after agree instructions and not after disagree
+	while (disagree - agree > 1) {
+		long middle = agree + (disagree - agree) / 2;
+
+		difftest_restore(test);
+		if (difftest_step_both(test, middle)) {
+			agree = middle;
+		} else {
+			disagree = middle;
+		}
+	}
+
+	// trace the reference up to the instruction before the divergence
+	difftest_restore(test);
+	start = (disagree > DIFFTEST_TRACE) ? disagree - DIFFTEST_TRACE : 0;
+	if (start > 0) {
+		(void)test->reference_run(test->reference, test->reference_memory, start);
+	}
+
+	test->trace_length = 0;
+	for (long i = start; i < disagree; i++) {
+		difftest_step *step = &test->trace[test->trace_length++];
+
+		step->index = test->instructions + i;
+		step->pc = test->reference->pc.W;
+		for (int j = 0; j < DIFFTEST_INSTRUCTION_BYTES; j++) {
+			step->bytes[j] = test->reference_memory[(uint16_t)(step->pc + j)];
+		}
+
+		if (i == disagree - 1) {
+			test->before = *test->reference;
+		}
+		(void)test->reference_run(test->reference, test->reference_memory, 1);
+	}
+
+	// and run the engine to the same point for the comparison
+	(void)test->engine_run(test->engine, test->engine_memory, disagree);
+	(void)difftest_step_both(test, 0);
+
+	test->reference_after = *test->reference;
+	test->engine_after = *test->engine;
+	if (test->address >= 0) {
+		test->reference_byte = test->reference_memory[test->address];
+		test->engine_byte = test->engine_memory[test->address];
+	}
+
+	test->diverged = 1;
+	test->divergence = test->instructions + disagree - 1;
+
+	if (test->on_rerun != NULL) {
+		test->on_rerun(test->rerun_context, 0);
+	}
+}
+
+/**
+ * Runs both engines in lockstep, comparing them every interval
+ * \param test test to run
+ * \param instructions number of instructions to run
+ * \return 0 if the engines agreed throughout, 1 if they diverged.
+ */
+int difftest_run(difftest *test, long instructions) {
+	if (!test->diverged && !difftest_step_both(test, 0)) {
+		// they disagree before running anything
+		test->diverged = 1;
+		test->divergence = test->instructions;
+		test->before = *test->reference;
+		test->reference_after = *test->reference;
+		test->engine_after = *test->engine;
+		return 1;
+	}
+
+	while (!test->diverged && instructions > 0) {
+		long slice = (instructions < test->interval) ? instructions : test->interval;
+
+		difftest_checkpoint(test);
+
+		if (!difftest_step_both(test, slice)) {
+			difftest_bisect(test, slice);
+			return 1;
+		}
+
+		test->instructions += slice;
+		instructions -= slice;
+	}
+
+	return test->diverged;
+}
+
+/**
+ * Writes one cpu's registers on a line
+ */
+static void difftest_write_state(FILE *out, const char *name, const z80 *cpu) {
+	fprintf(out, "%-9s pc=%04X a=%02X f=%02X bc=%04X de=%04X hl=%04X ix=%04X iy=%04X sp=%04X"
+	        " iff=%d%d im=%d halt=%d counter=%d cycles=%llu\n", name, cpu->pc.W, cpu->a, cpu->flags,
+	        cpu->bc.W, cpu->de.W, cpu->hl.W, cpu->ix.W, cpu->iy.W, cpu->sp.W, cpu->iff1, cpu->iff2,
+	        cpu->im, cpu->halted, cpu->counter, (unsigned long long)cpu->cycles);
+}
+
+/**
+ * Writes the outcome of a differential test: agreement, or the first
+ * diverging instruction with the trace and states around it
+ * \param test test to report on
+ * \param out stream to write to
+ */
+void difftest_write_report(difftest *test, FILE *out) {
+	if (!test->diverged) {
+		fprintf(out, "engines agree after %ld instructions\n", test->instructions);
+		return;
+	}
+
+	fprintf(out, "engines diverge at instruction %ld:", test->divergence);
+	if (test->field != NULL) {
+		fprintf(out, " %s differs", test->field);
+	}
+	if (test->address >= 0) {
+		fprintf(out, "%s memory at 0x%04X is 0x%02X, engine wrote 0x%02X", (test->field != NULL) ? "," : "",
+		        test->address, test->reference_byte, test->engine_byte);
+	}
+	fprintf(out, "\n");
+
+	fprintf(out, "trace:\n");
+	for (int i = 0; i < test->trace_length; i++) {
+		char text[DISASM_TEXT];
+
+		fprintf(out, "%s %8ld  %04X ", (i == test->trace_length - 1) ? ">" : " ", test->trace[i].index, test->trace[i].pc);
+		for (int j = 0; j < DIFFTEST_INSTRUCTION_BYTES; j++) {
+			fprintf(out, " %02X", test->trace[i].bytes[j]);
+		}
+		(void) disasm(test->trace[i].bytes, DIFFTEST_INSTRUCTION_BYTES, test->trace[i].pc, text);
+		fprintf(out, "  %s\n", text);
+	}
+
+	difftest_write_state(out, "before", &test->before);
+	difftest_write_state(out, "reference", &test->reference_after);
+	difftest_write_state(out, "engine", &test->engine_after);
+}
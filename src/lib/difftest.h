@@ -0,0 +1,79 @@
+/** \file difftest.h
+ *  \brief Differential testing of two CPU engines run in lockstep
+ */
+//
+//  difftest.h
+//  PZ80emu
+//
+
+#ifndef __PZ80emu__difftest__
+#define __PZ80emu__difftest__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "z80.h"
+
+/** Number of instructions leading up to a divergence kept in the trace */
+#define DIFFTEST_TRACE 16
+
+/** Maximum length of an instruction in the trace */
+#define DIFFTEST_INSTRUCTION_BYTES 4
+
+/**
+ * Runs a cpu for a number of instructions
+ * \param cpu cpu to run
+ * \param memory memory of the cpu
+ * \param instructions number of instructions to run, at least 1
+ * \return Number of instructions run, -1 on an unknown opcode.
+ */
+typedef int (*difftest_engine)(z80 *cpu, uint8_t *memory, long instructions);
+
+/** Instruction leading up to a divergence, as run by the reference */
+typedef struct {
+	long index; /** number of instructions run before this one */
+	uint16_t pc; /** address of the instruction */
+	uint8_t bytes[DIFFTEST_INSTRUCTION_BYTES]; /** bytes at the address */
+} difftest_step;
+
+/**
+ * Lockstep comparison of a reference and an optimized engine
+ * \brief Two cpus on copies of the same image, checked every interval
+ */
+typedef struct difftest {
+	difftest_engine reference_run; /** reference engine, run_reference() by default */
+	difftest_engine engine_run; /** engine under test, run() by default */
+	z80 *reference; /** cpu run by the reference engine */
+	z80 *engine; /** cpu run by the engine under test */
+	uint8_t *reference_memory; /** memory of the reference cpu */
+	uint8_t *engine_memory; /** memory of the cpu under test */
+	long interval; /** instructions between state comparisons */
+	long instructions; /** instructions both engines ran in agreement */
+
+	z80 reference_checkpoint; /** reference cpu at the last agreeing comparison */
+	z80 engine_checkpoint; /** cpu under test at the last agreeing comparison */
+	uint8_t *reference_checkpoint_memory; /** reference memory at the checkpoint */
+	uint8_t *engine_checkpoint_memory; /** memory under test at the checkpoint */
+
+	int diverged; /** set once the engines disagreed */
+	long divergence; /** index of the first instruction they disagreed after */
+	const char *field; /** first register or other state that differed */
+	int address; /** first memory address that differed, -1 if none */
+	z80 before; /** reference state before the diverging instruction */
+	z80 reference_after; /** reference state after it */
+	z80 engine_after; /** engine state after it */
+	uint8_t reference_byte; /** reference memory at address */
+	uint8_t engine_byte; /** engine memory at address */
+	difftest_step trace[DIFFTEST_TRACE]; /** instructions up to and including the diverging one */
+	int trace_length; /** number of entries in the trace */
+
+	void (*on_rerun)(void *context, int rerunning); /** called with 1 before instructions already run are run again from the checkpoint, and with 0 after, or NULL */
+	void *rerun_context; /** passed to on_rerun */
+} difftest;
+
+difftest *difftest_new(const uint8_t *image, size_t length, long interval);
+void difftest_free(difftest *test);
+const char *difftest_compare(const z80 *a, const z80 *b);
+int difftest_run(difftest *test, long instructions);
+void difftest_write_report(difftest *test, FILE *out);
+
+#endif /* defined(__PZ80emu__difftest__) */
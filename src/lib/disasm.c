@@ -0,0 +1,155 @@
+/** \file disasm.c
+ * Disassembles Z80 code from the opcode descriptions in opcodes.h: the
+ * prefix bytes pick a table, the opcode indexes it, and the mnemonic is
+ * copied out with its operand placeholders filled in from the bytes
+ * that follow. Nothing goes through printf, so whole images and long
+ * traces decode at memory speed.
+ */
+//
+//  disasm.c
+//  PZ80emu
+//
+
+#include <stddef.h>
+#include <stdint.h>
+#include "opcodes.h"
+#include "disasm.h"
+
+/** Hex digits, for writing operands */
+static const char disasm_digits[] = "0123456789ABCDEF";
+
+/**
+ * Writes a value as 0x and the given number of hex digits
+ * \return Where the text ends.
+ */
+static char *disasm_hex(char *out, unsigned value, int digits) {
+	*out++ = '0';
+	*out++ = 'x';
+	for (int shift = (digits - 1) * 4; shift >= 0; shift -= 4) {
+		*out++ = disasm_digits[(value >> shift) & 0x0F];
+	}
+
+	return out;
+}
+
+/**
+ * Finds the description of the instruction at the start of some bytes
+ * \param bytes instruction bytes
+ * \param available number of bytes readable at bytes, at least 1
+ * \param length where to store the number of bytes the instruction, or
+ * the undocumented bytes standing for none, take
+ * \return Description of the instruction, NULL for an undocumented
+ * opcode or one cut off by the end of the bytes.
+ */
+const opcode *disasm_decode(const uint8_t *bytes, size_t available, int *length) {
+	const opcode *op;
+
+	switch (bytes[0]) {
+	case 0xCB:
+		op = (available >= 2) ? &opcodes_cb[bytes[1]] : NULL;
+		break;
+
+	case 0xED:
+		op = (available >= 2) ? &opcodes_ed[bytes[1]] : NULL;
+
+		// undocumented ED opcodes run as two byte nops
+		if (op != NULL && op->mnemonic == NULL) {
+			*length = 2;
+			return NULL;
+		}
+		break;
+
+	case 0xDD:
+	case 0xFD:
+		if (available >= 2 && bytes[1] == 0xCB) {
+			op = (available >= 4) ? &((bytes[0] == 0xDD) ? opcodes_ddcb : opcodes_fdcb)[bytes[3]] : NULL;
+		} else {
+			op = (available >= 2) ? &((bytes[0] == 0xDD) ? opcodes_dd : opcodes_fd)[bytes[1]] : NULL;
+		}
+		break;
+
+	default:
+		op = &opcodes_base[bytes[0]];
+		break;
+	}
+
+	// the rest come out a byte at a time, an undocumented index prefix
+	// only holds up the instruction after it
+	if (op == NULL || op->mnemonic == NULL || op->length > available) {
+		*length = 1;
+		return NULL;
+	}
+
+	*length = op->length;
+	return op;
+}
+
+/**
+ * Disassembles one instruction
+ * \param bytes instruction bytes
+ * \param available number of bytes readable at bytes, at least 1
+ * \param address address of the instruction, for relative jump targets
+ * \param text where to write the instruction, DISASM_TEXT bytes
+ * \return Number of bytes disassembled. Undocumented bytes come out as db.
+ */
+int disasm(const uint8_t *bytes, size_t available, uint16_t address, char *text) {
+	int length;
+	const opcode *op = disasm_decode(bytes, available, &length);
+	const char *mnemonic;
+	const uint8_t *operand;
+	char *out = text;
+
+	if (op == NULL) {
+		*out++ = 'd';
+		*out++ = 'b';
+		*out++ = ' ';
+		for (int i = 0; i < length; i++) {
+			if (i > 0) {
+				*out++ = ',';
+			}
+			out = disasm_hex(out, bytes[i], 2);
+		}
+		*out = '\0';
+
+		return length;
+	}
+
+	// operands follow the opcode, except the offset of a DD CB or FD CB, which comes before it
+	operand = &bytes[(bytes[0] == 0xCB || bytes[0] == 0xED || bytes[0] == 0xDD || bytes[0] == 0xFD) ? 2 : 1];
+
+	for (mnemonic = op->mnemonic; *mnemonic != '\0'; mnemonic++) {
+		switch (*mnemonic) {
+		case 'N':
+			if (mnemonic[1] == 'N') {
+				out = disasm_hex(out, operand[0] | (operand[1] << 8), 4);
+				operand += 2;
+				mnemonic++;
+			} else {
+				out = disasm_hex(out, *operand++, 2);
+			}
+			break;
+
+		case 'E':
+			out = disasm_hex(out, (uint16_t)(address + length + (int8_t)*operand++), 4);
+			break;
+
+		case 'D':
+			// the + before D in the mnemonic is already written
+			if ((int8_t)*operand < 0) {
+				out[-1] = '-';
+				out = disasm_hex(out, (unsigned)-(int8_t)*operand, 2);
+			} else {
+				out = disasm_hex(out, *operand, 2);
+			}
+			operand++;
+			break;
+
+		default:
+			*out++ = *mnemonic;
+			break;
+		}
+	}
+	*out = '\0';
+
+	return length;
+}
@@ -0,0 +1,31 @@
+/** \file disasm.h
+ *  \brief Table-driven Z80 disassembler
+ */
+//
+//  disasm.h
+//  PZ80emu
+//
+
+#ifndef __PZ80emu__disasm__
+#define __PZ80emu__disasm__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "opcodes.h"
+
+/** Longest instruction in bytes, prefixes included */
+#define DISASM_MAX_LENGTH 4
+
+/** Room for the text of any instruction, with the terminating NUL */
+#define DISASM_TEXT 24
+
+/**
+ * Size of a record in a binary instruction trace: the instruction's
+ * address, little endian, then DISASM_MAX_LENGTH bytes from it
+ */
+#define DISASM_TRACE_RECORD (2 + DISASM_MAX_LENGTH)
+
+const opcode *disasm_decode(const uint8_t *bytes, size_t available, int *length);
+int disasm(const uint8_t *bytes, size_t available, uint16_t address, char *text);
+
+#endif /* defined(__PZ80emu__disasm__) */
@@ -0,0 +1,319 @@
+/** \file discover.c
+ * Finds the code in a memory image ahead of running it. Starting from
+ * the entry points, instructions are decoded with the disassembler's
+ * tables and control flow is followed: jumps to their targets, branches
+ * and calls to their targets and past them. Returns and jumps through
+ * registers end a path. What is reached is code, the rest is data or
+ * code only reached through computed jumps.
+ *
+ * The map is cached in a file named after a hash of the image and its
+ * load address, so later runs of the same image read it back instead.
+ */
+//
+//  discover.c
+//  PZ80emu
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "opcodes.h"
+#include "disasm.h"
+#include "discover.h"
+
+/** Size of the header of a cache file */
+#define DISCOVER_HEADER 24
+
+/** Sets \p address in a discovery bitmap */
+#define DISCOVER_SET(bitmap, address) ((bitmap)[(address) >> 3] |= (uint8_t)(1 << ((address) & 0x07)))
+
+/**
+ * Hashes an image and the address it is loaded at, the key of its cache file
+ * \param memory 64K of memory holding the image
+ * \param origin address the image is loaded at
+ * \param size bytes in the image
+ * \return FNV-1a hash of the load address and the image.
+ */
+uint64_t discover_hash(const uint8_t *memory, uint16_t origin, size_t size) {
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	hash = (hash ^ (origin & 0xFF)) * 0x100000001B3ULL;
+	hash = (hash ^ (origin >> 8)) * 0x100000001B3ULL;
+
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ memory[origin + i]) * 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+/**
+ * Counts the addresses set in a discovery bitmap
+ */
+static long discover_count(const uint8_t *bitmap) {
+	long count = 0;
+
+	for (int i = 0; i < 8192; i++) {
+		count += __builtin_popcount(bitmap[i]);
+	}
+
+	return count;
+}
+
+/**
+ * Finds where a jump, branch or call goes
+ * \param op description of the instruction
+ * \param bytes instruction bytes
+ * \param address address of the instruction
+ * \param target where to store the target
+ * \return 1 if the target is in the instruction, 0 for returns and
+ * jumps through registers.
+ */
+static int discover_target(const opcode *op, const uint8_t *bytes, uint16_t address, uint16_t *target) {
+	size_t length = strlen(op->mnemonic);
+
+	if (strncmp(op->mnemonic, "rst", 3) == 0) {
+		*target = bytes[0] & 0x38;
+	} else if (length >= 2 && strcmp(&op->mnemonic[length - 2], "NN") == 0) {
+		*target = (uint16_t)(bytes[1] | (bytes[2] << 8));
+	} else if (op->mnemonic[length - 1] == 'E') {
+		*target = (uint16_t)(address + op->length + (int8_t)bytes[1]);
+	} else {
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Follows the control flow from an entry point, adding what it reaches
+ * in the image to the map
+ * \param map map to add to
+ * \param memory 64K of memory holding the image
+ * \param address entry point
+ */
+void discover_entry(discover *map, const uint8_t *memory, uint16_t address) {
+	uint32_t end = (uint32_t)map->origin + map->size;
+	uint16_t *pending;
+	size_t count = 0;
+
+	// each instruction is decoded once and adds at most two paths
+	if ((pending = malloc((2 * 0x10000 + 1) * sizeof(uint16_t))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+	pending[count++] = address;
+
+	while (count > 0) {
+		uint32_t pc = pending[--count];
+
+		if (pc < map->origin || pc >= end) {
+			continue;
+		}
+
+		if (DISCOVER_IS_SET(map->code, pc)) {
+			// a jump into a known block splits it
+			DISCOVER_SET(map->blocks, pc);
+			continue;
+		}
+
+		for (int first = 1; pc < end && !DISCOVER_IS_SET(map->code, pc); first = 0) {
+			int length;
+			uint16_t target;
+			const opcode *op = disasm_decode(&memory[pc], end - pc, &length);
+
+			if (op == NULL) {
+				break; // undocumented or cut off, most likely data
+			}
+
+			if (first) {
+				DISCOVER_SET(map->blocks, pc);
+			}
+			DISCOVER_SET(map->code, pc);
+			map->instructions++;
+
+			if (op->kind != OPCODE_JUMP && op->kind != OPCODE_BRANCH) {
+				pc += (uint32_t)length;
+				continue;
+			}
+
+			if (discover_target(op, &memory[pc], (uint16_t)pc, &target)) {
+				pending[count++] = target;
+			}
+
+			// conditional branches fall through, and calls return
+			if (op->kind == OPCODE_BRANCH || strncmp(op->mnemonic, "call", 4) == 0 || strncmp(op->mnemonic, "rst", 3) == 0) {
+				pending[count++] = (uint16_t)(pc + (uint32_t)length);
+			}
+			break;
+		}
+	}
+
+	map->block_count = discover_count(map->blocks);
+	free(pending);
+}
+
+/**
+ * Finds the code of an image from its entry points: the load address,
+ * and the reset, RST and NMI vectors that fall inside the image
+ * \param memory 64K of memory holding the image
+ * \param origin address the image is loaded at
+ * \param size bytes in the image, at most 0x10000 - origin
+ * \return Pointer to the allocated map.
+ */
+discover *discover_new(const uint8_t *memory, uint16_t origin, size_t size) {
+	discover *map;
+
+	if ((map = calloc(1, sizeof (discover))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	map->hash = discover_hash(memory, origin, size);
+	map->origin = origin;
+	map->size = (uint32_t)size;
+
+	discover_entry(map, memory, origin);
+	for (uint16_t vector = 0x0000; vector <= 0x0038; vector += 0x08) {
+		discover_entry(map, memory, vector);
+	}
+	discover_entry(map, memory, 0x0066);
+
+	return map;
+}
+
+/**
+ * Frees a map
+ * \param map map to free
+ */
+void discover_free(discover *map) {
+	free(map);
+}
+
+/**
+ * Writes a map to a cache file. The file is written under a temporary
+ * name and renamed into place, so runs starting together never read
+ * half a file.
+ * \param map map to write
+ * \param filename cache file
+ * \return 0 on success, -1 if the file can't be written.
+ */
+int discover_save(const discover *map, const char *filename) {
+	uint8_t header[DISCOVER_HEADER] = { 0 };
+	char *temporary;
+	FILE *out;
+	int result = 0;
+
+	memcpy(header, DISCOVER_MAGIC, 8);
+	for (int i = 0; i < 8; i++) {
+		header[8 + i] = (uint8_t)(map->hash >> (8 * i));
+	}
+	header[16] = (uint8_t)map->origin;
+	header[17] = (uint8_t)(map->origin >> 8);
+	for (int i = 0; i < 4; i++) {
+		header[20 + i] = (uint8_t)(map->size >> (8 * i));
+	}
+
+	if ((temporary = malloc(strlen(filename) + 32)) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+	(void) sprintf(temporary, "%s.%ld.tmp", filename, (long)getpid());
+
+	if ((out = fopen(temporary, "wb")) == NULL) {
+		free(temporary);
+		return -1;
+	}
+
+	if (fwrite(header, 1, sizeof(header), out) != sizeof(header)
+	    || fwrite(map->code, 1, sizeof(map->code), out) != sizeof(map->code)
+	    || fwrite(map->blocks, 1, sizeof(map->blocks), out) != sizeof(map->blocks)) {
+		result = -1;
+	}
+
+	if (fclose(out) != 0 || result != 0 || rename(temporary, filename) != 0) {
+		(void) unlink(temporary);
+		result = -1;
+	}
+
+	free(temporary);
+	return result;
+}
+
+/**
+ * Reads a map back from a cache file
+ * \param filename cache file
+ * \param hash hash of the image the map has to be for
+ * \return Pointer to the allocated map, NULL if the file can't be read,
+ * is corrupt or is for another image.
+ */
+discover *discover_load(const char *filename, uint64_t hash) {
+	uint8_t header[DISCOVER_HEADER];
+	uint64_t stored = 0;
+	discover *map;
+	FILE *in;
+
+	if ((in = fopen(filename, "rb")) == NULL) {
+		return NULL;
+	}
+
+	if ((map = calloc(1, sizeof (discover))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	if (fread(header, 1, sizeof(header), in) != sizeof(header)
+	    || fread(map->code, 1, sizeof(map->code), in) != sizeof(map->code)
+	    || fread(map->blocks, 1, sizeof(map->blocks), in) != sizeof(map->blocks)
+	    || fgetc(in) != EOF) {
+		(void) fclose(in);
+		free(map);
+		return NULL;
+	}
+	(void) fclose(in);
+
+	for (int i = 0; i < 8; i++) {
+		stored |= (uint64_t)header[8 + i] << (8 * i);
+	}
+
+	if (memcmp(header, DISCOVER_MAGIC, 8) != 0 || stored != hash) {
+		free(map);
+		return NULL;
+	}
+
+	map->hash = stored;
+	map->origin = (uint16_t)(header[16] | (header[17] << 8));
+	map->size = (uint32_t)header[20] | ((uint32_t)header[21] << 8) | ((uint32_t)header[22] << 16) | ((uint32_t)header[23] << 24);
+	map->instructions = discover_count(map->code);
+	map->block_count = discover_count(map->blocks);
+	map->cached = 1;
+
+	return map;
+}
+
+/**
+ * Reads the map of an image from the cache, or builds it and stores it
+ * in the cache for the next run
+ * \param dir cache directory
+ * \param memory 64K of memory holding the image
+ * \param origin address the image is loaded at
+ * \param size bytes in the image, at most 0x10000 - origin
+ * \return Pointer to the allocated map. A cache that can't be written
+ * only costs the next run the analysis.
+ */
+discover *discover_cached(const char *dir, const uint8_t *memory, uint16_t origin, size_t size) {
+	uint64_t hash = discover_hash(memory, origin, size);
+	char *filename;
+	discover *map;
+
+	if ((filename = malloc(strlen(dir) + 32)) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+	(void) sprintf(filename, "%s/%016llx" DISCOVER_EXTENSION, dir, (unsigned long long)hash);
+
+	if ((map = discover_load(filename, hash)) == NULL) {
+		map = discover_new(memory, origin, size);
+		(void) discover_save(map, filename);
+	}
+
+	free(filename);
+	return map;
+}
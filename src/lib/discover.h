@@ -0,0 +1,48 @@
+/** \file discover.h
+ *  \brief Static code discovery over a memory image, cached on disk
+ */
+//
+//  discover.h
+//  PZ80emu
+//
+
+#ifndef __PZ80emu__discover__
+#define __PZ80emu__discover__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Magic at the start of a cache file, with the format version */
+#define DISCOVER_MAGIC "PZ80MAP1"
+
+/** Extension of cache files, named after the hash of the image */
+#define DISCOVER_EXTENSION ".pz80map"
+
+/** Whether \p address is set in a discovery bitmap */
+#define DISCOVER_IS_SET(bitmap, address) ((bitmap)[(address) >> 3] & (1 << ((address) & 0x07)))
+
+/**
+ * Code found by following the control flow of an image from its entry
+ * points: the reset and RST vectors, the NMI vector and the load address
+ * \brief Code and basic block map of an image
+ */
+typedef struct {
+	uint64_t hash; /** hash of the image, which keys the cache */
+	uint16_t origin; /** address the image is loaded at */
+	uint32_t size; /** bytes in the image */
+	uint8_t code[8192]; /** bitmap of addresses an instruction starts at */
+	uint8_t blocks[8192]; /** bitmap of addresses a basic block starts at */
+	long instructions; /** instructions found */
+	long block_count; /** basic blocks found */
+	int cached; /** 1 if the map was read from the cache rather than built */
+} discover;
+
+uint64_t discover_hash(const uint8_t *memory, uint16_t origin, size_t size);
+discover *discover_new(const uint8_t *memory, uint16_t origin, size_t size);
+void discover_free(discover *map);
+void discover_entry(discover *map, const uint8_t *memory, uint16_t address);
+int discover_save(const discover *map, const char *filename);
+discover *discover_load(const char *filename, uint64_t hash);
+discover *discover_cached(const char *dir, const uint8_t *memory, uint16_t origin, size_t size);
+
+#endif /* defined(__PZ80emu__discover__) */
@@ -14,8 +14,28 @@
 #include <ncurses.h>
 #include "z80.h"
 #include "display.h"
+#include "disasm.h"
 #include "utils.h"
 
+/** Display the instruction at the program counter, disassembled
+   \param cpu The z80 cpu whose next instruction to display.
+   \param memory The 64K of memory the cpu runs in.
+*/
+void display_instruction(z80 *cpu, uint8_t *memory) {
+    char text[DISASM_TEXT];
+    int length = disasm(&memory[cpu->pc.W], 0x10000 - cpu->pc.W, cpu->pc.W, text);
+
+    printf("Next Instruction:\n0x%04X: ", cpu->pc.W);
+    for (int i = 0; i < DISASM_MAX_LENGTH; i++) {
+        if (i < length) {
+            printf("%02hhX ", memory[cpu->pc.W + i]);
+        } else {
+            printf("   ");
+        }
+    }
+    printf(" %s\n\n", text);
+}
+
 /** Display the contents of a block of memory to a curses window
    \param win The curses window in which to display memory.
    \param memory A pointer to the block of memory to display
@@ -36,10 +56,10 @@ void curses_display_mem(WINDOW *win, uint8_t *memory) {
 			//(void) wmove(win, i+3, 2);
 			display_counter = 0;
 			rollover_counter++;
-			(void) wrefresh(win);
 		}
 		if(display_counter % 4 == 0) (void) wprintw(win, " ");
 	}
+	(void) wrefresh(win);
 }
 
 /** Display the current register state to a curses window
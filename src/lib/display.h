@@ -20,5 +20,6 @@ WINDOW *create_newwin(int height, int width, int starty, int startx);
 void create_newscreen(int main_row, int main_col);
 void display_mem(uint8_t *memory);
 void display_registers(z80 *cpu);
+void display_instruction(z80 *cpu, uint8_t *memory);
 
 #endif /* defined(__PZ80emu__display__) */
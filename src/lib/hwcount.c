@@ -0,0 +1,217 @@
+/** \file hwcount.c
+ * Reads the host's hardware performance counters with perf_event_open(),
+ * to tell whether run() is bound by branch misprediction or by memory.
+ * Counters only see the calling thread in user space, so a kernel that
+ * allows no more than perf_event_paranoid 2 still counts. Hosts without
+ * the counters, such as most virtual machines, or systems other than
+ * Linux, report the events as not available.
+ */
+//
+//  hwcount.c
+//  PZ80emu
+//
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "hwcount.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+/** Type and configuration of each event, in the order of the enum */
+static const struct {
+	uint32_t type;
+	uint64_t config;
+} hwcount_events[HWCOUNT_EVENTS] = {
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) }
+};
+
+/**
+ * Opens a counter of the calling thread, stopped
+ * \return File descriptor of the counter, -1 if it can't be opened.
+ */
+static int hwcount_open(int event) {
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = hwcount_events[event].type;
+	attr.config = hwcount_events[event].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+/** Name of each event, in the order of the enum */
+static const char *hwcount_names[HWCOUNT_EVENTS] = {
+	"task-clock-ns",
+	"cycles",
+	"instructions",
+	"branch-misses",
+	"L1D-misses",
+	"LLC-misses"
+};
+
+/**
+ * Opens the host counters, all zero and stopped
+ * \return Pointer to the allocated counters; events the host can't
+ * count are left out.
+ */
+hwcount *hwcount_new(void) {
+	hwcount *hw;
+
+	if ((hw = calloc(1, sizeof (hwcount))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	for (int event = 0; event < HWCOUNT_EVENTS; event++) {
+#ifdef __linux__
+		hw->fd[event] = hwcount_open(event);
+#else
+		hw->fd[event] = -1;
+#endif
+		if (hw->fd[event] >= 0) {
+			hw->available++;
+		}
+	}
+
+	return hw;
+}
+
+/**
+ * Closes the host counters
+ * \param hw counters to close
+ */
+void hwcount_free(hwcount *hw) {
+	for (int event = 0; event < HWCOUNT_EVENTS; event++) {
+		if (hw->fd[event] >= 0) {
+			(void) close(hw->fd[event]);
+		}
+	}
+	free(hw);
+}
+
+/**
+ * Starts counting from zero, call right before the code to count
+ * \param hw counters to start
+ */
+void hwcount_start(hwcount *hw) {
+#ifdef __linux__
+	for (int event = 0; event < HWCOUNT_EVENTS; event++) {
+		if (hw->fd[event] >= 0) {
+			(void) ioctl(hw->fd[event], PERF_EVENT_IOC_RESET, 0);
+			(void) ioctl(hw->fd[event], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+#else
+	(void) hw;
+#endif
+}
+
+/**
+ * Stops counting and adds the counts since hwcount_start() to the totals
+ * \param hw counters to stop
+ */
+void hwcount_stop(hwcount *hw) {
+#ifdef __linux__
+	// stopped in reverse, so the cheap software clock runs around the others
+	for (int event = HWCOUNT_EVENTS - 1; event >= 0; event--) {
+		if (hw->fd[event] >= 0) {
+			(void) ioctl(hw->fd[event], PERF_EVENT_IOC_DISABLE, 0);
+		}
+	}
+
+	for (int event = 0; event < HWCOUNT_EVENTS; event++) {
+		uint64_t data[3], enabled, running; // value, time enabled, time running
+
+		if (hw->fd[event] < 0 || read(hw->fd[event], data, sizeof(data)) != sizeof(data)) {
+			continue;
+		}
+
+		// a reset clears the value but not the times, so this stretch's times are the difference
+		enabled = data[1] - hw->enabled[event];
+		running = data[2] - hw->running[event];
+		hw->enabled[event] = data[1];
+		hw->running[event] = data[2];
+
+		if (running == 0) {
+			continue;
+		}
+
+		// the kernel shares the counter registers when there are too few, so estimate the whole
+		hw->value[event] += (running < enabled) ? (uint64_t)((double)data[0] * enabled / running) : data[0];
+	}
+#else
+	(void) hw;
+#endif
+}
+
+/**
+ * Names an event, as used in reports and CSV headers
+ * \param event event, HWCOUNT_TASK_CLOCK to HWCOUNT_EVENTS - 1
+ * \return Name of the event.
+ */
+const char *hwcount_name(int event) {
+	return hwcount_names[event];
+}
+
+/**
+ * Divides a total by the emulated instructions run while counting
+ * \param hw counters
+ * \param event event to divide
+ * \param instructions emulated instructions
+ * \param value set to the count per emulated instruction
+ * \return 1 if the event was counted, 0 if the host doesn't have it.
+ */
+int hwcount_per_instruction(const hwcount *hw, int event, long instructions, double *value) {
+	if (hw->fd[event] < 0 || instructions <= 0) {
+		return 0;
+	}
+
+	*value = (double)hw->value[event] / (double)instructions;
+	return 1;
+}
+
+/**
+ * Writes the counts per emulated instruction, with the host's
+ * instructions per cycle
+ * \param hw counters
+ * \param engine name of the engine that ran
+ * \param instructions emulated instructions run while counting
+ * \param out stream to write to
+ */
+void hwcount_write_report(const hwcount *hw, const char *engine, long instructions, FILE *out) {
+	fprintf(out, "host counters for %ld instructions on %s, per instruction:", instructions, engine);
+
+	for (int event = 0; event < HWCOUNT_EVENTS; event++) {
+		double value;
+
+		if (hwcount_per_instruction(hw, event, instructions, &value)) {
+			fprintf(out, " %s %.3f", hwcount_names[event], value);
+		} else {
+			fprintf(out, " %s n/a", hwcount_names[event]);
+		}
+	}
+
+	if (hw->fd[HWCOUNT_CYCLES] >= 0 && hw->fd[HWCOUNT_INSTRUCTIONS] >= 0 && hw->value[HWCOUNT_CYCLES] > 0) {
+		fprintf(out, ", IPC %.2f", (double)hw->value[HWCOUNT_INSTRUCTIONS] / (double)hw->value[HWCOUNT_CYCLES]);
+	}
+
+	fprintf(out, "\n");
+}
@@ -0,0 +1,47 @@
+/** \file hwcount.h
+ *  \brief Host hardware performance counters around a run
+ */
+//
+//  hwcount.h
+//  PZ80emu
+//
+
+#ifndef __PZ80emu__hwcount__
+#define __PZ80emu__hwcount__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/** Host events counted, in report order */
+enum {
+	HWCOUNT_TASK_CLOCK, /** nanoseconds on the cpu, to check the counters against */
+	HWCOUNT_CYCLES, /** host cpu cycles */
+	HWCOUNT_INSTRUCTIONS, /** host instructions retired */
+	HWCOUNT_BRANCH_MISSES, /** mispredicted host branches */
+	HWCOUNT_L1D_MISSES, /** level 1 data cache read misses */
+	HWCOUNT_LLC_MISSES, /** last level cache read misses */
+	HWCOUNT_EVENTS /** number of events */
+};
+
+/**
+ * Counters of the calling thread's own user space work, opened one by
+ * one so a host that lacks some events still counts the others
+ * \brief Host counters, summed over the counted stretches of a run
+ */
+typedef struct {
+	int fd[HWCOUNT_EVENTS]; /** counter of each event, -1 if the host doesn't have it */
+	uint64_t value[HWCOUNT_EVENTS]; /** count of each event, scaled up when the kernel multiplexed it */
+	uint64_t enabled[HWCOUNT_EVENTS]; /** nanoseconds each counter was enabled, as of the last stop */
+	uint64_t running[HWCOUNT_EVENTS]; /** nanoseconds each counter was counting, as of the last stop */
+	int available; /** number of events counted */
+} hwcount;
+
+hwcount *hwcount_new(void);
+void hwcount_free(hwcount *hw);
+void hwcount_start(hwcount *hw);
+void hwcount_stop(hwcount *hw);
+const char *hwcount_name(int event);
+int hwcount_per_instruction(const hwcount *hw, int event, long instructions, double *value);
+void hwcount_write_report(const hwcount *hw, const char *engine, long instructions, FILE *out);
+
+#endif /* defined(__PZ80emu__hwcount__) */
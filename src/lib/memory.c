@@ -63,7 +63,9 @@ static void memory_free(void *self) {
 memory *memory_new(void) {
 	// allocate memory
 	memory *mem;
-	mem = malloc(sizeof(memory));
+	if ((mem = malloc(sizeof(memory))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
 
 	if ((mem->memory = calloc(MEMSIZE, 1)) == NULL) {
 		exit(EXIT_FAILURE);
@@ -0,0 +1,363 @@
+/** \file monitor.c
+ * Live ncurses monitor: compares the cpu and memory against what is on
+ * screen, redraws only the register fields and memory bytes that
+ * changed, and caps the frame rate so drawing stays off the cpu's path
+ */
+//
+//  monitor.c
+//  PZ80emu
+//
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <ncurses.h>
+#include "z80.h"
+#include "monitor.h"
+#include "utils.h"
+
+/** Register fields per line of the register window */
+#define MONITOR_FIELDS_PER_LINE 10
+
+/** Columns taken by one register field */
+#define MONITOR_FIELD_WIDTH 8
+
+/** How a register field is formatted */
+enum {
+	MONITOR_HEX, /** hexadecimal */
+	MONITOR_BITS, /** one 0 or 1 per bit, lowest bit first */
+	MONITOR_DEC /** decimal */
+};
+
+/** Name, width and format of each register field */
+static const struct {
+	const char *name;
+	int width;
+	int format;
+} monitor_fields[MONITOR_FIELDS] = {
+	{ "pc", 4, MONITOR_HEX },
+	{ "a", 2, MONITOR_HEX },
+	{ "CNPHZS", 6, MONITOR_BITS },
+	{ "bc", 4, MONITOR_HEX },
+	{ "de", 4, MONITOR_HEX },
+	{ "hl", 4, MONITOR_HEX },
+	{ "ix", 4, MONITOR_HEX },
+	{ "iy", 4, MONITOR_HEX },
+	{ "sp", 4, MONITOR_HEX },
+	{ "i", 2, MONITOR_HEX },
+	{ "r", 2, MONITOR_HEX },
+	{ "'a", 2, MONITOR_HEX },
+	{ "'CNPHZS", 6, MONITOR_BITS },
+	{ "'bc", 4, MONITOR_HEX },
+	{ "'de", 4, MONITOR_HEX },
+	{ "'hl", 4, MONITOR_HEX },
+	{ "iff", 2, MONITOR_BITS },
+	{ "im", 1, MONITOR_DEC },
+	{ "halt", 1, MONITOR_DEC },
+	{ "counter", 6, MONITOR_DEC }
+};
+
+/**
+ * Reads one register field from a cpu
+ * \param cpu cpu to read
+ * \param field index into monitor_fields
+ * \return Value of the field.
+ */
+static uint32_t monitor_value(const z80 *cpu, int field) {
+	switch (field) {
+	case 0: return cpu->pc.W;
+	case 1: return cpu->a;
+	case 2: return cpu->flags;
+	case 3: return cpu->bc.W;
+	case 4: return cpu->de.W;
+	case 5: return cpu->hl.W;
+	case 6: return cpu->ix.W;
+	case 7: return cpu->iy.W;
+	case 8: return cpu->sp.W;
+	case 9: return cpu->ir.B.h;
+	case 10: return cpu->ir.B.l;
+	case 11: return cpu->_a;
+	case 12: return cpu->_flags;
+	case 13: return cpu->_bc.W;
+	case 14: return cpu->_de.W;
+	case 15: return cpu->_hl.W;
+	case 16: return cpu->iff1 | (cpu->iff2 << 1);
+	case 17: return cpu->im;
+	case 18: return cpu->halted;
+	default: return (uint32_t)cpu->counter;
+	}
+}
+
+/** Window line of a register field's name, its value is on the line below */
+static int monitor_field_line(int field) {
+	return 1 + 2 * (field / MONITOR_FIELDS_PER_LINE);
+}
+
+/** Window column of a register field */
+static int monitor_field_column(int field) {
+	return 2 + MONITOR_FIELD_WIDTH * (field % MONITOR_FIELDS_PER_LINE);
+}
+
+/** Window column of byte \p i of a memory row, with a gap every 4 bytes */
+static int monitor_byte_column(int i) {
+	return 8 + 3 * i + i / 4;
+}
+
+/**
+ * Draws a register field's value
+ */
+static void monitor_draw_field(WINDOW *win, int field, uint32_t value) {
+	int line = monitor_field_line(field) + 1;
+	int column = monitor_field_column(field);
+
+	switch (monitor_fields[field].format) {
+	case MONITOR_BITS:
+		for (int i = 0; i < monitor_fields[field].width; i++) {
+			(void) mvwaddch(win, line, column + i, IS_SET(value, i) ? '1' : '0');
+		}
+		break;
+
+	case MONITOR_DEC:
+		(void) mvwprintw(win, line, column, "%-*u", monitor_fields[field].width, value);
+		break;
+
+	default:
+		(void) mvwprintw(win, line, column, "%0*X", monitor_fields[field].width, value);
+		break;
+	}
+}
+
+/**
+ * Creates a monitor over two windows and draws their labels
+ *
+ * The first frame draws everything; later frames only what changed.
+ * Without windows the monitor only tracks changes.
+ * \param registers window of MONITOR_REGISTER_LINES lines for the registers, or NULL
+ * \param memory window for the memory view, or NULL
+ * \param fps frame rate cap, MONITOR_FPS when 0 or less
+ * \return Pointer to the allocated monitor.
+ */
+monitor *monitor_new(WINDOW *registers, WINDOW *memory, int fps) {
+	monitor *mon;
+
+	if ((mon = calloc(1, sizeof (monitor))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	mon->registers = registers;
+	mon->memory = memory;
+	mon->frame_interval = 1000000000L / ((fps > 0) ? fps : MONITOR_FPS);
+	mon->full = 1;
+
+	if (registers != NULL) {
+		for (int i = 0; i < MONITOR_FIELDS; i++) {
+			(void) mvwprintw(registers, monitor_field_line(i), monitor_field_column(i), "%s", monitor_fields[i].name);
+		}
+	}
+
+	if (memory != NULL) {
+		mon->rows = getmaxy(memory) - 2;
+		if (mon->rows < 0) {
+			mon->rows = 0;
+		}
+		if (mon->rows > 0x10000 / MONITOR_ROW) {
+			mon->rows = 0x10000 / MONITOR_ROW;
+		}
+	}
+
+	return mon;
+}
+
+/**
+ * Frees a monitor, leaving its windows alone
+ * \param mon monitor to free
+ */
+void monitor_free(monitor *mon) {
+	free(mon);
+}
+
+/**
+ * Finds the register fields and memory pages that differ from the screen
+ * \param mon monitor to update the dirty sets of
+ * \param cpu cpu to compare
+ * \param memory 64K of memory to compare
+ * \return Number of changed register fields and pages.
+ */
+int monitor_changes(monitor *mon, const z80 *cpu, const uint8_t *memory) {
+	int changes = 0;
+
+	mon->dirty_registers = 0;
+	for (int i = 0; i < MONITOR_FIELDS; i++) {
+		if (mon->full || monitor_value(cpu, i) != mon->shown_registers[i]) {
+			mon->dirty_registers |= 1u << i;
+			changes++;
+		}
+	}
+
+	for (int page = 0; page < MONITOR_PAGES; page++) {
+		size_t offset = (size_t)page * MONITOR_PAGE;
+
+		mon->dirty_pages[page] = mon->full || memcmp(&memory[offset], &mon->shown_memory[offset], MONITOR_PAGE) != 0;
+		changes += mon->dirty_pages[page];
+	}
+
+	return changes;
+}
+
+/**
+ * Redraws what monitor_changes() found dirty, and what scrolled into
+ * view, and records it as shown. Windows are staged with wnoutrefresh(),
+ * the caller updates the terminal.
+ * \param mon monitor to draw
+ * \param cpu cpu that was compared
+ * \param memory memory that was compared
+ */
+void monitor_draw(monitor *mon, const z80 *cpu, const uint8_t *memory) {
+	int redraw = mon->full || mon->scrolled;
+
+	for (int i = 0; i < MONITOR_FIELDS; i++) {
+		if (mon->dirty_registers & (1u << i)) {
+			mon->shown_registers[i] = monitor_value(cpu, i);
+
+			if (mon->registers != NULL) {
+				monitor_draw_field(mon->registers, i, mon->shown_registers[i]);
+				mon->cells++;
+			}
+		}
+	}
+
+	for (int row = 0; mon->memory != NULL && row < mon->rows; row++) {
+		int address = mon->top + row * MONITOR_ROW;
+
+		if (!redraw && !mon->dirty_pages[address / MONITOR_PAGE]) {
+			continue;
+		}
+
+		if (redraw) {
+			(void) mvwprintw(mon->memory, row + 1, 2, "%04X:", address);
+		}
+
+		for (int i = 0; i < MONITOR_ROW; i++) {
+			if (redraw || memory[address + i] != mon->shown_memory[address + i]) {
+				(void) mvwprintw(mon->memory, row + 1, monitor_byte_column(i), "%02X", memory[address + i]);
+				mon->cells++;
+			}
+		}
+	}
+
+	for (int page = 0; page < MONITOR_PAGES; page++) {
+		if (mon->dirty_pages[page]) {
+			size_t offset = (size_t)page * MONITOR_PAGE;
+
+			memcpy(&mon->shown_memory[offset], &memory[offset], MONITOR_PAGE);
+			mon->dirty_pages[page] = 0;
+		}
+	}
+
+	if (mon->registers != NULL && (mon->dirty_registers || mon->status_changed)) {
+		(void) wnoutrefresh(mon->registers);
+	}
+	if (mon->memory != NULL) {
+		(void) wnoutrefresh(mon->memory);
+	}
+
+	mon->dirty_registers = 0;
+	mon->full = 0;
+	mon->scrolled = 0;
+	mon->status_changed = 0;
+}
+
+/**
+ * Draws a frame if the frame interval has passed since the last one;
+ * cheap enough to call between short slices of run()
+ * \param mon monitor to draw
+ * \param cpu cpu to show
+ * \param memory memory to show
+ * \return 1 if a frame was due, 0 otherwise.
+ */
+int monitor_frame(monitor *mon, const z80 *cpu, const uint8_t *memory) {
+	struct timespec now;
+	long elapsed;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - mon->last_frame.tv_sec) * 1000000000L + (now.tv_nsec - mon->last_frame.tv_nsec);
+	if (elapsed < mon->frame_interval) {
+		return 0;
+	}
+
+	mon->last_frame = now;
+	if (monitor_changes(mon, cpu, memory) > 0 || mon->scrolled || mon->status_changed) {
+		monitor_draw(mon, cpu, memory);
+		(void) doupdate();
+	}
+	mon->frames++;
+
+	return 1;
+}
+
+/**
+ * Scrolls the memory view to a row, keeping the view inside the 64K
+ * \param mon monitor to scroll
+ * \param address address to show at the top, rounded down to a row
+ */
+void monitor_scroll(monitor *mon, long address) {
+	long last = 0x10000L - (long)((mon->rows > 0) ? mon->rows : 1) * MONITOR_ROW;
+
+	if (address > last) {
+		address = last;
+	}
+	if (address < 0) {
+		address = 0;
+	}
+	address &= ~(long)(MONITOR_ROW - 1);
+
+	if (address != mon->top) {
+		mon->top = (uint16_t)address;
+		mon->scrolled = 1;
+	}
+}
+
+/**
+ * Sets the status line on the bottom border of the register window,
+ * drawn with the next frame if it changed
+ * \param mon monitor to show the status on
+ * \param status text, cut to fit
+ */
+void monitor_status(monitor *mon, const char *status) {
+	if (strncmp(status, mon->status, sizeof(mon->status) - 1) == 0) {
+		return;
+	}
+
+	(void) strncpy(mon->status, status, sizeof(mon->status) - 1);
+	if (mon->registers != NULL) {
+		(void) box(mon->registers, 0, 0);
+		(void) mvwprintw(mon->registers, MONITOR_REGISTER_LINES - 1, 2, "%s", mon->status);
+		mon->status_changed = 1;
+	}
+}
+
+/**
+ * Handles a scrolling key: arrows move a row, page up and down a
+ * screen, home and end go to either end and p to the row with PC
+ * \param mon monitor to scroll
+ * \param cpu cpu whose PC p goes to
+ * \param key key from getch()
+ * \return 1 if the key was a scrolling key, 0 otherwise.
+ */
+int monitor_key(monitor *mon, const z80 *cpu, int key) {
+	long screen = (long)mon->rows * MONITOR_ROW;
+
+	switch (key) {
+	case KEY_UP: monitor_scroll(mon, mon->top - MONITOR_ROW); break;
+	case KEY_DOWN: monitor_scroll(mon, mon->top + MONITOR_ROW); break;
+	case KEY_PPAGE: monitor_scroll(mon, mon->top - screen); break;
+	case KEY_NPAGE: monitor_scroll(mon, mon->top + screen); break;
+	case KEY_HOME: monitor_scroll(mon, 0); break;
+	case KEY_END: monitor_scroll(mon, 0x10000L); break;
+	case 'p': monitor_scroll(mon, cpu->pc.W - screen / 2); break;
+	default: return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,69 @@
+/** \file monitor.h
+ *  \brief Live ncurses monitor of the registers and the whole 64K memory
+ */
+//
+//  monitor.h
+//  PZ80emu
+//
+
+#ifndef __PZ80emu__monitor__
+#define __PZ80emu__monitor__
+
+#include <stdint.h>
+#include <time.h>
+#include <ncurses.h>
+#include "z80.h"
+
+/** Default frame rate cap */
+#define MONITOR_FPS 30
+
+/** Number of register fields the monitor shows */
+#define MONITOR_FIELDS 20
+
+/** Size of the pages memory changes are tracked in */
+#define MONITOR_PAGE 256
+
+/** Number of pages in the 64K address space */
+#define MONITOR_PAGES (0x10000 / MONITOR_PAGE)
+
+/** Bytes on one row of the memory view */
+#define MONITOR_ROW 16
+
+/** Height of the register window */
+#define MONITOR_REGISTER_LINES 6
+
+/**
+ * Incremental view of a cpu and its memory
+ * \brief What is on screen, and what changed since it was drawn
+ */
+typedef struct monitor {
+	WINDOW *registers; /** register window, NULL to only track changes */
+	WINDOW *memory; /** memory window, NULL to only track changes */
+	int rows; /** memory rows visible */
+	uint16_t top; /** address of the first visible memory row */
+
+	uint32_t shown_registers[MONITOR_FIELDS]; /** register values on screen */
+	uint8_t shown_memory[0x10000]; /** memory as last drawn */
+	uint32_t dirty_registers; /** bit per register field that changed */
+	uint8_t dirty_pages[MONITOR_PAGES]; /** set for each page that changed */
+	int full; /** everything has to be drawn, after creation */
+	int scrolled; /** every visible memory row has to be drawn */
+
+	long frame_interval; /** minimum nanoseconds between frames */
+	struct timespec last_frame; /** time the last frame was drawn */
+	unsigned long frames; /** frames drawn */
+	unsigned long cells; /** register fields and memory bytes drawn */
+	char status[80]; /** status line on the register window's border */
+	int status_changed; /** the status line has to be drawn */
+} monitor;
+
+monitor *monitor_new(WINDOW *registers, WINDOW *memory, int fps);
+void monitor_free(monitor *mon);
+int monitor_changes(monitor *mon, const z80 *cpu, const uint8_t *memory);
+void monitor_draw(monitor *mon, const z80 *cpu, const uint8_t *memory);
+int monitor_frame(monitor *mon, const z80 *cpu, const uint8_t *memory);
+void monitor_scroll(monitor *mon, long address);
+void monitor_status(monitor *mon, const char *status);
+int monitor_key(monitor *mon, const z80 *cpu, int key);
+
+#endif /* defined(__PZ80emu__monitor__) */
@@ -0,0 +1,287 @@
+/** \file observer.c
+ * Lets a UI thread watch and steer a cpu running at full speed on
+ * another thread: the cpu publishes snapshots into two seqlocked
+ * buffers, so readers never block it, and takes commands from a
+ * single-producer single-consumer ring between run() slices
+ */
+//
+//  observer.c
+//  PZ80emu
+//
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "z80.h"
+#include "observer.h"
+
+/** Nanoseconds the cpu thread sleeps between command checks while paused */
+#define OBSERVER_PAUSE_SLEEP 1000000L
+
+/**
+ * Allocates an observer with nothing published and no commands queued
+ * \param rate snapshots per second while running, OBSERVER_RATE when 0 or less
+ * \return Pointer to the allocated observer.
+ */
+observer *observer_new(int rate) {
+	observer *obs;
+
+	if ((obs = calloc(1, sizeof (observer))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	atomic_init(&obs->slots[0].sequence, 0);
+	atomic_init(&obs->slots[1].sequence, 0);
+	atomic_init(&obs->latest, 0);
+	atomic_init(&obs->head, 0);
+	atomic_init(&obs->tail, 0);
+	atomic_init(&obs->done, 0);
+	obs->publish_interval = 1000000000L / ((rate > 0) ? rate : OBSERVER_RATE);
+
+	return obs;
+}
+
+/**
+ * Frees an observer
+ * \param obs observer to free
+ */
+void observer_free(observer *obs) {
+	free(obs);
+}
+
+/**
+ * Publishes a snapshot into the buffer readers are not using, then
+ * makes it the latest. Only the cpu thread publishes.
+ * \param obs observer to publish to
+ * \param cpu cpu to copy
+ * \param memory 64K of memory to copy
+ * \param instructions instructions run so far
+ */
+void observer_publish(observer *obs, const z80 *cpu, const uint8_t *memory, long instructions) {
+	unsigned next = atomic_load_explicit(&obs->latest, memory_order_relaxed) ^ 1;
+	observer_slot *slot = &obs->slots[next];
+	unsigned sequence = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+
+	// an odd sequence tells readers that caught this slot to retry
+	atomic_store_explicit(&slot->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	slot->snapshot.generation = ++obs->published;
+	slot->snapshot.instructions = instructions;
+	slot->snapshot.paused = obs->paused;
+	slot->snapshot.breakpoints = obs->breakpoint_count;
+	slot->snapshot.cpu = *cpu;
+	memcpy(slot->snapshot.memory, memory, sizeof(slot->snapshot.memory));
+
+	atomic_store_explicit(&slot->sequence, sequence + 2, memory_order_release);
+	atomic_store_explicit(&obs->latest, next, memory_order_release);
+
+	if (obs->on_publish != NULL) {
+		obs->on_publish(obs->publish_context, cpu, instructions);
+	}
+}
+
+/**
+ * Copies the latest snapshot, retrying if the cpu overwrote it meanwhile
+ * \param obs observer to read from
+ * \param snapshot where to copy the snapshot
+ * \return Generation of the snapshot, 0 if none was published yet.
+ */
+uint64_t observer_read(observer *obs, observer_snapshot *snapshot) {
+	for (;;) {
+		observer_slot *slot = &obs->slots[atomic_load_explicit(&obs->latest, memory_order_acquire)];
+		unsigned sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+
+		if (sequence == 0) {
+			return 0;
+		}
+		if (sequence & 1) {
+			continue;
+		}
+
+		memcpy(snapshot, &slot->snapshot, sizeof(observer_snapshot));
+		atomic_thread_fence(memory_order_acquire);
+
+		if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) == sequence) {
+			return snapshot->generation;
+		}
+	}
+}
+
+/**
+ * Queues a command for the cpu; only one thread may push
+ * \param obs observer to send the command through
+ * \param type one of the OBSERVER_ commands
+ * \param address address for OBSERVER_BREAK
+ * \return 1 if queued, 0 if the queue is full.
+ */
+int observer_push(observer *obs, int type, uint16_t address) {
+	unsigned head = atomic_load_explicit(&obs->head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(&obs->tail, memory_order_acquire);
+
+	if (head - tail == OBSERVER_QUEUE) {
+		return 0;
+	}
+
+	obs->queue[head % OBSERVER_QUEUE].type = type;
+	obs->queue[head % OBSERVER_QUEUE].address = address;
+	atomic_store_explicit(&obs->head, head + 1, memory_order_release);
+
+	return 1;
+}
+
+/**
+ * Takes the oldest queued command; only the cpu thread pops
+ * \param obs observer to take the command from
+ * \param command where to copy the command
+ * \return 1 if a command was taken, 0 if the queue is empty.
+ */
+int observer_pop(observer *obs, observer_command *command) {
+	unsigned tail = atomic_load_explicit(&obs->tail, memory_order_relaxed);
+	unsigned head = atomic_load_explicit(&obs->head, memory_order_acquire);
+
+	if (head == tail) {
+		return 0;
+	}
+
+	*command = obs->queue[tail % OBSERVER_QUEUE];
+	atomic_store_explicit(&obs->tail, tail + 1, memory_order_release);
+
+	return 1;
+}
+
+/**
+ * Applies the queued commands
+ * \return 1 if any command changed what a snapshot shows, 0 otherwise.
+ */
+static int observer_commands(observer *obs, z80 *cpu) {
+	observer_command command;
+	int changed = 0;
+
+	while (observer_pop(obs, &command)) {
+		switch (command.type) {
+		case OBSERVER_PAUSE:
+			obs->paused = 1;
+			break;
+
+		case OBSERVER_RESUME:
+			obs->paused = 0;
+			obs->steps = 0;
+			break;
+
+		case OBSERVER_STEP:
+			obs->steps++;
+			break;
+
+		case OBSERVER_BREAK:
+			obs->breakpoints[command.address >> 3] ^= 1 << (command.address & 0x07);
+			obs->breakpoint_count += IS_BREAKPOINT(obs->breakpoints, command.address) ? 1 : -1;
+			break;
+
+		case OBSERVER_QUIT:
+			obs->quit = 1;
+			break;
+		}
+		changed = 1;
+	}
+
+	// plain runs keep the fast interpreter while there are no breakpoints
+	cpu->breakpoints = (obs->breakpoint_count > 0) ? obs->breakpoints : NULL;
+
+	return changed;
+}
+
+/**
+ * Nanoseconds on the monotonic clock
+ */
+static long long observer_now(void) {
+	struct timespec now;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * Runs the cpu on the calling thread in slices, publishing snapshots at
+ * the observer's rate and applying commands in between. A breakpoint
+ * pauses the run with the cpu at it, and resuming runs the instruction
+ * there.
+ * \param obs observer to publish to and take commands from
+ * \param cpu cpu to run
+ * \param memory memory of the cpu
+ * \param runcycles instructions to run, 0 or less to run until OBSERVER_QUIT
+ * \param paused starts paused, to be stepped, when non-zero
+ * \return Result of the last run(), -1 if it stopped on a trap other than a
+ * breakpoint. The instructions run in all are left in executed.
+ */
+int observer_run(observer *obs, z80 *cpu, uint8_t *memory, long runcycles, int paused) {
+	long executed = 0;
+	long long last = observer_now();
+	int count = 0;
+	int resuming = 1; // the instruction at PC runs even if it has a breakpoint
+
+	obs->paused = paused;
+	observer_publish(obs, cpu, memory, executed);
+
+	while (!obs->quit && (runcycles <= 0 || executed < runcycles)) {
+		long slice = (runcycles > 0 && runcycles - executed < OBSERVER_SLICE) ? runcycles - executed : OBSERVER_SLICE;
+		int publish = observer_commands(obs, cpu);
+
+		if (obs->quit) {
+			break;
+		}
+
+		if (obs->paused) {
+			resuming = 1;
+
+			if (obs->steps == 0) {
+				struct timespec sleep = { 0, OBSERVER_PAUSE_SLEEP };
+
+				if (publish) {
+					observer_publish(obs, cpu, memory, executed);
+				}
+				(void) nanosleep(&sleep, NULL);
+				continue;
+			}
+
+			obs->steps--;
+			slice = 1;
+			publish = 1;
+		} else if (!resuming && cpu->breakpoints != NULL && IS_BREAKPOINT(cpu->breakpoints, cpu->pc.W)) {
+			// run() doesn't stop before its first instruction, so a slice ending at a breakpoint stops here
+			obs->paused = 1;
+			obs->steps = 0;
+			observer_publish(obs, cpu, memory, executed);
+			last = observer_now();
+			continue;
+		}
+
+		count = run(cpu, memory, slice, 0);
+		resuming = 0;
+		if (count < 0) {
+			executed += cpu->trap.instructions;
+			break;
+		}
+		executed += count;
+
+		if (cpu->trap.reason == TRAP_BREAKPOINT) {
+			obs->paused = 1;
+			obs->steps = 0;
+			publish = 1;
+		}
+
+		if (publish || observer_now() - last >= obs->publish_interval) {
+			observer_publish(obs, cpu, memory, executed);
+			last = observer_now();
+		}
+	}
+
+	cpu->breakpoints = NULL;
+	obs->executed = executed;
+	observer_publish(obs, cpu, memory, executed);
+	atomic_store_explicit(&obs->done, 1, memory_order_release);
+
+	return count;
+}
@@ -0,0 +1,89 @@
+/** \file observer.h
+ *  \brief Snapshots and commands between a running cpu and a UI thread
+ */
+//
+//  observer.h
+//  PZ80emu
+//
+
+#ifndef __PZ80emu__observer__
+#define __PZ80emu__observer__
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "z80.h"
+
+/** Instructions per run() call, between publishing and command checks */
+#define OBSERVER_SLICE 20000L
+
+/** Default snapshots per second */
+#define OBSERVER_RATE 60
+
+/** Number of commands the queue holds, a power of two */
+#define OBSERVER_QUEUE 64
+
+/** Commands from the UI to the cpu */
+enum {
+	OBSERVER_PAUSE, /** stop running, publishing the state */
+	OBSERVER_RESUME, /** run again */
+	OBSERVER_STEP, /** run one instruction while paused */
+	OBSERVER_BREAK, /** toggle a breakpoint at the address */
+	OBSERVER_QUIT /** end the run */
+};
+
+/** Command sent to the cpu */
+typedef struct {
+	int type; /** one of the OBSERVER_ commands */
+	uint16_t address; /** address for OBSERVER_BREAK */
+} observer_command;
+
+/** Copy of the cpu and its memory at one point in the run */
+typedef struct {
+	uint64_t generation; /** number of snapshots published up to this one */
+	long instructions; /** instructions run so far */
+	int paused; /** set while the cpu is paused */
+	int breakpoints; /** number of breakpoints set */
+	z80 cpu; /** registers, the pointers in it are not for the reader */
+	uint8_t memory[0x10000]; /** memory */
+} observer_snapshot;
+
+/** Snapshot buffer with its seqlock sequence, odd while being written */
+typedef struct {
+	atomic_uint sequence;
+	observer_snapshot snapshot;
+} observer_slot;
+
+/**
+ * Link between the thread running the cpu and a UI thread
+ * \brief Double-buffered snapshots one way, a command queue the other
+ */
+typedef struct observer {
+	observer_slot slots[2]; /** the cpu writes one while readers use the other */
+	atomic_uint latest; /** index of the last slot published */
+
+	observer_command queue[OBSERVER_QUEUE]; /** ring of commands */
+	atomic_uint head; /** commands pushed, written by the UI */
+	atomic_uint tail; /** commands taken, written by the cpu */
+
+	uint8_t breakpoints[0x2000]; /** breakpoint bitmap, only touched by the cpu thread */
+	int breakpoint_count; /** number of breakpoints set */
+	int paused; /** set while paused, cpu thread only */
+	long steps; /** steps asked for while paused, cpu thread only */
+	int quit; /** set by OBSERVER_QUIT, cpu thread only */
+	uint64_t published; /** snapshots published, cpu thread only */
+	long publish_interval; /** minimum nanoseconds between snapshots */
+	atomic_int done; /** set once observer_run() returned */
+	long executed; /** instructions observer_run() ran in all, read it once done is set */
+	void (*on_publish)(void *context, const z80 *cpu, long instructions); /** called on the cpu thread after each snapshot, or NULL */
+	void *publish_context; /** passed to on_publish */
+} observer;
+
+observer *observer_new(int rate);
+void observer_free(observer *obs);
+void observer_publish(observer *obs, const z80 *cpu, const uint8_t *memory, long instructions);
+uint64_t observer_read(observer *obs, observer_snapshot *snapshot);
+int observer_push(observer *obs, int type, uint16_t address);
+int observer_pop(observer *obs, observer_command *command);
+int observer_run(observer *obs, z80 *cpu, uint8_t *memory, long runcycles, int paused);
+
+#endif /* defined(__PZ80emu__observer__) */
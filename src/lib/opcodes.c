@@ -0,0 +1,34 @@
+/** \file opcodes.c
+ * Per-opcode descriptions, expanded from the lists in opcodes.h
+ */
+//
+//  opcodes.c
+//  PZ80emu
+//
+
+#include <stdint.h>
+#include "opcodes.h"
+
+/** Expands a row of an opcode list into a description */
+#define OPCODE(code, mnemonic, length, tstates, taken, kind) [code] = { mnemonic, length, tstates, taken, kind },
+
+/** Unprefixed opcodes */
+const opcode opcodes_base[256] = { Z80_OPCODES(OPCODE) };
+
+/** CB prefixed opcodes */
+const opcode opcodes_cb[256] = { Z80_OPCODES_CB(OPCODE) };
+
+/** ED prefixed opcodes */
+const opcode opcodes_ed[256] = { Z80_OPCODES_ED(OPCODE) };
+
+/** DD prefixed opcodes */
+const opcode opcodes_dd[256] = { Z80_OPCODES_INDEX(OPCODE, "ix") };
+
+/** FD prefixed opcodes */
+const opcode opcodes_fd[256] = { Z80_OPCODES_INDEX(OPCODE, "iy") };
+
+/** DD CB prefixed opcodes */
+const opcode opcodes_ddcb[256] = { Z80_OPCODES_INDEX_CB(OPCODE, "ix") };
+
+/** FD CB prefixed opcodes */
+const opcode opcodes_fdcb[256] = { Z80_OPCODES_INDEX_CB(OPCODE, "iy") };
@@ -0,0 +1,726 @@
+/** \file opcodes.h
+ *  \brief Declarative description of the Z80 instruction set
+ *
+ * One row per opcode, expanded wherever a per-opcode table is needed:
+ * the interpreter's T-state tables, instruction lengths, mnemonics for
+ * disassembly and the per-opcode tests. Each list calls
+ * X(opcode, mnemonic, length, tstates, taken, kind) with
+ * - mnemonic: assembler syntax, with N for an immediate byte, NN for an
+ *   immediate word, E for a relative jump target and D for an index
+ *   offset
+ * - length: bytes in the instruction, prefixes included
+ * - tstates: T-states, prefixes included, for a branch not taken or a
+ *   block instruction that doesn't repeat
+ * - taken: T-states added when a branch is taken or a block instruction repeats
+ * - kind: one of the OPCODE_ kinds
+ *
+ * Opcodes missing from a list are undocumented; the interpreter traps them.
+ */
+//
+//  opcodes.h
+//  PZ80emu
+//
+
+#ifndef __PZ80emu__opcodes__
+#define __PZ80emu__opcodes__
+
+#include <stdint.h>
+
+/** How an instruction moves the program counter */
+enum {
+	OPCODE_PLAIN, /** falls through to the next instruction */
+	OPCODE_JUMP, /** always jumps, calls or returns */
+	OPCODE_BRANCH, /** jumps, calls or returns on a condition */
+	OPCODE_REPEAT, /** block instruction that repeats until done */
+	OPCODE_HALT, /** stays put until an interrupt */
+	OPCODE_PREFIX /** selects another opcode page */
+};
+
+/** Unprefixed opcodes */
+#define Z80_OPCODES(X) \
+	X(0x00, "nop", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x01, "ld bc,NN", 3, 10, 0, OPCODE_PLAIN) \
+	X(0x02, "ld (bc),a", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x03, "inc bc", 1, 6, 0, OPCODE_PLAIN) \
+	X(0x04, "inc b", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x05, "dec b", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x06, "ld b,N", 2, 7, 0, OPCODE_PLAIN) \
+	X(0x07, "rlca", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x08, "ex af,af'", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x09, "add hl,bc", 1, 11, 0, OPCODE_PLAIN) \
+	X(0x0A, "ld a,(bc)", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x0B, "dec bc", 1, 6, 0, OPCODE_PLAIN) \
+	X(0x0C, "inc c", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x0D, "dec c", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x0E, "ld c,N", 2, 7, 0, OPCODE_PLAIN) \
+	X(0x0F, "rrca", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x10, "djnz E", 2, 8, 5, OPCODE_BRANCH) \
+	X(0x11, "ld de,NN", 3, 10, 0, OPCODE_PLAIN) \
+	X(0x12, "ld (de),a", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x13, "inc de", 1, 6, 0, OPCODE_PLAIN) \
+	X(0x14, "inc d", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x15, "dec d", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x16, "ld d,N", 2, 7, 0, OPCODE_PLAIN) \
+	X(0x17, "rla", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x18, "jr E", 2, 12, 0, OPCODE_JUMP) \
+	X(0x19, "add hl,de", 1, 11, 0, OPCODE_PLAIN) \
+	X(0x1A, "ld a,(de)", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x1B, "dec de", 1, 6, 0, OPCODE_PLAIN) \
+	X(0x1C, "inc e", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x1D, "dec e", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x1E, "ld e,N", 2, 7, 0, OPCODE_PLAIN) \
+	X(0x1F, "rra", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x20, "jr nz,E", 2, 7, 5, OPCODE_BRANCH) \
+	X(0x21, "ld hl,NN", 3, 10, 0, OPCODE_PLAIN) \
+	X(0x22, "ld (NN),hl", 3, 16, 0, OPCODE_PLAIN) \
+	X(0x23, "inc hl", 1, 6, 0, OPCODE_PLAIN) \
+	X(0x24, "inc h", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x25, "dec h", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x26, "ld h,N", 2, 7, 0, OPCODE_PLAIN) \
+	X(0x27, "daa", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x28, "jr z,E", 2, 7, 5, OPCODE_BRANCH) \
+	X(0x29, "add hl,hl", 1, 11, 0, OPCODE_PLAIN) \
+	X(0x2A, "ld hl,(NN)", 3, 16, 0, OPCODE_PLAIN) \
+	X(0x2B, "dec hl", 1, 6, 0, OPCODE_PLAIN) \
+	X(0x2C, "inc l", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x2D, "dec l", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x2E, "ld l,N", 2, 7, 0, OPCODE_PLAIN) \
+	X(0x2F, "cpl", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x30, "jr nc,E", 2, 7, 5, OPCODE_BRANCH) \
+	X(0x31, "ld sp,NN", 3, 10, 0, OPCODE_PLAIN) \
+	X(0x32, "ld (NN),a", 3, 13, 0, OPCODE_PLAIN) \
+	X(0x33, "inc sp", 1, 6, 0, OPCODE_PLAIN) \
+	X(0x34, "inc (hl)", 1, 11, 0, OPCODE_PLAIN) \
+	X(0x35, "dec (hl)", 1, 11, 0, OPCODE_PLAIN) \
+	X(0x36, "ld (hl),N", 2, 10, 0, OPCODE_PLAIN) \
+	X(0x37, "scf", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x38, "jr c,E", 2, 7, 5, OPCODE_BRANCH) \
+	X(0x39, "add hl,sp", 1, 11, 0, OPCODE_PLAIN) \
+	X(0x3A, "ld a,(NN)", 3, 13, 0, OPCODE_PLAIN) \
+	X(0x3B, "dec sp", 1, 6, 0, OPCODE_PLAIN) \
+	X(0x3C, "inc a", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x3D, "dec a", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x3E, "ld a,N", 2, 7, 0, OPCODE_PLAIN) \
+	X(0x3F, "ccf", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x40, "ld b,b", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x41, "ld b,c", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x42, "ld b,d", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x43, "ld b,e", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x44, "ld b,h", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x45, "ld b,l", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x46, "ld b,(hl)", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x47, "ld b,a", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x48, "ld c,b", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x49, "ld c,c", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x4A, "ld c,d", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x4B, "ld c,e", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x4C, "ld c,h", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x4D, "ld c,l", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x4E, "ld c,(hl)", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x4F, "ld c,a", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x50, "ld d,b", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x51, "ld d,c", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x52, "ld d,d", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x53, "ld d,e", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x54, "ld d,h", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x55, "ld d,l", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x56, "ld d,(hl)", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x57, "ld d,a", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x58, "ld e,b", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x59, "ld e,c", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x5A, "ld e,d", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x5B, "ld e,e", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x5C, "ld e,h", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x5D, "ld e,l", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x5E, "ld e,(hl)", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x5F, "ld e,a", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x60, "ld h,b", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x61, "ld h,c", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x62, "ld h,d", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x63, "ld h,e", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x64, "ld h,h", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x65, "ld h,l", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x66, "ld h,(hl)", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x67, "ld h,a", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x68, "ld l,b", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x69, "ld l,c", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x6A, "ld l,d", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x6B, "ld l,e", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x6C, "ld l,h", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x6D, "ld l,l", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x6E, "ld l,(hl)", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x6F, "ld l,a", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x70, "ld (hl),b", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x71, "ld (hl),c", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x72, "ld (hl),d", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x73, "ld (hl),e", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x74, "ld (hl),h", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x75, "ld (hl),l", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x76, "halt", 1, 4, 0, OPCODE_HALT) \
+	X(0x77, "ld (hl),a", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x78, "ld a,b", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x79, "ld a,c", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x7A, "ld a,d", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x7B, "ld a,e", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x7C, "ld a,h", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x7D, "ld a,l", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x7E, "ld a,(hl)", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x7F, "ld a,a", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x80, "add a,b", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x81, "add a,c", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x82, "add a,d", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x83, "add a,e", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x84, "add a,h", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x85, "add a,l", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x86, "add a,(hl)", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x87, "add a,a", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x88, "adc a,b", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x89, "adc a,c", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x8A, "adc a,d", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x8B, "adc a,e", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x8C, "adc a,h", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x8D, "adc a,l", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x8E, "adc a,(hl)", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x8F, "adc a,a", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x90, "sub b", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x91, "sub c", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x92, "sub d", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x93, "sub e", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x94, "sub h", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x95, "sub l", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x96, "sub (hl)", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x97, "sub a", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x98, "sbc a,b", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x99, "sbc a,c", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x9A, "sbc a,d", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x9B, "sbc a,e", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x9C, "sbc a,h", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x9D, "sbc a,l", 1, 4, 0, OPCODE_PLAIN) \
+	X(0x9E, "sbc a,(hl)", 1, 7, 0, OPCODE_PLAIN) \
+	X(0x9F, "sbc a,a", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xA0, "and b", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xA1, "and c", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xA2, "and d", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xA3, "and e", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xA4, "and h", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xA5, "and l", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xA6, "and (hl)", 1, 7, 0, OPCODE_PLAIN) \
+	X(0xA7, "and a", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xA8, "xor b", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xA9, "xor c", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xAA, "xor d", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xAB, "xor e", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xAC, "xor h", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xAD, "xor l", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xAE, "xor (hl)", 1, 7, 0, OPCODE_PLAIN) \
+	X(0xAF, "xor a", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xB0, "or b", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xB1, "or c", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xB2, "or d", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xB3, "or e", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xB4, "or h", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xB5, "or l", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xB6, "or (hl)", 1, 7, 0, OPCODE_PLAIN) \
+	X(0xB7, "or a", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xB8, "cp b", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xB9, "cp c", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xBA, "cp d", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xBB, "cp e", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xBC, "cp h", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xBD, "cp l", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xBE, "cp (hl)", 1, 7, 0, OPCODE_PLAIN) \
+	X(0xBF, "cp a", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xC0, "ret nz", 1, 5, 6, OPCODE_BRANCH) \
+	X(0xC1, "pop bc", 1, 10, 0, OPCODE_PLAIN) \
+	X(0xC2, "jp nz,NN", 3, 10, 0, OPCODE_BRANCH) \
+	X(0xC3, "jp NN", 3, 10, 0, OPCODE_JUMP) \
+	X(0xC4, "call nz,NN", 3, 10, 7, OPCODE_BRANCH) \
+	X(0xC5, "push bc", 1, 11, 0, OPCODE_PLAIN) \
+	X(0xC6, "add a,N", 2, 7, 0, OPCODE_PLAIN) \
+	X(0xC7, "rst 00h", 1, 11, 0, OPCODE_JUMP) \
+	X(0xC8, "ret z", 1, 5, 6, OPCODE_BRANCH) \
+	X(0xC9, "ret", 1, 10, 0, OPCODE_JUMP) \
+	X(0xCA, "jp z,NN", 3, 10, 0, OPCODE_BRANCH) \
+	X(0xCB, "cb", 1, 4, 0, OPCODE_PREFIX) \
+	X(0xCC, "call z,NN", 3, 10, 7, OPCODE_BRANCH) \
+	X(0xCD, "call NN", 3, 17, 0, OPCODE_JUMP) \
+	X(0xCE, "adc a,N", 2, 7, 0, OPCODE_PLAIN) \
+	X(0xCF, "rst 08h", 1, 11, 0, OPCODE_JUMP) \
+	X(0xD0, "ret nc", 1, 5, 6, OPCODE_BRANCH) \
+	X(0xD1, "pop de", 1, 10, 0, OPCODE_PLAIN) \
+	X(0xD2, "jp nc,NN", 3, 10, 0, OPCODE_BRANCH) \
+	X(0xD3, "out (N),a", 2, 11, 0, OPCODE_PLAIN) \
+	X(0xD4, "call nc,NN", 3, 10, 7, OPCODE_BRANCH) \
+	X(0xD5, "push de", 1, 11, 0, OPCODE_PLAIN) \
+	X(0xD6, "sub N", 2, 7, 0, OPCODE_PLAIN) \
+	X(0xD7, "rst 10h", 1, 11, 0, OPCODE_JUMP) \
+	X(0xD8, "ret c", 1, 5, 6, OPCODE_BRANCH) \
+	X(0xD9, "exx", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xDA, "jp c,NN", 3, 10, 0, OPCODE_BRANCH) \
+	X(0xDB, "in a,(N)", 2, 11, 0, OPCODE_PLAIN) \
+	X(0xDC, "call c,NN", 3, 10, 7, OPCODE_BRANCH) \
+	X(0xDD, "dd", 1, 4, 0, OPCODE_PREFIX) \
+	X(0xDE, "sbc a,N", 2, 7, 0, OPCODE_PLAIN) \
+	X(0xDF, "rst 18h", 1, 11, 0, OPCODE_JUMP) \
+	X(0xE0, "ret po", 1, 5, 6, OPCODE_BRANCH) \
+	X(0xE1, "pop hl", 1, 10, 0, OPCODE_PLAIN) \
+	X(0xE2, "jp po,NN", 3, 10, 0, OPCODE_BRANCH) \
+	X(0xE3, "ex (sp),hl", 1, 19, 0, OPCODE_PLAIN) \
+	X(0xE4, "call po,NN", 3, 10, 7, OPCODE_BRANCH) \
+	X(0xE5, "push hl", 1, 11, 0, OPCODE_PLAIN) \
+	X(0xE6, "and N", 2, 7, 0, OPCODE_PLAIN) \
+	X(0xE7, "rst 20h", 1, 11, 0, OPCODE_JUMP) \
+	X(0xE8, "ret pe", 1, 5, 6, OPCODE_BRANCH) \
+	X(0xE9, "jp (hl)", 1, 4, 0, OPCODE_JUMP) \
+	X(0xEA, "jp pe,NN", 3, 10, 0, OPCODE_BRANCH) \
+	X(0xEB, "ex de,hl", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xEC, "call pe,NN", 3, 10, 7, OPCODE_BRANCH) \
+	X(0xED, "ed", 1, 4, 0, OPCODE_PREFIX) \
+	X(0xEE, "xor N", 2, 7, 0, OPCODE_PLAIN) \
+	X(0xEF, "rst 28h", 1, 11, 0, OPCODE_JUMP) \
+	X(0xF0, "ret p", 1, 5, 6, OPCODE_BRANCH) \
+	X(0xF1, "pop af", 1, 10, 0, OPCODE_PLAIN) \
+	X(0xF2, "jp p,NN", 3, 10, 0, OPCODE_BRANCH) \
+	X(0xF3, "di", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xF4, "call p,NN", 3, 10, 7, OPCODE_BRANCH) \
+	X(0xF5, "push af", 1, 11, 0, OPCODE_PLAIN) \
+	X(0xF6, "or N", 2, 7, 0, OPCODE_PLAIN) \
+	X(0xF7, "rst 30h", 1, 11, 0, OPCODE_JUMP) \
+	X(0xF8, "ret m", 1, 5, 6, OPCODE_BRANCH) \
+	X(0xF9, "ld sp,hl", 1, 6, 0, OPCODE_PLAIN) \
+	X(0xFA, "jp m,NN", 3, 10, 0, OPCODE_BRANCH) \
+	X(0xFB, "ei", 1, 4, 0, OPCODE_PLAIN) \
+	X(0xFC, "call m,NN", 3, 10, 7, OPCODE_BRANCH) \
+	X(0xFD, "fd", 1, 4, 0, OPCODE_PREFIX) \
+	X(0xFE, "cp N", 2, 7, 0, OPCODE_PLAIN) \
+	X(0xFF, "rst 38h", 1, 11, 0, OPCODE_JUMP)
+
+/** CB prefixed opcodes */
+#define Z80_OPCODES_CB(X) \
+	X(0x00, "rlc b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x01, "rlc c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x02, "rlc d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x03, "rlc e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x04, "rlc h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x05, "rlc l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x06, "rlc (hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x07, "rlc a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x08, "rrc b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x09, "rrc c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x0A, "rrc d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x0B, "rrc e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x0C, "rrc h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x0D, "rrc l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x0E, "rrc (hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x0F, "rrc a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x10, "rl b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x11, "rl c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x12, "rl d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x13, "rl e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x14, "rl h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x15, "rl l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x16, "rl (hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x17, "rl a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x18, "rr b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x19, "rr c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x1A, "rr d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x1B, "rr e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x1C, "rr h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x1D, "rr l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x1E, "rr (hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x1F, "rr a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x20, "sla b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x21, "sla c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x22, "sla d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x23, "sla e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x24, "sla h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x25, "sla l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x26, "sla (hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x27, "sla a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x28, "sra b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x29, "sra c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x2A, "sra d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x2B, "sra e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x2C, "sra h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x2D, "sra l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x2E, "sra (hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x2F, "sra a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x38, "srl b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x39, "srl c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x3A, "srl d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x3B, "srl e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x3C, "srl h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x3D, "srl l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x3E, "srl (hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x3F, "srl a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x40, "bit 0,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x41, "bit 0,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x42, "bit 0,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x43, "bit 0,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x44, "bit 0,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x45, "bit 0,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x46, "bit 0,(hl)", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x47, "bit 0,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x48, "bit 1,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x49, "bit 1,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x4A, "bit 1,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x4B, "bit 1,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x4C, "bit 1,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x4D, "bit 1,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x4E, "bit 1,(hl)", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x4F, "bit 1,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x50, "bit 2,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x51, "bit 2,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x52, "bit 2,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x53, "bit 2,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x54, "bit 2,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x55, "bit 2,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x56, "bit 2,(hl)", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x57, "bit 2,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x58, "bit 3,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x59, "bit 3,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x5A, "bit 3,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x5B, "bit 3,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x5C, "bit 3,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x5D, "bit 3,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x5E, "bit 3,(hl)", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x5F, "bit 3,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x60, "bit 4,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x61, "bit 4,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x62, "bit 4,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x63, "bit 4,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x64, "bit 4,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x65, "bit 4,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x66, "bit 4,(hl)", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x67, "bit 4,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x68, "bit 5,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x69, "bit 5,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x6A, "bit 5,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x6B, "bit 5,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x6C, "bit 5,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x6D, "bit 5,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x6E, "bit 5,(hl)", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x6F, "bit 5,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x70, "bit 6,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x71, "bit 6,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x72, "bit 6,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x73, "bit 6,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x74, "bit 6,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x75, "bit 6,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x76, "bit 6,(hl)", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x77, "bit 6,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x78, "bit 7,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x79, "bit 7,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x7A, "bit 7,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x7B, "bit 7,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x7C, "bit 7,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x7D, "bit 7,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x7E, "bit 7,(hl)", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x7F, "bit 7,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x80, "res 0,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x81, "res 0,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x82, "res 0,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x83, "res 0,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x84, "res 0,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x85, "res 0,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x86, "res 0,(hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x87, "res 0,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x88, "res 1,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x89, "res 1,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x8A, "res 1,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x8B, "res 1,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x8C, "res 1,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x8D, "res 1,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x8E, "res 1,(hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x8F, "res 1,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x90, "res 2,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x91, "res 2,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x92, "res 2,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x93, "res 2,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x94, "res 2,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x95, "res 2,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x96, "res 2,(hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x97, "res 2,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x98, "res 3,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x99, "res 3,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x9A, "res 3,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x9B, "res 3,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x9C, "res 3,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x9D, "res 3,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x9E, "res 3,(hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x9F, "res 3,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xA0, "res 4,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xA1, "res 4,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xA2, "res 4,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xA3, "res 4,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xA4, "res 4,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xA5, "res 4,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xA6, "res 4,(hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0xA7, "res 4,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xA8, "res 5,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xA9, "res 5,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xAA, "res 5,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xAB, "res 5,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xAC, "res 5,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xAD, "res 5,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xAE, "res 5,(hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0xAF, "res 5,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xB0, "res 6,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xB1, "res 6,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xB2, "res 6,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xB3, "res 6,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xB4, "res 6,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xB5, "res 6,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xB6, "res 6,(hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0xB7, "res 6,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xB8, "res 7,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xB9, "res 7,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xBA, "res 7,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xBB, "res 7,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xBC, "res 7,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xBD, "res 7,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xBE, "res 7,(hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0xBF, "res 7,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xC0, "set 0,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xC1, "set 0,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xC2, "set 0,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xC3, "set 0,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xC4, "set 0,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xC5, "set 0,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xC6, "set 0,(hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0xC7, "set 0,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xC8, "set 1,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xC9, "set 1,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xCA, "set 1,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xCB, "set 1,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xCC, "set 1,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xCD, "set 1,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xCE, "set 1,(hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0xCF, "set 1,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xD0, "set 2,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xD1, "set 2,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xD2, "set 2,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xD3, "set 2,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xD4, "set 2,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xD5, "set 2,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xD6, "set 2,(hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0xD7, "set 2,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xD8, "set 3,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xD9, "set 3,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xDA, "set 3,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xDB, "set 3,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xDC, "set 3,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xDD, "set 3,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xDE, "set 3,(hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0xDF, "set 3,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xE0, "set 4,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xE1, "set 4,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xE2, "set 4,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xE3, "set 4,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xE4, "set 4,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xE5, "set 4,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xE6, "set 4,(hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0xE7, "set 4,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xE8, "set 5,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xE9, "set 5,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xEA, "set 5,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xEB, "set 5,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xEC, "set 5,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xED, "set 5,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xEE, "set 5,(hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0xEF, "set 5,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xF0, "set 6,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xF1, "set 6,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xF2, "set 6,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xF3, "set 6,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xF4, "set 6,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xF5, "set 6,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xF6, "set 6,(hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0xF7, "set 6,a", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xF8, "set 7,b", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xF9, "set 7,c", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xFA, "set 7,d", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xFB, "set 7,e", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xFC, "set 7,h", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xFD, "set 7,l", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xFE, "set 7,(hl)", 2, 15, 0, OPCODE_PLAIN) \
+	X(0xFF, "set 7,a", 2, 8, 0, OPCODE_PLAIN)
+
+
+/** ED prefixed opcodes */
+#define Z80_OPCODES_ED(X) \
+	X(0x40, "in b,(c)", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x41, "out (c),b", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x42, "sbc hl,bc", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x43, "ld (NN),bc", 4, 20, 0, OPCODE_PLAIN) \
+	X(0x44, "neg", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x45, "retn", 2, 14, 0, OPCODE_JUMP) \
+	X(0x46, "im 0", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x47, "ld i,a", 2, 9, 0, OPCODE_PLAIN) \
+	X(0x48, "in c,(c)", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x49, "out (c),c", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x4A, "adc hl,bc", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x4B, "ld bc,(NN)", 4, 20, 0, OPCODE_PLAIN) \
+	X(0x4C, "neg", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x4D, "reti", 2, 14, 0, OPCODE_JUMP) \
+	X(0x4E, "im 0", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x4F, "ld r,a", 2, 9, 0, OPCODE_PLAIN) \
+	X(0x50, "in d,(c)", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x51, "out (c),d", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x52, "sbc hl,de", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x53, "ld (NN),de", 4, 20, 0, OPCODE_PLAIN) \
+	X(0x54, "neg", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x55, "retn", 2, 14, 0, OPCODE_JUMP) \
+	X(0x56, "im 1", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x57, "ld a,i", 2, 9, 0, OPCODE_PLAIN) \
+	X(0x58, "in e,(c)", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x59, "out (c),e", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x5A, "adc hl,de", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x5B, "ld de,(NN)", 4, 20, 0, OPCODE_PLAIN) \
+	X(0x5C, "neg", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x5D, "retn", 2, 14, 0, OPCODE_JUMP) \
+	X(0x5E, "im 2", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x5F, "ld a,r", 2, 9, 0, OPCODE_PLAIN) \
+	X(0x60, "in h,(c)", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x61, "out (c),h", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x62, "sbc hl,hl", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x63, "ld (NN),hl", 4, 20, 0, OPCODE_PLAIN) \
+	X(0x64, "neg", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x65, "retn", 2, 14, 0, OPCODE_JUMP) \
+	X(0x66, "im 0", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x67, "rrd", 2, 18, 0, OPCODE_PLAIN) \
+	X(0x68, "in l,(c)", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x69, "out (c),l", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x6A, "adc hl,hl", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x6B, "ld hl,(NN)", 4, 20, 0, OPCODE_PLAIN) \
+	X(0x6C, "neg", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x6D, "retn", 2, 14, 0, OPCODE_JUMP) \
+	X(0x6E, "im 0", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x6F, "rld", 2, 18, 0, OPCODE_PLAIN) \
+	X(0x70, "in (c)", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x72, "sbc hl,sp", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x73, "ld (NN),sp", 4, 20, 0, OPCODE_PLAIN) \
+	X(0x74, "neg", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x75, "retn", 2, 14, 0, OPCODE_JUMP) \
+	X(0x76, "im 1", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x78, "in a,(c)", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x79, "out (c),a", 2, 12, 0, OPCODE_PLAIN) \
+	X(0x7A, "adc hl,sp", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x7B, "ld sp,(NN)", 4, 20, 0, OPCODE_PLAIN) \
+	X(0x7C, "neg", 2, 8, 0, OPCODE_PLAIN) \
+	X(0x7D, "retn", 2, 14, 0, OPCODE_JUMP) \
+	X(0x7E, "im 2", 2, 8, 0, OPCODE_PLAIN) \
+	X(0xA0, "ldi", 2, 16, 0, OPCODE_PLAIN) \
+	X(0xA1, "cpi", 2, 16, 0, OPCODE_PLAIN) \
+	X(0xA2, "ini", 2, 16, 0, OPCODE_PLAIN) \
+	X(0xA3, "outi", 2, 16, 0, OPCODE_PLAIN) \
+	X(0xA8, "ldd", 2, 16, 0, OPCODE_PLAIN) \
+	X(0xA9, "cpd", 2, 16, 0, OPCODE_PLAIN) \
+	X(0xAA, "ind", 2, 16, 0, OPCODE_PLAIN) \
+	X(0xAB, "outd", 2, 16, 0, OPCODE_PLAIN) \
+	X(0xB0, "ldir", 2, 16, 5, OPCODE_REPEAT) \
+	X(0xB1, "cpir", 2, 16, 5, OPCODE_REPEAT) \
+	X(0xB2, "inir", 2, 16, 5, OPCODE_REPEAT) \
+	X(0xB3, "otir", 2, 16, 5, OPCODE_REPEAT) \
+	X(0xB8, "lddr", 2, 16, 5, OPCODE_REPEAT) \
+	X(0xB9, "cpdr", 2, 16, 5, OPCODE_REPEAT) \
+	X(0xBA, "indr", 2, 16, 5, OPCODE_REPEAT) \
+	X(0xBB, "otdr", 2, 16, 5, OPCODE_REPEAT)
+
+/** DD and FD prefixed opcodes, with R the index register's name */
+#define Z80_OPCODES_INDEX(X, R) \
+	X(0x09, "add " R ",bc", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x19, "add " R ",de", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x21, "ld " R ",NN", 4, 14, 0, OPCODE_PLAIN) \
+	X(0x22, "ld (NN)," R, 4, 20, 0, OPCODE_PLAIN) \
+	X(0x23, "inc " R, 2, 10, 0, OPCODE_PLAIN) \
+	X(0x29, "add " R "," R, 2, 15, 0, OPCODE_PLAIN) \
+	X(0x2A, "ld " R ",(NN)", 4, 20, 0, OPCODE_PLAIN) \
+	X(0x2B, "dec " R, 2, 10, 0, OPCODE_PLAIN) \
+	X(0x34, "inc (" R "+D)", 3, 23, 0, OPCODE_PLAIN) \
+	X(0x35, "dec (" R "+D)", 3, 23, 0, OPCODE_PLAIN) \
+	X(0x36, "ld (" R "+D),N", 4, 19, 0, OPCODE_PLAIN) \
+	X(0x39, "add " R ",sp", 2, 15, 0, OPCODE_PLAIN) \
+	X(0x46, "ld b,(" R "+D)", 3, 19, 0, OPCODE_PLAIN) \
+	X(0x4E, "ld c,(" R "+D)", 3, 19, 0, OPCODE_PLAIN) \
+	X(0x56, "ld d,(" R "+D)", 3, 19, 0, OPCODE_PLAIN) \
+	X(0x5E, "ld e,(" R "+D)", 3, 19, 0, OPCODE_PLAIN) \
+	X(0x66, "ld h,(" R "+D)", 3, 19, 0, OPCODE_PLAIN) \
+	X(0x6E, "ld l,(" R "+D)", 3, 19, 0, OPCODE_PLAIN) \
+	X(0x70, "ld (" R "+D),b", 3, 19, 0, OPCODE_PLAIN) \
+	X(0x71, "ld (" R "+D),c", 3, 19, 0, OPCODE_PLAIN) \
+	X(0x72, "ld (" R "+D),d", 3, 19, 0, OPCODE_PLAIN) \
+	X(0x73, "ld (" R "+D),e", 3, 19, 0, OPCODE_PLAIN) \
+	X(0x74, "ld (" R "+D),h", 3, 19, 0, OPCODE_PLAIN) \
+	X(0x75, "ld (" R "+D),l", 3, 19, 0, OPCODE_PLAIN) \
+	X(0x77, "ld (" R "+D),a", 3, 19, 0, OPCODE_PLAIN) \
+	X(0x7E, "ld a,(" R "+D)", 3, 19, 0, OPCODE_PLAIN) \
+	X(0x86, "add a,(" R "+D)", 3, 19, 0, OPCODE_PLAIN) \
+	X(0x8E, "adc a,(" R "+D)", 3, 19, 0, OPCODE_PLAIN) \
+	X(0x96, "sub (" R "+D)", 3, 19, 0, OPCODE_PLAIN) \
+	X(0x9E, "sbc a,(" R "+D)", 3, 19, 0, OPCODE_PLAIN) \
+	X(0xA6, "and (" R "+D)", 3, 19, 0, OPCODE_PLAIN) \
+	X(0xAE, "xor (" R "+D)", 3, 19, 0, OPCODE_PLAIN) \
+	X(0xB6, "or (" R "+D)", 3, 19, 0, OPCODE_PLAIN) \
+	X(0xBE, "cp (" R "+D)", 3, 19, 0, OPCODE_PLAIN) \
+	X(0xCB, "cb", 2, 4, 0, OPCODE_PREFIX) \
+	X(0xE1, "pop " R, 2, 14, 0, OPCODE_PLAIN) \
+	X(0xE3, "ex (sp)," R, 2, 23, 0, OPCODE_PLAIN) \
+	X(0xE5, "push " R, 2, 15, 0, OPCODE_PLAIN) \
+	X(0xE9, "jp (" R ")", 2, 8, 0, OPCODE_JUMP) \
+	X(0xF9, "ld sp," R, 2, 10, 0, OPCODE_PLAIN)
+
+/** DD CB and FD CB prefixed opcodes, with the offset before the opcode */
+#define Z80_OPCODES_INDEX_CB(X, R) \
+	X(0x06, "rlc (" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0x0E, "rrc (" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0x16, "rl (" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0x1E, "rr (" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0x26, "sla (" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0x2E, "sra (" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0x3E, "srl (" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0x46, "bit 0,(" R "+D)", 4, 20, 0, OPCODE_PLAIN) \
+	X(0x4E, "bit 1,(" R "+D)", 4, 20, 0, OPCODE_PLAIN) \
+	X(0x56, "bit 2,(" R "+D)", 4, 20, 0, OPCODE_PLAIN) \
+	X(0x5E, "bit 3,(" R "+D)", 4, 20, 0, OPCODE_PLAIN) \
+	X(0x66, "bit 4,(" R "+D)", 4, 20, 0, OPCODE_PLAIN) \
+	X(0x6E, "bit 5,(" R "+D)", 4, 20, 0, OPCODE_PLAIN) \
+	X(0x76, "bit 6,(" R "+D)", 4, 20, 0, OPCODE_PLAIN) \
+	X(0x7E, "bit 7,(" R "+D)", 4, 20, 0, OPCODE_PLAIN) \
+	X(0x86, "res 0,(" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0x8E, "res 1,(" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0x96, "res 2,(" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0x9E, "res 3,(" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0xA6, "res 4,(" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0xAE, "res 5,(" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0xB6, "res 6,(" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0xBE, "res 7,(" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0xC6, "set 0,(" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0xCE, "set 1,(" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0xD6, "set 2,(" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0xDE, "set 3,(" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0xE6, "set 4,(" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0xEE, "set 5,(" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0xF6, "set 6,(" R "+D)", 4, 23, 0, OPCODE_PLAIN) \
+	X(0xFE, "set 7,(" R "+D)", 4, 23, 0, OPCODE_PLAIN)
+
+/**
+ * Description of one opcode, from the lists above
+ */
+typedef struct {
+	const char *mnemonic; /** assembler syntax, NULL for an undocumented opcode */
+	uint8_t length; /** bytes in the instruction, prefixes included */
+	uint8_t tstates; /** T-states, prefixes included */
+	uint8_t taken; /** T-states added for a taken branch or a repeat */
+	uint8_t kind; /** one of the OPCODE_ kinds */
+} opcode;
+
+extern const opcode opcodes_base[256];
+extern const opcode opcodes_cb[256];
+extern const opcode opcodes_ed[256];
+extern const opcode opcodes_dd[256];
+extern const opcode opcodes_fd[256];
+extern const opcode opcodes_ddcb[256];
+extern const opcode opcodes_fdcb[256];
+
+#endif /* defined(__PZ80emu__opcodes__) */
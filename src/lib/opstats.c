@@ -0,0 +1,240 @@
+/** \file opstats.c
+ * Opcode frequency and sequence statistics, used to find the handlers
+ * and instruction sequences worth a fast path
+ */
+//
+//  opstats.c
+//  PZ80emu
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "opstats.h"
+
+/** Initial number of slots in a sequence table */
+#define OPSTATS_TABLE_SIZE 4096
+
+/** Prefix bytes of each opcode page, as written to the CSV output */
+static const char *opstats_prefixes[OPSTATS_PAGES] = {
+	"", "CB", "ED", "DD", "FD", "DDCB", "FDCB"
+};
+
+/** One counted opcode or opcode sequence, for sorting */
+typedef struct {
+	uint64_t key;
+	uint64_t count;
+} opstats_entry;
+
+/**
+ * Allocates the slots of a sequence table
+ * \param table table to initialize
+ * \param size number of slots, a power of two
+ */
+static void opstats_table_init(opstats_table *table, size_t size) {
+	if ((table->keys = calloc(size, sizeof (uint64_t))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	if ((table->counts = calloc(size, sizeof (uint64_t))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	table->size = size;
+	table->used = 0;
+}
+
+/**
+ * Allocates new, zeroed opcode statistics
+ * \return Pointer to the allocated statistics.
+ */
+opstats *opstats_new(void) {
+	opstats *stats;
+	if ((stats = calloc(1, sizeof (opstats))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	opstats_table_init(&stats->pairs, OPSTATS_TABLE_SIZE);
+	opstats_table_init(&stats->triples, OPSTATS_TABLE_SIZE);
+
+	return stats;
+}
+
+/**
+ * Frees opcode statistics
+ * \param stats statistics to free
+ */
+void opstats_free(opstats *stats) {
+	free(stats->pairs.keys);
+	free(stats->pairs.counts);
+	free(stats->triples.keys);
+	free(stats->triples.counts);
+	free(stats);
+}
+
+/**
+ * Finds the slot holding a key, or the empty slot it would go in
+ * \param table table to search
+ * \param key stored key to look for
+ * \return Index of the slot.
+ */
+static size_t opstats_slot(opstats_table *table, uint64_t key) {
+	size_t mask = table->size - 1;
+	size_t slot = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+
+	while (table->keys[slot] != 0 && table->keys[slot] != key) {
+		slot = (slot + 1) & mask;
+	}
+
+	return slot;
+}
+
+/**
+ * Doubles the number of slots in a sequence table
+ * \param table table to grow
+ */
+static void opstats_grow(opstats_table *table) {
+	opstats_table old = *table;
+
+	opstats_table_init(table, old.size * 2);
+
+	for (size_t i = 0; i < old.size; i++) {
+		if (old.keys[i] != 0) {
+			size_t slot = opstats_slot(table, old.keys[i]);
+
+			table->keys[slot] = old.keys[i];
+			table->counts[slot] = old.counts[i];
+			table->used++;
+		}
+	}
+
+	free(old.keys);
+	free(old.counts);
+}
+
+/**
+ * Counts one occurrence of an opcode sequence
+ * \param table table to update
+ * \param key opcode sequence, 11 bits per opcode
+ */
+void opstats_count(opstats_table *table, uint64_t key) {
+	// keys are stored off by one so that 0 can mark empty slots
+	size_t slot = opstats_slot(table, key + 1);
+
+	if (table->keys[slot] == 0) {
+		// keep the table at most half full
+		if (2 * (table->used + 1) > table->size) {
+			opstats_grow(table);
+			slot = opstats_slot(table, key + 1);
+		}
+
+		table->keys[slot] = key + 1;
+		table->used++;
+	}
+
+	table->counts[slot]++;
+}
+
+/**
+ * Orders entries by descending count, then by key
+ */
+static int opstats_entry_compare(const void *a, const void *b) {
+	const opstats_entry *x = a;
+	const opstats_entry *y = b;
+
+	if (x->count != y->count) {
+		return (x->count < y->count) ? 1 : -1;
+	}
+
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+/**
+ * Writes a sequence of opcodes as space separated prefix+opcode hex
+ * \param out stream to write to
+ * \param key opcode sequence, 11 bits per opcode
+ * \param length number of opcodes in the sequence
+ */
+static void opstats_write_sequence(FILE *out, uint64_t key, int length) {
+	for (int i = length - 1; i >= 0; i--) {
+		uint32_t id = (uint32_t)(key >> (11 * i)) & 0x7FF;
+
+		fprintf(out, "%s%s%02X", (i == length - 1) ? "" : " ", opstats_prefixes[id >> 8], id & 0xFF);
+	}
+}
+
+/**
+ * Writes the entries of a sequence table, most frequent first
+ * \param table table to write
+ * \param out stream to write to
+ * \param kind name of the sequence kind, for the first CSV column
+ * \param length number of opcodes in each sequence
+ * \param limit maximum number of sequences to write, 0 for all of them
+ */
+static void opstats_write_table(opstats_table *table, FILE *out, const char *kind, int length, int limit) {
+	opstats_entry *entries;
+	uint64_t total = 0;
+	int count = 0;
+
+	if ((entries = malloc((table->used + 1) * sizeof (opstats_entry))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	for (size_t i = 0; i < table->size; i++) {
+		if (table->keys[i] != 0) {
+			entries[count].key = table->keys[i] - 1;
+			entries[count].count = table->counts[i];
+			total += table->counts[i];
+			count++;
+		}
+	}
+
+	qsort(entries, (size_t)count, sizeof (opstats_entry), opstats_entry_compare);
+
+	if (limit <= 0 || limit > count) {
+		limit = count;
+	}
+
+	for (int i = 0; i < limit; i++) {
+		fprintf(out, "%s,", kind);
+		opstats_write_sequence(out, entries[i].key, length);
+		fprintf(out, ",%llu,%.4f\n", (unsigned long long)entries[i].count,
+		        100.0 * (double)entries[i].count / (double)total);
+	}
+
+	free(entries);
+}
+
+/**
+ * Writes the statistics as CSV: every opcode that ran, then the most
+ * frequent opcode pairs and triples, each sorted by count
+ * \param stats statistics to write
+ * \param out stream to write to
+ * \param limit maximum number of pairs and of triples to write, 0 for all
+ */
+void opstats_write_csv(opstats *stats, FILE *out, int limit) {
+	opstats_table opcodes;
+
+	// reuse the sequence table writer for the single opcodes
+	opstats_table_init(&opcodes, OPSTATS_PAGES * 256 * 2);
+
+	for (int page = 0; page < OPSTATS_PAGES; page++) {
+		for (int opcode = 0; opcode < 256; opcode++) {
+			if (stats->counts[page][opcode] != 0) {
+				size_t slot = opstats_slot(&opcodes, (uint64_t)((page << 8) | opcode) + 1);
+
+				opcodes.keys[slot] = (uint64_t)((page << 8) | opcode) + 1;
+				opcodes.counts[slot] = stats->counts[page][opcode];
+				opcodes.used++;
+			}
+		}
+	}
+
+	fprintf(out, "kind,sequence,count,percent\n");
+	opstats_write_table(&opcodes, out, "opcode", 1, 0);
+	opstats_write_table(&stats->pairs, out, "pair", 2, limit);
+	opstats_write_table(&stats->triples, out, "triple", 3, limit);
+
+	free(opcodes.keys);
+	free(opcodes.counts);
+}
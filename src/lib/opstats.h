@@ -0,0 +1,94 @@
+/** \file opstats.h
+ *  \brief Opcode frequency and sequence statistics
+ */
+//
+//  opstats.h
+//  PZ80emu
+//
+
+#ifndef __PZ80emu__opstats__
+#define __PZ80emu__opstats__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/** Opcode pages, one per prefix combination */
+enum {
+	OPSTATS_BASE, /**< unprefixed opcodes */
+	OPSTATS_CB, /**< CB prefixed opcodes */
+	OPSTATS_ED, /**< ED prefixed opcodes */
+	OPSTATS_DD, /**< DD prefixed opcodes */
+	OPSTATS_FD, /**< FD prefixed opcodes */
+	OPSTATS_DDCB, /**< DD CB prefixed opcodes */
+	OPSTATS_FDCB, /**< FD CB prefixed opcodes */
+	OPSTATS_PAGES /**< number of opcode pages */
+};
+
+/** Open addressing hash table counting opcode sequences */
+typedef struct {
+	uint64_t *keys; /** sequence keys, 0 marks an empty slot */
+	uint64_t *counts; /** number of times each sequence ran */
+	size_t size; /** number of slots, always a power of two */
+	size_t used; /** number of occupied slots */
+} opstats_table;
+
+/**
+ * Opcode statistics for an instrumented run()
+ * \brief Opcode, opcode pair and opcode triple counters
+ */
+typedef struct opstats {
+	/** Number of times each opcode ran, per prefix page */
+	uint64_t counts[OPSTATS_PAGES][256];
+
+	/** Number of times each pair of consecutive opcodes ran */
+	opstats_table pairs;
+
+	/** Number of times each run of three consecutive opcodes ran */
+	opstats_table triples;
+
+	/** Previous two opcodes, most recent in the low bits */
+	uint32_t history;
+
+	/** Number of valid opcodes in the history */
+	int history_length;
+} opstats;
+
+opstats *opstats_new(void);
+void opstats_free(opstats *stats);
+void opstats_count(opstats_table *table, uint64_t key);
+void opstats_write_csv(opstats *stats, FILE *out, int limit);
+
+/**
+ * Counts one executed instruction and the sequences it ends
+ * \param stats statistics to update
+ * \param page opcode page the instruction was decoded from
+ * \param opcode final opcode byte of the instruction
+ */
+static inline void opstats_step(opstats *stats, int page, uint8_t opcode) {
+	uint32_t id = ((uint32_t)page << 8) | opcode;
+
+	stats->counts[page][opcode]++;
+
+	if (stats->history_length >= 1) {
+		opstats_count(&stats->pairs, ((uint64_t)(stats->history & 0x7FF) << 11) | id);
+	}
+
+	if (stats->history_length >= 2) {
+		opstats_count(&stats->triples, ((uint64_t)stats->history << 11) | id);
+	}
+
+	stats->history = ((stats->history << 11) | id) & 0x3FFFFF;
+	if (stats->history_length < 2) {
+		stats->history_length++;
+	}
+}
+
+/**
+ * Ends the current opcode sequence, e.g. when an interrupt is taken
+ * \param stats statistics to update
+ */
+static inline void opstats_break(opstats *stats) {
+	stats->history_length = 0;
+}
+
+#endif /* defined(__PZ80emu__opstats__) */
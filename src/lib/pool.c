@@ -0,0 +1,140 @@
+/** \file pool.c
+ * Hands out machines from one zero-filled mapping instead of allocating
+ * a cpu and 64K of memory per machine. The memory of every machine comes
+ * first, page aligned, followed by the cache line aligned cpus. Giving a
+ * machine back clears only the pages its cpu marked dirty, which for a
+ * short run is a few kilobytes instead of all 64K.
+ */
+//
+//  pool.c
+//  PZ80emu
+//
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "z80.h"
+#include "memory.h"
+#include "pool.h"
+
+/**
+ * Creates a pool of machines, all of them free
+ * \param count number of machines, at least 1
+ * \param huge nonzero to back the pool with huge pages: reserved ones if
+ * the system has enough, transparent ones otherwise
+ * \return Pointer to the allocated pool, NULL if the pool can't be
+ * mapped, with errno set.
+ */
+pool *pool_new(size_t count, int huge) {
+	pool *p;
+
+	if ((p = calloc(1, sizeof (pool))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	p->count = count;
+	p->size = count * (MEMSIZE + sizeof(pool_machine));
+	p->memory = MAP_FAILED;
+
+	if (huge) {
+		size_t size = (p->size + POOL_HUGE_PAGE - 1) & ~(POOL_HUGE_PAGE - 1);
+
+		p->memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p->memory != MAP_FAILED) {
+			p->size = size;
+			p->huge = 1;
+		}
+	}
+
+	if (p->memory == MAP_FAILED) {
+		if ((p->memory = mmap(NULL, p->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+			free(p);
+			return NULL;
+		}
+
+		if (huge) {
+			(void) madvise(p->memory, p->size, MADV_HUGEPAGE);
+		}
+	}
+
+	// MEMSIZE keeps the cpus after the memory cache line aligned
+	p->machines = (pool_machine *)&p->memory[count * MEMSIZE];
+
+	// the first machine handed out is the first one in the mapping
+	for (size_t i = count; i-- > 0; ) {
+		p->machines[i].memory = &p->memory[i * MEMSIZE];
+		p->machines[i].next = p->free;
+		p->free = &p->machines[i];
+	}
+
+	return p;
+}
+
+/**
+ * Frees a pool and every machine in it, handed out or not
+ * \param p pool to free
+ */
+void pool_free(pool *p) {
+	(void) munmap(p->memory, p->size);
+	free(p);
+}
+
+/**
+ * Takes a machine out of the pool: a cpu as new_cpu() gives it and
+ * memory that is all zero
+ * \param p pool to take the machine from
+ * \return Machine, NULL if every machine is handed out.
+ */
+pool_machine *pool_acquire(pool *p) {
+	pool_machine *machine = p->free;
+
+	if (machine != NULL) {
+		p->free = machine->next;
+		machine->next = NULL;
+	}
+
+	return machine;
+}
+
+/**
+ * Gives a machine back to the pool, clearing the pages of memory its cpu
+ * marked dirty and the whole cpu
+ * \param p pool the machine came from
+ * \param machine machine to give back
+ */
+void pool_release(pool *p, pool_machine *machine) {
+	uint64_t dirty = machine->cpu.dirty;
+
+	while (dirty != 0) {
+		int page = __builtin_ctzll(dirty);
+
+		memset(&machine->memory[page << DIRTY_SHIFT], 0, 1 << DIRTY_SHIFT);
+		dirty &= dirty - 1;
+		p->cleared++;
+	}
+
+	memset(&machine->cpu, 0, sizeof(machine->cpu));
+
+	machine->next = p->free;
+	p->free = machine;
+}
+
+/**
+ * Copies bytes into the memory of a machine, marking them dirty
+ * \param machine machine to load
+ * \param address where the bytes go
+ * \param data bytes to copy
+ * \param length number of bytes
+ * \return 0 on success, -1 if the bytes run past the end of memory.
+ */
+int pool_load(pool_machine *machine, uint16_t address, const uint8_t *data, size_t length) {
+	if (length > (size_t)(MEMSIZE - address)) {
+		return -1;
+	}
+
+	memcpy(&machine->memory[address], data, length);
+	mark_dirty(&machine->cpu, address, (long)length);
+
+	return 0;
+}
@@ -0,0 +1,57 @@
+/** \file pool.h
+ *  \brief Pool of preallocated machines for batch runs
+ */
+//
+//  pool.h
+//  PZ80emu
+//
+
+#ifndef __PZ80emu__pool__
+#define __PZ80emu__pool__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "z80.h"
+#include "memory.h"
+
+/** Alignment of each machine, a cache line so no two share one */
+#define POOL_ALIGN 64
+
+/** Size of a huge page, which huge page backed pools are rounded up to */
+#define POOL_HUGE_PAGE (2UL << 20)
+
+/**
+ * Machine handed out by a pool
+ * \brief A cpu and its memory
+ */
+typedef struct pool_machine {
+	z80 cpu; /** cpu, as new_cpu() gives it when handed out */
+	uint8_t *memory; /** MEMSIZE bytes of memory, all zero when handed out */
+	struct pool_machine *next; /** next free machine, while in the pool */
+} __attribute__((aligned(POOL_ALIGN))) pool_machine;
+
+/**
+ * Fixed set of machines in one mapping, reused instead of allocated.
+ * A machine going back to the pool has only the pages of memory its cpu
+ * marked dirty cleared, so writes made outside run() have to be marked
+ * with mark_dirty() or made through pool_load(). Not thread safe, use a
+ * pool per thread.
+ * \brief Free list of machines over one mapping
+ */
+typedef struct {
+	size_t count; /** number of machines */
+	size_t size; /** size of the mapping */
+	int huge; /** 1 if the mapping is made of reserved huge pages */
+	uint8_t *memory; /** start of the mapping, the memory of every machine */
+	pool_machine *machines; /** every machine, after the memory */
+	pool_machine *free; /** machines ready to be handed out */
+	long cleared; /** pages of memory cleared when machines came back */
+} pool;
+
+pool *pool_new(size_t count, int huge);
+void pool_free(pool *p);
+pool_machine *pool_acquire(pool *p);
+void pool_release(pool *p, pool_machine *machine);
+int pool_load(pool_machine *machine, uint16_t address, const uint8_t *data, size_t length);
+
+#endif /* defined(__PZ80emu__pool__) */
@@ -0,0 +1,41 @@
+/** \file probes.h
+ *  \brief USDT probes for SystemTap, bpftrace and perf
+ *
+ * Probes are compiled in when configure finds sys/sdt.h, and are then a
+ * single NOP each until a tracer attaches to them, so release builds
+ * keep them. All probes belong to the provider pz80, for example:
+ *
+ *     bpftrace -e 'usdt:./PZ80emu:pz80:port_out { printf("%x %x\n", arg0, arg1); }'
+ *
+ * | Probe         | Arguments                                    |
+ * |---------------|----------------------------------------------|
+ * | run_start     | PC, instructions asked for                   |
+ * | run_end       | PC, instructions run or -1 on a trap         |
+ * | interrupt     | PC interrupted, handler address, T-states    |
+ * | port_in       | port, byte read                              |
+ * | port_out      | port, byte written                           |
+ * | trap          | TRAP_ reason, PC                             |
+ * | bank_select   | slot, bank                                   |
+ */
+//
+//  probes.h
+//  PZ80emu
+//
+
+#ifndef __PZ80emu__probes__
+#define __PZ80emu__probes__
+
+#ifdef PZ80_PROBES
+#include <sys/sdt.h>
+
+/** Fires probe \p name of the pz80 provider with two arguments */
+#define PROBE2(name, a, b) DTRACE_PROBE2(pz80, name, a, b)
+
+/** Fires probe \p name of the pz80 provider with three arguments */
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(pz80, name, a, b, c)
+#else
+#define PROBE2(name, a, b) ((void)0)
+#define PROBE3(name, a, b, c) ((void)0)
+#endif
+
+#endif /* defined(__PZ80emu__probes__) */
@@ -0,0 +1,584 @@
+/** \file profile.c
+ * Per-PC hot-spot profiler with call-graph attribution
+ */
+//
+//  profile.c
+//  PZ80emu
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include "profile.h"
+
+/** Maximum length of a symbol name in a symbol map */
+#define SYMBOL_NAME_MAX 127
+
+/** Buffer size for an address formatted as symbol+offset */
+#define SYMBOL_LABEL_MAX (SYMBOL_NAME_MAX + 16)
+
+/** Maximum length of one frame in a folded stack line */
+#define FOLDED_FRAME_MAX (SYMBOL_LABEL_MAX + 8)
+
+/** Maximum length of a folded stack line, enough for a full shadow stack */
+#define FOLDED_PATH_MAX ((PROFILE_STACK_DEPTH + 1) * FOLDED_FRAME_MAX)
+
+/** One line of the sorted hot-spot report */
+typedef struct {
+	uint16_t pc;
+	uint64_t hits;
+	uint64_t tstates;
+} profile_entry;
+
+/** Per-function totals for the call-graph report */
+typedef struct {
+	uint16_t address;
+	uint64_t calls;
+	uint64_t inclusive;
+	uint64_t exclusive;
+} profile_function;
+
+/**
+ * Allocates a new, zeroed profile
+ * \return Pointer to the allocated profile.
+ */
+profile *profile_new(void) {
+	profile *prof;
+	if ((prof = calloc(1, sizeof (profile))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	prof->current = &prof->root;
+
+	return prof;
+}
+
+/**
+ * Frees every node below a call tree node
+ * \param node call tree node whose children should be freed
+ */
+static void profile_free_children(profile_node *node) {
+	profile_node *child = node->child;
+
+	while (child != NULL) {
+		profile_node *next = child->sibling;
+
+		profile_free_children(child);
+		free(child);
+		child = next;
+	}
+}
+
+/**
+ * Frees a profile and its call tree
+ * \param prof profile to free
+ */
+void profile_free(profile *prof) {
+	profile_free_children(&prof->root);
+
+	for (int i = 0; i < prof->symbol_count; i++) {
+		free(prof->symbols[i].name);
+	}
+	free(prof->symbols);
+
+	free(prof);
+}
+
+/**
+ * Pushes a frame onto the shadow call stack
+ * \param prof profile to update
+ * \param target address of the routine being entered
+ * \param return_address address the routine will return to
+ * \param interrupt non-zero if the routine is entered by an interrupt
+ */
+static void profile_enter(profile *prof, uint16_t target, uint16_t return_address, int interrupt) {
+	profile_node *node;
+
+	if (prof->depth == PROFILE_STACK_DEPTH) {
+		prof->overflows++;
+		return;
+	}
+
+	// find the call path below the current frame, or start a new one
+	for (node = prof->current->child; node != NULL; node = node->sibling) {
+		if (node->address == target && node->interrupt == interrupt) {
+			break;
+		}
+	}
+
+	if (node == NULL) {
+		if ((node = calloc(1, sizeof (profile_node))) == NULL) {
+			exit(EXIT_FAILURE);
+		}
+
+		node->address = target;
+		node->interrupt = interrupt;
+		node->parent = prof->current;
+		node->sibling = prof->current->child;
+		prof->current->child = node;
+	}
+
+	prof->stack[prof->depth].return_address = return_address;
+	prof->stack[prof->depth].node = prof->current;
+	prof->depth++;
+
+	node->calls++;
+	prof->current = node;
+}
+
+/**
+ * Records a subroutine call or RST on the shadow call stack
+ * \param prof profile to update
+ * \param target address of the called routine
+ * \param return_address address the call will return to
+ */
+void profile_call(profile *prof, uint16_t target, uint16_t return_address) {
+	profile_enter(prof, target, return_address, 0);
+}
+
+/**
+ * Records an accepted interrupt on the shadow call stack
+ * \param prof profile to update
+ * \param target address of the interrupt service routine
+ * \param return_address address of the interrupted instruction
+ * \param tstates number of T-states the interrupt acknowledge took
+ */
+void profile_interrupt(profile *prof, uint16_t target, uint16_t return_address, int tstates) {
+	profile_enter(prof, target, return_address, 1);
+	prof->current->tstates += tstates;
+}
+
+/**
+ * Records a RET, RETI or RETN on the shadow call stack
+ *
+ * Frames are popped up to the one whose return address matches, so code
+ * that discards stack frames (longjmp-style) stays in sync. A RET that
+ * matches no frame is a computed jump and leaves the stack alone.
+ * \param prof profile to update
+ * \param address address the RET instruction jumped to
+ */
+void profile_ret(profile *prof, uint16_t address) {
+	for (int i = prof->depth - 1; i >= 0; i--) {
+		if (prof->stack[i].return_address == address) {
+			prof->current = prof->stack[i].node;
+			prof->depth = i;
+			return;
+		}
+	}
+}
+
+/**
+ * Parses a number from a symbol map
+ *
+ * Accepts the $1234, 0x1234, #1234 and 1234h notations for hexadecimal;
+ * anything else is read in \p base.
+ * \param text token to parse
+ * \param base base of numbers without a hexadecimal marker
+ * \param value set to the parsed number
+ * \return 1 if the whole token was a number, 0 otherwise.
+ */
+static int profile_parse_number(const char *text, int base, long *value) {
+	char digits[SYMBOL_NAME_MAX + 1];
+	size_t length = strlen(text);
+	char *end;
+
+	if (length == 0 || length > SYMBOL_NAME_MAX) {
+		return 0;
+	}
+
+	if (text[0] == '$' || text[0] == '#') {
+		text++;
+		base = 16;
+	} else if (length > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+		text += 2;
+		base = 16;
+	}
+
+	(void) strcpy(digits, text);
+	length = strlen(digits);
+
+	if (length > 1 && (digits[length - 1] == 'h' || digits[length - 1] == 'H')) {
+		digits[length - 1] = '\0';
+		base = 16;
+	}
+
+	*value = strtol(digits, &end, base);
+
+	return digits[0] != '\0' && *end == '\0';
+}
+
+/**
+ * Orders symbols by address, then by name
+ */
+static int profile_symbol_compare(const void *a, const void *b) {
+	const profile_symbol *x = a;
+	const profile_symbol *y = b;
+
+	if (x->address != y->address) {
+		return (int)x->address - (int)y->address;
+	}
+
+	return strcmp(x->name, y->name);
+}
+
+/**
+ * Loads symbol names from an assembler symbol map or listing
+ *
+ * Understands "name: equ $1234" style label files as written by z80asm,
+ * "name EQU 0x1234" and "name = 1234h" definitions, and "1234 name" map
+ * lines. Anything else, including comments, is ignored.
+ * \param prof profile to add the symbols to
+ * \param filename String containing the filename of the symbol map.
+ * \return Number of symbols loaded, or -1 if the file could not be read.
+ */
+int profile_load_symbols(profile *prof, const char *filename) {
+	char line[256];
+	int loaded = 0;
+
+	FILE *infile = fopen(filename, "r");
+	if (infile == NULL) {
+		return -1;
+	}
+
+	while (fgets(line, sizeof (line), infile) != NULL) {
+		char first[SYMBOL_NAME_MAX + 1], second[SYMBOL_NAME_MAX + 1], third[SYMBOL_NAME_MAX + 1];
+		char *name;
+		long value;
+
+		int fields = sscanf(line, "%127s %127s %127s", first, second, third);
+
+		if (fields >= 3 && (strcasecmp(second, "equ") == 0 || strcmp(second, "=") == 0)
+		    && profile_parse_number(third, 10, &value)) {
+			name = first;
+		} else if (fields >= 2 && profile_parse_number(first, 16, &value)) {
+			name = second;
+		} else {
+			continue;
+		}
+
+		// drop the label colon
+		if (name[strlen(name) - 1] == ':') {
+			name[strlen(name) - 1] = '\0';
+		}
+
+		if (name[0] == '\0' || value < 0 || value > 0xFFFF) {
+			continue;
+		}
+
+		profile_symbol *symbols = realloc(prof->symbols, (size_t)(prof->symbol_count + 1) * sizeof (profile_symbol));
+		if (symbols == NULL) {
+			exit(EXIT_FAILURE);
+		}
+		prof->symbols = symbols;
+
+		if ((prof->symbols[prof->symbol_count].name = strdup(name)) == NULL) {
+			exit(EXIT_FAILURE);
+		}
+		prof->symbols[prof->symbol_count].address = (uint16_t)value;
+		prof->symbol_count++;
+		loaded++;
+	}
+
+	if ((fclose(infile)) != 0) {
+		return -1;
+	}
+
+	qsort(prof->symbols, (size_t)prof->symbol_count, sizeof (profile_symbol), profile_symbol_compare);
+
+	return loaded;
+}
+
+/**
+ * Finds the symbol at or closest below an address
+ * \param prof profile holding the symbols
+ * \param address address to look up
+ * \return The symbol, or NULL if no symbol lies at or below the address.
+ */
+static const profile_symbol *profile_find_symbol(profile *prof, uint16_t address) {
+	int low = 0, high = prof->symbol_count - 1;
+	const profile_symbol *found = NULL;
+
+	while (low <= high) {
+		int middle = (low + high) / 2;
+
+		if (prof->symbols[middle].address <= address) {
+			found = &prof->symbols[middle];
+			low = middle + 1;
+		} else {
+			high = middle - 1;
+		}
+	}
+
+	// prefer the first of several symbols sharing the address
+	while (found != NULL && found > prof->symbols && (found - 1)->address == found->address) {
+		found--;
+	}
+
+	return found;
+}
+
+/**
+ * Looks up the name of an address
+ * \param prof profile holding the symbols
+ * \param address address to look up
+ * \return Name of the symbol at exactly that address, or NULL.
+ */
+const char *profile_symbol_name(profile *prof, uint16_t address) {
+	const profile_symbol *symbol = profile_find_symbol(prof, address);
+
+	if (symbol == NULL || symbol->address != address) {
+		return NULL;
+	}
+
+	return symbol->name;
+}
+
+/**
+ * Formats an address as symbol+offset, or as plain hex without symbols
+ * \param prof profile holding the symbols
+ * \param address address to format
+ * \param buffer buffer to format into
+ * \param length size of the buffer
+ * \return The buffer.
+ */
+static char *profile_format_address(profile *prof, uint16_t address, char *buffer, size_t length) {
+	const profile_symbol *symbol = profile_find_symbol(prof, address);
+
+	if (symbol == NULL) {
+		(void) snprintf(buffer, length, "0x%04X", address);
+	} else if (symbol->address == address) {
+		(void) snprintf(buffer, length, "%s", symbol->name);
+	} else {
+		(void) snprintf(buffer, length, "%s+0x%X", symbol->name, address - symbol->address);
+	}
+
+	return buffer;
+}
+
+/**
+ * Orders report entries by descending T-states, then by address
+ */
+static int profile_entry_compare(const void *a, const void *b) {
+	const profile_entry *x = a;
+	const profile_entry *y = b;
+
+	if (x->tstates != y->tstates) {
+		return (x->tstates < y->tstates) ? 1 : -1;
+	}
+
+	return (int)x->pc - (int)y->pc;
+}
+
+/**
+ * Writes the hottest addresses of a profile, sorted by T-states
+ * \param prof profile to report on
+ * \param out stream to write the report to
+ * \param limit maximum number of addresses to list, 0 for all of them
+ */
+void profile_write_report(profile *prof, FILE *out, int limit) {
+	profile_entry *entries;
+	uint64_t total_hits = 0, total_tstates = 0;
+	int count = 0;
+
+	if ((entries = malloc(PROFILE_ADDRESSES * sizeof (profile_entry))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	for (int pc = 0; pc < PROFILE_ADDRESSES; pc++) {
+		if (prof->hits[pc] == 0) {
+			continue;
+		}
+
+		entries[count].pc = (uint16_t)pc;
+		entries[count].hits = prof->hits[pc];
+		entries[count].tstates = prof->tstates[pc];
+		total_hits += prof->hits[pc];
+		total_tstates += prof->tstates[pc];
+		count++;
+	}
+
+	qsort(entries, (size_t)count, sizeof (profile_entry), profile_entry_compare);
+
+	if (limit <= 0 || limit > count) {
+		limit = count;
+	}
+
+	fprintf(out, "# %llu instructions, %llu T-states, %d addresses\n",
+	        (unsigned long long)total_hits, (unsigned long long)total_tstates, count);
+	fprintf(out, "# address\thits\tT-states\t%%T\tT/hit\tsymbol\n");
+
+	for (int i = 0; i < limit; i++) {
+		char name[SYMBOL_LABEL_MAX];
+
+		fprintf(out, "%04X\t%llu\t%llu\t%.2f\t%.2f\t%s\n",
+		        entries[i].pc,
+		        (unsigned long long)entries[i].hits,
+		        (unsigned long long)entries[i].tstates,
+		        100.0 * (double)entries[i].tstates / (double)total_tstates,
+		        (double)entries[i].tstates / (double)entries[i].hits,
+		        profile_format_address(prof, entries[i].pc, name, sizeof (name)));
+	}
+
+	free(entries);
+}
+
+/**
+ * Accumulates a call tree node and its children into per-function totals
+ *
+ * Inclusive time is only counted for the outermost activation of a
+ * function, so recursive routines are not counted several times over.
+ * \param node call tree node to accumulate
+ * \param functions per-address totals, indexed by entry address
+ * \param root totals for code outside any tracked call
+ * \param active number of activations of each address on the current path
+ * \return T-states spent in the node and everything it called.
+ */
+static uint64_t profile_sum_node(profile_node *node, profile_function *functions, profile_function *root, int *active) {
+	profile_function *function = (node->parent == NULL) ? root : &functions[node->address];
+	uint64_t total = node->tstates;
+
+	function->calls += node->calls;
+	function->exclusive += node->tstates;
+	active[node->address] += (node->parent != NULL);
+
+	for (profile_node *child = node->child; child != NULL; child = child->sibling) {
+		total += profile_sum_node(child, functions, root, active);
+	}
+
+	active[node->address] -= (node->parent != NULL);
+
+	if (node->parent == NULL || active[node->address] == 0) {
+		function->inclusive += total;
+	}
+
+	return total;
+}
+
+/**
+ * Orders functions by descending inclusive T-states, then by address
+ */
+static int profile_function_compare(const void *a, const void *b) {
+	const profile_function *x = a;
+	const profile_function *y = b;
+
+	if (x->inclusive != y->inclusive) {
+		return (x->inclusive < y->inclusive) ? 1 : -1;
+	}
+
+	return (int)x->address - (int)y->address;
+}
+
+/**
+ * Writes inclusive and exclusive T-states per called routine, sorted by
+ * inclusive T-states
+ * \param prof profile to report on
+ * \param out stream to write the report to
+ * \param limit maximum number of routines to list, 0 for all of them
+ */
+void profile_write_functions(profile *prof, FILE *out, int limit) {
+	profile_function *functions, root = { 0, 0, 0, 0 };
+	int *active;
+	int count = 0;
+
+	if ((functions = calloc(PROFILE_ADDRESSES, sizeof (profile_function))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	if ((active = calloc(PROFILE_ADDRESSES, sizeof (int))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	uint64_t total = profile_sum_node(&prof->root, functions, &root, active);
+
+	// compact the called routines to the front of the table
+	for (int address = 0; address < PROFILE_ADDRESSES; address++) {
+		if (functions[address].calls == 0) {
+			continue;
+		}
+
+		functions[count] = functions[address];
+		functions[count].address = (uint16_t)address;
+		count++;
+	}
+
+	qsort(functions, (size_t)count, sizeof (profile_function), profile_function_compare);
+
+	if (limit <= 0 || limit > count) {
+		limit = count;
+	}
+
+	fprintf(out, "# %d routines, %llu T-states, %llu untracked calls\n",
+	        count, (unsigned long long)total, (unsigned long long)prof->overflows);
+	fprintf(out, "# routine\tcalls\tinclusive\t%%incl\texclusive\t%%excl\n");
+	fprintf(out, "root\t-\t%llu\t%.2f\t%llu\t%.2f\n",
+	        (unsigned long long)root.inclusive,
+	        total ? 100.0 * (double)root.inclusive / (double)total : 0.0,
+	        (unsigned long long)root.exclusive,
+	        total ? 100.0 * (double)root.exclusive / (double)total : 0.0);
+
+	for (int i = 0; i < limit; i++) {
+		char name[SYMBOL_LABEL_MAX];
+
+		fprintf(out, "%s\t%llu\t%llu\t%.2f\t%llu\t%.2f\n",
+		        profile_format_address(prof, functions[i].address, name, sizeof (name)),
+		        (unsigned long long)functions[i].calls,
+		        (unsigned long long)functions[i].inclusive,
+		        total ? 100.0 * (double)functions[i].inclusive / (double)total : 0.0,
+		        (unsigned long long)functions[i].exclusive,
+		        total ? 100.0 * (double)functions[i].exclusive / (double)total : 0.0);
+	}
+
+	free(active);
+	free(functions);
+}
+
+/**
+ * Writes one call tree node and its children in folded-stack format
+ * \param prof profile holding the symbols
+ * \param node call tree node to write
+ * \param out stream to write to
+ * \param path buffer holding the ';' separated path of the parent frames
+ * \param length length of the path currently in the buffer
+ */
+static void profile_write_node(profile *prof, profile_node *node, FILE *out, char *path, int length) {
+	int parent_length = length;
+
+	if (node->parent != NULL) {
+		char name[SYMBOL_LABEL_MAX];
+
+		length += snprintf(path + length, FOLDED_FRAME_MAX, ";%s%s",
+		                   node->interrupt ? "irq:" : "",
+		                   profile_format_address(prof, node->address, name, sizeof (name)));
+	}
+
+	if (node->tstates > 0) {
+		fprintf(out, "%s %llu\n", path, (unsigned long long)node->tstates);
+	}
+
+	for (profile_node *child = node->child; child != NULL; child = child->sibling) {
+		profile_write_node(prof, child, out, path, length);
+	}
+
+	path[parent_length] = '\0';
+}
+
+/**
+ * Writes the call tree as folded stacks, one line per call path, suitable
+ * for flamegraph.pl and compatible tools
+ * \param prof profile to write
+ * \param out stream to write to
+ */
+void profile_write_folded(profile *prof, FILE *out) {
+	char *path;
+
+	if ((path = malloc(FOLDED_PATH_MAX)) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	(void) strcpy(path, "root");
+	profile_write_node(prof, &prof->root, out, path, 4);
+
+	free(path);
+}
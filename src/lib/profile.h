@@ -0,0 +1,100 @@
+/** \file profile.h
+ *  \brief Per-PC hot-spot and call-graph profiler
+ */
+//
+//  profile.h
+//  PZ80emu
+//
+
+#ifndef __PZ80emu__profile__
+#define __PZ80emu__profile__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/** Number of distinct program counter values tracked by the profiler */
+#define PROFILE_ADDRESSES 65536
+
+/** Maximum depth of the profiler's shadow call stack */
+#define PROFILE_STACK_DEPTH 256
+
+/** Node in the profiler's call tree, one per distinct call path */
+typedef struct profile_node {
+	uint16_t address; /** entry address of the called routine */
+	int interrupt; /** non-zero if the routine was entered by an interrupt */
+	uint64_t calls; /** number of times this call path was entered */
+	uint64_t tstates; /** T-states spent in this frame, excluding callees */
+	struct profile_node *parent; /** calling frame */
+	struct profile_node *child; /** first routine called from this frame */
+	struct profile_node *sibling; /** next routine called from the parent */
+} profile_node;
+
+/** Named address loaded from an assembler symbol map */
+typedef struct {
+	uint16_t address; /** value of the symbol */
+	char *name; /** name of the symbol */
+} profile_symbol;
+
+/** Frame on the profiler's shadow call stack */
+typedef struct {
+	uint16_t return_address; /** address the matching RET is expected to land on */
+	profile_node *node; /** call tree node of the caller */
+} profile_frame;
+
+/**
+ * Per-PC execution profile
+ * \brief Counters for a profiled run()
+ */
+typedef struct profile {
+	/** Number of times an instruction was fetched at each address */
+	uint64_t hits[PROFILE_ADDRESSES];
+
+	/** T-states spent executing the instruction at each address */
+	uint64_t tstates[PROFILE_ADDRESSES];
+
+	/** Root of the call tree, i.e. code not inside any tracked call */
+	profile_node root;
+
+	/** Call tree node instructions are currently attributed to */
+	profile_node *current;
+
+	/** Shadow call stack built from calls, RSTs, interrupts and returns */
+	profile_frame stack[PROFILE_STACK_DEPTH];
+
+	/** Number of frames on the shadow call stack */
+	int depth;
+
+	/** Calls that could not be tracked because the shadow stack was full */
+	uint64_t overflows;
+
+	/** Symbols sorted by address, NULL if no symbol map was loaded */
+	profile_symbol *symbols;
+
+	/** Number of loaded symbols */
+	int symbol_count;
+} profile;
+
+profile *profile_new(void);
+void profile_free(profile *prof);
+void profile_call(profile *prof, uint16_t target, uint16_t return_address);
+void profile_interrupt(profile *prof, uint16_t target, uint16_t return_address, int tstates);
+void profile_ret(profile *prof, uint16_t address);
+int profile_load_symbols(profile *prof, const char *filename);
+const char *profile_symbol_name(profile *prof, uint16_t address);
+void profile_write_report(profile *prof, FILE *out, int limit);
+void profile_write_functions(profile *prof, FILE *out, int limit);
+void profile_write_folded(profile *prof, FILE *out);
+
+/**
+ * Attributes one executed instruction to the profile
+ * \param prof profile to update
+ * \param pc address the instruction was fetched from
+ * \param tstates number of T-states the instruction took
+ */
+static inline void profile_step(profile *prof, uint16_t pc, int tstates) {
+	prof->hits[pc]++;
+	prof->tstates[pc] += tstates;
+	prof->current->tstates += tstates;
+}
+
+#endif /* defined(__PZ80emu__profile__) */
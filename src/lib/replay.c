@@ -0,0 +1,500 @@
+/** \file replay.c
+ * Deterministic record and replay: everything the cpu can't compute
+ * itself, port reads, host interrupts, host memory writes and other host
+ * input, goes into an append-only stream stamped with the cycle count.
+ * Replaying reads the recording in whole and feeds the same inputs back
+ * at the same points, keeping a second cursor on the next host event so
+ * the cpu can be stopped there, and checks the final state against a
+ * hash recorded at the end. Recording costs nothing per instruction,
+ * only per input.
+ */
+//
+//  replay.c
+//  PZ80emu
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "z80.h"
+#include "replay.h"
+
+/**
+ * Writes an unsigned LEB128 varint
+ */
+static void replay_put_varint(FILE *stream, uint64_t value) {
+	while (value >= 0x80) {
+		(void) putc((int)(value & 0x7F) | 0x80, stream);
+		value >>= 7;
+	}
+	(void) putc((int)value, stream);
+}
+
+/**
+ * Decodes an unsigned LEB128 varint from the recording
+ * \return 0 on success, -1 at the end of the recording or on an overlong varint.
+ */
+static int replay_get_varint(const replay *rep, size_t *offset, uint64_t *value) {
+	*value = 0;
+
+	for (int shift = 0; shift < 64 && *offset < rep->size; shift += 7) {
+		uint8_t c = rep->data[(*offset)++];
+
+		*value |= (uint64_t)(c & 0x7F) << shift;
+		if (!(c & 0x80)) {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Starts an event: its type and the cycles since the previous one
+ */
+static void replay_put_event(replay *rep, int type) {
+	(void) putc(type, rep->stream);
+	replay_put_varint(rep->stream, rep->cpu->cycles - rep->cycles);
+	rep->cycles = rep->cpu->cycles;
+	rep->events++;
+}
+
+/**
+ * Decodes the event following the given one in its place, type 0 at the
+ * end of the recording
+ */
+static void replay_decode(replay *rep, replay_event *event) {
+	size_t offset = event->offset;
+	uint64_t delta, address = 0, value = 0;
+	int type;
+
+	event->type = 0;
+	if (offset >= rep->size) {
+		return;
+	}
+
+	type = rep->data[offset++];
+	if (replay_get_varint(rep, &offset, &delta) != 0) {
+		rep->status = REPLAY_CORRUPT;
+		return;
+	}
+
+	switch (type) {
+	case REPLAY_INTERRUPT:
+		break;
+
+	case REPLAY_PORT_IN:
+	case REPLAY_WRITE:
+		if (replay_get_varint(rep, &offset, &address) != 0 || offset >= rep->size) {
+			rep->status = REPLAY_CORRUPT;
+			return;
+		}
+		value = rep->data[offset++];
+		break;
+
+	case REPLAY_INPUT:
+		// values are zigzag encoded, so EOF stays short
+		if (replay_get_varint(rep, &offset, &address) != 0 || replay_get_varint(rep, &offset, &value) != 0) {
+			rep->status = REPLAY_CORRUPT;
+			return;
+		}
+		value = (value >> 1) ^ -(value & 1);
+		break;
+
+	case REPLAY_END:
+		if (rep->size - offset < 8) {
+			rep->status = REPLAY_CORRUPT;
+			return;
+		}
+		event->hash = 0;
+		for (int i = 0; i < 8; i++) {
+			event->hash = (event->hash << 8) | rep->data[offset++];
+		}
+		break;
+
+	default:
+		rep->status = REPLAY_CORRUPT;
+		return;
+	}
+
+	event->offset = offset;
+	event->type = type;
+	event->cycles += delta;
+	event->address = (uint16_t)address;
+	event->value = (int)value;
+}
+
+/**
+ * Moves the host cursor on to the next host event or the end
+ */
+static void replay_find_host(replay *rep) {
+	while (rep->host.type == REPLAY_PORT_IN || rep->host.type == REPLAY_INPUT) {
+		replay_decode(rep, &rep->host);
+	}
+}
+
+/**
+ * Takes the next recorded event as replayed
+ */
+static void replay_take_event(replay *rep) {
+	int host = (rep->next.offset == rep->host.offset);
+
+	rep->events++;
+	replay_decode(rep, &rep->next);
+
+	if (host) {
+		rep->host = rep->next;
+		replay_find_host(rep);
+	}
+}
+
+/**
+ * Port read handler while recording, logs what the cpu's handler returned
+ */
+static uint8_t replay_record_port_in(void *context, uint16_t port) {
+	replay *rep = context;
+	uint8_t value = (rep->port_in != NULL) ? rep->port_in(rep->port_context, port) : 0xFF;
+
+	replay_put_event(rep, REPLAY_PORT_IN);
+	replay_put_varint(rep->stream, port);
+	(void) putc(value, rep->stream);
+
+	return value;
+}
+
+/**
+ * Port read handler while replaying, returns the recorded value. Reads
+ * are matched in order and by port; within a bulk block instruction the
+ * cycle count isn't advanced per read, so it isn't compared.
+ */
+static uint8_t replay_play_port_in(void *context, uint16_t port) {
+	replay *rep = context;
+	uint8_t value;
+
+	if (rep->next.type != REPLAY_PORT_IN || rep->next.address != port) {
+		if (rep->status == REPLAY_OK) {
+			rep->status = REPLAY_DESYNC;
+		}
+		return 0xFF;
+	}
+
+	value = (uint8_t)rep->next.value;
+	replay_take_event(rep);
+
+	return value;
+}
+
+/**
+ * Port write handler, passes writes on to the cpu's own handler
+ */
+static void replay_port_out(void *context, uint16_t port, uint8_t value) {
+	replay *rep = context;
+
+	if (rep->port_out != NULL) {
+		rep->port_out(rep->port_context, port, value);
+	}
+}
+
+/**
+ * Installs the replay between the cpu and its port handlers
+ */
+static replay *replay_new(z80 *cpu, FILE *stream, int mode) {
+	replay *rep;
+
+	if ((rep = calloc(1, sizeof (replay))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	rep->stream = stream;
+	rep->mode = mode;
+	rep->cpu = cpu;
+	rep->port_in = cpu->port_in;
+	rep->port_out = cpu->port_out;
+	rep->port_context = cpu->port_context;
+	rep->cycles = cpu->cycles;
+
+	cpu->port_in = (mode == REPLAY_RECORD) ? replay_record_port_in : replay_play_port_in;
+	cpu->port_out = replay_port_out;
+	cpu->port_context = rep;
+
+	return rep;
+}
+
+/**
+ * Starts recording a run's inputs; the cpu's port handlers keep working
+ * and what they return is logged
+ * \param cpu cpu to record, with its port handlers set up
+ * \param stream stream to append the events to
+ * \return Pointer to the allocated recorder.
+ */
+replay *replay_record(z80 *cpu, FILE *stream) {
+	(void) fputs(REPLAY_MAGIC, stream);
+
+	return replay_new(cpu, stream, REPLAY_RECORD);
+}
+
+/**
+ * Starts replaying a recording onto a cpu in the state the recording
+ * started from; port reads return the recorded values and the cpu's
+ * port read handler is not called
+ * \param cpu cpu to replay on
+ * \param stream recorded stream
+ * \return Pointer to the allocated player, NULL if the stream is not a recording.
+ */
+replay *replay_play(z80 *cpu, FILE *stream) {
+	size_t length = sizeof(REPLAY_MAGIC) - 1, size = 0, capacity = REPLAY_CHUNK;
+	uint8_t *data;
+	replay *rep;
+
+	if ((data = malloc(capacity)) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	for (size_t read; (read = fread(&data[size], 1, capacity - size, stream)) > 0; ) {
+		size += read;
+		if (size == capacity && (data = realloc(data, capacity *= 2)) == NULL) {
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (size < length || memcmp(data, REPLAY_MAGIC, length) != 0) {
+		free(data);
+		return NULL;
+	}
+
+	rep = replay_new(cpu, stream, REPLAY_PLAY);
+	rep->data = data;
+	rep->size = size;
+	rep->next.offset = length;
+	rep->next.cycles = cpu->cycles;
+	replay_decode(rep, &rep->next);
+	rep->host = rep->next;
+	replay_find_host(rep);
+
+	return rep;
+}
+
+/**
+ * Puts the cpu's own port handlers back and frees the replay, leaving
+ * the stream open
+ * \param rep replay to free
+ */
+void replay_free(replay *rep) {
+	rep->cpu->port_in = rep->port_in;
+	rep->cpu->port_out = rep->port_out;
+	rep->cpu->port_context = rep->port_context;
+	free(rep->data);
+	free(rep);
+}
+
+/**
+ * Asserts an interrupt from the host between runs; ignored while
+ * replaying, where the recorded ones are asserted
+ * \param rep replay of the cpu
+ */
+void replay_interrupt(replay *rep) {
+	if (rep->mode == REPLAY_RECORD) {
+		replay_put_event(rep, REPLAY_INTERRUPT);
+		rep->cpu->int_pending = 1;
+	}
+}
+
+/**
+ * Writes memory from the host between runs; ignored while replaying,
+ * where the recorded writes are made
+ * \param rep replay of the cpu
+ * \param memory memory of the cpu
+ * \param address address to write
+ * \param value byte to write
+ */
+void replay_write(replay *rep, uint8_t *memory, uint16_t address, uint8_t value) {
+	if (rep->mode == REPLAY_RECORD) {
+		replay_put_event(rep, REPLAY_WRITE);
+		replay_put_varint(rep->stream, address);
+		(void) putc(value, rep->stream);
+		memory[address] = value;
+		rep->cpu->dirty |= DIRTY_BIT(address);
+	}
+}
+
+/**
+ * Passes a host input the cpu consumes, such as a console character,
+ * through the replay
+ * \param rep replay of the cpu
+ * \param channel number telling inputs apart
+ * \param value input while recording, ignored while replaying
+ * \return The input, the recorded one while replaying.
+ */
+int replay_input(replay *rep, uint16_t channel, int value) {
+	if (rep->mode == REPLAY_RECORD) {
+		replay_put_event(rep, REPLAY_INPUT);
+		replay_put_varint(rep->stream, channel);
+		replay_put_varint(rep->stream, ((uint64_t)(int64_t)value << 1) ^ (uint64_t)((int64_t)value >> 63));
+		return value;
+	}
+
+	if (rep->next.type != REPLAY_INPUT || rep->next.address != channel) {
+		if (rep->status == REPLAY_OK) {
+			rep->status = REPLAY_DESYNC;
+		}
+		return value;
+	}
+
+	value = rep->next.value;
+	replay_take_event(rep);
+
+	return value;
+}
+
+/**
+ * Makes the recorded host interrupts and writes due at this cycle
+ */
+static void replay_host_events(replay *rep, uint8_t *memory) {
+	while ((rep->next.type == REPLAY_INTERRUPT || rep->next.type == REPLAY_WRITE) && rep->next.cycles == rep->cpu->cycles) {
+		if (rep->next.type == REPLAY_INTERRUPT) {
+			rep->cpu->int_pending = 1;
+		} else {
+			memory[rep->next.address] = (uint8_t)rep->next.value;
+			rep->cpu->dirty |= DIRTY_BIT(rep->next.address);
+		}
+		replay_take_event(rep);
+	}
+}
+
+/**
+ * Runs the cpu; while replaying, stops at each instruction boundary a
+ * host event was recorded at, closing in on it in slices that can't
+ * run past it
+ * \param rep replay of the cpu
+ * \param memory memory of the cpu
+ * \param runcycles number of instructions to run
+ * \return Count of instructions executed, -1 on a trap or when the
+ * replay went out of step.
+ */
+int replay_run(replay *rep, uint8_t *memory, long runcycles) {
+	z80 *cpu = rep->cpu;
+	long executed = 0;
+
+	if (rep->mode == REPLAY_RECORD) {
+		return run(cpu, memory, runcycles, 0);
+	}
+
+	while (executed < runcycles && rep->status == REPLAY_OK) {
+		long slice = runcycles - executed;
+		int count;
+
+		replay_host_events(rep, memory);
+
+		// port reads before the host event don't stop the cpu, so look past them
+		if (rep->host.type == REPLAY_INTERRUPT || rep->host.type == REPLAY_WRITE) {
+			uint64_t ahead;
+
+			if (rep->host.cycles < cpu->cycles) {
+				rep->status = REPLAY_DESYNC;
+				break;
+			}
+
+			ahead = (rep->host.cycles - cpu->cycles) / REPLAY_MAX_TSTATES;
+			if ((uint64_t)slice > ahead) {
+				slice = (ahead > 0) ? (long)ahead : 1;
+			}
+		}
+
+		if ((count = run(cpu, memory, slice, 0)) < 0) {
+			return -1;
+		}
+		executed += count;
+
+		if (cpu->trap.reason == TRAP_BREAKPOINT) {
+			break;
+		}
+	}
+
+	replay_host_events(rep, memory);
+
+	return (rep->status == REPLAY_OK) ? (int)executed : -1;
+}
+
+/**
+ * Ends the recording with a hash of the final state, or checks the
+ * final state of a replay against it
+ * \param rep replay of the cpu
+ * \param memory memory of the cpu
+ * \return REPLAY_OK if the replay reproduced the recording, or another of
+ * the REPLAY_ results.
+ */
+int replay_finish(replay *rep, const uint8_t *memory) {
+	uint64_t hash;
+
+	if (rep->mode == REPLAY_RECORD) {
+		hash = replay_hash(rep->cpu, memory);
+		replay_put_event(rep, REPLAY_END);
+		for (int i = 56; i >= 0; i -= 8) {
+			(void) putc((int)((hash >> i) & 0xFF), rep->stream);
+		}
+		(void) fflush(rep->stream);
+		return rep->status;
+	}
+
+	replay_host_events(rep, (uint8_t *)memory);
+
+	if (rep->status == REPLAY_OK) {
+		if (rep->next.type != REPLAY_END) {
+			rep->status = (rep->next.type == 0) ? REPLAY_CORRUPT : REPLAY_DESYNC;
+		} else if (rep->next.cycles != rep->cpu->cycles || rep->next.hash != replay_hash(rep->cpu, memory)) {
+			rep->status = REPLAY_MISMATCH;
+		}
+	}
+
+	return rep->status;
+}
+
+/**
+ * Adds bytes to an FNV-1a hash
+ */
+static uint64_t replay_fnv(uint64_t hash, const void *data, size_t length) {
+	const uint8_t *bytes = data;
+
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+/**
+ * Hashes the architectural state and memory of a cpu
+ * \param cpu cpu to hash
+ * \param memory 64K of memory to hash
+ * \return FNV-1a hash of the state.
+ */
+uint64_t replay_hash(const z80 *cpu, const uint8_t *memory) {
+	uint16_t words[] = {
+		cpu->pc.W, cpu->sp.W, cpu->bc.W, cpu->de.W, cpu->hl.W, cpu->ix.W, cpu->iy.W, cpu->ir.W,
+		cpu->_bc.W, cpu->_de.W, cpu->_hl.W, cpu->a, cpu->flags, cpu->_a, cpu->_flags,
+		(uint16_t)(cpu->iff1 | (cpu->iff2 << 1) | (cpu->im << 2) | (cpu->int_pending << 4) | (cpu->halted << 5))
+	};
+	uint64_t counts[] = { cpu->cycles, (uint64_t)(int64_t)cpu->counter };
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	hash = replay_fnv(hash, words, sizeof(words));
+	hash = replay_fnv(hash, counts, sizeof(counts));
+
+	return replay_fnv(hash, memory, 0x10000);
+}
+
+/**
+ * Describes a replay result
+ * \param status one of the REPLAY_ results
+ * \return Description of the result.
+ */
+const char *replay_status(int status) {
+	switch (status) {
+	case REPLAY_OK: return "reproduced";
+	case REPLAY_DESYNC: return "out of step with the recording";
+	case REPLAY_CORRUPT: return "recording is truncated or corrupt";
+	case REPLAY_MISMATCH: return "final state differs from the recording";
+	default: return "unknown result";
+	}
+}
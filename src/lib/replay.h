@@ -0,0 +1,92 @@
+/** \file replay.h
+ *  \brief Recording and replaying the inputs of a run
+ */
+//
+//  replay.h
+//  PZ80emu
+//
+
+#ifndef __PZ80emu__replay__
+#define __PZ80emu__replay__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "z80.h"
+
+/** Magic at the start of a replay stream, with the format version */
+#define REPLAY_MAGIC "PZ80RPL1"
+
+/** Most T-states one counted instruction can take, with an interrupt acknowledge */
+#define REPLAY_MAX_TSTATES 42
+
+/** Initial size of the buffer a recording is read into */
+#define REPLAY_CHUNK 65536
+
+/** Events in a replay stream */
+enum {
+	REPLAY_PORT_IN = 1, /** port read: port, value */
+	REPLAY_INTERRUPT, /** interrupt asserted by the host */
+	REPLAY_WRITE, /** memory written by the host: address, value */
+	REPLAY_INPUT, /** other host input: channel, value */
+	REPLAY_END /** end of the run: hash of the final state */
+};
+
+/** What a replay does with its stream */
+enum {
+	REPLAY_RECORD, /** appends the inputs of a live run */
+	REPLAY_PLAY /** feeds recorded inputs back */
+};
+
+/** Result of a replay */
+enum {
+	REPLAY_OK, /** in step with the recording so far */
+	REPLAY_DESYNC, /** the run asked for a different input than was recorded */
+	REPLAY_CORRUPT, /** the stream ended early or holds an unknown event */
+	REPLAY_MISMATCH /** the final state differs from the recorded one */
+};
+
+/**
+ * Event decoded from a recording
+ */
+typedef struct {
+	size_t offset; /** where the following event starts in the recording */
+	int type; /** one of the REPLAY_ events, 0 past the end */
+	uint64_t cycles; /** timestamp of the event */
+	uint16_t address; /** port, address or channel */
+	int value; /** value read, written or input */
+	uint64_t hash; /** final state hash, for REPLAY_END */
+} replay_event;
+
+/**
+ * Recorder or player of a run's inputs
+ * \brief Wraps the cpu's port reads and logs or feeds host events
+ */
+typedef struct replay {
+	FILE *stream; /** event stream, appended to while recording */
+	int mode; /** REPLAY_RECORD or REPLAY_PLAY */
+	z80 *cpu; /** cpu whose inputs are recorded or replayed */
+	uint8_t (*port_in)(void *context, uint16_t port); /** cpu's own port read handler */
+	void (*port_out)(void *context, uint16_t port, uint8_t value); /** cpu's own port write handler */
+	void *port_context; /** cpu's own port context */
+	uint64_t cycles; /** timestamp of the last event recorded */
+	long events; /** events recorded or replayed */
+	int status; /** one of the REPLAY_ results */
+
+	uint8_t *data; /** recording being played, read in whole */
+	size_t size; /** size of the recording */
+	replay_event next; /** next event to replay */
+	replay_event host; /** next host event or the end, to stop the cpu at */
+} replay;
+
+replay *replay_record(z80 *cpu, FILE *stream);
+replay *replay_play(z80 *cpu, FILE *stream);
+void replay_free(replay *rep);
+void replay_interrupt(replay *rep);
+void replay_write(replay *rep, uint8_t *memory, uint16_t address, uint8_t value);
+int replay_input(replay *rep, uint16_t channel, int value);
+int replay_run(replay *rep, uint8_t *memory, long runcycles);
+int replay_finish(replay *rep, const uint8_t *memory);
+uint64_t replay_hash(const z80 *cpu, const uint8_t *memory);
+const char *replay_status(int status);
+
+#endif /* defined(__PZ80emu__replay__) */
@@ -0,0 +1,137 @@
+/** \file shmexport.c
+ * Places the emulated memory and a mirror of the registers in a POSIX
+ * shared memory segment, so local tools can map it and read a running
+ * emulator without copies or round trips
+ */
+//
+//  shmexport.c
+//  PZ80emu
+//
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdatomic.h>
+#include "z80.h"
+#include "shmexport.h"
+#include "utils.h"
+
+/**
+ * Converts the 6-bit flags field to the Z80's F register
+ */
+static uint8_t shmexport_flags(unsigned flags) {
+	return (uint8_t)((IS_SET(flags, 0) ? 0x01 : 0) | (IS_SET(flags, 1) ? 0x02 : 0) | (IS_SET(flags, 2) ? 0x04 : 0)
+	                 | (IS_SET(flags, 3) ? 0x10 : 0) | (IS_SET(flags, 4) ? 0x40 : 0) | (IS_SET(flags, 5) ? 0x80 : 0));
+}
+
+/**
+ * Creates and maps a shared memory segment, replacing one left behind
+ * under the same name, with the header filled in and memory cleared
+ * \param name segment name, a leading / is added if missing
+ * \return Pointer to the allocated export, NULL if the segment can't be
+ * created or mapped, with errno set.
+ */
+shmexport *shmexport_new(const char *name) {
+	shmexport *exp;
+
+	if ((exp = calloc(1, sizeof (shmexport))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	if ((exp->name = malloc(strlen(name) + 2)) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+	exp->name[0] = '/';
+	strcpy(&exp->name[name[0] != '/'], name);
+
+	exp->size = SHMEXPORT_MEMORY_OFFSET + SHMEXPORT_MEMORY_SIZE;
+
+	if ((exp->fd = shm_open(exp->name, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		free(exp->name);
+		free(exp);
+		return NULL;
+	}
+
+	if (ftruncate(exp->fd, (off_t)exp->size) != 0
+	    || (exp->header = mmap(NULL, exp->size, PROT_READ | PROT_WRITE, MAP_SHARED, exp->fd, 0)) == MAP_FAILED) {
+		(void) close(exp->fd);
+		(void) shm_unlink(exp->name);
+		free(exp->name);
+		free(exp);
+		return NULL;
+	}
+
+	exp->registers = (shmexport_registers *)((uint8_t *)exp->header + sizeof(shmexport_header));
+	exp->memory = (uint8_t *)exp->header + SHMEXPORT_MEMORY_OFFSET;
+
+	exp->header->version = SHMEXPORT_VERSION;
+	exp->header->header_size = sizeof(shmexport_header);
+	exp->header->registers_offset = sizeof(shmexport_header);
+	exp->header->registers_size = sizeof(shmexport_registers);
+	exp->header->memory_offset = SHMEXPORT_MEMORY_OFFSET;
+	exp->header->memory_size = SHMEXPORT_MEMORY_SIZE;
+	exp->header->pid = (int32_t)getpid();
+	atomic_store_explicit(&exp->header->generation, 0, memory_order_relaxed);
+
+	// tools check the magic last, once the rest of the header is there
+	atomic_thread_fence(memory_order_release);
+	exp->header->magic = SHMEXPORT_MAGIC;
+
+	return exp;
+}
+
+/**
+ * Unmaps and removes the segment; tools that still have it mapped keep
+ * their mapping
+ * \param exp export to free
+ */
+void shmexport_free(shmexport *exp) {
+	(void) munmap(exp->header, exp->size);
+	(void) close(exp->fd);
+	(void) shm_unlink(exp->name);
+	free(exp->name);
+	free(exp);
+}
+
+/**
+ * Copies the registers into the mirror under the generation counter
+ * \param exp export to update
+ * \param cpu cpu to mirror
+ * \param instructions instructions run so far
+ */
+void shmexport_update(shmexport *exp, const z80 *cpu, long instructions) {
+	shmexport_registers *registers = exp->registers;
+	uint64_t generation = atomic_load_explicit(&exp->header->generation, memory_order_relaxed);
+
+	atomic_store_explicit(&exp->header->generation, generation + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	registers->instructions = (uint64_t)instructions;
+	registers->cycles = cpu->cycles;
+	registers->pc = cpu->pc.W;
+	registers->sp = cpu->sp.W;
+	registers->af = (uint16_t)((cpu->a << 8) | shmexport_flags(cpu->flags));
+	registers->bc = cpu->bc.W;
+	registers->de = cpu->de.W;
+	registers->hl = cpu->hl.W;
+	registers->ix = cpu->ix.W;
+	registers->iy = cpu->iy.W;
+	registers->af_ = (uint16_t)((cpu->_a << 8) | shmexport_flags(cpu->_flags));
+	registers->bc_ = cpu->_bc.W;
+	registers->de_ = cpu->_de.W;
+	registers->hl_ = cpu->_hl.W;
+	registers->i = cpu->ir.B.h;
+	registers->r = cpu->ir.B.l;
+	registers->iff1 = cpu->iff1;
+	registers->iff2 = cpu->iff2;
+	registers->im = cpu->im;
+	registers->halted = cpu->halted;
+	registers->trap = (uint8_t)cpu->trap.reason;
+	registers->trap_pc = cpu->trap.pc;
+
+	atomic_store_explicit(&exp->header->generation, generation + 2, memory_order_release);
+}
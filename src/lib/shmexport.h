@@ -0,0 +1,84 @@
+/** \file shmexport.h
+ *  \brief Emulated memory and a register mirror in POSIX shared memory
+ */
+//
+//  shmexport.h
+//  PZ80emu
+//
+
+#ifndef __PZ80emu__shmexport__
+#define __PZ80emu__shmexport__
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "z80.h"
+
+/** First word of the segment, "PZ80" in memory order */
+#define SHMEXPORT_MAGIC 0x30385A50
+
+/** Layout version, bumped on incompatible changes */
+#define SHMEXPORT_VERSION 1
+
+/** Offset of the emulated memory, page aligned so tools can map it alone */
+#define SHMEXPORT_MEMORY_OFFSET 4096
+
+/** Size of the emulated memory in the segment */
+#define SHMEXPORT_MEMORY_SIZE 65536
+
+/** Instructions per run() call between register mirror updates */
+#define SHMEXPORT_SLICE 100000L
+
+/**
+ * Registers as external tools see them, in a fixed layout. F uses the
+ * Z80's bit positions: S 7, Z 6, H 4, P/V 2, N 1, C 0.
+ */
+typedef struct {
+	uint64_t instructions; /** instructions run */
+	uint64_t cycles; /** T-states run */
+	uint16_t pc, sp, af, bc, de, hl, ix, iy;
+	uint16_t af_, bc_, de_, hl_; /** alternate register set */
+	uint8_t i, r;
+	uint8_t iff1, iff2, im, halted;
+	uint8_t trap; /** TRAP_ reason of the last run() */
+	uint8_t reserved;
+	uint16_t trap_pc; /** address of the trapping instruction */
+	uint8_t padding[6];
+} shmexport_registers;
+
+/**
+ * Start of the segment. The generation is odd while the register mirror
+ * is being written: readers load it with acquire semantics, copy the
+ * registers and load it again, retrying if it was odd or changed. The
+ * memory is the live emulated memory and is not covered by it.
+ */
+typedef struct {
+	uint32_t magic; /** SHMEXPORT_MAGIC */
+	uint16_t version; /** SHMEXPORT_VERSION */
+	uint16_t header_size; /** size of this header */
+	uint32_t registers_offset; /** offset of the shmexport_registers */
+	uint32_t registers_size; /** size of the shmexport_registers */
+	uint32_t memory_offset; /** offset of the emulated memory */
+	uint32_t memory_size; /** size of the emulated memory */
+	int32_t pid; /** process running the emulator */
+	uint32_t reserved;
+	_Atomic uint64_t generation; /** register mirror updates times two */
+} shmexport_header;
+
+/**
+ * Shared memory segment owned by the emulator
+ * \brief Header, register mirror and the memory the cpu runs in
+ */
+typedef struct shmexport {
+	char *name; /** name the segment was created under */
+	int fd; /** descriptor of the segment */
+	size_t size; /** size of the mapping */
+	shmexport_header *header; /** start of the mapping */
+	shmexport_registers *registers; /** register mirror in the segment */
+	uint8_t *memory; /** emulated memory in the segment, run the cpu on this */
+} shmexport;
+
+shmexport *shmexport_new(const char *name);
+void shmexport_free(shmexport *exp);
+void shmexport_update(shmexport *exp, const z80 *cpu, long instructions);
+
+#endif /* defined(__PZ80emu__shmexport__) */
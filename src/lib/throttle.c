@@ -0,0 +1,202 @@
+/** \file throttle.c
+ * Runs the cpu in real time at a target clock rate: the cpu runs a
+ * slice of emulated time at full speed, then waits for the wall clock
+ * to catch up. Deadlines follow from the cycle count, so a slice that
+ * ends a few T-states late doesn't drift the run. Waits sleep until
+ * shortly before the deadline and spin the rest, which keeps the
+ * lateness low without keeping a host core busy.
+ */
+//
+//  throttle.c
+//  PZ80emu
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <strings.h>
+#include <time.h>
+#include "z80.h"
+#include "throttle.h"
+
+/**
+ * Nanoseconds on the monotonic clock
+ */
+static long long throttle_now(void) {
+	struct timespec now;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * Nanoseconds of emulated time a number of T-states take, without
+ * overflowing on long runs
+ */
+static long long throttle_ns(const throttle *thr, uint64_t cycles) {
+	return (long long)(cycles / (uint64_t)thr->hz) * 1000000000LL
+	       + (long long)((cycles % (uint64_t)thr->hz) * 1000000000ULL / (uint64_t)thr->hz);
+}
+
+/**
+ * Parses a clock rate such as 4MHz, 3.5mhz, 500kHz or 4000000
+ * \param rate rate with an optional Hz, kHz, MHz or GHz suffix
+ * \return Rate in Hz, -1 if it isn't a positive rate.
+ */
+long throttle_parse(const char *rate) {
+	char *suffix;
+	double hz = strtod(rate, &suffix);
+
+	if (suffix == rate) {
+		return -1;
+	}
+
+	if (*suffix == 'k' || *suffix == 'K') {
+		hz *= 1e3;
+		suffix++;
+	} else if (*suffix == 'm' || *suffix == 'M') {
+		hz *= 1e6;
+		suffix++;
+	} else if (*suffix == 'g' || *suffix == 'G') {
+		hz *= 1e9;
+		suffix++;
+	}
+
+	if ((*suffix != '\0' && strcasecmp(suffix, "hz") != 0) || hz < 1 || hz > 1e12) {
+		return -1;
+	}
+
+	return (long)(hz + 0.5);
+}
+
+/**
+ * Allocates a pacer, starting the clock now at the cpu's cycle count
+ * \param hz target clock rate in Hz
+ * \param cpu cpu to pace
+ * \return Pointer to the allocated pacer.
+ */
+throttle *throttle_new(long hz, const z80 *cpu) {
+	throttle *thr;
+
+	if ((thr = calloc(1, sizeof (throttle))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	thr->hz = hz;
+	thr->slice_cycles = (long)(hz * THROTTLE_SLICE_NS / 1000000000LL);
+	if (thr->slice_cycles < 1) {
+		thr->slice_cycles = 1;
+	}
+
+	thr->start = thr->base = throttle_now();
+	thr->start_cycles = thr->base_cycles = cpu->cycles;
+	thr->slice_end = cpu->cycles + (uint64_t)thr->slice_cycles;
+
+	return thr;
+}
+
+/**
+ * Frees a pacer
+ * \param thr pacer to free
+ */
+void throttle_free(throttle *thr) {
+	free(thr);
+}
+
+/**
+ * Instructions the cpu can run without passing the end of the current
+ * slice by more than one instruction
+ * \param thr pacer of the cpu
+ * \param cpu cpu to run
+ * \param runcycles most instructions wanted
+ * \return Instructions to pass to run(), at least 1.
+ */
+long throttle_budget(const throttle *thr, const z80 *cpu, long runcycles) {
+	long budget = 1;
+
+	if (cpu->cycles < thr->slice_end) {
+		budget = (long)((thr->slice_end - cpu->cycles) / THROTTLE_MAX_TSTATES);
+	}
+
+	if (budget > runcycles) {
+		budget = runcycles;
+	}
+
+	return (budget > 0) ? budget : 1;
+}
+
+/**
+ * Waits for the wall clock once the cpu finished the current slice,
+ * then starts the next one. A run that falls more than a slice behind
+ * counts an overrun and carries on from the current time instead of
+ * racing to catch up.
+ * \param thr pacer of the cpu
+ * \param cpu cpu being run
+ */
+void throttle_pace(throttle *thr, const z80 *cpu) {
+	long long deadline, now;
+
+	if (cpu->cycles < thr->slice_end) {
+		return;
+	}
+
+	deadline = thr->base + throttle_ns(thr, cpu->cycles - thr->base_cycles);
+	now = throttle_now();
+
+	if (now - deadline > THROTTLE_SLICE_NS) {
+		thr->overruns++;
+		thr->base = now;
+		thr->base_cycles = cpu->cycles;
+	} else {
+		if (deadline - now > THROTTLE_SPIN_NS) {
+			struct timespec wake = {
+				(time_t)((deadline - THROTTLE_SPIN_NS) / 1000000000LL),
+				(long)((deadline - THROTTLE_SPIN_NS) % 1000000000LL)
+			};
+
+			(void) clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+		}
+
+		while ((now = throttle_now()) < deadline) {
+			// spin out the rest
+		}
+
+		thr->late += now - deadline;
+		if (now - deadline > thr->worst_late) {
+			thr->worst_late = now - deadline;
+		}
+	}
+
+	thr->slices++;
+	thr->slice_end = cpu->cycles + (uint64_t)thr->slice_cycles;
+}
+
+/**
+ * Ratio of emulated time to wall time since the pacer started
+ * \param thr pacer of the cpu
+ * \param cpu cpu being run
+ * \return 1.0 when the run keeps the target rate, less when it can't.
+ */
+double throttle_ratio(const throttle *thr, const z80 *cpu) {
+	long long wall = throttle_now() - thr->start;
+
+	if (wall <= 0) {
+		return 0.0;
+	}
+
+	return (double)throttle_ns(thr, cpu->cycles - thr->start_cycles) / (double)wall;
+}
+
+/**
+ * Writes the achieved speed and how well the deadlines were met
+ * \param thr pacer of the cpu
+ * \param cpu cpu that was run
+ * \param out stream to write to
+ */
+void throttle_write_report(const throttle *thr, const z80 *cpu, FILE *out) {
+	long waited = thr->slices - thr->overruns;
+
+	fprintf(out, "clock %.3f MHz: %.4fx real time over %ld slices, %ld overruns, late %.1f us on average and %.1f us at worst\n",
+	        thr->hz / 1e6, throttle_ratio(thr, cpu), thr->slices, thr->overruns,
+	        (waited > 0) ? thr->late / 1e3 / waited : 0.0, thr->worst_late / 1e3);
+}
@@ -0,0 +1,51 @@
+/** \file throttle.h
+ *  \brief Pacing a run against the wall clock at a target clock rate
+ */
+//
+//  throttle.h
+//  PZ80emu
+//
+
+#ifndef __PZ80emu__throttle__
+#define __PZ80emu__throttle__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "z80.h"
+
+/** Emulated nanoseconds per slice the cpu runs between waits */
+#define THROTTLE_SLICE_NS 1000000LL
+
+/** Nanoseconds before a deadline the wait stops sleeping and spins */
+#define THROTTLE_SPIN_NS 200000LL
+
+/** Most T-states one counted instruction can take, with an interrupt acknowledge */
+#define THROTTLE_MAX_TSTATES 42
+
+/**
+ * Pacer of a cpu at a target clock rate
+ * \brief Tracks the current slice's deadline and how well they were met
+ */
+typedef struct throttle {
+	long hz; /** target clock rate in T-states per second */
+	long slice_cycles; /** T-states per slice */
+	long long base; /** monotonic time the cycle count was last synchronised at */
+	uint64_t base_cycles; /** cycle count at base */
+	uint64_t slice_end; /** cycle count the current slice ends at */
+	long long start; /** monotonic time the run started at */
+	uint64_t start_cycles; /** cycle count the run started at */
+	long slices; /** slices waited for */
+	long overruns; /** slices that finished later than a slice past their deadline */
+	long long late; /** total nanoseconds the waits returned after their deadline */
+	long long worst_late; /** most nanoseconds a wait returned after its deadline */
+} throttle;
+
+long throttle_parse(const char *rate);
+throttle *throttle_new(long hz, const z80 *cpu);
+void throttle_free(throttle *thr);
+long throttle_budget(const throttle *thr, const z80 *cpu, long runcycles);
+void throttle_pace(throttle *thr, const z80 *cpu);
+double throttle_ratio(const throttle *thr, const z80 *cpu);
+void throttle_write_report(const throttle *thr, const z80 *cpu, FILE *out);
+
+#endif /* defined(__PZ80emu__throttle__) */
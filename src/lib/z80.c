@@ -10,9 +10,29 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include "z80.h"
 #include "utils.h"
 #include "display.h"
+#include "profile.h"
+#include "opstats.h"
+#include "opcodes.h"
+#include "probes.h"
+
+/** Expands a row of an opcode list into its T-states */
+#define TSTATES(code, mnemonic, length, tstates, taken, kind) [code] = (tstates),
+
+/** Expands a row of a prefixed opcode list into its T-states after the prefix */
+#define TSTATES_PREFIXED(code, mnemonic, length, tstates, taken, kind) [code] = (tstates) - 4,
+
+/** T-states for each unprefixed opcode, not counting taken conditional branches */
+static const uint8_t cycles[256] = { Z80_OPCODES(TSTATES) };
+
+/** T-states for each ED prefixed opcode, not counting the prefix; undocumented ones trap */
+static const uint8_t cycles_ed[256] = { Z80_OPCODES_ED(TSTATES_PREFIXED) };
+
+/** T-states for each DD/FD prefixed opcode, not counting the prefix; undocumented ones trap */
+static const uint8_t cycles_idx[256] = { Z80_OPCODES_INDEX(TSTATES_PREFIXED, "") };
 
 /**
  * Fills out a new z80 CPU struct
@@ -28,12 +48,77 @@ z80 *new_cpu(void) {
 }
 
 /**
- * Triggers the reset state on the z80 CPU
+ * Triggers the reset state on the z80 CPU. Every register, flag and
+ * counter goes back to what new_cpu() gives; what the cpu is attached
+ * to (handlers, profiler, statistics, breakpoints) and the record of
+ * dirty memory stay.
  * \param cpu A z80 struct to reset.
  */
 void reset_cpu(z80 *cpu) {
-	// need to implement interrupt resetting here
-	cpu->pc.W = 0x0000;
+	z80 attached = *cpu;
+
+	memset(cpu, 0, sizeof(*cpu));
+
+	cpu->prof = attached.prof;
+	cpu->ops = attached.ops;
+	cpu->port_in = attached.port_in;
+	cpu->port_out = attached.port_out;
+	cpu->port_context = attached.port_context;
+	cpu->trap_handler = attached.trap_handler;
+	cpu->trap_context = attached.trap_context;
+	cpu->breakpoints = attached.breakpoints;
+	cpu->dirty = attached.dirty;
+}
+
+/**
+ * Marks a run of memory as written, for writes made outside run()
+ * \param cpu z80 cpu object
+ * \param address first byte written
+ * \param length number of bytes written, wrapping past 0xFFFF
+ */
+void mark_dirty(z80 *cpu, uint16_t address, long length) {
+	if (length <= 0) {
+		return;
+	}
+
+	if (length >= 0x10000) {
+		cpu->dirty = ~0ULL;
+		return;
+	}
+
+	uint16_t last = (uint16_t)(address + length - 1);
+	uint64_t from = ~(DIRTY_BIT(address) - 1), to = (DIRTY_BIT(last) << 1) - 1;
+
+	// a run wrapping around the end of memory covers both ends
+	cpu->dirty |= (last >= address) ? (from & to) : (from | to);
+}
+
+/**
+ * Marks the page holding an address as written
+ * \param cpu z80 cpu object
+ * \param address address written
+ */
+static inline void _dirty(z80 *cpu, uint16_t address) {
+	cpu->dirty |= DIRTY_BIT(address);
+}
+
+/**
+ * Marks the two bytes of a word as written
+ * \param cpu z80 cpu object
+ * \param address address of the low byte
+ */
+static inline void _dirty_word(z80 *cpu, uint16_t address) {
+	cpu->dirty |= DIRTY_BIT(address) | DIRTY_BIT(address + 1);
+}
+
+/**
+ * Marks the byte an (ix+d) or (iy+d) store just wrote as written
+ * \param cpu z80 cpu object, with pc just past the offset
+ * \param memory block of memory holding the instruction
+ * \param index_register pointer to ix or iy index register
+ */
+static inline void _dirty_idx(z80 *cpu, uint8_t *memory, word *index_register) {
+	_dirty(cpu, index_register->W + (int8_t)memory[(uint16_t)(cpu->pc.W - 1)]);
 }
 
 /**
@@ -51,29 +136,31 @@ void _load_reg8_mem_pair(uint8_t *reg, word *address_pair, uint8_t *memory) {
 }
 
 /**
- * Loads a value into an 8-bit register from the memory location stored in an index register + an offset from memory.
+ * Loads a value into an 8-bit register from the memory location stored in an index register + a signed offset from memory.
+ * The address wraps around at the end of memory.
  * \param reg register to load
  * \param index_register pointer to ix or iy index register
  * \param memory block of memory containing the value to load
  * \param pc pointer to program counter
  */
 void _load_reg8_mem_idx_offset(uint8_t *reg, word *index_register, uint8_t *memory, word *pc) {
-	uint8_t index = memory[pc->W++];
+	int8_t offset = (int8_t)memory[pc->W++];
 
-	*reg = memory[(index + index_register->W)];
+	*reg = memory[(uint16_t)(index_register->W + offset)];
 }
 
 /**
- * Loads a value into a memory location stored in an index register + an offset from a register.
+ * Loads a value into a memory location stored in an index register + a signed offset from a register.
+ * The address wraps around at the end of memory.
  * \param reg register to load from
  * \param index_register pointer to ix or iy index register
  * \param memory block of memory containing the value to load
  * \param pc pointer to program counter
  */
 void _load_mem_idx_offset_reg8(uint8_t *reg, word *index_register, uint8_t *memory, word *pc) {
-	uint8_t index = memory[pc->W++];
+	int8_t offset = (int8_t)memory[pc->W++];
 
-	memory[(index + index_register->W)] = *reg;
+	memory[(uint16_t)(index_register->W + offset)] = *reg;
 }
 
 /**
@@ -90,6 +177,496 @@ void _load_reg16_nn(word *reg, uint8_t *memory, word *pc) {
 	reg->W = nn.W;
 }
 
+/**
+ * Pushes a 16 bit register pair onto the stack
+ * \param reg register to push
+ * \param memory block of memory containing the stack
+ * \param sp pointer to stack pointer
+ */
+void _push_reg16(word *reg, uint8_t *memory, word *sp) {
+	memory[--sp->W] = reg->B.h;
+	memory[--sp->W] = reg->B.l;
+}
+
+/**
+ * Pops a 16 bit register pair off the stack
+ * \param reg register to pop into
+ * \param memory block of memory containing the stack
+ * \param sp pointer to stack pointer
+ */
+void _pop_reg16(word *reg, uint8_t *memory, word *sp) {
+	reg->B.l = memory[sp->W++];
+	reg->B.h = memory[sp->W++];
+}
+
+/**
+ * Returns the 8-bit register encoded in a 3 bit opcode field
+ * \param cpu z80 cpu object
+ * \param r register field, 0-7 for b, c, d, e, h, l, (hl) and a
+ * \return Pointer to the register, NULL for (hl).
+ */
+static inline uint8_t *_reg8(z80 *cpu, int r) {
+	switch (r & 0x07) {
+	case 0: return &cpu->bc.B.h;
+	case 1: return &cpu->bc.B.l;
+	case 2: return &cpu->de.B.h;
+	case 3: return &cpu->de.B.l;
+	case 4: return &cpu->hl.B.h;
+	case 5: return &cpu->hl.B.l;
+	case 7: return &cpu->a;
+	default: return NULL;
+	}
+}
+
+/**
+ * Increments an 8-bit register, setting S, Z, H and P/V and resetting N.
+ * Carry is preserved.
+ * \param cpu z80 cpu object
+ * \param reg register to increment
+ */
+void _inc_reg8(z80 *cpu, uint8_t *reg) {
+	unsigned flags = cpu->flags & (1 << 0);
+
+	(*reg)++;
+
+	if (*reg == 0x80) flags |= (1 << 2); // overflow
+	if ((*reg & 0x0F) == 0x00) flags |= (1 << 3); // half carry
+	if (*reg == 0) flags |= (1 << 4); // zero
+	if (*reg & 0x80) flags |= (1 << 5); // sign
+
+	cpu->flags = flags;
+}
+
+/**
+ * Decrements an 8-bit register, setting S, Z, H, P/V and N.
+ * Carry is preserved.
+ * \param cpu z80 cpu object
+ * \param reg register to decrement
+ */
+void _dec_reg8(z80 *cpu, uint8_t *reg) {
+	unsigned flags = (cpu->flags & (1 << 0)) | (1 << 1);
+
+	(*reg)--;
+
+	if (*reg == 0x7F) flags |= (1 << 2); // overflow
+	if ((*reg & 0x0F) == 0x0F) flags |= (1 << 3); // half borrow
+	if (*reg == 0) flags |= (1 << 4); // zero
+	if (*reg & 0x80) flags |= (1 << 5); // sign
+
+	cpu->flags = flags;
+}
+
+/**
+ * Compares a value with A, setting the flags as for A minus the value
+ * \param cpu z80 cpu object
+ * \param value value to compare A with
+ */
+void _cp_a(z80 *cpu, uint8_t value) {
+	uint8_t result = cpu->a - value;
+	unsigned flags = (1 << 1);
+
+	if (cpu->a < value) flags |= (1 << 0); // borrow
+	if ((cpu->a ^ value) & (cpu->a ^ result) & 0x80) flags |= (1 << 2); // overflow
+	if ((cpu->a & 0x0F) < (value & 0x0F)) flags |= (1 << 3); // half borrow
+	if (result == 0) flags |= (1 << 4); // zero
+	if (result & 0x80) flags |= (1 << 5); // sign
+
+	cpu->flags = flags;
+}
+
+/**
+ * Computes the parity of a byte
+ * \param value byte to check
+ * \return 1 if the byte has an even number of bits set, 0 otherwise.
+ */
+static inline int _parity(uint8_t value) {
+	value ^= value >> 4;
+	value ^= value >> 2;
+	value ^= value >> 1;
+	return !(value & 1);
+}
+
+/**
+ * Ands a value into A, setting S, Z, P/V and H and resetting N and C
+ * \param cpu z80 cpu object
+ * \param value value to and with A
+ */
+void _and_a(z80 *cpu, uint8_t value) {
+	unsigned flags = (1 << 3);
+
+	cpu->a &= value;
+
+	if (_parity(cpu->a)) flags |= (1 << 2); // parity
+	if (cpu->a == 0) flags |= (1 << 4); // zero
+	if (cpu->a & 0x80) flags |= (1 << 5); // sign
+
+	cpu->flags = flags;
+}
+
+/**
+ * Reads a byte from an I/O port
+ * \param cpu z80 cpu object
+ * \param port 16-bit port address, as put on the address bus
+ * \return Byte read, 0xFF if no port handler is attached.
+ */
+uint8_t _port_in(z80 *cpu, uint16_t port) {
+	uint8_t value = 0xFF; // nothing drives the data bus without a handler
+
+	if (cpu->port_in != NULL) {
+		value = cpu->port_in(cpu->port_context, port);
+	}
+
+	PROBE2(port_in, port, value);
+	return value;
+}
+
+/**
+ * Writes a byte to an I/O port
+ * \param cpu z80 cpu object
+ * \param port 16-bit port address, as put on the address bus
+ * \param value byte to write, ignored if no port handler is attached
+ */
+void _port_out(z80 *cpu, uint16_t port, uint8_t value) {
+	PROBE2(port_out, port, value);
+
+	if (cpu->port_out != NULL) {
+		cpu->port_out(cpu->port_context, port, value);
+	}
+}
+
+/**
+ * Copies a forward run of bytes one at a time, as LDIR does, so an
+ * overlapping destination ahead of the source repeats the pattern
+ * \param dst first destination byte
+ * \param src first source byte
+ * \param length number of bytes to copy
+ */
+static void _copy_forward(uint8_t *dst, const uint8_t *src, long length) {
+	long distance = dst - src;
+
+	if (distance <= 0 || distance >= length) {
+		memmove(dst, src, (size_t)length);
+	} else if (distance == 1) {
+		memset(dst, *src, (size_t)length);
+	} else {
+		// each chunk reads what the previous one wrote
+		while (length > 0) {
+			long chunk = (length < distance) ? length : distance;
+
+			memcpy(dst, src, (size_t)chunk);
+			dst += chunk;
+			src += chunk;
+			length -= chunk;
+		}
+	}
+}
+
+/**
+ * Copies a backward run of bytes one at a time, as LDDR does
+ * \param dst last destination byte, the first one written
+ * \param src last source byte, the first one read
+ * \param length number of bytes to copy
+ */
+static void _copy_backward(uint8_t *dst, const uint8_t *src, long length) {
+	long distance = src - dst;
+
+	if (distance <= 0 || distance >= length) {
+		memmove(dst - length + 1, src - length + 1, (size_t)length);
+	} else if (distance == 1) {
+		memset(dst - length + 1, *src, (size_t)length);
+	} else {
+		while (length > 0) {
+			long chunk = (length < distance) ? length : distance;
+
+			memcpy(dst - chunk + 1, src - chunk + 1, (size_t)chunk);
+			dst -= chunk;
+			src -= chunk;
+			length -= chunk;
+		}
+	}
+}
+
+/**
+ * Runs iterations of LDI (step 1) or LDD (step -1) as bulk copies.
+ * The copy stops early after a byte lands on the instruction itself, so
+ * the next iteration is fetched again.
+ * \param cpu z80 cpu object
+ * \param memory memory to copy within
+ * \param iterations maximum number of bytes to copy, at least 1
+ * \param step 1 to increment HL and DE, -1 to decrement them
+ * \param pc address of the block instruction
+ * \return Number of bytes copied.
+ */
+long _block_copy(z80 *cpu, uint8_t *memory, long iterations, int step, uint16_t pc) {
+	long done = 0;
+
+	for (int i = 0; i < 2; i++) {
+		long hit = (uint16_t)(step * ((uint16_t)(pc + i) - cpu->de.W));
+
+		if (hit < iterations) {
+			iterations = hit + 1;
+		}
+	}
+
+	while (done < iterations) {
+		long src = cpu->hl.W;
+		long dst = cpu->de.W;
+		long length = iterations - done;
+
+		// split at the ends of the address space, where HL and DE wrap
+		if (step > 0) {
+			if (length > 0x10000 - src) length = 0x10000 - src;
+			if (length > 0x10000 - dst) length = 0x10000 - dst;
+			_copy_forward(&memory[dst], &memory[src], length);
+			mark_dirty(cpu, (uint16_t)dst, length);
+		} else {
+			if (length > src + 1) length = src + 1;
+			if (length > dst + 1) length = dst + 1;
+			_copy_backward(&memory[dst], &memory[src], length);
+			mark_dirty(cpu, (uint16_t)(dst - length + 1), length);
+		}
+
+		cpu->hl.W += step * length;
+		cpu->de.W += step * length;
+		cpu->bc.W -= length;
+		done += length;
+	}
+
+	// S, Z and C are kept, H and N reset, P/V set while BC is non-zero
+	cpu->flags = (cpu->flags & ((1 << 5) | (1 << 4) | (1 << 0))) | ((cpu->bc.W != 0) << 2);
+
+	return done;
+}
+
+/**
+ * Runs iterations of CPI (step 1) or CPD (step -1), scanning memory for
+ * A and stopping at the first match
+ * \param cpu z80 cpu object
+ * \param memory memory to scan
+ * \param iterations maximum number of bytes to compare, at least 1
+ * \param step 1 to increment HL, -1 to decrement it
+ * \return Number of bytes compared.
+ */
+long _block_compare(z80 *cpu, uint8_t *memory, long iterations, int step) {
+	unsigned carry = cpu->flags & (1 << 0);
+	long done = 0;
+	int found = 0;
+
+	while (done < iterations && !found) {
+		long address = cpu->hl.W;
+		long length = iterations - done;
+		long compared;
+
+		if (step > 0) {
+			uint8_t *match;
+
+			if (length > 0x10000 - address) length = 0x10000 - address;
+			match = memchr(&memory[address], cpu->a, (size_t)length);
+			found = (match != NULL);
+			compared = found ? (match - &memory[address]) + 1 : length;
+		} else {
+			if (length > address + 1) length = address + 1;
+			for (compared = 0; compared < length && !found; compared++) {
+				found = (memory[address - compared] == cpu->a);
+			}
+		}
+
+		cpu->hl.W += step * compared;
+		cpu->bc.W -= compared;
+		done += compared;
+	}
+
+	// flags as for cp (hl) on the last byte, keeping C, with P/V set while BC is non-zero
+	_cp_a(cpu, memory[(uint16_t)(cpu->hl.W - step)]);
+	cpu->flags = (cpu->flags & ~((1 << 2) | (1 << 0))) | carry | ((cpu->bc.W != 0) << 2);
+
+	return done;
+}
+
+/**
+ * Sets the flags after an iteration of a block I/O instruction
+ * \param cpu z80 cpu object, with B already decremented
+ * \param value byte transferred
+ * \param k C adjusted by the step for input, L after the step for output
+ */
+static void _block_io_flags(z80 *cpu, uint8_t value, uint8_t k) {
+	unsigned sum = value + k;
+	unsigned flags = 0;
+
+	if (sum > 0xFF) flags |= (1 << 3) | (1 << 0); // half carry and carry
+	if (_parity((uint8_t)((sum & 0x07) ^ cpu->bc.B.h))) flags |= (1 << 2); // parity
+	if (value & 0x80) flags |= (1 << 1); // subtract
+	if (cpu->bc.B.h == 0) flags |= (1 << 4); // zero
+	if (cpu->bc.B.h & 0x80) flags |= (1 << 5); // sign
+
+	cpu->flags = flags;
+}
+
+/**
+ * Runs iterations of INI (step 1) or IND (step -1), stopping early after
+ * a byte lands on the instruction itself
+ * \param cpu z80 cpu object
+ * \param memory memory to store the bytes read to
+ * \param iterations maximum number of bytes to read, at least 1
+ * \param step 1 to increment HL, -1 to decrement it
+ * \param pc address of the block instruction
+ * \return Number of bytes read.
+ */
+long _block_in(z80 *cpu, uint8_t *memory, long iterations, int step, uint16_t pc) {
+	uint8_t value = 0;
+	long done = 0;
+
+	while (done < iterations) {
+		uint16_t address = cpu->hl.W;
+
+		value = _port_in(cpu, cpu->bc.W);
+		memory[address] = value;
+		_dirty(cpu, address);
+		cpu->hl.W += step;
+		cpu->bc.B.h--;
+		done++;
+
+		if ((uint16_t)(address - pc) < 2) {
+			break;
+		}
+	}
+
+	_block_io_flags(cpu, value, (uint8_t)(cpu->bc.B.l + step));
+
+	return done;
+}
+
+/**
+ * Runs iterations of OUTI (step 1) or OUTD (step -1)
+ * \param cpu z80 cpu object
+ * \param memory memory to read the bytes written from
+ * \param iterations maximum number of bytes to write, at least 1
+ * \param step 1 to increment HL, -1 to decrement it
+ * \return Number of bytes written.
+ */
+long _block_out(z80 *cpu, uint8_t *memory, long iterations, int step) {
+	uint8_t value = 0;
+	long done = 0;
+
+	while (done < iterations) {
+		value = memory[cpu->hl.W];
+		cpu->bc.B.h--; // the port address already has B decremented
+		_port_out(cpu, cpu->bc.W, value);
+		cpu->hl.W += step;
+		done++;
+	}
+
+	_block_io_flags(cpu, value, cpu->hl.B.l);
+
+	return done;
+}
+
+/**
+ * Evaluates the condition encoded in bits 3-5 of a conditional opcode
+ * \param cpu z80 cpu object
+ * \param opcode conditional jump, call or return opcode
+ * \return 1 if the condition holds, 0 otherwise.
+ */
+static inline int _condition(z80 *cpu, uint8_t opcode) {
+	switch ((opcode >> 3) & 0x07) {
+	case 0: return !IS_SET(cpu->flags, 4); // nz
+	case 1: return IS_SET(cpu->flags, 4); // z
+	case 2: return !IS_SET(cpu->flags, 0); // nc
+	case 3: return IS_SET(cpu->flags, 0); // c
+	case 4: return !IS_SET(cpu->flags, 2); // po
+	case 5: return IS_SET(cpu->flags, 2); // pe
+	case 6: return !IS_SET(cpu->flags, 5); // p
+	default: return IS_SET(cpu->flags, 5); // m
+	}
+}
+
+/**
+ * Accepts a maskable interrupt, pushing PC and jumping to the handler for
+ * the current interrupt mode. Mode 0 assumes an RST 38h on the data bus.
+ * A halted cpu resumes after its HALT.
+ * \param cpu z80 cpu object
+ * \param memory block of memory containing the stack and vector table
+ * \return Number of T-states the interrupt acknowledge took.
+ */
+int _interrupt(z80 *cpu, uint8_t *memory) {
+	cpu->int_pending = 0;
+	cpu->iff1 = 0;
+	cpu->iff2 = 0;
+
+	if (cpu->halted) {
+		// leave the halt, returning to the instruction after it
+		cpu->halted = 0;
+		cpu->pc.W++;
+	}
+
+	_push_reg16(&cpu->pc, memory, &cpu->sp);
+	_dirty_word(cpu, cpu->sp.W);
+
+	if (cpu->im == 2) {
+		word vector;
+		vector.B.h = cpu->ir.B.h;
+		vector.B.l = 0xFF;
+
+		cpu->pc.B.l = memory[vector.W++];
+		cpu->pc.B.h = memory[vector.W];
+		return 19;
+	}
+
+	cpu->pc.W = 0x0038;
+	return 13;
+}
+
+/**
+ * Records an instruction the interpreter can't execute, puts PC back at
+ * it and offers it to the trap handler
+ * \param cpu z80 cpu object
+ * \param memory block of memory containing the instruction
+ * \param reason one of the TRAP_ codes
+ * \param pc address of the instruction
+ * \param length opcode bytes identifying the instruction, prefix included
+ * \return T-states the handler took to emulate the instruction, -1 if it
+ * was not handled and run() has to stop.
+ */
+int _trap(z80 *cpu, uint8_t *memory, int reason, uint16_t pc, int length) {
+	PROBE2(trap, reason, pc);
+
+	cpu->trap.reason = reason;
+	cpu->trap.pc = pc;
+	cpu->trap.length = length;
+	for (int i = 0; i < TRAP_BYTES; i++) {
+		cpu->trap.bytes[i] = memory[(uint16_t)(pc + i)];
+	}
+
+	cpu->pc.W = pc;
+
+	if (cpu->trap_handler != NULL) {
+		int t = cpu->trap_handler(cpu->trap_context, cpu, memory, &cpu->trap);
+
+		if (t >= 0) {
+			cpu->trap.reason = TRAP_NONE;
+			return t;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Describes a trap reason
+ * \param reason one of the TRAP_ codes
+ * \return Description of the reason.
+ */
+const char *trap_reason(int reason) {
+	switch (reason) {
+	case TRAP_NONE: return "no trap";
+	case TRAP_OPCODE: return "unimplemented opcode";
+	case TRAP_ED: return "unimplemented ED opcode";
+	case TRAP_INDEX: return "unimplemented index register opcode";
+	case TRAP_BREAKPOINT: return "breakpoint";
+	default: return "unknown trap";
+	}
+}
+
 /**
  * Adds the contents of a user supplied register to A
  * \param cpu z80 cpu object
@@ -209,20 +786,115 @@ void _adc_a_reg8(z80 *cpu, uint8_t *reg) {
 }
 
 /**
- * Runs the cpu
+ * Whether the current handler may run the next instruction itself: only
+ * in the plain interpreter, outside step mode, with run budget left and
+ * no interrupt raised or taken at the boundary in between.
+ */
+#define FUSABLE (!instrumented && !s_flag && runcycles > 1 && cpu->counter > t && !(cpu->int_pending && cpu->iff1))
+
+/** Whether the next instruction is \p next and can be fused */
+#define CAN_FUSE(next) (FUSABLE && memory[cpu->pc.W] == (next))
+
+/** Accounts for the fused instruction \p next, leaving PC after its opcode */
+#define FUSE(next) do { cpu->pc.W++; t += cycles[(next)]; count++; runcycles--; } while (0)
+
+/**
+ * Fast-forwards through an idle loop, i.e. one that leaves the machine
+ * in the same state on every iteration, until the run budget ends or
+ * just before the interrupt counter expires, where the dispatch loop
+ * takes over again. The handler has run the first instruction of the
+ * loop, and returns to the same point after the last skipped iteration.
+ * \param n number of instructions in one iteration of the loop
+ * \param tstates number of T-states one iteration of the loop takes
+ */
+#define IDLE(n, tstates) do { \
+		long skip = (runcycles - 1) / (n); \
+		long fit = (cpu->counter - t - 1) / (tstates); \
+		if (skip > fit) skip = fit; \
+		count += (int)(skip * (n)); \
+		runcycles -= skip * (n); \
+		t += (int)(skip * (tstates)); \
+	} while (0)
+
+/**
+ * Number of iterations a repeating block instruction may run in one
+ * dispatch: no more than are left, than the run budget allows, or than
+ * fit before the interrupt counter expires at 21 T-states each
+ * \param cpu z80 cpu object
+ * \param remaining iterations left until the instruction stops repeating
+ * \param runcycles instructions left in this run, each iteration is one
+ * \return Number of iterations, at least 1.
+ */
+static inline long _block_limit(z80 *cpu, long remaining, long runcycles) {
+	long interrupt = (cpu->counter + 20) / 21;
+
+	if (remaining > runcycles) remaining = runcycles;
+	if (remaining > interrupt) remaining = interrupt;
+
+	return (remaining < 1) ? 1 : remaining;
+}
+
+/**
+ * Accounts for \p n iterations of a block instruction, the first of which
+ * is the one dispatched, and goes back for another when \p again is set
+ */
+#define BLOCK_REPEAT(n, again) do { \
+		count += (int)(n) - 1; \
+		runcycles -= (n) - 1; \
+		t += 21 * (int)((n) - 1); \
+		if (again) { cpu->pc.W -= 2; t += 5; } \
+	} while (0)
+
+/**
+ * Hands the current instruction to _trap(), and either accounts for the
+ * T-states the trap handler took or stops run() with the instructions
+ * before it completed
+ */
+#define TRAP(reason, length) do { \
+		t = _trap(cpu, memory, (reason), pc, (length)); \
+		if (t < 0) { \
+			cpu->trap.instructions = count - 1; \
+			return -1; \
+		} \
+	} while (0)
+
+/**
+ * Interpreter loop shared by the plain and instrumented variants of run()
+ *
+ * Always inlined with a constant \p instrumented so each caller gets its
+ * own copy with the instrumentation hooks either compiled in or out.
  * \param cpu A z80 cpu struct to run.
  * \param memory An allocated block of memory to pass to the cpu.
  * \param runcycles The number of clock cycles to run the cpu.
+ * \param s_flag Enables step mode when non-zero.
+ * \param instrumented Enables the instrumentation hooks, and disables the fast paths
+ * that would hide single instructions from them, when non-zero.
  * \return Count of cycles executed.
  */
-int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
+static inline __attribute__((always_inline)) int _run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag, const int instrumented) {
 	int count = 0;
-	// number of T cycles for each opcode
-	const int cycles[15] = {4, 10, 7, 6, 4, 4, 7, 4, 4, 11, 7, 6, 4, 4, 7};
+
+	cpu->trap.reason = TRAP_NONE;
 
 	do {
+		uint16_t pc = cpu->pc.W; // address of this instruction, for the profiler
+
+		// stop at a breakpoint, unless it is where this run started
+		if (instrumented && cpu->breakpoints != NULL && count > 0 && IS_BREAKPOINT(cpu->breakpoints, pc)) {
+			PROBE2(trap, TRAP_BREAKPOINT, pc);
+			cpu->trap.reason = TRAP_BREAKPOINT;
+			cpu->trap.pc = pc;
+			cpu->trap.length = 0;
+			cpu->trap.instructions = count;
+			break;
+		}
+
+		int call_return = -1; // return address of a call, for the profiler
+		int ret = 0; // set when a return was taken, for the profiler
+		int ei = 0; // set by ei, which holds off interrupts for one instruction
+		int page = OPSTATS_BASE; // opcode page, for the opcode statistics
 		uint8_t opcode = memory[cpu->pc.W++]; // fetch next opcode from memory
-		cpu->counter -= cycles[opcode]; // decrease the interrupt counter by number of cycles for opcode
+		int t = cycles[opcode]; // number of T-states for this instruction
 		count++;
 
 		// opcode interpreter switch
@@ -231,24 +903,84 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 
 		case 0x01: _load_reg16_nn(&cpu->bc, memory, &cpu->pc); break; // ld bc,nn
 
-		case 0x02: memory[cpu->bc.W] = cpu->a; break; // ld (bc),a
+		case 0x02: memory[cpu->bc.W] = cpu->a; _dirty(cpu, cpu->bc.W); break; // ld (bc),a
 
 		case 0x03: cpu->bc.W++; break; // inc bc
 
-		case 0x04:
-			// inc b
-			if (IS_SET(cpu->flags, 1)) {
-				cpu->flags &= ~(1 << 1);
-			}
-			cpu->bc.B.h++;
+		case 0x04: // inc b
+		case 0x0C: // inc c
+		case 0x14: // inc d
+		case 0x1C: // inc e
+		case 0x24: // inc h
+		case 0x2C: // inc l
+		case 0x3C: // inc a
+			_inc_reg8(cpu, _reg8(cpu, opcode >> 3));
+			break;
+
+		case 0x34:
+			// inc (hl)
+			_inc_reg8(cpu, &memory[cpu->hl.W]);
+			_dirty(cpu, cpu->hl.W);
 			break;
 
 		case 0x05:
-			/// @bug dec b isn't operating on flags
-			cpu->bc.B.h--;
+			// dec b
+			_dec_reg8(cpu, &cpu->bc.B.h);
+
+			// dec b; jr nz,e runs as one handler, and keeps looping here
+			// without a dispatch while it jumps straight back to the dec b
+			while (CAN_FUSE(0x20)) {
+				FUSE(0x20);
+
+				if (IS_SET(cpu->flags, 4)) {
+					cpu->pc.W++;
+					break;
+				}
+
+				cpu->pc.W += (int8_t)memory[cpu->pc.W] + 1;
+				t += 5;
+
+				if (cpu->pc.W != pc || !CAN_FUSE(0x05)) {
+					break;
+				}
+
+				FUSE(0x05);
+				_dec_reg8(cpu, &cpu->bc.B.h);
+			}
+			break;
+
+		case 0x0D: // dec c
+		case 0x15: // dec d
+		case 0x1D: // dec e
+		case 0x25: // dec h
+		case 0x2D: // dec l
+		case 0x3D: // dec a
+			_dec_reg8(cpu, _reg8(cpu, opcode >> 3));
+			break;
+
+		case 0x35:
+			// dec (hl)
+			_dec_reg8(cpu, &memory[cpu->hl.W]);
+			_dirty(cpu, cpu->hl.W);
 			break;
 
-		case 0x06: cpu->bc.B.h = memory[cpu->pc.W++]; break; // ld b,n
+		case 0x06: // ld b,n
+		case 0x0E: // ld c,n
+		case 0x16: // ld d,n
+		case 0x1E: // ld e,n
+		case 0x26: // ld h,n
+		case 0x2E: // ld l,n
+		case 0x3E: // ld a,n
+			*_reg8(cpu, opcode >> 3) = memory[cpu->pc.W++];
+
+			// runs of ld r,n, e.g. ld b,n; ld c,n for a 16-bit constant
+			while (FUSABLE && (memory[cpu->pc.W] & 0xC7) == 0x06 && memory[cpu->pc.W] != 0x36) {
+				uint8_t next = memory[cpu->pc.W];
+
+				FUSE(next);
+				*_reg8(cpu, next >> 3) = memory[cpu->pc.W++];
+			}
+			break;
 
 		case 0x07:
 			// rlca
@@ -311,21 +1043,6 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 			cpu->bc.W--;
 			break;
 
-		case 0x0C:
-			/// @bug inc c isn't operating on flags
-			cpu->bc.B.h++;
-			break;
-
-		case 0x0D:
-			/// @bug dec c isn't operating on flags
-			cpu->bc.B.h--;
-			break;
-
-		case 0x0E:
-			// ld c,n
-			cpu->bc.B.l = memory[cpu->pc.W++];
-			break;
-
 		case 0x0F:
 			// rrca
 			if(IS_SET(cpu->a, 0) == 1) {
@@ -338,11 +1055,86 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 			break;
 
 		case 0x10:
-			// djnz n
-			cpu->bc.B.h--;
-			if (cpu->bc.B.h == 0) {
-				cpu->pc.W += (signed) memory[cpu->pc.W++];
-			};
+			// djnz e
+			for (;;) {
+				int8_t e = (int8_t)memory[cpu->pc.W++];
+
+				if (--cpu->bc.B.h == 0) {
+					break;
+				}
+
+				cpu->pc.W += e;
+				t += 5;
+
+				// djnz $ delay loops count down without a dispatch
+				if (cpu->pc.W != pc || !CAN_FUSE(0x10)) {
+					break;
+				}
+
+				FUSE(0x10);
+			}
+			break;
+
+		// jump instructions
+		case 0x18:
+			// jr e
+		{
+			int8_t e = (int8_t)memory[cpu->pc.W++];
+			cpu->pc.W += e;
+
+			// jr $ waits for an interrupt
+			if (cpu->pc.W == pc && FUSABLE) {
+				IDLE(1, 12);
+			}
+		}
+		break;
+
+		case 0x20: // jr nz,e
+		case 0x28: // jr z,e
+		case 0x30: // jr nc,e
+		case 0x38: // jr c,e
+		{
+			int8_t e = (int8_t)memory[cpu->pc.W++];
+
+			if (_condition(cpu, opcode - 0x20)) {
+				cpu->pc.W += e;
+				t += 5;
+			}
+		}
+		break;
+
+		case 0xC3:
+			// jp nn
+			_load_reg16_nn(&cpu->pc, memory, &cpu->pc);
+
+			// jp $ waits for an interrupt
+			if (cpu->pc.W == pc && FUSABLE) {
+				IDLE(1, 10);
+			}
+			break;
+
+		case 0xC2: // jp nz,nn
+		case 0xCA: // jp z,nn
+		case 0xD2: // jp nc,nn
+		case 0xDA: // jp c,nn
+		case 0xE2: // jp po,nn
+		case 0xEA: // jp pe,nn
+		case 0xF2: // jp p,nn
+		case 0xFA: // jp m,nn
+		{
+			word address;
+			address.B.l = memory[cpu->pc.W++];
+			address.B.h = memory[cpu->pc.W++];
+
+			if (_condition(cpu, opcode)) {
+				cpu->pc.W = address.W;
+			}
+		}
+		break;
+
+		case 0xE9:
+			// jp (hl)
+			cpu->pc.W = cpu->hl.W;
 			break;
 
 		case 0x11:
@@ -353,17 +1145,28 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
         case 0x12:
             // ld (de),a
             memory[cpu->de.W] = cpu->a;
+            _dirty(cpu, cpu->de.W);
             break;
-                
-        case 0x16:
-            // ld d,n
-            cpu->de.B.h = memory[cpu->pc.W++];
-            break;
-                
-        case 0x1E:
-            // ld e,n
-            cpu->de.B.l = memory[cpu->pc.W++];
-            break;
+
+		case 0x13:
+			// inc de
+			cpu->de.W++;
+			break;
+
+		case 0x1B:
+			// dec de
+			cpu->de.W--;
+			break;
+
+		case 0x33:
+			// inc sp
+			cpu->sp.W++;
+			break;
+
+		case 0x3B:
+			// dec sp
+			cpu->sp.W--;
+			break;
 
         case 0x22:
             // ld (nn),hl
@@ -372,6 +1175,7 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
                 address.B.l = memory[cpu->pc.W++];
                 address.B.h = memory[cpu->pc.W++];
                 
+                _dirty_word(cpu, address.W);
                 memory[address.W++] = cpu->hl.B.l;
                 memory[address.W] = cpu->hl.B.h;
             }
@@ -404,23 +1208,16 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 			_adc_a_reg8(cpu, &memory[cpu->hl.W]);
 			break;
                 
-        case 0x26:
-            // ld h,n
-            cpu->hl.B.h = memory[cpu->pc.W++];
-            break;
-                
-        case 0x2E:
-            // ld l,n
-            cpu->hl.B.l = memory[cpu->pc.W++];
-            break;
-                
         case 0x36:
             // ld (hl),n
             memory[cpu->hl.W] = memory[cpu->pc.W++];
+            _dirty(cpu, cpu->hl.W);
             break;
 
 		case 0xDD:
 			opcode = memory[cpu->pc.W++];
+			t += cycles_idx[opcode];
+			page = OPSTATS_DD;
 
 			switch(opcode) {
 			case 0x7E:
@@ -461,45 +1258,52 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 			case 0x77:
 				// ld (ix+n),a
 				_load_mem_idx_offset_reg8(&cpu->a, &cpu->ix, memory, &cpu->pc);
+				_dirty_idx(cpu, memory, &cpu->ix);
 				break;
 
 			case 0x70:
 				// ld (ix+n),b
 				_load_mem_idx_offset_reg8(&cpu->bc.B.h, &cpu->ix, memory, &cpu->pc);
+				_dirty_idx(cpu, memory, &cpu->ix);
 				break;
 
 			case 0x71:
 				// ld (ix+n),c
 				_load_mem_idx_offset_reg8(&cpu->bc.B.l, &cpu->ix, memory, &cpu->pc);
+				_dirty_idx(cpu, memory, &cpu->ix);
 				break;
 
 			case 0x72:
 				// ld (ix+n),d
 				_load_mem_idx_offset_reg8(&cpu->de.B.h, &cpu->ix, memory, &cpu->pc);
+				_dirty_idx(cpu, memory, &cpu->ix);
 				break;
 
 			case 0x73:
 				// ld (ix+n),e
 				_load_mem_idx_offset_reg8(&cpu->de.B.l, &cpu->ix, memory, &cpu->pc);
+				_dirty_idx(cpu, memory, &cpu->ix);
 				break;
 
 			case 0x74:
 				// ld (ix+n),h
 				_load_mem_idx_offset_reg8(&cpu->hl.B.h, &cpu->ix, memory, &cpu->pc);
+				_dirty_idx(cpu, memory, &cpu->ix);
 				break;
 
 			case 0x75:
 				// ld (ix+n),l
 				_load_mem_idx_offset_reg8(&cpu->hl.B.l, &cpu->ix, memory, &cpu->pc);
+				_dirty_idx(cpu, memory, &cpu->ix);
 				break;
 
 			case 0x36:
 				// ld (ix+n),n
 			{
-				uint8_t index;
-				index = memory[cpu->pc.W++];
+				uint16_t address = (uint16_t)(cpu->ix.W + (int8_t)memory[cpu->pc.W++]);
 
-				memory[(index + cpu->ix.W)] = memory[cpu->pc.W++];
+				memory[address] = memory[cpu->pc.W++];
+				_dirty(cpu, address);
 			}
 			break;
 
@@ -510,10 +1314,11 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 
 			case 0xE3:
 				// ex (sp),ix
-				if (memory[cpu->sp.W + 1] != cpu->ix.B.h) {
-					cpu->ix.B.h ^= memory[cpu->sp.W + 1];
-					memory[cpu->sp.W + 1] ^= cpu->ix.B.h;
-					cpu->ix.B.h ^= memory[cpu->sp.W + 1];
+				_dirty_word(cpu, cpu->sp.W);
+				if (memory[(uint16_t)(cpu->sp.W + 1)] != cpu->ix.B.h) {
+					cpu->ix.B.h ^= memory[(uint16_t)(cpu->sp.W + 1)];
+					memory[(uint16_t)(cpu->sp.W + 1)] ^= cpu->ix.B.h;
+					cpu->ix.B.h ^= memory[(uint16_t)(cpu->sp.W + 1)];
 				}
 
 				if (memory[cpu->sp.W] != cpu->ix.B.l) {
@@ -523,12 +1328,17 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 				}
 				break;
 
+			default:
+				TRAP(TRAP_INDEX, 2);
+				break;
 			}
 			break;
 
 		// extended instruction set 0xFDxx
 		case 0xFD:
 			opcode = memory[cpu->pc.W++];
+			t += cycles_idx[opcode];
+			page = OPSTATS_FD;
 
 			switch(opcode) {
 			case 0x7E:
@@ -569,45 +1379,52 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 			case 0x77:
 				// ld (iy+n),a
 				_load_mem_idx_offset_reg8(&cpu->a, &cpu->iy, memory, &cpu->pc);
+				_dirty_idx(cpu, memory, &cpu->iy);
 				break;
 
 			case 0x70:
 				// ld (iy+n),b
 				_load_mem_idx_offset_reg8(&cpu->bc.B.h, &cpu->iy, memory, &cpu->pc);
+				_dirty_idx(cpu, memory, &cpu->iy);
 				break;
 
 			case 0x71:
 				// ld (iy+n),c
 				_load_mem_idx_offset_reg8(&cpu->bc.B.l, &cpu->iy, memory, &cpu->pc);
+				_dirty_idx(cpu, memory, &cpu->iy);
 				break;
 
 			case 0x72:
 				// ld (iy+n),d
 				_load_mem_idx_offset_reg8(&cpu->de.B.h, &cpu->iy, memory, &cpu->pc);
+				_dirty_idx(cpu, memory, &cpu->iy);
 				break;
 
 			case 0x73:
 				// ld (iy+n),e
 				_load_mem_idx_offset_reg8(&cpu->de.B.l, &cpu->iy, memory, &cpu->pc);
+				_dirty_idx(cpu, memory, &cpu->iy);
 				break;
 
 			case 0x74:
 				// ld (iy+n),h
 				_load_mem_idx_offset_reg8(&cpu->hl.B.h, &cpu->iy, memory, &cpu->pc);
+				_dirty_idx(cpu, memory, &cpu->iy);
 				break;
 
 			case 0x75:
 				// ld (iy+n),l
 				_load_mem_idx_offset_reg8(&cpu->hl.B.l, &cpu->iy, memory, &cpu->pc);
+				_dirty_idx(cpu, memory, &cpu->iy);
 				break;
 
 			case 0x36:
 				// ld (iy+n),n
 			{
-				uint8_t index;
-				index = memory[cpu->pc.W++];
+				uint16_t address = (uint16_t)(cpu->iy.W + (int8_t)memory[cpu->pc.W++]);
 
-				memory[(index + cpu->iy.W)] = memory[cpu->pc.W++];
+				memory[address] = memory[cpu->pc.W++];
+				_dirty(cpu, address);
 			}
 			break;
 
@@ -619,11 +1436,12 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 
 			case 0xE3:
 				// ex (sp),iy
+				_dirty_word(cpu, cpu->sp.W);
 
-				if (memory[cpu->sp.W + 1] != cpu->iy.B.h) {
-					cpu->iy.B.h ^= memory[cpu->sp.W + 1];
-					memory[cpu->sp.W + 1] ^= cpu->iy.B.h;
-					cpu->iy.B.h ^= memory[cpu->sp.W + 1];
+				if (memory[(uint16_t)(cpu->sp.W + 1)] != cpu->iy.B.h) {
+					cpu->iy.B.h ^= memory[(uint16_t)(cpu->sp.W + 1)];
+					memory[(uint16_t)(cpu->sp.W + 1)] ^= cpu->iy.B.h;
+					cpu->iy.B.h ^= memory[(uint16_t)(cpu->sp.W + 1)];
 				}
 
 				if (memory[cpu->sp.W] != cpu->iy.B.l) {
@@ -633,6 +1451,9 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 				}
 				break;
 
+			default:
+				TRAP(TRAP_INDEX, 2);
+				break;
 			}
 			break;
 
@@ -676,11 +1497,23 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 		case 0x7E:
 			// ld a,(hl)
 			_load_reg8_mem_pair(&cpu->a, &cpu->hl, memory);
+
+			// ld a,(hl); inc hl
+			if (CAN_FUSE(0x23)) {
+				FUSE(0x23);
+				cpu->hl.W++;
+			}
 			break;
 
 		case 0x1A:
 			// ld a,(de)
 			cpu->a = memory[cpu->de.W];
+
+			// ld a,(de); inc de
+			if (CAN_FUSE(0x13)) {
+				FUSE(0x13);
+				cpu->de.W++;
+			}
 			break;
 
 		case 0x3A:
@@ -690,6 +1523,26 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 			nn.B.l = memory[cpu->pc.W++];
 			nn.B.h = memory[cpu->pc.W++];
 			cpu->a = memory[nn.W];
+
+			// ld a,(nn); and m; jr z/nz,$-7 polls a flag that only an
+			// interrupt handler can change, unless it is in the loop itself
+			if (FUSABLE && memory[cpu->pc.W] == 0xE6 && memory[(uint16_t)(cpu->pc.W + 3)] == 0xF9
+			    && (uint16_t)(nn.W - pc) > 6) {
+				uint8_t jump = memory[(uint16_t)(cpu->pc.W + 2)];
+				int zero = (cpu->a & memory[(uint16_t)(cpu->pc.W + 1)]) == 0;
+
+				if ((jump == 0x28 && zero) || (jump == 0x20 && !zero)) {
+					uint8_t a = cpu->a;
+
+					IDLE(3, 13 + 7 + 12);
+
+					if (t > cycles[0x3A]) {
+						// iterations were skipped, their ands leave the flags behind
+						_and_a(cpu, memory[(uint16_t)(cpu->pc.W + 1)]);
+						cpu->a = a;
+					}
+				}
+			}
 		}
 		break;
 
@@ -936,41 +1789,59 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 		case 0x77:
 			// ld (hl),a
 			memory[cpu->hl.W] = cpu->a;
+			_dirty(cpu, cpu->hl.W);
+
+			// ld (hl),a; inc hl
+			if (CAN_FUSE(0x23)) {
+				FUSE(0x23);
+				cpu->hl.W++;
+			}
 			break;
 
 		case 0x70:
 			// ld (hl),b
 			memory[cpu->hl.W] = cpu->bc.B.h;
+			_dirty(cpu, cpu->hl.W);
 			break;
 
 		case 0x71:
 			// ld (hl),c
 			memory[cpu->hl.W] = cpu->bc.B.l;
+			_dirty(cpu, cpu->hl.W);
 			break;
 
 		case 0x72:
 			// ld (hl),d
 			memory[cpu->hl.W] = cpu->de.B.h;
+			_dirty(cpu, cpu->hl.W);
 			break;
 
 		case 0x73:
 			// ld (hl),e
 			memory[cpu->hl.W] = cpu->de.B.l;
+			_dirty(cpu, cpu->hl.W);
 			break;
 
 		case 0x74:
 			// ld (hl),h
 			memory[cpu->hl.W] = cpu->hl.B.h;
+			_dirty(cpu, cpu->hl.W);
 			break;
 
 		case 0x75:
 			// ld (hl),l
 			memory[cpu->hl.W] = cpu->hl.B.l;
+			_dirty(cpu, cpu->hl.W);
 			break;
 
-		case 0x3E:
-			// ld a,n
-			cpu->a = memory[cpu->pc.W++];
+		case 0x76:
+			// halt, running nops in place until an interrupt is taken
+			cpu->halted = 1;
+			cpu->pc.W--;
+
+			if (FUSABLE) {
+				IDLE(1, 4);
+			}
 			break;
 
 		case 0x32:
@@ -981,6 +1852,7 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
                 address.B.h = memory[cpu->pc.W++];
 
                 memory[address.W] = cpu->a;
+                _dirty(cpu, address.W);
             }
             break;
 
@@ -994,6 +1866,93 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 			_load_reg16_nn(&cpu->sp, memory, &cpu->pc);
 			break;
 
+		// call and return instructions
+		case 0xCD:
+			// call nn
+		{
+			word address;
+			address.B.l = memory[cpu->pc.W++];
+			address.B.h = memory[cpu->pc.W++];
+
+			call_return = cpu->pc.W;
+			_push_reg16(&cpu->pc, memory, &cpu->sp);
+			_dirty_word(cpu, cpu->sp.W);
+			cpu->pc.W = address.W;
+		}
+		break;
+
+		case 0xC4: // call nz,nn
+		case 0xCC: // call z,nn
+		case 0xD4: // call nc,nn
+		case 0xDC: // call c,nn
+		case 0xE4: // call po,nn
+		case 0xEC: // call pe,nn
+		case 0xF4: // call p,nn
+		case 0xFC: // call m,nn
+		{
+			word address;
+			address.B.l = memory[cpu->pc.W++];
+			address.B.h = memory[cpu->pc.W++];
+
+			if (_condition(cpu, opcode)) {
+				call_return = cpu->pc.W;
+				_push_reg16(&cpu->pc, memory, &cpu->sp);
+				_dirty_word(cpu, cpu->sp.W);
+				cpu->pc.W = address.W;
+				t += 7;
+			}
+		}
+		break;
+
+		case 0xC9:
+			// ret
+			_pop_reg16(&cpu->pc, memory, &cpu->sp);
+			ret = 1;
+			break;
+
+		case 0xC0: // ret nz
+		case 0xC8: // ret z
+		case 0xD0: // ret nc
+		case 0xD8: // ret c
+		case 0xE0: // ret po
+		case 0xE8: // ret pe
+		case 0xF0: // ret p
+		case 0xF8: // ret m
+			if (_condition(cpu, opcode)) {
+				_pop_reg16(&cpu->pc, memory, &cpu->sp);
+				ret = 1;
+				t += 6;
+			}
+			break;
+
+		case 0xC7: // rst 00h
+		case 0xCF: // rst 08h
+		case 0xD7: // rst 10h
+		case 0xDF: // rst 18h
+		case 0xE7: // rst 20h
+		case 0xEF: // rst 28h
+		case 0xF7: // rst 30h
+		case 0xFF: // rst 38h
+			call_return = cpu->pc.W;
+			_push_reg16(&cpu->pc, memory, &cpu->sp);
+			_dirty_word(cpu, cpu->sp.W);
+			cpu->pc.W = opcode & 0x38;
+			break;
+
+		// interrupt control instructions
+		case 0xF3:
+			// di
+			cpu->iff1 = 0;
+			cpu->iff2 = 0;
+			break;
+
+		case 0xFB:
+			// ei
+			cpu->iff1 = 1;
+			cpu->iff2 = 1;
+			ei = 1;
+			break;
+
 		// Register Exchange Instructions
 		case 0xEB:
 			// ex hl,de
@@ -1006,11 +1965,12 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 
 		case 0xE3:
 			// ex (sp),hl
+			_dirty_word(cpu, cpu->sp.W);
 
-			if (memory[cpu->sp.W + 1] != cpu->hl.B.h) {
-				cpu->hl.B.h ^= memory[cpu->sp.W + 1];
-				memory[cpu->sp.W + 1] ^= cpu->hl.B.h;
-				cpu->hl.B.h ^= memory[cpu->sp.W + 1];
+			if (memory[(uint16_t)(cpu->sp.W + 1)] != cpu->hl.B.h) {
+				cpu->hl.B.h ^= memory[(uint16_t)(cpu->sp.W + 1)];
+				memory[(uint16_t)(cpu->sp.W + 1)] ^= cpu->hl.B.h;
+				cpu->hl.B.h ^= memory[(uint16_t)(cpu->sp.W + 1)];
 			}
 
 			if (memory[cpu->sp.W] != cpu->hl.B.l) {
@@ -1083,8 +2043,91 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 			_add_a_reg8(cpu, &memory[cpu->hl.W]);
 			break;
 
+		// i/o instructions
+		case 0xD3:
+			// out (n),a
+			_port_out(cpu, (uint16_t)((cpu->a << 8) | memory[cpu->pc.W++]), cpu->a);
+			break;
+
+		case 0xDB:
+			// in a,(n)
+			cpu->a = _port_in(cpu, (uint16_t)((cpu->a << 8) | memory[cpu->pc.W++]));
+			break;
+
+		// logical instructions
+		case 0xA0: // and b
+		case 0xA1: // and c
+		case 0xA2: // and d
+		case 0xA3: // and e
+		case 0xA4: // and h
+		case 0xA5: // and l
+		case 0xA7: // and a
+			_and_a(cpu, *_reg8(cpu, opcode));
+			break;
+
+		case 0xA6:
+			// and (hl)
+			_and_a(cpu, memory[cpu->hl.W]);
+			break;
+
+		case 0xE6:
+			// and n
+			_and_a(cpu, memory[cpu->pc.W++]);
+			break;
+
+		// compare instructions
+		case 0xB8: // cp b
+		case 0xB9: // cp c
+		case 0xBA: // cp d
+		case 0xBB: // cp e
+		case 0xBC: // cp h
+		case 0xBD: // cp l
+		case 0xBF: // cp a
+			_cp_a(cpu, *_reg8(cpu, opcode));
+			break;
+
+		case 0xBE:
+			// cp (hl)
+			_cp_a(cpu, memory[cpu->hl.W]);
+			break;
+
+		case 0xFE:
+			// cp n
+			_cp_a(cpu, memory[cpu->pc.W++]);
+
+			// cp n; jr cc,e
+			if (FUSABLE && (memory[cpu->pc.W] & 0xE7) == 0x20) {
+				uint8_t next = memory[cpu->pc.W];
+				int8_t e;
+
+				FUSE(next);
+				e = (int8_t)memory[cpu->pc.W++];
+
+				if (_condition(cpu, next - 0x20)) {
+					cpu->pc.W += e;
+					t += 5;
+				}
+			}
+
+			// cp n; jp cc,nn
+			else if (FUSABLE && (memory[cpu->pc.W] & 0xC7) == 0xC2) {
+				uint8_t next = memory[cpu->pc.W];
+				word address;
+
+				FUSE(next);
+				address.B.l = memory[cpu->pc.W++];
+				address.B.h = memory[cpu->pc.W++];
+
+				if (_condition(cpu, next)) {
+					cpu->pc.W = address.W;
+				}
+			}
+			break;
+
 		case 0xED:
 			opcode = memory[cpu->pc.W++];
+			t += cycles_ed[opcode];
+			page = OPSTATS_ED;
 
 			switch(opcode) {
 				case 0x43:
@@ -1094,6 +2137,7 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 					address.B.l = memory[cpu->pc.W++];
 					address.B.h = memory[cpu->pc.W++];
 
+					_dirty_word(cpu, address.W);
 					memory[address.W] = cpu->bc.B.l;
 					memory[++address.W] = cpu->bc.B.h;
 				}
@@ -1142,6 +2186,36 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
                 }
                     break;
 
+				case 0x45: // retn
+				case 0x55:
+				case 0x5D:
+				case 0x65:
+				case 0x6D:
+				case 0x75:
+				case 0x7D:
+				case 0x4D: // reti
+					cpu->iff1 = cpu->iff2;
+					_pop_reg16(&cpu->pc, memory, &cpu->sp);
+					ret = 1;
+					break;
+
+				case 0x46: // im 0
+				case 0x4E:
+				case 0x66:
+				case 0x6E:
+					cpu->im = 0;
+					break;
+
+				case 0x56: // im 1
+				case 0x76:
+					cpu->im = 1;
+					break;
+
+				case 0x5E: // im 2
+				case 0x7E:
+					cpu->im = 2;
+					break;
+
 				case 0x53:
 				// ld (nn),bc
 				{
@@ -1149,23 +2223,125 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 					address.B.l = memory[cpu->pc.W++];
 					address.B.h = memory[cpu->pc.W++];
 
+					_dirty_word(cpu, address.W);
 					memory[address.W] = cpu->de.B.l;
 					memory[++address.W] = cpu->de.B.h;
 				}
 				break;
+
+				// block instructions, repeats run in bulk when nothing
+				// needs to observe the individual iterations
+				case 0xA0: // ldi
+				case 0xA8: // ldd
+					_block_copy(cpu, memory, 1, (opcode == 0xA0) ? 1 : -1, pc);
+					break;
+
+				case 0xB0: // ldir
+				case 0xB8: // lddr
+				{
+					long n = FUSABLE ? _block_limit(cpu, cpu->bc.W ? cpu->bc.W : 0x10000, runcycles) : 1;
+
+					n = _block_copy(cpu, memory, n, (opcode == 0xB0) ? 1 : -1, pc);
+					BLOCK_REPEAT(n, cpu->bc.W != 0);
+				}
+				break;
+
+				case 0xA1: // cpi
+				case 0xA9: // cpd
+					_block_compare(cpu, memory, 1, (opcode == 0xA1) ? 1 : -1);
+					break;
+
+				case 0xB1: // cpir
+				case 0xB9: // cpdr
+				{
+					long n = FUSABLE ? _block_limit(cpu, cpu->bc.W ? cpu->bc.W : 0x10000, runcycles) : 1;
+
+					n = _block_compare(cpu, memory, n, (opcode == 0xB1) ? 1 : -1);
+					BLOCK_REPEAT(n, cpu->bc.W != 0 && !IS_SET(cpu->flags, 4));
+				}
+				break;
+
+				case 0xA2: // ini
+				case 0xAA: // ind
+					_block_in(cpu, memory, 1, (opcode == 0xA2) ? 1 : -1, pc);
+					break;
+
+				case 0xB2: // inir
+				case 0xBA: // indr
+				{
+					long n = FUSABLE ? _block_limit(cpu, cpu->bc.B.h ? cpu->bc.B.h : 0x100, runcycles) : 1;
+
+					n = _block_in(cpu, memory, n, (opcode == 0xB2) ? 1 : -1, pc);
+					BLOCK_REPEAT(n, cpu->bc.B.h != 0);
+				}
+				break;
+
+				case 0xA3: // outi
+				case 0xAB: // outd
+					_block_out(cpu, memory, 1, (opcode == 0xA3) ? 1 : -1);
+					break;
+
+				case 0xB3: // otir
+				case 0xBB: // otdr
+				{
+					long n = FUSABLE ? _block_limit(cpu, cpu->bc.B.h ? cpu->bc.B.h : 0x100, runcycles) : 1;
+
+					n = _block_out(cpu, memory, n, (opcode == 0xB3) ? 1 : -1);
+					BLOCK_REPEAT(n, cpu->bc.B.h != 0);
+				}
+				break;
                     
-                default:
-                    exit(EXIT_FAILURE);
+				default:
+					TRAP(TRAP_ED, 2);
+					break;
 			}
 			break;
 
 		default:
-			return -1;
+			TRAP(TRAP_OPCODE, 1);
+			break;
+		}
+
+		cpu->counter -= t; // decrease the interrupt counter by number of cycles for opcode
+		cpu->cycles += t;
+
+		if (instrumented) {
+			if (cpu->prof != NULL) {
+				profile_step(cpu->prof, pc, t);
+
+				if (call_return >= 0) {
+					profile_call(cpu->prof, cpu->pc.W, (uint16_t)call_return);
+				} else if (ret) {
+					profile_ret(cpu->prof, cpu->pc.W);
+				}
+			}
+
+			if (cpu->ops != NULL) {
+				opstats_step(cpu->ops, page, opcode);
+			}
 		}
 
 		if (cpu->counter <= 0) {
-			// interrupt tasks here
+			// raise the periodic interrupt, it stays pending while masked
 			cpu->counter += INTERRUPT_PERIOD;
+			cpu->int_pending = 1;
+		}
+
+		if (cpu->int_pending && cpu->iff1 && !ei) {
+			uint16_t interrupted = cpu->pc.W + cpu->halted; // a halt resumes after itself
+			int ack = _interrupt(cpu, memory);
+
+			cpu->counter -= ack;
+			cpu->cycles += ack;
+			PROBE3(interrupt, interrupted, cpu->pc.W, ack);
+
+			if (instrumented && cpu->prof != NULL) {
+				profile_interrupt(cpu->prof, cpu->pc.W, interrupted, ack);
+			}
+
+			if (instrumented && cpu->ops != NULL) {
+				opstats_break(cpu->ops);
+			}
 		}
 
 		runcycles--;
@@ -1173,6 +2349,7 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
         // step mode!
         if (s_flag) {
             display_registers(cpu);
+            display_instruction(cpu, memory);
             display_mem(memory);
             fgetc(stdin);
         }
@@ -1181,3 +2358,52 @@ int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
 
 	return count;
 }
+
+/**
+ * Runs the cpu
+ *
+ * Dispatches to the instrumented interpreter only when a profiler,
+ * opcode statistics or breakpoints are attached, so plain runs pay
+ * nothing for them. A breakpoint stops the run before its instruction
+ * with a TRAP_BREAKPOINT trap, and the count of instructions run.
+ * \param cpu A z80 cpu struct to run.
+ * \param memory An allocated block of memory to pass to the cpu.
+ * \param runcycles The number of clock cycles to run the cpu.
+ * \param s_flag Enables step mode when non-zero.
+ * \return Count of cycles executed.
+ */
+int run(z80 *cpu, uint8_t *memory, long runcycles, int s_flag) {
+	int count;
+
+	PROBE2(run_start, cpu->pc.W, runcycles);
+
+	if (cpu->prof != NULL || cpu->ops != NULL || cpu->breakpoints != NULL) {
+		count = _run(cpu, memory, runcycles, s_flag, 1);
+	} else {
+		count = _run(cpu, memory, runcycles, s_flag, 0);
+	}
+
+	PROBE2(run_end, cpu->pc.W, count);
+	return count;
+}
+
+/**
+ * Runs the cpu with the reference interpreter
+ *
+ * Every instruction is dispatched on its own: no superinstructions, bulk
+ * block instructions or idle loop skipping. The end state must always be
+ * the same as after run(), which is what the differential tests check.
+ * \param cpu A z80 cpu struct to run.
+ * \param memory An allocated block of memory to pass to the cpu.
+ * \param runcycles The number of instructions to run.
+ * \return Count of instructions executed, -1 on an unknown opcode.
+ */
+int run_reference(z80 *cpu, uint8_t *memory, long runcycles) {
+	int count;
+
+	PROBE2(run_start, cpu->pc.W, runcycles);
+	count = _run(cpu, memory, runcycles, 0, 1);
+	PROBE2(run_end, cpu->pc.W, count);
+
+	return count;
+}
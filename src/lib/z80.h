@@ -10,6 +10,8 @@
 #define __PZ80emu__z80__
 
 #include <stdint.h>
+#include "profile.h"
+#include "opstats.h"
 
 /** The initial value of the PC register */
 #define INIT_PC 0x0000
@@ -17,6 +19,27 @@
 /** The number of cycles to run before triggering interrupt */
 #define INTERRUPT_PERIOD 10240
 
+/** Number of bytes at the trapping address kept in a trap */
+#define TRAP_BYTES 4
+
+/** Why run() stopped before running all of its instructions */
+enum {
+	TRAP_NONE = 0, /** no trap, run() finished normally */
+	TRAP_OPCODE, /** unimplemented unprefixed opcode */
+	TRAP_ED, /** unimplemented ED prefixed opcode */
+	TRAP_INDEX, /** unimplemented DD or FD prefixed opcode */
+	TRAP_BREAKPOINT /** breakpoint reached, the instruction has not run */
+};
+
+/** log2 of the bytes of memory each bit of z80.dirty stands for */
+#define DIRTY_SHIFT 10
+
+/** Bit of z80.dirty for the page holding \p address */
+#define DIRTY_BIT(address) (1ULL << ((uint16_t)(address) >> DIRTY_SHIFT))
+
+/** Whether \p address is set in a breakpoint bitmap */
+#define IS_BREAKPOINT(breakpoints, address) ((breakpoints)[(address) >> 3] & (1 << ((address) & 0x07)))
+
 /** Type to deal with endianness and access of high/low bits */
 typedef union {
 	uint16_t W; /** 16 Bit Pair */
@@ -33,8 +56,30 @@ typedef union {
 	} B;
 } word;
 
-/** Collection of registers comprising a Z80 CPU */
+/** Instruction run() could not execute */
 typedef struct {
+	int reason; /** one of the TRAP_ codes */
+	uint16_t pc; /** address of the trapping instruction */
+	uint8_t bytes[TRAP_BYTES]; /** memory at the address */
+	int length; /** opcode bytes identifying the instruction, prefix included */
+	int instructions; /** instructions run() completed before the trap */
+} z80_trap;
+
+struct z80;
+
+/**
+ * Trap handler, called with pc still at the trapping instruction
+ * \param context cpu's trap_context
+ * \param cpu cpu that trapped
+ * \param memory memory of the cpu
+ * \param trap instruction that trapped
+ * \return T-states taken after emulating the instruction and moving pc
+ * past it, -1 to stop run().
+ */
+typedef int (*z80_trap_handler)(void *context, struct z80 *cpu, uint8_t *memory, const z80_trap *trap);
+
+/** Collection of registers comprising a Z80 CPU */
+typedef struct z80 {
 	word pc; /** program counter */
 	int counter; /** interrupt counter */
 	uint8_t a; /** A register */
@@ -51,13 +96,46 @@ typedef struct {
 	word _de; /** DE' register pair */
 	word _hl; /** HL' register pair */
 	word sp; /** Stack Pointer */
+	unsigned iff1 : 1; /** interrupt enable flip-flop 1 */
+	unsigned iff2 : 1; /** interrupt enable flip-flop 2 */
+	unsigned im : 2; /** interrupt mode */
+	unsigned int_pending : 1; /** maskable interrupt requested */
+	unsigned halted : 1; /** set by HALT until an interrupt is taken */
+	uint64_t cycles; /** T-states run since reset */
+	profile *prof; /** per-PC profiler, run() is instrumented when set */
+	opstats *ops; /** opcode statistics, run() is instrumented when set */
+	uint8_t (*port_in)(void *context, uint16_t port); /** port read handler, NULL reads 0xFF */
+	void (*port_out)(void *context, uint16_t port, uint8_t value); /** port write handler, NULL ignores writes */
+	void *port_context; /** passed to the port handlers */
+	z80_trap trap; /** last trap, reason TRAP_NONE when the last run() did not stop on one */
+	z80_trap_handler trap_handler; /** emulates unimplemented instructions, NULL stops run() */
+	void *trap_context; /** passed to the trap handler */
+	const uint8_t *breakpoints; /** 8K bitmap of breakpoint addresses, run() is instrumented when set */
+	uint64_t dirty; /** pages of memory run() wrote to, see DIRTY_BIT; whoever clears the memory clears this */
 } z80;
 
 z80 *new_cpu(void);
 void reset_cpu(z80 *cpu); // reset function
+void mark_dirty(z80 *cpu, uint16_t address, long length);
 int run(z80 *cpu, uint8_t *memory, long cycles, int s_flag); // run CPU function
+int run_reference(z80 *cpu, uint8_t *memory, long cycles); // run CPU without fast paths
 void _load_reg8_mem_pair(uint8_t *reg, word *address_pair, uint8_t *memory);
 void _load_reg8_mem_idx_offset(uint8_t *reg, word *index_register, uint8_t *memory, word *pc);
 void _load_mem_idx_offset_reg8(uint8_t *reg, word *index_register, uint8_t *memory, word *pc);
 void _load_reg16_nn(word *reg, uint8_t *memory, word *pc);
+void _push_reg16(word *reg, uint8_t *memory, word *sp);
+void _pop_reg16(word *reg, uint8_t *memory, word *sp);
+int _interrupt(z80 *cpu, uint8_t *memory);
+int _trap(z80 *cpu, uint8_t *memory, int reason, uint16_t pc, int length);
+const char *trap_reason(int reason);
+void _inc_reg8(z80 *cpu, uint8_t *reg);
+void _dec_reg8(z80 *cpu, uint8_t *reg);
+void _cp_a(z80 *cpu, uint8_t value);
+void _and_a(z80 *cpu, uint8_t value);
+uint8_t _port_in(z80 *cpu, uint16_t port);
+void _port_out(z80 *cpu, uint16_t port, uint8_t value);
+long _block_copy(z80 *cpu, uint8_t *memory, long iterations, int step, uint16_t pc);
+long _block_compare(z80 *cpu, uint8_t *memory, long iterations, int step);
+long _block_in(z80 *cpu, uint8_t *memory, long iterations, int step, uint16_t pc);
+long _block_out(z80 *cpu, uint8_t *memory, long iterations, int step);
 #endif /* defined(__PZ80emu__z80__) */
@@ -0,0 +1,562 @@
+/** \file bench_z80.c
+ *  \brief Micro-benchmarks for the CPU core
+ *
+ * Runs fixed Z80 workloads through run() several times each and reports
+ * the median speed, with the median absolute deviation as noise estimate.
+ * Given a baseline written with -c, fails when a workload got slower than
+ * the threshold allows, beyond the noise of either measurement.
+ * With -H, the host's hardware counters are read around the timed runs
+ * and reported per emulated instruction, for the engine chosen with -e.
+ * A baseline records the host and compiler it was taken with, and one
+ * from elsewhere is reported but not gated on. Comparing needs libraries
+ * configured with optimization (e.g. ./configure CFLAGS=-O2).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include "z80.h"
+#include "hwcount.h"
+
+/** Command line usage text */
+#define USAGE "Usage: bench_z80 [-i <instructions>] [-n <runs>] [-w <workload>] [-e <engine>] [-H] [-c]" \
+              " [-b <baseline.csv> [-t <percent>]]\n" \
+              "       engines: run, reference\n"
+
+/** Default number of instructions per timed run */
+#define BENCH_INSTRUCTIONS 20000000L
+
+/** Default number of timed runs per workload */
+#define BENCH_RUNS 7
+
+/** Maximum number of timed runs per workload */
+#define BENCH_MAX_RUNS 101
+
+/** Default slowdown against the baseline, in percent, that fails the check */
+#define BENCH_THRESHOLD 10.0
+
+/**
+ * Number of combined median absolute deviations a slowdown must exceed
+ * to count as a regression; 3 MADs are about 2 standard deviations
+ */
+#define BENCH_NOISE_MADS 3.0
+
+/** Maximum number of workloads in a baseline file */
+#define BENCH_MAX_BASELINE 32
+
+/** Length of the host and compiler descriptions of a baseline */
+#define BENCH_ORIGIN 256
+
+/** Flags the libraries were configured with, set by the Makefile */
+#ifndef BENCH_CFLAGS
+#define BENCH_CFLAGS ""
+#endif
+
+/** Fixed Z80 program, looping forever from address 0 */
+typedef struct {
+	const char *name; /** workload name, as used with -w and in the output */
+	const uint8_t *code; /** program bytes, loaded at 0x0000 */
+	size_t length; /** number of program bytes */
+} bench_workload;
+
+/** 8-bit arithmetic, logic and branches */
+static const uint8_t alu_code[] = {
+	0x06, 0x00,       // ld b,0
+	0x0E, 0x00,       // ld c,0
+	0x78,             // loop: ld a,b
+	0x81,             // add a,c
+	0x87,             // add a,a
+	0xA1,             // and c
+	0x3C,             // inc a
+	0xFE, 0x10,       // cp 0x10
+	0x0C,             // inc c
+	0x15,             // dec d
+	0x20, 0xF5,       // jr nz,loop
+	0x04,             // inc b
+	0xC3, 0x04, 0x00  // jp loop
+};
+
+/** Block and byte-by-byte memory copies */
+static const uint8_t copy_code[] = {
+	0x21, 0x00, 0x40, // ld hl,0x4000
+	0x11, 0x00, 0x80, // ld de,0x8000
+	0x01, 0x00, 0x01, // ld bc,0x0100
+	0xED, 0xB0,       // ldir
+	0x21, 0x00, 0x40, // ld hl,0x4000
+	0x11, 0x00, 0x90, // ld de,0x9000
+	0x06, 0x40,       // ld b,0x40
+	0x7E,             // loop: ld a,(hl)
+	0x23,             // inc hl
+	0x12,             // ld (de),a
+	0x13,             // inc de
+	0x10, 0xFA,       // djnz loop
+	0xC3, 0x00, 0x00  // jp 0
+};
+
+/** Nested calls, returns and restarts */
+static const uint8_t call_code[] = {
+	0x31, 0x00, 0x00, // ld sp,0
+	0xCD, 0x10, 0x00, // loop: call sub1
+	0xCD, 0x14, 0x00, // call sub2
+	0xFF,             // rst 38h
+	0xC3, 0x03, 0x00, // jp loop
+	0x00, 0x00, 0x00,
+	0xCD, 0x14, 0x00, // sub1: call sub2
+	0xC9,             // ret
+	0x3C,             // sub2: inc a
+	0xC9,             // ret
+	[0x38] = 0xC9     // ret
+};
+
+/** DD/FD prefixed indexed loads and stores */
+static const uint8_t index_code[] = {
+	0xDD, 0x21, 0x00, 0x40, // ld ix,0x4000
+	0xFD, 0x21, 0x00, 0x50, // ld iy,0x5000
+	0x06, 0x00,             // ld b,0
+	0xDD, 0x7E, 0x01,       // loop: ld a,(ix+1)
+	0xFD, 0x77, 0x02,       // ld (iy+2),a
+	0xDD, 0x4E, 0x03,       // ld c,(ix+3)
+	0xFD, 0x71, 0x04,       // ld (iy+4),c
+	0xDD, 0x36, 0x05, 0xAA, // ld (ix+5),0xAA
+	0x10, 0xEE,             // djnz loop
+	0xC3, 0x0A, 0x00        // jp loop
+};
+
+/** Engine the workloads run on */
+typedef struct {
+	const char *name; /** engine name, as used with -e and in the output */
+	int (*run)(z80 *cpu, uint8_t *memory, long instructions); /** runs the cpu, as run() does */
+} bench_engine;
+
+/**
+ * The interpreter with all its fast paths
+ */
+static int bench_run_fast(z80 *cpu, uint8_t *memory, long instructions) {
+	return run(cpu, memory, instructions, 0);
+}
+
+/** All engines, the first is the default */
+static const bench_engine engines[] = {
+	{ "run", bench_run_fast },
+	{ "reference", run_reference }
+};
+
+/** All workloads, in output order */
+static const bench_workload workloads[] = {
+	{ "alu", alu_code, sizeof(alu_code) },
+	{ "copy", copy_code, sizeof(copy_code) },
+	{ "call", call_code, sizeof(call_code) },
+	{ "index", index_code, sizeof(index_code) }
+};
+
+/** Statistics of one workload over all timed runs */
+typedef struct {
+	double mips_median; /** median millions of instructions per second */
+	double mips_mad; /** median absolute deviation of the MIPS */
+	double mips_min; /** slowest run */
+	double mips_max; /** fastest run */
+	double tstates_per_second; /** median emulated T-states per second */
+	long counted; /** emulated instructions run while the host counters counted */
+} bench_result;
+
+/** Result of one workload read back from a baseline file */
+typedef struct {
+	char name[32]; /** workload name */
+	double mips_median; /** median MIPS when the baseline was taken */
+	double mips_mad; /** median absolute deviation of the MIPS */
+	char engine[16]; /** engine name, run for baselines from before engines were recorded */
+} bench_baseline;
+
+/** Host and build results were measured on */
+typedef struct {
+	char host[BENCH_ORIGIN]; /** architecture and CPU model, empty if not recorded */
+	char compiler[BENCH_ORIGIN]; /** compiler version and library CFLAGS, empty if not recorded */
+} bench_origin;
+
+/**
+ * Describes the host and build this program runs on
+ * \param origin description to fill
+ */
+static void bench_get_origin(bench_origin *origin) {
+	struct utsname name;
+	char line[256];
+	FILE *in;
+
+	if (uname(&name) != 0) {
+		strcpy(name.machine, "unknown");
+	}
+	snprintf(origin->host, sizeof(origin->host), "%s", name.machine);
+
+	// the CPU model is only known where /proc/cpuinfo has it
+	if ((in = fopen("/proc/cpuinfo", "r")) != NULL) {
+		while (fgets(line, sizeof(line), in) != NULL) {
+			char *model = strchr(line, ':');
+
+			if (strncmp(line, "model name", 10) == 0 && model != NULL) {
+				model += strspn(model + 1, " \t") + 1;
+				model[strcspn(model, "\n")] = '\0';
+				snprintf(origin->host, sizeof(origin->host), "%.64s %.160s", name.machine, model);
+				break;
+			}
+		}
+		(void)fclose(in);
+	}
+
+	snprintf(origin->compiler, sizeof(origin->compiler), "%.64s, CFLAGS %.160s", __VERSION__, BENCH_CFLAGS);
+}
+
+/**
+ * Tells whether compiler flags turn optimization on
+ * \param cflags compiler flags, of which the last -O option counts
+ * \return 1 if they optimize, 0 if not.
+ */
+static int bench_optimized(const char *cflags) {
+	const char *level = NULL;
+
+	for (const char *flag = strstr(cflags, "-O"); flag != NULL; flag = strstr(flag + 2, "-O")) {
+		if (flag == cflags || flag[-1] == ' ') {
+			level = flag + 2;
+		}
+	}
+
+	return level != NULL && *level != '0' && *level != 'g';
+}
+
+/**
+ * Reads a baseline written by bench_z80 -c
+ * \param filename file to read
+ * \param baseline array to fill, BENCH_MAX_BASELINE entries long
+ * \param origin filled with the host and build the baseline was taken on
+ * \return Number of workloads read, -1 if the file could not be opened.
+ */
+static int bench_load_baseline(const char *filename, bench_baseline *baseline, bench_origin *origin) {
+	char line[256];
+	int count = 0;
+	FILE *in;
+
+	if ((in = fopen(filename, "r")) == NULL) {
+		return -1;
+	}
+
+	origin->host[0] = origin->compiler[0] = '\0';
+	while (count < BENCH_MAX_BASELINE && fgets(line, sizeof(line), in) != NULL) {
+		long instructions;
+		int runs, fields;
+
+		if (sscanf(line, "# host: %255[^\n]", origin->host) == 1 ||
+		    sscanf(line, "# compiler: %255[^\n]", origin->compiler) == 1) {
+			continue;
+		}
+
+		// the header line and anything else malformed is skipped
+		fields = sscanf(line, "%31[^,],%ld,%d,%lf,%lf,%*f,%*f,%*f,%*f,%15[^,\n]", baseline[count].name,
+		                &instructions, &runs, &baseline[count].mips_median, &baseline[count].mips_mad,
+		                baseline[count].engine);
+
+		if (fields >= 5) {
+			if (fields == 5) {
+				strcpy(baseline[count].engine, engines[0].name);
+			}
+			count++;
+		}
+	}
+
+	(void)fclose(in);
+	return count;
+}
+
+/**
+ * Compares a workload's result with its baseline
+ * \param baseline baseline of the workload
+ * \param result result of the workload
+ * \param threshold slowdown in percent that counts as a regression
+ * \param slowdown set to the slowdown in percent, negative when faster
+ * \return 1 if the workload regressed, 0 otherwise.
+ */
+static int bench_regressed(const bench_baseline *baseline, const bench_result *result, double threshold, double *slowdown) {
+	double drop = baseline->mips_median - result->mips_median;
+	double noise = BENCH_NOISE_MADS * (baseline->mips_mad + result->mips_mad);
+
+	*slowdown = 100.0 * drop / baseline->mips_median;
+
+	return *slowdown > threshold && drop > noise;
+}
+
+/**
+ * Reads the monotonic clock
+ * \return Current time in seconds.
+ */
+static double bench_now(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/**
+ * Orders doubles ascending, for qsort()
+ */
+static int bench_compare(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Computes the median of a set of values
+ * \param values values to sort and take the median of
+ * \param count number of values
+ * \return Median value.
+ */
+static double bench_median(double *values, int count) {
+	qsort(values, (size_t)count, sizeof (double), bench_compare);
+
+	if (count % 2) {
+		return values[count / 2];
+	}
+
+	return (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+/**
+ * Runs one workload several times from a fresh cpu and memory
+ * \param workload workload to run
+ * \param engine engine to run it on
+ * \param instructions number of instructions per timed run
+ * \param runs number of timed runs, after one untimed warm-up run
+ * \param hw host counters to add the timed runs to, NULL not to count
+ * \param result statistics of the timed runs
+ */
+static void bench_run(const bench_workload *workload, const bench_engine *engine, long instructions, int runs,
+                      hwcount *hw, bench_result *result) {
+	double mips[BENCH_MAX_RUNS], tstates[BENCH_MAX_RUNS], deviation[BENCH_MAX_RUNS];
+	uint8_t *memory;
+	z80 *cpu = new_cpu();
+
+	if ((memory = calloc(0x10000, sizeof(uint8_t))) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	memcpy(memory, workload->code, workload->length);
+	(void)engine->run(cpu, memory, instructions);
+	result->counted = 0;
+
+	for (int i = 0; i < runs; i++) {
+		uint64_t cycles = cpu->cycles;
+		double start, elapsed;
+		int count;
+
+		// the counters are switched outside the timed stretch
+		if (hw != NULL) {
+			hwcount_start(hw);
+		}
+		start = bench_now();
+		count = engine->run(cpu, memory, instructions);
+		elapsed = bench_now() - start;
+		if (hw != NULL) {
+			hwcount_stop(hw);
+			result->counted += count;
+		}
+
+		if (count != instructions) {
+			fprintf(stderr, "bench_z80: %s stopped after %d instructions at 0x%04X\n",
+			        workload->name, count, cpu->pc.W);
+			exit(EXIT_FAILURE);
+		}
+
+		mips[i] = (double)count / elapsed / 1e6;
+		tstates[i] = (double)(cpu->cycles - cycles) / elapsed;
+	}
+
+	result->mips_median = bench_median(mips, runs);
+	result->mips_min = mips[0];
+	result->mips_max = mips[runs - 1];
+	result->tstates_per_second = bench_median(tstates, runs);
+
+	for (int i = 0; i < runs; i++) {
+		deviation[i] = mips[i] > result->mips_median ? mips[i] - result->mips_median : result->mips_median - mips[i];
+	}
+	result->mips_mad = bench_median(deviation, runs);
+
+	free(memory);
+	free(cpu);
+}
+
+/** PZ80 CPU core benchmarks */
+int main(int argc, char *argv[]) {
+	long instructions = BENCH_INSTRUCTIONS;
+	int runs = BENCH_RUNS;
+	int csv = 0, counters = 0;
+	int c;
+	int baseline_count = 0, regressions = 0;
+	double threshold = BENCH_THRESHOLD;
+	char *only = NULL, *baseline_file = NULL, *engine_name = NULL;
+	const bench_engine *engine = &engines[0];
+	bench_baseline baseline[BENCH_MAX_BASELINE];
+	bench_origin origin, baseline_origin;
+
+	while ((c = getopt(argc, argv, "i:n:w:e:Hcb:t:")) != -1) {
+		switch (c) {
+			case 'i':
+				instructions = strtol(optarg, NULL, 0);
+				break;
+
+			case 'n':
+				runs = (int)strtol(optarg, NULL, 0);
+				break;
+
+			case 'w':
+				only = optarg;
+				break;
+
+			case 'e':
+				engine_name = optarg;
+				break;
+
+			case 'H':
+				counters = 1;
+				break;
+
+			case 'c':
+				csv = 1;
+				break;
+
+			case 'b':
+				baseline_file = optarg;
+				break;
+
+			case 't':
+				threshold = strtod(optarg, NULL);
+				break;
+
+			default:
+				fprintf(stderr, USAGE);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (instructions <= 0 || instructions > 0x7FFFFFFF || runs <= 0 || runs > BENCH_MAX_RUNS) {
+		fprintf(stderr, USAGE);
+		return EXIT_FAILURE;
+	}
+
+	if (engine_name != NULL) {
+		for (engine = NULL, c = 0; c < (int)(sizeof(engines) / sizeof(engines[0])); c++) {
+			if (strcmp(engines[c].name, engine_name) == 0) {
+				engine = &engines[c];
+			}
+		}
+
+		if (engine == NULL) {
+			fprintf(stderr, USAGE);
+			return EXIT_FAILURE;
+		}
+	}
+
+	bench_get_origin(&origin);
+
+	if (baseline_file != NULL) {
+		if (!bench_optimized(BENCH_CFLAGS)) {
+			fprintf(stderr, "bench_z80: libraries configured with CFLAGS '%s', configure with optimization"
+			        " (e.g. CFLAGS=-O2) to compare against a baseline\n", BENCH_CFLAGS);
+			return EXIT_FAILURE;
+		}
+
+		if ((baseline_count = bench_load_baseline(baseline_file, baseline, &baseline_origin)) < 0) {
+			fprintf(stderr, "bench_z80: cannot read baseline %s\n", baseline_file);
+			return EXIT_FAILURE;
+		}
+
+		// numbers from another machine or build say nothing about this one
+		if (strcmp(baseline_origin.host, origin.host) != 0 || strcmp(baseline_origin.compiler, origin.compiler) != 0) {
+			fprintf(stderr, "bench_z80: baseline %s is from %s (%s), not %s (%s), skipping the comparison\n",
+			        baseline_file, baseline_origin.host[0] != '\0' ? baseline_origin.host : "an unknown host",
+			        baseline_origin.compiler[0] != '\0' ? baseline_origin.compiler : "unknown compiler",
+			        origin.host, origin.compiler);
+			baseline_count = 0;
+		}
+	}
+
+	// new columns go last, baselines are read by position
+	if (csv) {
+		printf("# host: %s\n# compiler: %s\n", origin.host, origin.compiler);
+		printf("workload,instructions,runs,mips_median,mips_mad,mips_min,mips_max,tstates_per_second,ns_per_instruction,engine");
+		for (int event = 0; counters && event < HWCOUNT_EVENTS; event++) {
+			printf(",%s_per_instruction", hwcount_name(event));
+		}
+		printf("\n");
+	} else {
+		printf("%-8s %-10s %10s %8s %10s %10s %14s %10s\n",
+		       "workload", "engine", "MIPS", "+/- MAD", "min", "max", "T-states/s", "ns/instr");
+	}
+
+	for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+		hwcount *hw;
+		bench_result result;
+
+		if (only != NULL && strcmp(only, workloads[i].name) != 0) {
+			continue;
+		}
+
+		hw = counters ? hwcount_new() : NULL;
+		bench_run(&workloads[i], engine, instructions, runs, hw, &result);
+
+		if (csv) {
+			printf("%s,%ld,%d,%.3f,%.3f,%.3f,%.3f,%.0f,%.3f,%s", workloads[i].name, instructions, runs,
+			       result.mips_median, result.mips_mad, result.mips_min, result.mips_max,
+			       result.tstates_per_second, 1000.0 / result.mips_median, engine->name);
+
+			// events the host doesn't have are left empty
+			for (int event = 0; hw != NULL && event < HWCOUNT_EVENTS; event++) {
+				double value;
+
+				if (hwcount_per_instruction(hw, event, result.counted, &value)) {
+					printf(",%.4f", value);
+				} else {
+					printf(",");
+				}
+			}
+			printf("\n");
+		} else {
+			printf("%-8s %-10s %10.2f %8.2f %10.2f %10.2f %14.0f %10.2f\n", workloads[i].name, engine->name,
+			       result.mips_median, result.mips_mad, result.mips_min, result.mips_max,
+			       result.tstates_per_second, 1000.0 / result.mips_median);
+			if (hw != NULL) {
+				hwcount_write_report(hw, engine->name, result.counted, stdout);
+			}
+		}
+		fflush(stdout);
+
+		if (hw != NULL) {
+			hwcount_free(hw);
+		}
+
+		for (int j = 0; j < baseline_count; j++) {
+			double slowdown;
+
+			if (strcmp(baseline[j].name, workloads[i].name) != 0 || strcmp(baseline[j].engine, engine->name) != 0) {
+				continue;
+			}
+
+			if (bench_regressed(&baseline[j], &result, threshold, &slowdown)) {
+				regressions++;
+				fprintf(stderr, "bench_z80: %s regressed %.1f%% (%.2f MIPS, baseline %.2f +/- %.2f)\n",
+				        workloads[i].name, slowdown, result.mips_median, baseline[j].mips_median, baseline[j].mips_mad);
+			} else {
+				fprintf(stderr, "bench_z80: %s %+.1f%% against baseline, ok\n", workloads[i].name, -slowdown);
+			}
+		}
+	}
+
+	if (regressions > 0) {
+		fprintf(stderr, "bench_z80: %d workload(s) more than %.1f%% slower than %s\n", regressions, threshold, baseline_file);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
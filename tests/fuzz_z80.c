@@ -0,0 +1,580 @@
+/** \file fuzz_z80.c
+ *  \brief Coverage-guided instruction fuzzer for the CPU core
+ *
+ * Generates random instruction streams and register states, runs each
+ * case in a forked child through the reference interpreter one
+ * instruction at a time and through run() in one call, and compares the
+ * two. Coverage is kept per handler and per resulting flags value in
+ * memory shared with the children; generation is steered toward
+ * handlers that haven't run yet, and cases that found new coverage are
+ * kept and mutated. Crashes, unexpected exits, unknown opcodes and
+ * divergences are minimized and reported once per handler.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "z80.h"
+#include "opstats.h"
+#include "difftest.h"
+
+/** Command line usage text */
+#define USAGE "Usage: fuzz_z80 [-n <cases>] [-s <seed>] [-i <instructions>] [-m <findings>] [-q]\n"
+
+/** Number of code bytes in a case, loaded at 0x0000 */
+#define FUZZ_CODE 64
+
+/** Number of 16-bit register values in a case */
+#define FUZZ_REGISTERS 11
+
+/** Maximum number of instructions run per case */
+#define FUZZ_MAX_INSTRUCTIONS FUZZ_CODE
+
+/** Number of cases that found new coverage kept for mutation */
+#define FUZZ_CORPUS 256
+
+/** Seconds a case may run before it counts as hung */
+#define FUZZ_TIMEOUT 2
+
+/** Child exit status for a case where both engines agreed */
+#define FUZZ_STATUS_OK 0
+
+/** Child exit status for a case where run() disagreed with the reference */
+#define FUZZ_STATUS_DIVERGED 100
+
+/** Child exit status for a case that hit an opcode run() returns -1 for */
+#define FUZZ_STATUS_UNKNOWN 101
+
+/** Outcome of a case */
+enum {
+	FUZZ_OK, /**< both engines agreed */
+	FUZZ_DIVERGED, /**< run() disagreed with the reference interpreter */
+	FUZZ_UNKNOWN, /**< run() returned -1 for an unknown opcode */
+	FUZZ_EXIT, /**< the child exited with a status it never returns, such as an allocation failure's */
+	FUZZ_CRASH, /**< the child was killed by a signal */
+	FUZZ_HANG, /**< the child ran out of time */
+	FUZZ_OUTCOMES /**< number of outcomes */
+};
+
+/** Names of the outcomes, for the report */
+static const char *fuzz_outcomes[FUZZ_OUTCOMES] = {
+	"ok", "diverged", "unknown opcode", "unexpected exit", "crash", "hang"
+};
+
+/** Names of the opcode pages, for the report */
+static const char *fuzz_pages[OPSTATS_PAGES] = {
+	"", "CB", "ED", "DD", "FD", "DDCB", "FDCB"
+};
+
+/** Initial machine state of a case */
+typedef struct {
+	uint8_t code[FUZZ_CODE]; /** instruction stream at 0x0000 */
+	uint16_t registers[FUZZ_REGISTERS]; /** af bc de hl ix iy sp af' bc' de' hl' */
+	int instructions; /** number of instructions to run */
+} fuzz_input;
+
+/** State shared with the forked children */
+typedef struct {
+	uint8_t hits[OPSTATS_PAGES][256][64]; /** handler runs per resulting flags value */
+	int new_coverage; /** set by a child that hit something new */
+	int page; /** page of the last instruction the reference started */
+	int opcode; /** opcode of the last instruction the reference started */
+} fuzz_shared;
+
+/** State of the xorshift random number generator */
+static uint64_t fuzz_state;
+
+/**
+ * Returns the next pseudo-random number, reproducible from the seed
+ */
+static uint32_t fuzz_random(void) {
+	fuzz_state ^= fuzz_state << 13;
+	fuzz_state ^= fuzz_state >> 7;
+	fuzz_state ^= fuzz_state << 17;
+	return (uint32_t)(fuzz_state >> 16);
+}
+
+/**
+ * Finds the handler of the instruction at an address
+ * \param memory memory holding the instruction
+ * \param pc address of the instruction
+ * \param page set to the opcode page
+ * \return Opcode selecting the handler within the page.
+ */
+static int fuzz_decode(const uint8_t *memory, uint16_t pc, int *page) {
+	uint8_t opcode = memory[pc];
+	uint8_t next = memory[(uint16_t)(pc + 1)];
+
+	switch (opcode) {
+	case 0xCB:
+		*page = OPSTATS_CB;
+		return next;
+
+	case 0xED:
+		*page = OPSTATS_ED;
+		return next;
+
+	case 0xDD:
+	case 0xFD:
+		if (next == 0xCB) {
+			*page = (opcode == 0xDD) ? OPSTATS_DDCB : OPSTATS_FDCB;
+			return memory[(uint16_t)(pc + 3)];
+		}
+
+		*page = (opcode == 0xDD) ? OPSTATS_DD : OPSTATS_FD;
+		return next;
+
+	default:
+		*page = OPSTATS_BASE;
+		return opcode;
+	}
+}
+
+/**
+ * Sets up a cpu and memory from a case
+ * \param input case to load
+ * \param cpu cpu to set up
+ * \param memory memory to set up, on top of a fixed background pattern
+ */
+static void fuzz_load(const fuzz_input *input, z80 *cpu, uint8_t *memory) {
+	word *pairs[] = { &cpu->bc, &cpu->de, &cpu->hl, &cpu->ix, &cpu->iy, &cpu->sp };
+	word *alternates[] = { &cpu->_bc, &cpu->_de, &cpu->_hl };
+
+	memset(cpu, 0, sizeof (z80));
+	cpu->counter = INTERRUPT_PERIOD;
+	cpu->im = 1;
+
+	cpu->a = input->registers[0] >> 8;
+	cpu->flags = input->registers[0] & 0x3F;
+	for (int i = 0; i < 6; i++) {
+		pairs[i]->W = input->registers[1 + i];
+	}
+	cpu->_a = input->registers[7] >> 8;
+	cpu->_flags = input->registers[7] & 0x3F;
+	for (int i = 0; i < 3; i++) {
+		alternates[i]->W = input->registers[8 + i];
+	}
+
+	for (int i = 0; i < 0x10000; i++) {
+		memory[i] = (uint8_t)(i * 167 + (i >> 8) * 13);
+	}
+	memcpy(memory, input->code, FUZZ_CODE);
+}
+
+/** Memory of the reference interpreter in the child */
+static uint8_t reference_memory[0x10000];
+
+/** Memory of run() in the child */
+static uint8_t engine_memory[0x10000];
+
+/**
+ * Runs the first instructions of a case through both engines
+ * \param input case to run
+ * \param instructions number of instructions to run
+ * \param reference set to the reference cpu afterwards
+ * \param engine set to the run() cpu afterwards
+ * \return 1 if the engines agree afterwards, 0 otherwise.
+ */
+static int fuzz_agree(const fuzz_input *input, int instructions, z80 *reference, z80 *engine) {
+	fuzz_load(input, reference, reference_memory);
+	fuzz_load(input, engine, engine_memory);
+
+	if (instructions == 0) {
+		return 1;
+	}
+
+	for (int i = 0; i < instructions; i++) {
+		(void)run_reference(reference, reference_memory, 1);
+	}
+
+	return run(engine, engine_memory, instructions, 0) == instructions && difftest_compare(reference, engine) == NULL
+	       && memcmp(reference_memory, engine_memory, sizeof(reference_memory)) == 0;
+}
+
+/**
+ * Runs a case, in the child: the reference one instruction at a time,
+ * recording coverage, then run() in one call, and compares the two
+ * \return Exit status for the parent.
+ */
+static int fuzz_child(const fuzz_input *input, fuzz_shared *shared) {
+	z80 reference, engine;
+	int engine_count;
+
+	fuzz_load(input, &reference, reference_memory);
+	fuzz_load(input, &engine, engine_memory);
+
+	for (int i = 0; i < input->instructions; i++) {
+		int page;
+		int opcode = fuzz_decode(reference_memory, reference.pc.W, &page);
+
+		shared->page = page;
+		shared->opcode = opcode;
+
+		if (run_reference(&reference, reference_memory, 1) < 0) {
+			return FUZZ_STATUS_UNKNOWN;
+		}
+
+		if (shared->hits[page][opcode][reference.flags] == 0) {
+			shared->hits[page][opcode][reference.flags] = 1;
+			shared->new_coverage = 1;
+		}
+	}
+
+	engine_count = run(&engine, engine_memory, input->instructions, 0);
+
+	if (engine_count != input->instructions || difftest_compare(&reference, &engine) != NULL
+	    || memcmp(reference_memory, engine_memory, sizeof(reference_memory)) != 0) {
+		// blame the first instruction after which the engines disagree
+		for (int n = 1; n <= input->instructions; n++) {
+			if (!fuzz_agree(input, n, &reference, &engine)) {
+				(void)fuzz_agree(input, n - 1, &reference, &engine);
+				shared->opcode = fuzz_decode(reference_memory, reference.pc.W, &shared->page);
+				break;
+			}
+		}
+
+		return FUZZ_STATUS_DIVERGED;
+	}
+
+	return FUZZ_STATUS_OK;
+}
+
+/**
+ * Runs a case in a forked child, so exits and crashes in the core are
+ * caught
+ * \param input case to run
+ * \param shared coverage and progress shared with the child
+ * \return Outcome of the case.
+ */
+static int fuzz_run(const fuzz_input *input, fuzz_shared *shared) {
+	int status;
+	pid_t child;
+
+	(void)fflush(stdout);
+
+	if ((child = fork()) < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+
+	if (child == 0) {
+		(void)alarm(FUZZ_TIMEOUT);
+		_exit(fuzz_child(input, shared));
+	}
+
+	if (waitpid(child, &status, 0) < 0) {
+		perror("waitpid");
+		exit(EXIT_FAILURE);
+	}
+
+	if (WIFSIGNALED(status)) {
+		return (WTERMSIG(status) == SIGALRM) ? FUZZ_HANG : FUZZ_CRASH;
+	}
+
+	switch (WEXITSTATUS(status)) {
+	case FUZZ_STATUS_OK:
+		return FUZZ_OK;
+
+	case FUZZ_STATUS_DIVERGED:
+		return FUZZ_DIVERGED;
+
+	case FUZZ_STATUS_UNKNOWN:
+		return FUZZ_UNKNOWN;
+
+	// unknown opcodes trap rather than exit, so this is something else calling exit()
+	default:
+		return FUZZ_EXIT;
+	}
+}
+
+/**
+ * Writes the bytes of an instruction selecting a handler, with random
+ * operand bytes after it
+ * \param code buffer to write to, at least 4 bytes long
+ * \param page opcode page of the handler
+ * \param opcode opcode of the handler
+ * \return Number of bytes written.
+ */
+static int fuzz_emit(uint8_t *code, int page, int opcode) {
+	switch (page) {
+	case OPSTATS_CB:
+	case OPSTATS_ED:
+	case OPSTATS_DD:
+	case OPSTATS_FD:
+		code[0] = (page == OPSTATS_CB) ? 0xCB : (page == OPSTATS_ED) ? 0xED : (page == OPSTATS_DD) ? 0xDD : 0xFD;
+		code[1] = (uint8_t)opcode;
+		code[2] = (uint8_t)fuzz_random();
+		code[3] = (uint8_t)fuzz_random();
+		return 2;
+
+	case OPSTATS_DDCB:
+	case OPSTATS_FDCB:
+		code[0] = (page == OPSTATS_DDCB) ? 0xDD : 0xFD;
+		code[1] = 0xCB;
+		code[2] = (uint8_t)fuzz_random();
+		code[3] = (uint8_t)opcode;
+		return 4;
+
+	default:
+		code[0] = (uint8_t)opcode;
+		code[1] = (uint8_t)fuzz_random();
+		code[2] = (uint8_t)fuzz_random();
+		return 1;
+	}
+}
+
+/**
+ * Checks whether any flags outcome of a handler has been seen
+ */
+static int fuzz_covered(const fuzz_shared *shared, int page, int opcode) {
+	for (int flags = 0; flags < 64; flags++) {
+		if (shared->hits[page][opcode][flags]) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Generates a new case, mostly from instructions whose handlers haven't
+ * run yet
+ */
+static void fuzz_generate(fuzz_input *input, const fuzz_shared *shared, int instructions) {
+	int position = 0;
+
+	for (int i = 0; i < FUZZ_REGISTERS; i++) {
+		input->registers[i] = (uint16_t)fuzz_random();
+	}
+	input->instructions = instructions;
+
+	while (position < FUZZ_CODE - 4) {
+		int page = (int)(fuzz_random() % OPSTATS_PAGES);
+		int opcode = (int)(fuzz_random() % 256);
+
+		// retry a few times for an uncovered handler, then take what we got
+		for (int tries = 0; tries < 8 && fuzz_covered(shared, page, opcode); tries++) {
+			page = (int)(fuzz_random() % OPSTATS_PAGES);
+			opcode = (int)(fuzz_random() % 256);
+		}
+
+		position += fuzz_emit(&input->code[position], page, opcode);
+	}
+
+	while (position < FUZZ_CODE) {
+		input->code[position++] = (uint8_t)fuzz_random();
+	}
+}
+
+/**
+ * Mutates a case from the corpus: flips bytes, replaces instructions or
+ * changes registers
+ */
+static void fuzz_mutate(fuzz_input *input) {
+	int mutations = 1 + (int)(fuzz_random() % 4);
+
+	for (int i = 0; i < mutations; i++) {
+		switch (fuzz_random() % 3) {
+		case 0:
+			input->code[fuzz_random() % FUZZ_CODE] ^= (uint8_t)(1 << (fuzz_random() % 8));
+			break;
+
+		case 1:
+			input->code[fuzz_random() % FUZZ_CODE] = (uint8_t)fuzz_random();
+			break;
+
+		default:
+			input->registers[fuzz_random() % FUZZ_REGISTERS] = (uint16_t)fuzz_random();
+			break;
+		}
+	}
+}
+
+/**
+ * Runs a candidate while minimizing a case
+ * \return 1 if the candidate has the outcome in the same handler, 0 otherwise.
+ */
+static int fuzz_reproduces(const fuzz_input *candidate, int outcome, int page, int opcode, fuzz_shared *shared) {
+	return fuzz_run(candidate, shared) == outcome && shared->page == page && shared->opcode == opcode;
+}
+
+/**
+ * Shrinks a case while it keeps the same outcome in the same handler:
+ * fewer instructions, then code bytes replaced by nops, then registers
+ * cleared
+ * \param input case to shrink in place
+ * \param outcome outcome to keep
+ * \param page opcode page of the handler to keep
+ * \param opcode opcode of the handler to keep
+ * \param shared state shared with the children
+ */
+static void fuzz_minimize(fuzz_input *input, int outcome, int page, int opcode, fuzz_shared *shared) {
+	fuzz_input candidate = *input;
+
+	for (int n = 1; n < input->instructions; n++) {
+		candidate.instructions = n;
+		if (fuzz_reproduces(&candidate, outcome, page, opcode, shared)) {
+			input->instructions = n;
+			break;
+		}
+	}
+
+	for (int i = 0; i < FUZZ_CODE; i++) {
+		if (input->code[i] != 0x00) {
+			candidate = *input;
+			candidate.code[i] = 0x00;
+			if (fuzz_reproduces(&candidate, outcome, page, opcode, shared)) {
+				*input = candidate;
+			}
+		}
+	}
+
+	for (int i = 0; i < FUZZ_REGISTERS; i++) {
+		if (input->registers[i] != 0) {
+			candidate = *input;
+			candidate.registers[i] = 0;
+			if (fuzz_reproduces(&candidate, outcome, page, opcode, shared)) {
+				*input = candidate;
+			}
+		}
+	}
+}
+
+/**
+ * Writes a minimized case: outcome, handler, and the state to reproduce it
+ */
+static void fuzz_write_finding(FILE *out, const fuzz_input *input, int outcome, int page, int opcode) {
+	int length = FUZZ_CODE;
+
+	// trailing nops don't matter
+	while (length > 1 && input->code[length - 1] == 0x00) {
+		length--;
+	}
+
+	fprintf(out, "%s in handler %s%02X after %d instruction(s)\n  code:",
+	        fuzz_outcomes[outcome], fuzz_pages[page], opcode, input->instructions);
+	for (int i = 0; i < length; i++) {
+		fprintf(out, " %02X", input->code[i]);
+	}
+	fprintf(out, "\n  af=%04X bc=%04X de=%04X hl=%04X ix=%04X iy=%04X sp=%04X af'=%04X bc'=%04X de'=%04X hl'=%04X\n",
+	        input->registers[0], input->registers[1], input->registers[2], input->registers[3],
+	        input->registers[4], input->registers[5], input->registers[6], input->registers[7],
+	        input->registers[8], input->registers[9], input->registers[10]);
+}
+
+/** PZ80 CPU core fuzzer */
+int main(int argc, char *argv[]) {
+	long cases = 10000;
+	long seed = 1;
+	int instructions = 16;
+	int max_findings = 100;
+	int quiet = 0;
+	int c;
+	int corpus_size = 0, findings = 0;
+	long outcomes[FUZZ_OUTCOMES] = { 0 };
+	fuzz_shared *shared;
+	static fuzz_input corpus[FUZZ_CORPUS];
+	static uint8_t seen[FUZZ_OUTCOMES][OPSTATS_PAGES][256];
+
+	while ((c = getopt(argc, argv, "n:s:i:m:q")) != -1) {
+		switch (c) {
+			case 'n':
+				cases = strtol(optarg, NULL, 0);
+				break;
+
+			case 's':
+				seed = strtol(optarg, NULL, 0);
+				break;
+
+			case 'i':
+				instructions = (int)strtol(optarg, NULL, 0);
+				break;
+
+			case 'm':
+				max_findings = (int)strtol(optarg, NULL, 0);
+				break;
+
+			case 'q':
+				quiet = 1;
+				break;
+
+			default:
+				fprintf(stderr, USAGE);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (cases <= 0 || instructions <= 0 || instructions > FUZZ_MAX_INSTRUCTIONS) {
+		fprintf(stderr, USAGE);
+		return EXIT_FAILURE;
+	}
+
+	shared = mmap(NULL, sizeof (fuzz_shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+
+	fuzz_state = 0x9E3779B97F4A7C15ULL ^ (uint64_t)seed;
+
+	for (long n = 0; n < cases; n++) {
+		fuzz_input input;
+		int outcome;
+
+		// half the cases mutate something that found new coverage
+		if (corpus_size > 0 && fuzz_random() % 2) {
+			input = corpus[fuzz_random() % (uint32_t)corpus_size];
+			fuzz_mutate(&input);
+		} else {
+			fuzz_generate(&input, shared, instructions);
+		}
+
+		shared->new_coverage = 0;
+		outcome = fuzz_run(&input, shared);
+		outcomes[outcome]++;
+
+		if (shared->new_coverage && outcome == FUZZ_OK) {
+			corpus[(corpus_size < FUZZ_CORPUS) ? corpus_size++ : (int)(fuzz_random() % FUZZ_CORPUS)] = input;
+		}
+
+		// report each outcome once per handler it happened in
+		if (outcome != FUZZ_OK && !seen[outcome][shared->page][shared->opcode] && findings < max_findings) {
+			int page = shared->page;
+			int opcode = shared->opcode;
+
+			seen[outcome][page][opcode] = 1;
+			findings++;
+
+			fuzz_minimize(&input, outcome, page, opcode, shared);
+			if (!quiet) {
+				fuzz_write_finding(stdout, &input, outcome, page, opcode);
+			}
+		}
+	}
+
+	printf("%ld cases:", cases);
+	for (int i = 0; i < FUZZ_OUTCOMES; i++) {
+		printf(" %s %ld%s", fuzz_outcomes[i], outcomes[i], (i < FUZZ_OUTCOMES - 1) ? "," : "\n");
+	}
+
+	printf("handlers covered:");
+	for (int page = 0; page < OPSTATS_PAGES; page++) {
+		int covered = 0;
+
+		for (int opcode = 0; opcode < 256; opcode++) {
+			covered += fuzz_covered(shared, page, opcode);
+		}
+		printf(" %s %d", (page == 0) ? "base" : fuzz_pages[page], covered);
+	}
+	printf("\n%d finding(s) reported\n", findings);
+
+	(void)munmap(shared, sizeof (fuzz_shared));
+
+	// unknown opcodes and exits are gaps in the instruction set, not bugs
+	return (outcomes[FUZZ_DIVERGED] || outcomes[FUZZ_CRASH] || outcomes[FUZZ_HANG]) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
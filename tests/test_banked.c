@@ -0,0 +1,108 @@
+#include <glib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "banked.h"
+
+typedef struct {
+	banked *b;
+} test_fixture;
+
+static void setup_banked(test_fixture *tf, gconstpointer data) {
+	tf->b = banked_new((size_t)GPOINTER_TO_INT(data));
+	g_assert(tf->b != NULL);
+}
+
+static void teardown_banked(test_fixture *tf, gconstpointer data) {
+	banked_free(tf->b);
+}
+
+// resident memory of the process, in bytes
+static long resident(void) {
+	long size, pages;
+	FILE *statm = fopen("/proc/self/statm", "r");
+
+	g_assert(statm != NULL);
+	g_assert_cmpint(fscanf(statm, "%ld %ld", &size, &pages), ==, 2);
+	(void) fclose(statm);
+
+	return pages * sysconf(_SC_PAGESIZE);
+}
+
+// every slot needs a bank of its own
+static void test_banked_count(test_fixture *tf, gconstpointer data) {
+	for (size_t count = 0; count < BANKED_SLOTS; count++) {
+		errno = 0;
+		g_assert(banked_new(count) == NULL);
+		g_assert_cmpint(errno, ==, EINVAL);
+	}
+
+	for (int slot = 0; slot < BANKED_SLOTS; slot++) {
+		g_assert_cmpint(tf->b->slots[slot], ==, slot);
+	}
+	g_assert_cmpint(banked_select(tf->b, 0, BANKED_SLOTS), ==, -1);
+}
+
+static void test_banked_select(test_fixture *tf, gconstpointer data) {
+	uint8_t *memory = tf->b->memory;
+
+	g_assert(banked_bank(tf->b, 1) == &memory[0x4000]);
+	memory[0x4000] = 0x11;
+	memory[0x7FFF] = 0x22;
+
+	g_assert_cmpint(banked_select(tf->b, 1, 7), ==, 0);
+	g_assert_cmpint(tf->b->slots[1], ==, 7);
+	g_assert_cmpint(memory[0x4000], ==, 0);
+	memory[0x4000] = 0x77;
+
+	// the bank that left keeps its contents where it lives
+	g_assert(banked_bank(tf->b, 1) != &memory[0x4000]);
+	g_assert_cmpint(banked_bank(tf->b, 1)[0], ==, 0x11);
+	g_assert_cmpint(banked_bank(tf->b, 1)[BANKED_BANK_SIZE - 1], ==, 0x22);
+
+	banked_bank(tf->b, 9)[0x10] = 0x99;
+	g_assert_cmpint(banked_select(tf->b, 3, 9), ==, 0);
+	g_assert_cmpint(memory[0xC010], ==, 0x99);
+
+	g_assert_cmpint(banked_select(tf->b, 1, 1), ==, 0);
+	g_assert_cmpint(memory[0x4000], ==, 0x11);
+	g_assert_cmpint(banked_bank(tf->b, 7)[0], ==, 0x77);
+
+	// a bank can only be in one slot, and both have to exist
+	g_assert_cmpint(banked_select(tf->b, 0, 2), ==, -1);
+	g_assert_cmpint(banked_select(tf->b, 4, 5), ==, -1);
+	g_assert_cmpint(banked_select(tf->b, 0, 16), ==, -1);
+	g_assert_cmpint(tf->b->slots[0], ==, 0);
+}
+
+// pages only get storage when they are written
+static void test_banked_lazy(test_fixture *tf, gconstpointer data) {
+	long before = resident(), sum = 0;
+
+	for (size_t bank = 0; bank < tf->b->count; bank++) {
+		const uint8_t *bytes = banked_bank(tf->b, (int)bank);
+
+		for (size_t i = 0; i < BANKED_BANK_SIZE; i++) {
+			sum += bytes[i];
+		}
+	}
+	g_assert_cmpint(sum, ==, 0);
+	g_assert_cmpint(resident() - before, <, 1 << 20);
+
+	for (size_t bank = 0; bank < 256; bank++) {
+		banked_bank(tf->b, (int)bank)[0] = 1;
+	}
+	g_assert_cmpint(resident() - before, >=, 256 * sysconf(_SC_PAGESIZE));
+	g_assert_cmpint(resident() - before, <, 4 << 20);
+}
+
+int main(int argc, char *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/banked/count", test_fixture, GINT_TO_POINTER(BANKED_SLOTS), setup_banked, test_banked_count, teardown_banked);
+	g_test_add("/banked/select", test_fixture, GINT_TO_POINTER(16), setup_banked, test_banked_select, teardown_banked);
+	g_test_add("/banked/lazy", test_fixture, GINT_TO_POINTER(1024), setup_banked, test_banked_lazy, teardown_banked);
+
+	return g_test_run();
+}
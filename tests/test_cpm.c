@@ -0,0 +1,138 @@
+#include <glib.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "z80.h"
+#include "cpm.h"
+
+// prints "Hi" with function 9 and "!" with function 2, stores the
+// version number from function 12 at 0x0200 and returns to CP/M
+static const uint8_t program[] = {
+	0x0E, 0x09,       // ld c,9
+	0x11, 0x18, 0x01, // ld de,msg
+	0xCD, 0x05, 0x00, // call 5
+	0x0E, 0x02,       // ld c,2
+	0x1E, 0x21,       // ld e,'!'
+	0xCD, 0x05, 0x00, // call 5
+	0x0E, 0x0C,       // ld c,12
+	0xCD, 0x05, 0x00, // call 5
+	0x32, 0x00, 0x02, // ld (0x0200),a
+	0xC9,             // ret
+	'H', 'i', '$'     // msg
+};
+
+typedef struct {
+	z80 *cpu;
+	uint8_t *memory;
+	cpm *machine;
+	char *output;
+	size_t output_length;
+	char path[32];
+} test_fixture;
+
+static void setup_cpm(test_fixture *tf, gconstpointer data) {
+	int fd;
+	FILE *com;
+
+	tf->cpu = new_cpu();
+	tf->memory = calloc(0x10000, sizeof(uint8_t));
+	tf->machine = cpm_new(tf->cpu, tf->memory);
+	tf->machine->out = open_memstream(&tf->output, &tf->output_length);
+
+	strcpy(tf->path, "/tmp/test_cpm_XXXXXX");
+	fd = mkstemp(tf->path);
+	com = fdopen(fd, "wb");
+	fwrite(program, 1, sizeof(program), com);
+	fclose(com);
+}
+
+static void teardown_cpm(test_fixture *tf, gconstpointer data) {
+	unlink(tf->path);
+	fclose(tf->machine->out);
+	free(tf->output);
+	cpm_free(tf->machine);
+	free(tf->cpu);
+	free(tf->memory);
+}
+
+static void test_cpm_setup(test_fixture *tf, gconstpointer data) {
+	// BDOS entry and top of the TPA
+	g_assert(tf->memory[0x0005] == 0xC3);
+	g_assert((tf->memory[0x0006] | (tf->memory[0x0007] << 8)) == CPM_BDOS);
+	g_assert(tf->cpu->pc.W == CPM_TPA);
+	g_assert(tf->cpu->sp.W == CPM_BDOS - 2);
+	g_assert(tf->cpu->port_context == tf->machine);
+}
+
+static void test_cpm_load(test_fixture *tf, gconstpointer data) {
+	char path[] = "/tmp/test_cpm_big_XXXXXX";
+	int fd = mkstemp(path);
+	FILE *com = fdopen(fd, "wb");
+
+	g_assert(cpm_load(tf->machine, tf->path) == sizeof(program));
+	g_assert(memcmp(&tf->memory[CPM_TPA], program, sizeof(program)) == 0);
+
+	// a program running into the BDOS doesn't fit
+	for (long i = 0; i <= CPM_BDOS - CPM_TPA; i++) {
+		fputc(0, com);
+	}
+	fclose(com);
+
+	g_assert(cpm_load(tf->machine, path) == -1);
+	g_assert(cpm_load(tf->machine, "/nonexistent/program.com") == -1);
+	unlink(path);
+}
+
+static void test_cpm_console(test_fixture *tf, gconstpointer data) {
+	g_assert(cpm_load(tf->machine, tf->path) == sizeof(program));
+
+	for (int i = 0; i < 100 && !tf->machine->done; i++) {
+		g_assert(run(tf->cpu, tf->memory, 1, 0) == 1);
+	}
+
+	// the ret lands on the warm boot code
+	g_assert(tf->machine->done);
+	g_assert(tf->cpu->pc.W == 0x0002);
+	g_assert(tf->memory[0x0200] == 0x22);
+
+	fflush(tf->machine->out);
+	g_assert(tf->output_length == 3);
+	g_assert(strcmp(tf->output, "Hi!") == 0);
+}
+
+// nothing after a system reset call runs
+static void test_cpm_reset(test_fixture *tf, gconstpointer data) {
+	static const uint8_t reset[] = {
+		0x0E, 0x00,       // ld c,0
+		0xCD, 0x05, 0x00, // call 5
+		0x0E, 0x02,       // ld c,2
+		0x1E, 'X',        // ld e,'X'
+		0xCD, 0x05, 0x00, // call 5
+		0x18, 0xFE        // jr $
+	};
+
+	memcpy(&tf->memory[CPM_TPA], reset, sizeof(reset));
+
+	for (int i = 0; i < 100 && !tf->machine->done; i++) {
+		g_assert(run(tf->cpu, tf->memory, 1, 0) == 1);
+	}
+
+	g_assert(tf->machine->done);
+	g_assert(tf->cpu->pc.W == 0x0002);
+	g_assert(tf->cpu->bc.B.l == 0);
+
+	fflush(tf->machine->out);
+	g_assert(tf->output_length == 0);
+}
+
+int main (int argc, char *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/cpm/setup", test_fixture, NULL, setup_cpm, test_cpm_setup, teardown_cpm);
+	g_test_add("/cpm/load", test_fixture, NULL, setup_cpm, test_cpm_load, teardown_cpm);
+	g_test_add("/cpm/console", test_fixture, NULL, setup_cpm, test_cpm_console, teardown_cpm);
+	g_test_add("/cpm/system reset", test_fixture, NULL, setup_cpm, test_cpm_reset, teardown_cpm);
+
+	return g_test_run();
+}
@@ -0,0 +1,128 @@
+#include <glib.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "z80.h"
+#include "difftest.h"
+
+// copies and loops over fusable and block instructions
+static const uint8_t program[] = {
+	0x21, 0x00, 0x10, // ld hl,0x1000
+	0x11, 0x00, 0x20, // ld de,0x2000
+	0x06, 0x20,       // ld b,0x20
+	0x7E,             // loop: ld a,(hl)
+	0x23,             // inc hl
+	0x12,             // ld (de),a
+	0x13,             // inc de
+	0x05,             // dec b
+	0x20, 0xF9,       // jr nz,loop
+	0x01, 0x00, 0x01, // ld bc,0x0100
+	0xED, 0xB0,       // ldir
+	0xC3, 0x00, 0x00  // jp 0
+};
+
+typedef struct {
+	difftest *test;
+} test_fixture;
+
+/**
+ * Engine under test that gets the inc hl wrong when it makes HL 0x1006,
+ * the instruction at index 34, leaving HL one too high
+ */
+static int broken_engine(z80 *cpu, uint8_t *memory, long instructions) {
+	int count = 0;
+
+	while (count < instructions) {
+		int broken = (cpu->pc.W == 0x0009 && cpu->hl.W == 0x1005);
+
+		g_assert(run(cpu, memory, 1, 0) == 1);
+		if (broken) {
+			cpu->hl.W++;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+/** Arguments on_rerun was called with, in order */
+static int reruns[4];
+static int rerun_count;
+
+static void record_rerun(void *context, int rerunning) {
+	g_assert(context == reruns);
+	if (rerun_count < 4) {
+		reruns[rerun_count] = rerunning;
+	}
+	rerun_count++;
+}
+
+static void setup_difftest(test_fixture *tf, gconstpointer data) {
+	tf->test = difftest_new(program, sizeof(program), 256);
+
+	for (int i = 0; i < 0x100; i++) {
+		tf->test->reference_memory[0x1000 + i] = tf->test->engine_memory[0x1000 + i] = (uint8_t)i;
+	}
+}
+
+static void teardown_difftest(test_fixture *tf, gconstpointer data) {
+	difftest_free(tf->test);
+}
+
+static void test_difftest_agree(test_fixture *tf, gconstpointer data) {
+	char *buffer = NULL;
+	size_t length = 0;
+	FILE *out = open_memstream(&buffer, &length);
+
+	g_assert(difftest_run(tf->test, 20000) == 0);
+	g_assert(tf->test->instructions == 20000);
+	g_assert(difftest_compare(tf->test->reference, tf->test->engine) == NULL);
+	g_assert(tf->test->reference->cycles > 0);
+
+	difftest_write_report(tf->test, out);
+	fclose(out);
+	g_assert(strcmp(buffer, "engines agree after 20000 instructions\n") == 0);
+	free(buffer);
+}
+
+static void test_difftest_diverge(test_fixture *tf, gconstpointer data) {
+	char *buffer = NULL;
+	size_t length = 0;
+	FILE *out = open_memstream(&buffer, &length);
+
+	tf->test->engine_run = broken_engine;
+	tf->test->on_rerun = record_rerun;
+	tf->test->rerun_context = reruns;
+	rerun_count = 0;
+
+	g_assert(difftest_run(tf->test, 20000) == 1);
+	g_assert_cmpint(rerun_count, ==, 2);
+	g_assert_cmpint(reruns[0], ==, 1);
+	g_assert_cmpint(reruns[1], ==, 0);
+	g_assert(tf->test->diverged);
+	g_assert(tf->test->divergence == 34);
+	g_assert(strcmp(tf->test->field, "hl") == 0);
+	g_assert(tf->test->engine_after.hl.W == tf->test->reference_after.hl.W + 1);
+	g_assert(tf->test->trace_length == DIFFTEST_TRACE);
+	g_assert(tf->test->trace[DIFFTEST_TRACE - 1].index == 34);
+	g_assert(tf->test->trace[DIFFTEST_TRACE - 1].pc == 0x0009);
+	g_assert(tf->test->trace[DIFFTEST_TRACE - 1].bytes[0] == 0x23);
+	g_assert(tf->test->before.pc.W == 0x0009);
+	g_assert(tf->test->before.hl.W == 0x1005);
+
+	difftest_write_report(tf->test, out);
+	fclose(out);
+	g_assert(strncmp(buffer, "engines diverge at instruction 34: hl differs\n", 46) == 0);
+	g_assert(strstr(buffer, "0009  23 ") != NULL);
+	g_assert(strstr(buffer, "  inc hl\n") != NULL);
+	free(buffer);
+}
+
+int main (int argc, char *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/difftest/agree", test_fixture, NULL, setup_difftest, test_difftest_agree, teardown_difftest);
+	g_test_add("/difftest/diverge", test_fixture, NULL, setup_difftest, test_difftest_diverge, teardown_difftest);
+
+	return g_test_run();
+}
@@ -0,0 +1,120 @@
+#include <glib.h>
+#include <stdint.h>
+#include <string.h>
+#include "opcodes.h"
+#include "disasm.h"
+
+typedef struct {
+	char text[DISASM_TEXT];
+} test_fixture;
+
+static void setup_disasm(test_fixture *tf, gconstpointer data) {
+	memset(tf->text, 0, sizeof(tf->text));
+}
+
+static void teardown_disasm(test_fixture *tf, gconstpointer data) {
+}
+
+// disassembles some bytes at an address, checking the length and text
+static void check(test_fixture *tf, const uint8_t *bytes, size_t available, uint16_t address, int length, const char *text) {
+	g_assert_cmpint(disasm(bytes, available, address, tf->text), ==, length);
+	g_assert_cmpstr(tf->text, ==, text);
+}
+
+static void test_disasm_prefixes(test_fixture *tf, gconstpointer data) {
+	const uint8_t nop[] = { 0x00 };
+	const uint8_t ld_a_n[] = { 0x3E, 0x12 };
+	const uint8_t jp[] = { 0xC3, 0x34, 0x12 };
+	const uint8_t bit[] = { 0xCB, 0x7E };
+	const uint8_t srl_a[] = { 0xCB, 0x3F };
+	const uint8_t ld_nn_de[] = { 0xED, 0x53, 0x00, 0x80 };
+	const uint8_t ldir[] = { 0xED, 0xB0 };
+	const uint8_t ld_ix_nn[] = { 0xDD, 0x21, 0xCD, 0xAB };
+	const uint8_t ld_iy_d_n[] = { 0xFD, 0x36, 0x05, 0x42 };
+	const uint8_t set_ix_d[] = { 0xDD, 0xCB, 0xFE, 0xC6 };
+	const uint8_t res_iy_d[] = { 0xFD, 0xCB, 0x80, 0xBE };
+
+	check(tf, nop, sizeof(nop), 0, 1, "nop");
+	check(tf, ld_a_n, sizeof(ld_a_n), 0, 2, "ld a,0x12");
+	check(tf, jp, sizeof(jp), 0, 3, "jp 0x1234");
+	check(tf, bit, sizeof(bit), 0, 2, "bit 7,(hl)");
+	check(tf, srl_a, sizeof(srl_a), 0, 2, "srl a");
+	check(tf, ld_nn_de, sizeof(ld_nn_de), 0, 4, "ld (0x8000),de");
+	check(tf, ldir, sizeof(ldir), 0, 2, "ldir");
+	check(tf, ld_ix_nn, sizeof(ld_ix_nn), 0, 4, "ld ix,0xABCD");
+	check(tf, ld_iy_d_n, sizeof(ld_iy_d_n), 0, 4, "ld (iy+0x05),0x42");
+	check(tf, set_ix_d, sizeof(set_ix_d), 0, 4, "set 0,(ix-0x02)");
+	check(tf, res_iy_d, sizeof(res_iy_d), 0, 4, "res 7,(iy-0x80)");
+}
+
+// relative jumps show their target, wrapping around the address space
+static void test_disasm_relative(test_fixture *tf, gconstpointer data) {
+	const uint8_t back[] = { 0x10, 0xFE };
+	const uint8_t forward[] = { 0x20, 0x10 };
+
+	check(tf, back, sizeof(back), 0x0100, 2, "djnz 0x0100");
+	check(tf, forward, sizeof(forward), 0xFFF8, 2, "jr nz,0x000A");
+}
+
+static void test_disasm_undocumented(test_fixture *tf, gconstpointer data) {
+	const uint8_t ed_nop[] = { 0xED, 0x77 };
+	const uint8_t dd_nop[] = { 0xDD, 0x00 };
+	const uint8_t sll[] = { 0xCB, 0x30 };
+	const uint8_t cut[] = { 0xC3, 0x34 };
+
+	check(tf, ed_nop, sizeof(ed_nop), 0, 2, "db 0xED,0x77");
+	check(tf, dd_nop, sizeof(dd_nop), 0, 1, "db 0xDD");
+	check(tf, sll, sizeof(sll), 0, 1, "db 0xCB");
+	check(tf, cut, sizeof(cut), 0, 1, "db 0xC3");
+	check(tf, cut, 1, 0, 1, "db 0xC3");
+}
+
+// every documented opcode decodes to its own length with all operands filled in
+static void test_disasm_tables(test_fixture *tf, gconstpointer data) {
+	const struct {
+		uint8_t prefix[2];
+		int prefix_length;
+		const opcode *table;
+	} pages[] = {
+		{ { 0 }, 0, opcodes_base }, { { 0xCB }, 1, opcodes_cb }, { { 0xED }, 1, opcodes_ed },
+		{ { 0xDD }, 1, opcodes_dd }, { { 0xFD }, 1, opcodes_fd },
+		{ { 0xDD, 0xCB }, 2, opcodes_ddcb }, { { 0xFD, 0xCB }, 2, opcodes_fdcb }
+	};
+	int decoded = 0;
+
+	for (size_t p = 0; p < sizeof(pages) / sizeof(pages[0]); p++) {
+		for (int code = 0; code < 256; code++) {
+			const opcode *op = &pages[p].table[code];
+			uint8_t bytes[DISASM_MAX_LENGTH] = { 0 };
+
+			if (op->mnemonic == NULL || op->kind == OPCODE_PREFIX) {
+				continue;
+			}
+
+			memcpy(bytes, pages[p].prefix, pages[p].prefix_length);
+			// the opcode of a DD CB or FD CB comes after the offset
+			bytes[(pages[p].prefix_length == 2) ? 3 : pages[p].prefix_length] = (uint8_t)code;
+
+			g_assert_cmpint(disasm(bytes, sizeof(bytes), 0, tf->text), ==, op->length);
+
+			// with zero operands nothing is left in upper case but placeholders
+			for (const char *c = tf->text; *c != '\0'; c++) {
+				g_assert(*c < 'A' || *c > 'Z');
+			}
+			decoded++;
+		}
+	}
+
+	g_assert_cmpint(decoded, >, 600);
+}
+
+int main(int argc, char *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/disasm/prefixes", test_fixture, NULL, setup_disasm, test_disasm_prefixes, teardown_disasm);
+	g_test_add("/disasm/relative", test_fixture, NULL, setup_disasm, test_disasm_relative, teardown_disasm);
+	g_test_add("/disasm/undocumented", test_fixture, NULL, setup_disasm, test_disasm_undocumented, teardown_disasm);
+	g_test_add("/disasm/tables", test_fixture, NULL, setup_disasm, test_disasm_tables, teardown_disasm);
+
+	return g_test_run();
+}
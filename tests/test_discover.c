@@ -0,0 +1,137 @@
+#include <glib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "discover.h"
+
+typedef struct {
+	uint8_t *memory;
+	char dir[64];
+} test_fixture;
+
+static void setup_discover(test_fixture *tf, gconstpointer data) {
+	tf->memory = calloc(0x10000, sizeof(uint8_t));
+	strcpy(tf->dir, "/tmp/pz80-discover-XXXXXX");
+	g_assert(mkdtemp(tf->dir) != NULL);
+}
+
+static void teardown_discover(test_fixture *tf, gconstpointer data) {
+	char command[128];
+
+	(void) snprintf(command, sizeof(command), "rm -rf %s", tf->dir);
+	g_assert_cmpint(system(command), ==, 0);
+	free(tf->memory);
+}
+
+// a program at 0x0100, with data nothing jumps to
+static const uint8_t program[] = {
+	0xC3, 0x05, 0x01, // 0100: jp 0x0105
+	0x48, 0x69,       // 0103: "Hi"
+	0x3E, 0x01,       // 0105: ld a,1
+	0x20, 0x04,       // 0107: jr nz,0x010D
+	0xCD, 0x10, 0x01, // 0109: call 0x0110
+	0x76,             // 010C: halt
+	0xE9,             // 010D: jp (hl)
+	0xFF, 0xFF,       // 010E: data
+	0xC9              // 0110: ret
+};
+
+static void test_discover_flow(test_fixture *tf, gconstpointer data) {
+	const uint16_t code[] = { 0x0100, 0x0105, 0x0107, 0x0109, 0x010C, 0x010D, 0x0110 };
+	const uint16_t blocks[] = { 0x0100, 0x0105, 0x0109, 0x010C, 0x010D, 0x0110 };
+	discover *map;
+
+	memcpy(&tf->memory[0x0100], program, sizeof(program));
+	map = discover_new(tf->memory, 0x0100, sizeof(program));
+
+	for (size_t i = 0; i < sizeof(code) / sizeof(code[0]); i++) {
+		g_assert(DISCOVER_IS_SET(map->code, code[i]));
+	}
+	for (size_t i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++) {
+		g_assert(DISCOVER_IS_SET(map->blocks, blocks[i]));
+	}
+	g_assert(!DISCOVER_IS_SET(map->code, 0x0103));
+	g_assert(!DISCOVER_IS_SET(map->code, 0x010E));
+	g_assert(!DISCOVER_IS_SET(map->blocks, 0x0107));
+	g_assert_cmpint(map->instructions, ==, 7);
+	g_assert_cmpint(map->block_count, ==, 6);
+
+	discover_free(map);
+}
+
+// the reset, RST and NMI vectors are entry points when the image covers them
+static void test_discover_vectors(test_fixture *tf, gconstpointer data) {
+	discover *map;
+
+	// ED ED is undocumented, so vectors with nothing there find nothing
+	memset(tf->memory, 0xED, 0x80);
+	tf->memory[0x0000] = 0xC3; // jp 0x0040
+	tf->memory[0x0001] = 0x40;
+	tf->memory[0x0002] = 0x00;
+	tf->memory[0x0038] = 0xC9; // ret
+	tf->memory[0x0040] = 0x76; // halt
+	tf->memory[0x0066] = 0xED; // retn
+	tf->memory[0x0067] = 0x45;
+
+	map = discover_new(tf->memory, 0x0000, 0x80);
+
+	g_assert(DISCOVER_IS_SET(map->code, 0x0000));
+	g_assert(DISCOVER_IS_SET(map->code, 0x0038));
+	g_assert(DISCOVER_IS_SET(map->code, 0x0040));
+	g_assert(DISCOVER_IS_SET(map->code, 0x0066));
+	g_assert_cmpint(map->instructions, ==, 4);
+
+	discover_free(map);
+}
+
+// the second run of an image reads the map back, a changed image doesn't
+static void test_discover_cache(test_fixture *tf, gconstpointer data) {
+	discover *built, *cached, *changed;
+	char filename[128];
+	FILE *file;
+
+	memcpy(&tf->memory[0x0100], program, sizeof(program));
+
+	built = discover_cached(tf->dir, tf->memory, 0x0100, sizeof(program));
+	g_assert_cmpint(built->cached, ==, 0);
+
+	cached = discover_cached(tf->dir, tf->memory, 0x0100, sizeof(program));
+	g_assert_cmpint(cached->cached, ==, 1);
+	g_assert(cached->hash == built->hash);
+	g_assert_cmpint(cached->origin, ==, 0x0100);
+	g_assert_cmpint(cached->size, ==, sizeof(program));
+	g_assert(memcmp(cached->code, built->code, sizeof(built->code)) == 0);
+	g_assert(memcmp(cached->blocks, built->blocks, sizeof(built->blocks)) == 0);
+	g_assert_cmpint(cached->instructions, ==, built->instructions);
+	g_assert_cmpint(cached->block_count, ==, built->block_count);
+
+	tf->memory[0x0106] = 0x02;
+	changed = discover_cached(tf->dir, tf->memory, 0x0100, sizeof(program));
+	g_assert_cmpint(changed->cached, ==, 0);
+	g_assert(changed->hash != built->hash);
+
+	// a truncated file is ignored
+	(void) snprintf(filename, sizeof(filename), "%s/%016llx" DISCOVER_EXTENSION, tf->dir, (unsigned long long)built->hash);
+	g_assert(discover_load(filename, built->hash) != NULL);
+	g_assert(discover_load(filename, changed->hash) == NULL);
+	g_assert((file = fopen(filename, "r+b")) != NULL);
+	g_assert_cmpint(ftruncate(fileno(file), 100), ==, 0);
+	(void) fclose(file);
+	g_assert(discover_load(filename, built->hash) == NULL);
+
+	discover_free(built);
+	discover_free(cached);
+	discover_free(changed);
+}
+
+int main(int argc, char *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/discover/flow", test_fixture, NULL, setup_discover, test_discover_flow, teardown_discover);
+	g_test_add("/discover/vectors", test_fixture, NULL, setup_discover, test_discover_vectors, teardown_discover);
+	g_test_add("/discover/cache", test_fixture, NULL, setup_discover, test_discover_cache, teardown_discover);
+
+	return g_test_run();
+}
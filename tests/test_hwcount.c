@@ -0,0 +1,121 @@
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hwcount.h"
+
+typedef struct {
+	hwcount *hw;
+} test_fixture;
+
+static void setup_hwcount(test_fixture *tf, gconstpointer data) {
+	tf->hw = hwcount_new();
+}
+
+static void teardown_hwcount(test_fixture *tf, gconstpointer data) {
+	hwcount_free(tf->hw);
+}
+
+// work the counters can see
+static volatile unsigned long sink;
+
+static void busy(void) {
+	for (unsigned long i = 0; i < 1000000; i++) {
+		sink += i;
+	}
+}
+
+// events the host has count, the rest stay empty; hosts without counters pass too
+static void test_hwcount_count(test_fixture *tf, gconstpointer data) {
+	uint64_t first[HWCOUNT_EVENTS], first_enabled[HWCOUNT_EVENTS];
+	int available = 0;
+
+	for (int event = 0; event < HWCOUNT_EVENTS; event++) {
+		g_assert(tf->hw->value[event] == 0);
+		if (tf->hw->fd[event] >= 0) {
+			available++;
+		}
+	}
+	g_assert_cmpint(tf->hw->available, ==, available);
+
+	hwcount_start(tf->hw);
+	busy();
+	hwcount_stop(tf->hw);
+	memcpy(first, tf->hw->value, sizeof(first));
+	memcpy(first_enabled, tf->hw->enabled, sizeof(first_enabled));
+
+	for (int event = 0; event < HWCOUNT_EVENTS; event++) {
+		double value = 0.0;
+
+		if (tf->hw->fd[event] < 0) {
+			g_assert(first[event] == 0);
+			g_assert_cmpint(hwcount_per_instruction(tf->hw, event, 1000, &value), ==, 0);
+			continue;
+		}
+
+		g_assert_cmpint(hwcount_per_instruction(tf->hw, event, 1000, &value), ==, 1);
+		g_assert(value == (double)first[event] / 1000);
+		g_assert_cmpint(hwcount_per_instruction(tf->hw, event, 0, &value), ==, 0);
+	}
+
+	// a busy task clock and cpu see the loop
+	if (tf->hw->fd[HWCOUNT_TASK_CLOCK] >= 0) {
+		g_assert(first[HWCOUNT_TASK_CLOCK] > 0);
+	}
+	if (tf->hw->fd[HWCOUNT_INSTRUCTIONS] >= 0) {
+		g_assert(first[HWCOUNT_INSTRUCTIONS] >= 1000000);
+	}
+
+	// a second stretch adds to the first, and nothing counts in between
+	busy();
+	hwcount_start(tf->hw);
+	busy();
+	hwcount_stop(tf->hw);
+
+	// the times the next stretch is scaled by are kept, as the kernel never resets them
+	for (int event = 0; event < HWCOUNT_EVENTS; event++) {
+		g_assert(tf->hw->value[event] >= first[event]);
+		g_assert(tf->hw->running[event] <= tf->hw->enabled[event]);
+		if (tf->hw->fd[event] >= 0) {
+			g_assert(tf->hw->enabled[event] > first_enabled[event]);
+		}
+	}
+	if (tf->hw->fd[HWCOUNT_INSTRUCTIONS] >= 0) {
+		g_assert(tf->hw->value[HWCOUNT_INSTRUCTIONS] < 3 * first[HWCOUNT_INSTRUCTIONS]);
+	}
+}
+
+static void test_hwcount_report(test_fixture *tf, gconstpointer data) {
+	char *buffer = NULL;
+	size_t length = 0;
+	FILE *out = open_memstream(&buffer, &length);
+
+	hwcount_start(tf->hw);
+	busy();
+	hwcount_stop(tf->hw);
+
+	hwcount_write_report(tf->hw, "run", 1000000, out);
+	(void) fclose(out);
+
+	g_assert(strncmp(buffer, "host counters for 1000000 instructions on run, per instruction:", 63) == 0);
+	g_assert(buffer[length - 1] == '\n');
+
+	for (int event = 0; event < HWCOUNT_EVENTS; event++) {
+		char expected[64];
+
+		// events the host lacks say so rather than showing zero
+		(void) snprintf(expected, sizeof(expected), (tf->hw->fd[event] < 0) ? " %s n/a" : " %s ", hwcount_name(event));
+		g_assert(strstr(buffer, expected) != NULL);
+	}
+
+	free(buffer);
+}
+
+int main(int argc, char *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/hwcount/count", test_fixture, NULL, setup_hwcount, test_hwcount_count, teardown_hwcount);
+	g_test_add("/hwcount/report", test_fixture, NULL, setup_hwcount, test_hwcount_report, teardown_hwcount);
+
+	return g_test_run();
+}
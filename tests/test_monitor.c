@@ -0,0 +1,95 @@
+#include <glib.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <ncurses.h>
+#include "z80.h"
+#include "monitor.h"
+
+typedef struct {
+	z80 *cpu;
+	uint8_t *memory;
+	monitor *mon;
+} test_fixture;
+
+// a monitor without windows only tracks changes
+static void setup_monitor(test_fixture *tf, gconstpointer data) {
+	tf->cpu = new_cpu();
+	tf->memory = calloc(0x10000, sizeof(uint8_t));
+	tf->mon = monitor_new(NULL, NULL, 0);
+}
+
+static void teardown_monitor(test_fixture *tf, gconstpointer data) {
+	monitor_free(tf->mon);
+	free(tf->cpu);
+	free(tf->memory);
+}
+
+// the first frame draws everything, later ones only what changed
+static void test_monitor_changes(test_fixture *tf, gconstpointer data) {
+	g_assert(monitor_changes(tf->mon, tf->cpu, tf->memory) == MONITOR_FIELDS + MONITOR_PAGES);
+	monitor_draw(tf->mon, tf->cpu, tf->memory);
+	g_assert(monitor_changes(tf->mon, tf->cpu, tf->memory) == 0);
+
+	tf->memory[0x1234] = 0x55;
+	tf->memory[0x12FF] = 0xAA;
+	tf->cpu->hl.W = 0x1234;
+	tf->cpu->flags = 0x01;
+
+	g_assert(monitor_changes(tf->mon, tf->cpu, tf->memory) == 3);
+	g_assert(tf->mon->dirty_pages[0x12]);
+	g_assert(!tf->mon->dirty_pages[0x13]);
+	g_assert(tf->mon->dirty_registers == ((1u << 2) | (1u << 5)));
+
+	monitor_draw(tf->mon, tf->cpu, tf->memory);
+	g_assert(tf->mon->shown_memory[0x1234] == 0x55);
+	g_assert(tf->mon->shown_registers[5] == 0x1234);
+	g_assert(monitor_changes(tf->mon, tf->cpu, tf->memory) == 0);
+	g_assert(!tf->mon->dirty_pages[0x12]);
+}
+
+// frames are capped, and nothing is drawn when nothing changed
+static void test_monitor_frame_rate(test_fixture *tf, gconstpointer data) {
+	g_assert(monitor_frame(tf->mon, tf->cpu, tf->memory) == 1);
+	tf->memory[0x0000] = 0x01;
+	g_assert(monitor_frame(tf->mon, tf->cpu, tf->memory) == 0);
+	g_assert(tf->mon->frames == 1);
+
+	tf->mon->frame_interval = 0;
+	g_assert(monitor_frame(tf->mon, tf->cpu, tf->memory) == 1);
+	g_assert(tf->mon->shown_memory[0x0000] == 0x01);
+	g_assert(monitor_changes(tf->mon, tf->cpu, tf->memory) == 0);
+}
+
+// the view scrolls by rows and screens and stays inside the 64K
+static void test_monitor_scroll(test_fixture *tf, gconstpointer data) {
+	tf->mon->rows = 8;
+
+	g_assert(monitor_key(tf->mon, tf->cpu, KEY_DOWN));
+	g_assert(tf->mon->top == 0x0010);
+	g_assert(tf->mon->scrolled);
+	g_assert(monitor_key(tf->mon, tf->cpu, KEY_NPAGE));
+	g_assert(tf->mon->top == 0x0090);
+	g_assert(monitor_key(tf->mon, tf->cpu, KEY_END));
+	g_assert(tf->mon->top == 0xFF80);
+	g_assert(monitor_key(tf->mon, tf->cpu, KEY_DOWN));
+	g_assert(tf->mon->top == 0xFF80);
+	g_assert(monitor_key(tf->mon, tf->cpu, KEY_HOME));
+	g_assert(tf->mon->top == 0x0000);
+	g_assert(monitor_key(tf->mon, tf->cpu, KEY_UP));
+	g_assert(tf->mon->top == 0x0000);
+
+	tf->cpu->pc.W = 0x4321;
+	g_assert(monitor_key(tf->mon, tf->cpu, 'p'));
+	g_assert(tf->mon->top == 0x42E0);
+	g_assert(!monitor_key(tf->mon, tf->cpu, 'x'));
+}
+
+int main(int argc, char *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/monitor/changes", test_fixture, NULL, setup_monitor, test_monitor_changes, teardown_monitor);
+	g_test_add("/monitor/frame rate", test_fixture, NULL, setup_monitor, test_monitor_frame_rate, teardown_monitor);
+	g_test_add("/monitor/scroll", test_fixture, NULL, setup_monitor, test_monitor_scroll, teardown_monitor);
+
+	return g_test_run();
+}
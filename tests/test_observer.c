@@ -0,0 +1,213 @@
+#include <glib.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "z80.h"
+#include "observer.h"
+
+/** Snapshots the publisher thread writes in the seqlock test */
+#define PUBLISHES 2000
+
+typedef struct {
+	z80 *cpu;
+	uint8_t *memory;
+	observer *obs;
+	observer_snapshot *snapshot;
+} test_fixture;
+
+static void setup_observer(test_fixture *tf, gconstpointer data) {
+	tf->cpu = new_cpu();
+	tf->memory = calloc(0x10000, sizeof(uint8_t));
+	tf->obs = observer_new(0);
+	tf->snapshot = malloc(sizeof(observer_snapshot));
+}
+
+static void teardown_observer(test_fixture *tf, gconstpointer data) {
+	observer_free(tf->obs);
+	free(tf->cpu);
+	free(tf->memory);
+	free(tf->snapshot);
+}
+
+static void test_observer_queue(test_fixture *tf, gconstpointer data) {
+	observer_command command;
+
+	g_assert(!observer_pop(tf->obs, &command));
+
+	for (int i = 0; i < OBSERVER_QUEUE; i++) {
+		g_assert(observer_push(tf->obs, OBSERVER_BREAK, (uint16_t)i));
+	}
+	g_assert(!observer_push(tf->obs, OBSERVER_QUIT, 0));
+
+	// commands come out in order, and make room as they do
+	g_assert(observer_pop(tf->obs, &command));
+	g_assert(command.type == OBSERVER_BREAK && command.address == 0);
+	g_assert(observer_push(tf->obs, OBSERVER_QUIT, 0));
+
+	for (int i = 1; i < OBSERVER_QUEUE; i++) {
+		g_assert(observer_pop(tf->obs, &command));
+		g_assert(command.address == i);
+	}
+	g_assert(observer_pop(tf->obs, &command));
+	g_assert(command.type == OBSERVER_QUIT);
+	g_assert(!observer_pop(tf->obs, &command));
+}
+
+static void test_observer_publish(test_fixture *tf, gconstpointer data) {
+	g_assert(observer_read(tf->obs, tf->snapshot) == 0);
+
+	tf->cpu->hl.W = 0x1234;
+	tf->memory[0x8000] = 0x55;
+	observer_publish(tf->obs, tf->cpu, tf->memory, 10);
+
+	g_assert(observer_read(tf->obs, tf->snapshot) == 1);
+	g_assert(tf->snapshot->cpu.hl.W == 0x1234);
+	g_assert(tf->snapshot->memory[0x8000] == 0x55);
+	g_assert(tf->snapshot->instructions == 10);
+
+	// the cpu's later changes only show in the next snapshot
+	tf->cpu->hl.W = 0x4321;
+	g_assert(observer_read(tf->obs, tf->snapshot) == 1);
+	g_assert(tf->snapshot->cpu.hl.W == 0x1234);
+	observer_publish(tf->obs, tf->cpu, tf->memory, 20);
+	g_assert(observer_read(tf->obs, tf->snapshot) == 2);
+	g_assert(tf->snapshot->cpu.hl.W == 0x4321);
+}
+
+// publishes snapshots whose registers and memory all hold the same value
+static void *publish_thread(void *context) {
+	test_fixture *tf = context;
+
+	for (int i = 1; i <= PUBLISHES; i++) {
+		tf->cpu->a = (uint8_t)i;
+		memset(tf->memory, (uint8_t)i, 0x10000);
+		observer_publish(tf->obs, tf->cpu, tf->memory, i);
+	}
+
+	return NULL;
+}
+
+// readers never see a snapshot torn between two publishes
+static void test_observer_seqlock(test_fixture *tf, gconstpointer data) {
+	pthread_t publisher;
+	uint64_t generation = 0;
+
+	g_assert(pthread_create(&publisher, NULL, publish_thread, tf) == 0);
+
+	while (generation < PUBLISHES) {
+		uint64_t read = observer_read(tf->obs, tf->snapshot);
+
+		if (read == 0) {
+			continue;
+		}
+
+		g_assert(read >= generation);
+		g_assert(tf->snapshot->instructions == (long)read);
+		g_assert(tf->snapshot->cpu.a == (uint8_t)read);
+		g_assert(tf->snapshot->memory[0x0000] == (uint8_t)read);
+		g_assert(tf->snapshot->memory[0x7FFF] == (uint8_t)read);
+		g_assert(tf->snapshot->memory[0xFFFF] == (uint8_t)read);
+		generation = read;
+	}
+
+	g_assert(pthread_join(publisher, NULL) == 0);
+}
+
+typedef struct {
+	test_fixture *tf;
+	int result;
+} run_context;
+
+static void *run_thread(void *context) {
+	run_context *run = context;
+
+	run->result = observer_run(run->tf->obs, run->tf->cpu, run->tf->memory, 0, 1);
+	return NULL;
+}
+
+// waits for a snapshot of a paused cpu after the given number of instructions
+static void wait_paused(test_fixture *tf, long instructions) {
+	struct timespec sleep = { 0, 100000L };
+
+	for (;;) {
+		if (observer_read(tf->obs, tf->snapshot) > 0 && tf->snapshot->paused
+		    && tf->snapshot->instructions == instructions) {
+			return;
+		}
+		(void) nanosleep(&sleep, NULL);
+	}
+}
+
+// commands step, break and stop a cpu running on another thread
+static void test_observer_run(test_fixture *tf, gconstpointer data) {
+	// inc a; jp 0x0000
+	uint8_t program[] = { 0x3C, 0xC3, 0x00, 0x00 };
+	run_context run = { tf, 0 };
+	pthread_t cpu;
+
+	memcpy(tf->memory, program, sizeof(program));
+	tf->cpu->counter = INTERRUPT_PERIOD;
+	g_assert(pthread_create(&cpu, NULL, run_thread, &run) == 0);
+
+	wait_paused(tf, 0);
+	g_assert(observer_push(tf->obs, OBSERVER_STEP, 0));
+	g_assert(observer_push(tf->obs, OBSERVER_STEP, 0));
+	g_assert(observer_push(tf->obs, OBSERVER_STEP, 0));
+	wait_paused(tf, 3);
+	g_assert(tf->snapshot->cpu.pc.W == 0x0001);
+	g_assert(tf->snapshot->cpu.a == 2);
+
+	// runs once around the loop back to the breakpoint
+	g_assert(observer_push(tf->obs, OBSERVER_BREAK, 0x0001));
+	g_assert(observer_push(tf->obs, OBSERVER_RESUME, 0));
+	wait_paused(tf, 5);
+	g_assert(tf->snapshot->cpu.pc.W == 0x0001);
+	g_assert(tf->snapshot->cpu.a == 3);
+	g_assert(tf->snapshot->breakpoints == 1);
+
+	g_assert(observer_push(tf->obs, OBSERVER_QUIT, 0));
+	g_assert(pthread_join(cpu, NULL) == 0);
+	g_assert(atomic_load(&tf->obs->done));
+	g_assert(run.result >= 0);
+	g_assert_cmpint(tf->obs->executed, ==, 5);
+	g_assert(tf->cpu->breakpoints == NULL);
+}
+
+// a breakpoint where one run() slice ends and the next starts still stops the cpu
+static void test_observer_slice_break(test_fixture *tf, gconstpointer data) {
+	run_context run = { tf, 0 };
+	pthread_t cpu;
+
+	// nops all the way round
+	tf->cpu->counter = INTERRUPT_PERIOD;
+	g_assert(observer_push(tf->obs, OBSERVER_BREAK, (uint16_t)OBSERVER_SLICE));
+	g_assert(observer_push(tf->obs, OBSERVER_RESUME, 0));
+	g_assert(pthread_create(&cpu, NULL, run_thread, &run) == 0);
+
+	wait_paused(tf, OBSERVER_SLICE);
+	g_assert(tf->snapshot->cpu.pc.W == OBSERVER_SLICE);
+
+	// resuming runs the instruction at the breakpoint, and stops there next time round
+	g_assert(observer_push(tf->obs, OBSERVER_RESUME, 0));
+	wait_paused(tf, OBSERVER_SLICE + 0x10000);
+	g_assert(tf->snapshot->cpu.pc.W == OBSERVER_SLICE);
+
+	g_assert(observer_push(tf->obs, OBSERVER_QUIT, 0));
+	g_assert(pthread_join(cpu, NULL) == 0);
+	g_assert_cmpint(tf->obs->executed, ==, OBSERVER_SLICE + 0x10000);
+}
+
+int main(int argc, char *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/observer/command queue", test_fixture, NULL, setup_observer, test_observer_queue, teardown_observer);
+	g_test_add("/observer/publish", test_fixture, NULL, setup_observer, test_observer_publish, teardown_observer);
+	g_test_add("/observer/seqlock", test_fixture, NULL, setup_observer, test_observer_seqlock, teardown_observer);
+	g_test_add("/observer/run", test_fixture, NULL, setup_observer, test_observer_run, teardown_observer);
+	g_test_add("/observer/slice break", test_fixture, NULL, setup_observer, test_observer_slice_break, teardown_observer);
+
+	return g_test_run();
+}
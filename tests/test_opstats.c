@@ -0,0 +1,100 @@
+#include <glib.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "z80.h"
+#include "opstats.h"
+
+typedef struct {
+	z80 *cpu;
+	uint8_t *memory;
+} test_fixture;
+
+static void setup_opstats(test_fixture *tf, gconstpointer data) {
+	tf->cpu = new_cpu();
+	tf->cpu->ops = opstats_new();
+	tf->memory = calloc(0x0100, sizeof(uint8_t));
+}
+
+static void teardown_opstats(test_fixture *tf, gconstpointer data) {
+	opstats_free(tf->cpu->ops);
+	free(tf->cpu);
+	free(tf->memory);
+}
+
+static void test_opstats_pages(test_fixture *tf, gconstpointer data) {
+	// ld a,n / ld ix,nn / ld (ix+n),a / nop
+	uint8_t program[10] = { 0x3E, 0x05, 0xDD, 0x21, 0x80, 0x00, 0xDD, 0x77, 0x01, 0x00 };
+	memcpy(tf->memory, program, sizeof(program));
+
+	g_assert(run(tf->cpu, tf->memory, 4, 0) == 4);
+	g_assert(tf->memory[0x0081] == 0x05);
+
+	g_assert(tf->cpu->ops->counts[OPSTATS_BASE][0x3E] == 1);
+	g_assert(tf->cpu->ops->counts[OPSTATS_BASE][0x00] == 1);
+	g_assert(tf->cpu->ops->counts[OPSTATS_DD][0x21] == 1);
+	g_assert(tf->cpu->ops->counts[OPSTATS_DD][0x77] == 1);
+	g_assert(tf->cpu->ops->counts[OPSTATS_BASE][0xDD] == 0);
+	g_assert(tf->cpu->ops->pairs.used == 3);
+	g_assert(tf->cpu->ops->triples.used == 2);
+}
+
+static void test_opstats_csv(test_fixture *tf, gconstpointer data) {
+	char *buffer = NULL;
+	size_t length = 0;
+	FILE *out = open_memstream(&buffer, &length);
+
+	// ld a,(hl) / inc hl, three times over, then a nop
+	uint8_t program[7] = { 0x7E, 0x23, 0x7E, 0x23, 0x7E, 0x23, 0x00 };
+	memcpy(tf->memory, program, sizeof(program));
+
+	g_assert(run(tf->cpu, tf->memory, 7, 0) == 7);
+	opstats_write_csv(tf->cpu->ops, out, 1);
+	fclose(out);
+
+	g_assert(strncmp(buffer, "kind,sequence,count,percent\n", 28) == 0);
+	g_assert(strstr(buffer, "\nopcode,23,3,42.8571\n") != NULL);
+	g_assert(strstr(buffer, "\nopcode,7E,3,42.8571\n") != NULL);
+	g_assert(strstr(buffer, "\nopcode,00,1,14.2857\n") != NULL);
+	g_assert(strstr(buffer, "\npair,7E 23,3,50.0000\n") != NULL);
+	g_assert(strstr(buffer, "\ntriple,23 7E 23,2,40.0000\n") != NULL);
+
+	// only the most frequent pair and triple are written, ties by opcode
+	g_assert(strstr(buffer, "pair,23 7E") == NULL);
+	g_assert(strstr(buffer, "triple,7E 23 7E") == NULL);
+
+	free(buffer);
+}
+
+static void test_opstats_table_growth(test_fixture *tf, gconstpointer data) {
+	opstats_table *pairs = &tf->cpu->ops->pairs;
+	size_t size = pairs->size;
+
+	// every pair of base opcodes, enough to force several resizes
+	for (int i = 0; i < 256; i++) {
+		for (int j = 0; j < 256; j++) {
+			opstats_count(pairs, ((uint64_t)i << 11) | (uint64_t)j);
+		}
+	}
+	opstats_count(pairs, 0);
+
+	g_assert(pairs->used == 65536);
+	g_assert(pairs->size > size);
+	g_assert(2 * pairs->used <= pairs->size);
+
+	for (size_t slot = 0; slot < pairs->size; slot++) {
+		if (pairs->keys[slot] == 1) {
+			g_assert(pairs->counts[slot] == 2);
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/opstats/prefix pages", test_fixture, NULL, setup_opstats, test_opstats_pages, teardown_opstats);
+	g_test_add("/opstats/csv output", test_fixture, NULL, setup_opstats, test_opstats_csv, teardown_opstats);
+	g_test_add("/opstats/table growth", test_fixture, NULL, setup_opstats, test_opstats_table_growth, teardown_opstats);
+
+	return g_test_run();
+}
@@ -0,0 +1,102 @@
+#include <glib.h>
+#include <stdint.h>
+#include <string.h>
+#include "z80.h"
+#include "memory.h"
+#include "pool.h"
+
+typedef struct {
+	pool *p;
+} test_fixture;
+
+static void setup_pool(test_fixture *tf, gconstpointer data) {
+	tf->p = pool_new(4, GPOINTER_TO_INT(data));
+	g_assert(tf->p != NULL);
+}
+
+static void teardown_pool(test_fixture *tf, gconstpointer data) {
+	pool_free(tf->p);
+}
+
+// whether a run of memory is all zero
+static int is_zero(const uint8_t *memory, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		if (memory[i] != 0) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void test_pool_acquire(test_fixture *tf, gconstpointer data) {
+	pool_machine *machines[4];
+	z80 fresh;
+
+	memset(&fresh, 0, sizeof(fresh));
+
+	for (int i = 0; i < 4; i++) {
+		machines[i] = pool_acquire(tf->p);
+		g_assert(machines[i] != NULL);
+		g_assert(((uintptr_t)machines[i] % POOL_ALIGN) == 0);
+		g_assert(((uintptr_t)machines[i]->memory % 4096) == 0);
+		g_assert(memcmp(&machines[i]->cpu, &fresh, sizeof(fresh)) == 0);
+		g_assert(is_zero(machines[i]->memory, MEMSIZE));
+
+		for (int j = 0; j < i; j++) {
+			g_assert(machines[i] != machines[j]);
+			g_assert(machines[i]->memory != machines[j]->memory);
+		}
+	}
+
+	g_assert(pool_acquire(tf->p) == NULL);
+
+	// a machine given back is the next one handed out
+	pool_release(tf->p, machines[2]);
+	g_assert(pool_acquire(tf->p) == machines[2]);
+}
+
+// only the pages the cpu wrote are cleared when it goes back
+static void test_pool_dirty(test_fixture *tf, gconstpointer data) {
+	const uint8_t code[] = {
+		0x31, 0x00, 0x00, // ld sp,0x0000
+		0x3E, 0x55,       // ld a,0x55
+		0x32, 0x00, 0x80, // ld (0x8000),a
+		0xCD, 0x0C, 0x00, // call 0x000C
+		0x76,             // halt
+		0xC9              // ret
+	};
+	pool_machine *machine = pool_acquire(tf->p);
+
+	g_assert_cmpint(pool_load(machine, 0x0000, code, sizeof(code)), ==, 0);
+	g_assert_cmpint(pool_load(machine, 0xFFF0, code, 0x20), ==, -1);
+
+	g_assert_cmpint(run(&machine->cpu, machine->memory, 5, 0), ==, 5);
+	g_assert_cmpint(machine->memory[0x8000], ==, 0x55);
+	g_assert_cmpint(machine->memory[0xFFFE], ==, 0x0B);
+	g_assert(machine->cpu.dirty == (DIRTY_BIT(0x0000) | DIRTY_BIT(0x8000) | DIRTY_BIT(0xFFFE)));
+
+	// a write nobody marked survives, showing the rest wasn't touched
+	machine->memory[0x4000] = 0xAA;
+	machine->cpu.port_context = tf;
+
+	pool_release(tf->p, machine);
+	g_assert_cmpint(tf->p->cleared, ==, 3);
+
+	g_assert(pool_acquire(tf->p) == machine);
+	g_assert(machine->cpu.port_context == NULL);
+	g_assert(machine->cpu.dirty == 0);
+	g_assert(is_zero(machine->memory, 0x4000));
+	g_assert_cmpint(machine->memory[0x4000], ==, 0xAA);
+	g_assert(is_zero(&machine->memory[0x4001], MEMSIZE - 0x4001));
+}
+
+int main(int argc, char *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/pool/acquire", test_fixture, GINT_TO_POINTER(0), setup_pool, test_pool_acquire, teardown_pool);
+	g_test_add("/pool/huge", test_fixture, GINT_TO_POINTER(1), setup_pool, test_pool_acquire, teardown_pool);
+	g_test_add("/pool/dirty", test_fixture, GINT_TO_POINTER(0), setup_pool, test_pool_dirty, teardown_pool);
+
+	return g_test_run();
+}
@@ -0,0 +1,229 @@
+#include <glib.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "z80.h"
+#include "profile.h"
+
+// ld sp,0x0100 / call 0x0009 / ld a,0x07 / nop / ld b,0x05 / ret
+static const uint8_t program[12] = {
+	0x31, 0x00, 0x01, 0xCD, 0x09, 0x00, 0x3E, 0x07, 0x00, 0x06, 0x05, 0xC9
+};
+
+typedef struct {
+	z80 *cpu;
+	uint8_t *memory;
+} test_fixture;
+
+static void setup_profile(test_fixture *tf, gconstpointer data) {
+	tf->cpu = new_cpu();
+	tf->cpu->prof = profile_new();
+	tf->memory = calloc(0x0100, sizeof(uint8_t));
+	memcpy(tf->memory, program, sizeof(program));
+}
+
+static void teardown_profile(test_fixture *tf, gconstpointer data) {
+	profile_free(tf->cpu->prof);
+	free(tf->cpu);
+	free(tf->memory);
+}
+
+static void test_profile_counters(test_fixture *tf, gconstpointer data) {
+	g_assert(run(tf->cpu, tf->memory, 6, 0) == 6);
+
+	// every instruction ran once, except the nop after the ld a,n
+	g_assert(tf->cpu->prof->hits[0x0000] == 1);
+	g_assert(tf->cpu->prof->hits[0x0003] == 1);
+	g_assert(tf->cpu->prof->hits[0x0006] == 1);
+	g_assert(tf->cpu->prof->hits[0x0008] == 1);
+	g_assert(tf->cpu->prof->hits[0x0009] == 1);
+	g_assert(tf->cpu->prof->hits[0x000B] == 1);
+	g_assert(tf->cpu->prof->hits[0x0001] == 0);
+
+	g_assert(tf->cpu->prof->tstates[0x0000] == 10);
+	g_assert(tf->cpu->prof->tstates[0x0003] == 17);
+	g_assert(tf->cpu->prof->tstates[0x0009] == 7);
+	g_assert(tf->cpu->prof->tstates[0x000B] == 10);
+}
+
+static void test_profile_call_tree(test_fixture *tf, gconstpointer data) {
+	g_assert(run(tf->cpu, tf->memory, 6, 0) == 6);
+
+	// the call itself belongs to the caller, the ret to the callee
+	g_assert(tf->cpu->prof->depth == 0);
+	g_assert(tf->cpu->prof->current == &tf->cpu->prof->root);
+	g_assert(tf->cpu->prof->root.tstates == 10 + 17 + 7 + 4);
+	g_assert(tf->cpu->prof->root.child != NULL);
+	g_assert(tf->cpu->prof->root.child->address == 0x0009);
+	g_assert(tf->cpu->prof->root.child->tstates == 7 + 10);
+	g_assert(tf->cpu->prof->root.child->sibling == NULL);
+}
+
+static void test_profile_unmatched_ret(test_fixture *tf, gconstpointer data) {
+	profile *prof = tf->cpu->prof;
+
+	profile_call(prof, 0x1000, 0x0003);
+	profile_call(prof, 0x2000, 0x1003);
+	g_assert(prof->depth == 2);
+
+	// a ret that matches no frame is a computed jump
+	profile_ret(prof, 0x4000);
+	g_assert(prof->depth == 2);
+	g_assert(prof->current->address == 0x2000);
+
+	// a ret past the innermost frame unwinds both
+	profile_ret(prof, 0x0003);
+	g_assert(prof->depth == 0);
+	g_assert(prof->current == &prof->root);
+}
+
+static void test_profile_folded(test_fixture *tf, gconstpointer data) {
+	char *buffer = NULL;
+	size_t length = 0;
+	FILE *out = open_memstream(&buffer, &length);
+
+	g_assert(run(tf->cpu, tf->memory, 6, 0) == 6);
+	profile_write_folded(tf->cpu->prof, out);
+	fclose(out);
+
+	g_assert(strcmp(buffer, "root 38\nroot;0x0009 17\n") == 0);
+
+	free(buffer);
+}
+
+static void test_profile_report(test_fixture *tf, gconstpointer data) {
+	char *buffer = NULL;
+	size_t length = 0;
+	FILE *out = open_memstream(&buffer, &length);
+
+	g_assert(run(tf->cpu, tf->memory, 6, 0) == 6);
+	profile_write_report(tf->cpu->prof, out, 2);
+	fclose(out);
+
+	// the call is the hottest instruction, followed by the ld sp,nn
+	g_assert(strstr(buffer, "# 6 instructions, 55 T-states, 6 addresses\n") != NULL);
+	g_assert(strstr(buffer, "\n0003\t1\t17\t") != NULL);
+	g_assert(strstr(buffer, "\n0000\t1\t10\t") != NULL);
+	g_assert(strstr(buffer, "\n000B\t") == NULL);
+
+	free(buffer);
+}
+
+static void test_profile_interrupt(test_fixture *tf, gconstpointer data) {
+	char *buffer = NULL;
+	size_t length = 0;
+	FILE *out = open_memstream(&buffer, &length);
+
+	// im 1 / ei, with an ei / reti handler at 38h
+	tf->memory[0x0006] = 0xED;
+	tf->memory[0x0007] = 0x56;
+	tf->memory[0x0008] = 0xFB;
+	tf->memory[0x0038] = 0xFB;
+	tf->memory[0x0039] = 0xED;
+	tf->memory[0x003A] = 0x4D;
+	tf->cpu->pc.W = 0x0006;
+	tf->cpu->sp.W = 0x0100;
+	tf->cpu->int_pending = 1;
+
+	// im 1, ei, the ld b,n the interrupt is held off for, ei, reti
+	g_assert(run(tf->cpu, tf->memory, 5, 0) == 5);
+	g_assert(tf->cpu->pc.W == 0x000B);
+	g_assert(tf->cpu->prof->depth == 0);
+
+	profile_write_folded(tf->cpu->prof, out);
+	fclose(out);
+
+	// acknowledge, ei and reti are all charged to the handler
+	g_assert(strcmp(buffer, "root 19\nroot;irq:0x0038 31\n") == 0);
+
+	free(buffer);
+}
+
+// walk a recursive call path by hand: root -> sub -> sub -> other
+static void profile_recursion(profile *prof) {
+	profile_step(prof, 0x0000, 10);
+	profile_call(prof, 0x1000, 0x0003);
+	profile_step(prof, 0x1000, 4);
+	profile_call(prof, 0x1000, 0x1003);
+	profile_step(prof, 0x1000, 4);
+	profile_call(prof, 0x2000, 0x1006);
+	profile_step(prof, 0x2000, 7);
+	profile_ret(prof, 0x1006);
+	profile_ret(prof, 0x1003);
+	profile_step(prof, 0x1003, 10);
+	profile_ret(prof, 0x0003);
+}
+
+static void test_profile_functions(test_fixture *tf, gconstpointer data) {
+	char *buffer = NULL;
+	size_t length = 0;
+	FILE *out = open_memstream(&buffer, &length);
+
+	profile_recursion(tf->cpu->prof);
+	profile_write_functions(tf->cpu->prof, out, 0);
+	fclose(out);
+
+	// the recursive call is only counted once towards inclusive time
+	g_assert(strstr(buffer, "# 2 routines, 35 T-states, 0 untracked calls\n") != NULL);
+	g_assert(strstr(buffer, "\nroot\t-\t35\t100.00\t10\t28.57\n") != NULL);
+	g_assert(strstr(buffer, "\n0x1000\t2\t25\t71.43\t18\t51.43\n") != NULL);
+	g_assert(strstr(buffer, "\n0x2000\t1\t7\t20.00\t7\t20.00\n") != NULL);
+	g_assert(strstr(buffer, "0x1000") < strstr(buffer, "0x2000"));
+
+	free(buffer);
+}
+
+static void test_profile_symbols(test_fixture *tf, gconstpointer data) {
+	char path[] = "/tmp/test_profile_XXXXXX";
+	char *buffer = NULL;
+	size_t length = 0;
+	int fd = mkstemp(path);
+	FILE *map = fdopen(fd, "w");
+
+	fprintf(map, "start:\tequ $0000\n");
+	fprintf(map, "; a comment line\n");
+	fprintf(map, "sub EQU 0x1000\n");
+	fprintf(map, "2000 other\n");
+	fprintf(map, "value = 10h\n");
+	fclose(map);
+
+	g_assert(profile_load_symbols(tf->cpu->prof, path) == 4);
+	g_assert(profile_load_symbols(tf->cpu->prof, "/nonexistent/symbols") == -1);
+	unlink(path);
+
+	g_assert(strcmp(profile_symbol_name(tf->cpu->prof, 0x0000), "start") == 0);
+	g_assert(strcmp(profile_symbol_name(tf->cpu->prof, 0x0010), "value") == 0);
+	g_assert(strcmp(profile_symbol_name(tf->cpu->prof, 0x1000), "sub") == 0);
+	g_assert(strcmp(profile_symbol_name(tf->cpu->prof, 0x2000), "other") == 0);
+	g_assert(profile_symbol_name(tf->cpu->prof, 0x1003) == NULL);
+
+	profile_recursion(tf->cpu->prof);
+
+	FILE *out = open_memstream(&buffer, &length);
+	profile_write_folded(tf->cpu->prof, out);
+	profile_write_functions(tf->cpu->prof, out, 0);
+	profile_write_report(tf->cpu->prof, out, 0);
+	fclose(out);
+
+	g_assert(strstr(buffer, "root;sub;sub;other 7\n") != NULL);
+	g_assert(strstr(buffer, "\nsub\t2\t25\t") != NULL);
+	g_assert(strstr(buffer, "\t10.00\tsub+0x3\n") != NULL);
+
+	free(buffer);
+}
+
+int main(int argc, char *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/profile/per-PC counters", test_fixture, NULL, setup_profile, test_profile_counters, teardown_profile);
+	g_test_add("/profile/call tree", test_fixture, NULL, setup_profile, test_profile_call_tree, teardown_profile);
+	g_test_add("/profile/unmatched ret", test_fixture, NULL, setup_profile, test_profile_unmatched_ret, teardown_profile);
+	g_test_add("/profile/folded stacks", test_fixture, NULL, setup_profile, test_profile_folded, teardown_profile);
+	g_test_add("/profile/sorted report", test_fixture, NULL, setup_profile, test_profile_report, teardown_profile);
+	g_test_add("/profile/interrupt frames", test_fixture, NULL, setup_profile, test_profile_interrupt, teardown_profile);
+	g_test_add("/profile/call-graph report", test_fixture, NULL, setup_profile, test_profile_functions, teardown_profile);
+	g_test_add("/profile/symbol map", test_fixture, NULL, setup_profile, test_profile_symbols, teardown_profile);
+
+	return g_test_run();
+}
@@ -0,0 +1,204 @@
+#include <glib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "z80.h"
+#include "replay.h"
+
+// reads port 0x10 in a loop and copies 0x5000 out, the interrupt handler reads port 0x11
+static const uint8_t program[] = {
+	0x31, 0x00, 0x80, // ld sp,0x8000
+	0xED, 0x56, // im 1
+	0xFB, // ei
+	0xDB, 0x10, // loop: in a,(0x10)
+	0x32, 0x00, 0x40, // ld (0x4000),a
+	0x3A, 0x00, 0x50, // ld a,(0x5000)
+	0x32, 0x01, 0x40, // ld (0x4001),a
+	0xC3, 0x06, 0x00 // jp loop
+};
+
+static const uint8_t handler[] = {
+	0xDB, 0x11, // in a,(0x11)
+	0x32, 0x02, 0x40, // ld (0x4002),a
+	0xFB, // ei
+	0xC9 // ret
+};
+
+#define TEST_INSTRUCTIONS 740
+
+typedef struct {
+	z80 *cpu;
+	uint8_t *memory;
+	FILE *stream;
+	uint8_t next_value;
+} test_fixture;
+
+static void load(test_fixture *tf) {
+	memset(tf->memory, 0, 0x10000);
+	memcpy(tf->memory, program, sizeof(program));
+	memcpy(&tf->memory[0x38], handler, sizeof(handler));
+}
+
+static void setup_replay(test_fixture *tf, gconstpointer data) {
+	tf->cpu = new_cpu();
+	tf->memory = malloc(0x10000);
+	g_assert(tf->memory != NULL);
+	load(tf);
+	tf->stream = tmpfile();
+	g_assert(tf->stream != NULL);
+	tf->next_value = 0;
+}
+
+static void teardown_replay(test_fixture *tf, gconstpointer data) {
+	(void) fclose(tf->stream);
+	free(tf->memory);
+	free(tf->cpu);
+}
+
+// live input that differs on every read
+static uint8_t live_port_in(void *context, uint16_t port) {
+	test_fixture *tf = context;
+
+	tf->next_value += 7;
+	return (uint8_t)(tf->next_value ^ (port & 0xFF));
+}
+
+// records a run in slices of 37 instructions with host interrupts and writes in between
+static uint64_t record(test_fixture *tf) {
+	replay *rep;
+	uint64_t hash;
+	long executed = 0;
+
+	tf->cpu->port_in = live_port_in;
+	tf->cpu->port_context = tf;
+	rep = replay_record(tf->cpu, tf->stream);
+
+	for (int i = 0; executed < TEST_INSTRUCTIONS; i++) {
+		int count = replay_run(rep, tf->memory, 37);
+
+		g_assert(count == 37);
+		executed += count;
+
+		if (i % 3 == 0) {
+			replay_interrupt(rep);
+		}
+		if (i % 5 == 0) {
+			replay_write(rep, tf->memory, 0x5000, (uint8_t)(0xA0 + i));
+		}
+	}
+
+	g_assert(replay_finish(rep, tf->memory) == REPLAY_OK);
+	g_assert(rep->events > 20);
+	hash = replay_hash(tf->cpu, tf->memory);
+	replay_free(rep);
+
+	g_assert(tf->cpu->port_in == live_port_in);
+	g_assert(tf->cpu->port_context == tf);
+
+	// start over from the same state, without the live input
+	free(tf->cpu);
+	tf->cpu = new_cpu();
+	load(tf);
+	rewind(tf->stream);
+
+	return hash;
+}
+
+// replays in slices of 50 instructions
+static int play(test_fixture *tf) {
+	replay *rep = replay_play(tf->cpu, tf->stream);
+	long executed = 0;
+	int status;
+
+	g_assert(rep != NULL);
+
+	while (executed < TEST_INSTRUCTIONS) {
+		int count = replay_run(rep, tf->memory, (TEST_INSTRUCTIONS - executed < 50) ? TEST_INSTRUCTIONS - executed : 50);
+
+		if (count < 0) {
+			break;
+		}
+		executed += count;
+	}
+
+	status = replay_finish(rep, tf->memory);
+	replay_free(rep);
+
+	return status;
+}
+
+static void test_replay_reproduces(test_fixture *tf, gconstpointer data) {
+	uint64_t hash = record(tf);
+
+	g_assert(play(tf) == REPLAY_OK);
+	g_assert(replay_hash(tf->cpu, tf->memory) == hash);
+	g_assert(tf->memory[0x4000] != 0 || tf->memory[0x4002] != 0);
+}
+
+// a state difference the inputs don't explain shows up in the final hash
+static void test_replay_mismatch(test_fixture *tf, gconstpointer data) {
+	(void) record(tf);
+
+	tf->memory[0x7000] = 0x55;
+	g_assert(play(tf) == REPLAY_MISMATCH);
+}
+
+// reading another port than was recorded stops the replay
+static void test_replay_desync(test_fixture *tf, gconstpointer data) {
+	(void) record(tf);
+
+	tf->memory[0x0007] = 0x12;
+	g_assert(play(tf) == REPLAY_DESYNC);
+}
+
+static void test_replay_input(test_fixture *tf, gconstpointer data) {
+	replay *rep = replay_record(tf->cpu, tf->stream);
+
+	g_assert(replay_input(rep, 0, 'A') == 'A');
+	g_assert(replay_input(rep, 0, EOF) == EOF);
+	g_assert(replay_input(rep, 3, 100000) == 100000);
+	g_assert(replay_finish(rep, tf->memory) == REPLAY_OK);
+	replay_free(rep);
+
+	rewind(tf->stream);
+	rep = replay_play(tf->cpu, tf->stream);
+	g_assert(rep != NULL);
+	g_assert(replay_input(rep, 0, 0) == 'A');
+	g_assert(replay_input(rep, 0, 0) == EOF);
+	g_assert(replay_input(rep, 3, 0) == 100000);
+	g_assert(replay_finish(rep, tf->memory) == REPLAY_OK);
+	replay_free(rep);
+}
+
+static void test_replay_corrupt(test_fixture *tf, gconstpointer data) {
+	replay *rep;
+
+	(void) fputs("not a recording", tf->stream);
+	rewind(tf->stream);
+	g_assert(replay_play(tf->cpu, tf->stream) == NULL);
+
+	// a recording cut short has no end
+	(void) fclose(tf->stream);
+	tf->stream = tmpfile();
+	g_assert(tf->stream != NULL);
+	(void) fputs(REPLAY_MAGIC, tf->stream);
+	(void) putc(REPLAY_PORT_IN, tf->stream);
+	rewind(tf->stream);
+	rep = replay_play(tf->cpu, tf->stream);
+	g_assert(rep != NULL);
+	g_assert(replay_finish(rep, tf->memory) == REPLAY_CORRUPT);
+	replay_free(rep);
+}
+
+int main(int argc, char *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/replay/reproduces", test_fixture, NULL, setup_replay, test_replay_reproduces, teardown_replay);
+	g_test_add("/replay/mismatch", test_fixture, NULL, setup_replay, test_replay_mismatch, teardown_replay);
+	g_test_add("/replay/desync", test_fixture, NULL, setup_replay, test_replay_desync, teardown_replay);
+	g_test_add("/replay/input", test_fixture, NULL, setup_replay, test_replay_input, teardown_replay);
+	g_test_add("/replay/corrupt", test_fixture, NULL, setup_replay, test_replay_corrupt, teardown_replay);
+
+	return g_test_run();
+}
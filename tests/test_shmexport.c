@@ -0,0 +1,113 @@
+#include <glib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "z80.h"
+#include "shmexport.h"
+
+typedef struct {
+	z80 *cpu;
+	shmexport *exp;
+	char name[64];
+} test_fixture;
+
+static void setup_shmexport(test_fixture *tf, gconstpointer data) {
+	tf->cpu = new_cpu();
+	(void) snprintf(tf->name, sizeof(tf->name), "pz80-test-%d", (int)getpid());
+	tf->exp = shmexport_new(tf->name);
+	g_assert(tf->exp != NULL);
+}
+
+static void teardown_shmexport(test_fixture *tf, gconstpointer data) {
+	if (tf->exp != NULL) {
+		shmexport_free(tf->exp);
+	}
+	free(tf->cpu);
+}
+
+// maps the segment the way an external tool would
+static const uint8_t *map_segment(test_fixture *tf, int *fd) {
+	const uint8_t *segment;
+
+	g_assert((*fd = shm_open(tf->exp->name, O_RDONLY, 0)) >= 0);
+	segment = mmap(NULL, tf->exp->size, PROT_READ, MAP_SHARED, *fd, 0);
+	g_assert(segment != MAP_FAILED);
+
+	return segment;
+}
+
+static void test_shmexport_layout(test_fixture *tf, gconstpointer data) {
+	int fd;
+	const uint8_t *segment = map_segment(tf, &fd);
+	const shmexport_header *header = (const shmexport_header *)segment;
+
+	g_assert(tf->exp->name[0] == '/');
+	g_assert(header->magic == SHMEXPORT_MAGIC);
+	g_assert(header->version == SHMEXPORT_VERSION);
+	g_assert(header->pid == (int32_t)getpid());
+	g_assert(header->registers_offset >= header->header_size);
+	g_assert(header->registers_offset + header->registers_size <= header->memory_offset);
+	g_assert(header->memory_offset % 4096 == 0);
+	g_assert(header->memory_size == 65536);
+
+	// the cpu's memory is the segment, so writes show up without a copy
+	tf->exp->memory[0x1234] = 0x5A;
+	g_assert(segment[header->memory_offset + 0x1234] == 0x5A);
+
+	(void) munmap((void *)segment, tf->exp->size);
+	(void) close(fd);
+}
+
+static void test_shmexport_registers(test_fixture *tf, gconstpointer data) {
+	int fd;
+	const uint8_t *segment = map_segment(tf, &fd);
+	const shmexport_header *header = (const shmexport_header *)segment;
+	const shmexport_registers *registers = (const shmexport_registers *)(segment + header->registers_offset);
+
+	g_assert(atomic_load(&header->generation) == 0);
+
+	tf->cpu->pc.W = 0x0100;
+	tf->cpu->a = 0x12;
+	tf->cpu->flags = 0x3F;
+	tf->cpu->hl.W = 0xBEEF;
+	tf->cpu->cycles = 1000;
+	tf->cpu->iff1 = 1;
+	shmexport_update(tf->exp, tf->cpu, 250);
+
+	g_assert(atomic_load(&header->generation) == 2);
+	g_assert(registers->pc == 0x0100);
+	g_assert(registers->af == 0x12D7);
+	g_assert(registers->hl == 0xBEEF);
+	g_assert(registers->cycles == 1000);
+	g_assert(registers->instructions == 250);
+	g_assert(registers->iff1 == 1 && registers->iff2 == 0);
+
+	(void) munmap((void *)segment, tf->exp->size);
+	(void) close(fd);
+}
+
+// freeing removes the segment
+static void test_shmexport_free(test_fixture *tf, gconstpointer data) {
+	char name[64];
+
+	(void) snprintf(name, sizeof(name), "/%s", tf->name);
+	shmexport_free(tf->exp);
+	tf->exp = NULL;
+
+	g_assert(shm_open(name, O_RDONLY, 0) < 0);
+	g_assert(errno == ENOENT);
+}
+
+int main(int argc, char *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/shmexport/layout", test_fixture, NULL, setup_shmexport, test_shmexport_layout, teardown_shmexport);
+	g_test_add("/shmexport/registers", test_fixture, NULL, setup_shmexport, test_shmexport_registers, teardown_shmexport);
+	g_test_add("/shmexport/free", test_fixture, NULL, setup_shmexport, test_shmexport_free, teardown_shmexport);
+
+	return g_test_run();
+}
@@ -0,0 +1,133 @@
+#include <glib.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "z80.h"
+#include "throttle.h"
+
+typedef struct {
+	z80 *cpu;
+	throttle *thr;
+} test_fixture;
+
+static void setup_throttle(test_fixture *tf, gconstpointer data) {
+	tf->cpu = new_cpu();
+	tf->thr = throttle_new(4000000, tf->cpu);
+}
+
+static void teardown_throttle(test_fixture *tf, gconstpointer data) {
+	throttle_free(tf->thr);
+	free(tf->cpu);
+}
+
+static long long now_ns(void) {
+	struct timespec now;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void test_throttle_parse(test_fixture *tf, gconstpointer data) {
+	g_assert_cmpint(throttle_parse("4MHz"), ==, 4000000);
+	g_assert_cmpint(throttle_parse("3.5mhz"), ==, 3500000);
+	g_assert_cmpint(throttle_parse("500kHz"), ==, 500000);
+	g_assert_cmpint(throttle_parse("2M"), ==, 2000000);
+	g_assert_cmpint(throttle_parse("4000000"), ==, 4000000);
+	g_assert_cmpint(throttle_parse("100Hz"), ==, 100);
+	g_assert_cmpint(throttle_parse("fast"), ==, -1);
+	g_assert_cmpint(throttle_parse("4MBps"), ==, -1);
+	g_assert_cmpint(throttle_parse("0"), ==, -1);
+	g_assert_cmpint(throttle_parse("-4MHz"), ==, -1);
+}
+
+static void test_throttle_budget(test_fixture *tf, gconstpointer data) {
+	// 1 ms at 4 MHz, in the longest instructions
+	g_assert_cmpint(tf->thr->slice_cycles, ==, 4000);
+	g_assert_cmpint(throttle_budget(tf->thr, tf->cpu, 1000000), ==, 4000 / THROTTLE_MAX_TSTATES);
+	g_assert_cmpint(throttle_budget(tf->thr, tf->cpu, 10), ==, 10);
+
+	// closes in on the end of the slice one instruction at a time
+	tf->cpu->cycles = 3990;
+	g_assert_cmpint(throttle_budget(tf->thr, tf->cpu, 1000000), ==, 1);
+	tf->cpu->cycles = 4005;
+	g_assert_cmpint(throttle_budget(tf->thr, tf->cpu, 1000000), ==, 1);
+}
+
+// slices wait for the wall clock to catch up with the cycle count
+// paces 20 slices, returning whether the host let them run without descheduling the test
+static int pace_slices(test_fixture *tf) {
+	long long start = now_ns(), elapsed;
+	struct rusage before, after;
+
+	(void) getrusage(RUSAGE_SELF, &before);
+	for (int i = 0; i < 20; i++) {
+		tf->cpu->cycles = tf->thr->slice_end + 3;
+		throttle_pace(tf->thr, tf->cpu);
+	}
+	(void) getrusage(RUSAGE_SELF, &after);
+	elapsed = now_ns() - start;
+
+	g_assert_cmpint(tf->thr->slices, ==, 20);
+	g_assert_cmpint(elapsed, >=, (long long)(tf->cpu->cycles - tf->thr->start_cycles) / 4 * 1000 - THROTTLE_SLICE_NS);
+	g_assert(throttle_ratio(tf->thr, tf->cpu) <= 1.01);
+	return tf->thr->overruns == 0 && after.ru_nivcsw == before.ru_nivcsw;
+}
+
+static void test_throttle_pace(test_fixture *tf, gconstpointer data) {
+	long long late = -1, worst_late = -1;
+
+	// nothing to wait for in the middle of a slice
+	tf->cpu->cycles = 2000;
+	throttle_pace(tf->thr, tf->cpu);
+	g_assert_cmpint(tf->thr->slices, ==, 0);
+
+	// a hypervisor can preempt a spin without the test seeing it, so the
+	// least late of a few undisturbed runs is held to the jitter target
+	for (int attempt = 0; attempt < 5; attempt++) {
+		if (attempt > 0) {
+			throttle_free(tf->thr);
+			tf->thr = throttle_new(4000000, tf->cpu);
+		}
+		if (!pace_slices(tf))
+			continue;
+		if (worst_late < 0 || tf->thr->worst_late < worst_late) {
+			late = tf->thr->late / (tf->thr->slices - tf->thr->overruns);
+			worst_late = tf->thr->worst_late;
+		}
+	}
+	if (worst_late < 0) {
+		g_test_skip("host descheduled the test");
+		return;
+	}
+	g_assert_cmpint(late, <, 100000);
+	g_assert_cmpint(worst_late, <, 100000);
+}
+
+// a slice that ends well past its deadline is an overrun, and the next one isn't rushed
+static void test_throttle_overrun(test_fixture *tf, gconstpointer data) {
+	struct timespec stall = { 0, 5000000 };
+	long long start;
+
+	(void) nanosleep(&stall, NULL);
+	tf->cpu->cycles = tf->thr->slice_end;
+	throttle_pace(tf->thr, tf->cpu);
+	g_assert_cmpint(tf->thr->overruns, ==, 1);
+
+	start = now_ns();
+	tf->cpu->cycles = tf->thr->slice_end;
+	throttle_pace(tf->thr, tf->cpu);
+	g_assert_cmpint(tf->thr->overruns, ==, 1);
+	g_assert_cmpint(now_ns() - start, >=, THROTTLE_SLICE_NS / 2);
+}
+
+int main(int argc, char *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/throttle/parse", test_fixture, NULL, setup_throttle, test_throttle_parse, teardown_throttle);
+	g_test_add("/throttle/budget", test_fixture, NULL, setup_throttle, test_throttle_budget, teardown_throttle);
+	g_test_add("/throttle/pace", test_fixture, NULL, setup_throttle, test_throttle_pace, teardown_throttle);
+	g_test_add("/throttle/overrun", test_fixture, NULL, setup_throttle, test_throttle_overrun, teardown_throttle);
+
+	return g_test_run();
+}
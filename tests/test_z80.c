@@ -2,10 +2,12 @@
 
 #include <glib.h>
 #include <stdlib.h>
+#include <string.h>
 #include "z80.h"
 #include "memory.h"
 #include "utils.h"
 #include "display.h"
+#include "opcodes.h"
 
 // set up test fixture with a cpu object
 typedef struct {
@@ -54,6 +56,54 @@ static void test_cpu_reset(test_fixture *tf, gconstpointer data) {
 	reset_cpu(tf->test_cpu);
 
 	g_assert(tf->test_cpu->pc.W == 0);
+
+	// every register goes, what the cpu is attached to stays
+	tf->test_cpu->a = 0x12;
+	tf->test_cpu->sp.W = 0x8000;
+	tf->test_cpu->ix.W = 0x1234;
+	tf->test_cpu->_hl.W = 0x5678;
+	tf->test_cpu->ir.W = 0x3F7F;
+	tf->test_cpu->iff1 = 1;
+	tf->test_cpu->im = 2;
+	tf->test_cpu->counter = 100;
+	tf->test_cpu->cycles = 1000;
+	tf->test_cpu->trap.reason = TRAP_OPCODE;
+	tf->test_cpu->port_context = tf;
+	tf->test_cpu->dirty = DIRTY_BIT(0x8000);
+
+	reset_cpu(tf->test_cpu);
+
+	g_assert(tf->test_cpu->a == 0);
+	g_assert(tf->test_cpu->sp.W == 0);
+	g_assert(tf->test_cpu->ix.W == 0);
+	g_assert(tf->test_cpu->_hl.W == 0);
+	g_assert(tf->test_cpu->ir.W == 0);
+	g_assert(tf->test_cpu->iff1 == 0);
+	g_assert(tf->test_cpu->im == 0);
+	g_assert(tf->test_cpu->counter == 0);
+	g_assert(tf->test_cpu->cycles == 0);
+	g_assert(tf->test_cpu->trap.reason == TRAP_NONE);
+	g_assert(tf->test_cpu->port_context == tf);
+	g_assert(tf->test_cpu->dirty == DIRTY_BIT(0x8000));
+}
+
+static void test_mark_dirty(test_fixture *tf, gconstpointer data) {
+	mark_dirty(tf->test_cpu, 0x0400, 0x0400);
+	g_assert(tf->test_cpu->dirty == DIRTY_BIT(0x0400));
+
+	mark_dirty(tf->test_cpu, 0x0FFF, 2);
+	g_assert(tf->test_cpu->dirty == (DIRTY_BIT(0x0400) | DIRTY_BIT(0x0C00) | DIRTY_BIT(0x1000)));
+
+	// wrapping around the end of memory
+	tf->test_cpu->dirty = 0;
+	mark_dirty(tf->test_cpu, 0xFFFF, 2);
+	g_assert(tf->test_cpu->dirty == (DIRTY_BIT(0xFFFF) | DIRTY_BIT(0x0000)));
+
+	mark_dirty(tf->test_cpu, 0x1234, 0);
+	g_assert(tf->test_cpu->dirty == (DIRTY_BIT(0xFFFF) | DIRTY_BIT(0x0000)));
+
+	mark_dirty(tf->test_cpu, 0x1234, 0x10000);
+	g_assert(tf->test_cpu->dirty == ~0ULL);
 }
 
 static void test_load_reg8_from_ram(test_fixture *tf, gconstpointer data) {
@@ -338,7 +388,8 @@ static void test_ld_a_16(test_fixture *tf, gconstpointer data) {
 }
 
 static void test_add_hl(test_fixture *tf, gconstpointer data) {
-	uint8_t memory[7] = { 0x21, 0xff, 0xff, 0x01, 0xff, 0xff, 0x09 };
+	// padded with nops so the 7 instruction runs stay inside the buffer
+	uint8_t memory[16] = { 0x21, 0xff, 0xff, 0x01, 0xff, 0xff, 0x09 };
 
 	g_assert(run(tf->test_cpu, memory, 7, 0));
 	g_test_message("BC: %04X\n", tf->test_cpu->bc.W);
@@ -427,11 +478,636 @@ static void test_add_a(test_fixture *tf, gconstpointer data) {
     g_assert(tf->test_cpu->flags == 0b000000);
 }
 
+static void test_call_ret(test_fixture *tf, gconstpointer data) {
+	uint8_t *memory = calloc(0x0100, sizeof(uint8_t));
+	uint8_t program[12] = {
+		0x31, 0x00, 0x01, // ld sp,0x0100
+		0xCD, 0x09, 0x00, // call 0x0009
+		0x3E, 0x07,       // ld a,0x07
+		0x00,             // nop
+		0x06, 0x05,       // ld b,0x05
+		0xC9              // ret
+	};
+
+	for (int i = 0; i < 12; i++) {
+		memory[i] = program[i];
+	}
+
+	// run up to the first instruction of the subroutine
+	g_assert(run(tf->test_cpu, memory, 2, 0) == 2);
+	g_assert(tf->test_cpu->pc.W == 0x0009);
+	g_assert(tf->test_cpu->sp.W == 0x00FE);
+	g_assert(memory[0x00FE] == 0x06);
+	g_assert(memory[0x00FF] == 0x00);
+
+	// run the subroutine and the instruction after the call
+	g_assert(run(tf->test_cpu, memory, 3, 0) == 3);
+	g_assert(tf->test_cpu->pc.W == 0x0008);
+	g_assert(tf->test_cpu->sp.W == 0x0100);
+	g_assert(tf->test_cpu->a == 0x07);
+	g_assert(tf->test_cpu->bc.B.h == 0x05);
+
+	free(memory);
+}
+
+static void test_call_ret_cond(test_fixture *tf, gconstpointer data) {
+	uint8_t *memory = calloc(0x0100, sizeof(uint8_t));
+	uint8_t program[12] = {
+		0x31, 0x00, 0x01, // ld sp,0x0100
+		0xCC, 0x10, 0x00, // call z,0x0010
+		0xC4, 0x10, 0x00, // call nz,0x0010
+		0xFF              // rst 38h
+	};
+
+	for (int i = 0; i < 10; i++) {
+		memory[i] = program[i];
+	}
+	memory[0x0010] = 0xC8; // ret z
+	memory[0x0011] = 0xC0; // ret nz
+
+	// with Z reset only the nz variants are taken
+	g_assert(run(tf->test_cpu, memory, 5, 0) == 5);
+	g_assert(tf->test_cpu->pc.W == 0x0009);
+	g_assert(tf->test_cpu->sp.W == 0x0100);
+	g_assert(tf->test_cpu->counter == INTERRUPT_PERIOD - (10 + 10 + 17 + 5 + 11));
+
+	g_assert(run(tf->test_cpu, memory, 1, 0) == 1);
+	g_assert(tf->test_cpu->pc.W == 0x0038);
+	g_assert(tf->test_cpu->sp.W == 0x00FE);
+	g_assert(memory[0x00FE] == 0x0A);
+	g_assert(memory[0x00FF] == 0x00);
+
+	free(memory);
+}
+
+static void test_interrupt_im1(test_fixture *tf, gconstpointer data) {
+	uint8_t *memory = calloc(0x0100, sizeof(uint8_t));
+	uint8_t program[7] = {
+		0x31, 0x00, 0x01, // ld sp,0x0100
+		0xED, 0x56,       // im 1
+		0xFB,             // ei
+		0x00              // nop
+	};
+
+	for (int i = 0; i < 7; i++) {
+		memory[i] = program[i];
+	}
+	memory[0x0038] = 0xFB; // ei
+	memory[0x0039] = 0xED; // reti
+	memory[0x003A] = 0x4D;
+
+	// raise the interrupt on the first instruction, while still masked
+	tf->test_cpu->counter = 1;
+	g_assert(run(tf->test_cpu, memory, 1, 0) == 1);
+	g_assert(tf->test_cpu->int_pending);
+	g_assert(tf->test_cpu->pc.W == 0x0003);
+
+	// ei holds the interrupt off until after the nop
+	g_assert(run(tf->test_cpu, memory, 2, 0) == 2);
+	g_assert(tf->test_cpu->im == 1);
+	g_assert(tf->test_cpu->iff1);
+	g_assert(tf->test_cpu->pc.W == 0x0006);
+
+	g_assert(run(tf->test_cpu, memory, 1, 0) == 1);
+	g_assert(!tf->test_cpu->int_pending);
+	g_assert(!tf->test_cpu->iff1);
+	g_assert(tf->test_cpu->pc.W == 0x0038);
+	g_assert(tf->test_cpu->sp.W == 0x00FE);
+	g_assert(memory[0x00FE] == 0x07);
+
+	// the handler returns with interrupts enabled again
+	g_assert(run(tf->test_cpu, memory, 2, 0) == 2);
+	g_assert(tf->test_cpu->pc.W == 0x0007);
+	g_assert(tf->test_cpu->sp.W == 0x0100);
+	g_assert(tf->test_cpu->iff1);
+
+	free(memory);
+}
+
+/**
+ * Runs a program once in a single run() call, where superinstructions
+ * can be fused, and once one instruction per call, where they can't, and
+ * checks that both end up in the same state
+ */
+static void test_fused_sequences(test_fixture *tf, gconstpointer data) {
+	uint8_t *fused = calloc(0x0100, sizeof(uint8_t));
+	uint8_t *single = calloc(0x0100, sizeof(uint8_t));
+	z80 *reference = new_cpu();
+	uint8_t program[] = {
+		0x21, 0x80, 0x00, // ld hl,0x0080
+		0x11, 0xC0, 0x00, // ld de,0x00C0
+		0x06, 0x04,       // ld b,4
+		0x0E, 0x00,       // ld c,0
+		0x1A,             // loop: ld a,(de)
+		0x13,             // inc de
+		0x77,             // ld (hl),a
+		0x23,             // inc hl
+		0x05,             // dec b
+		0x20, 0xF9,       // jr nz,loop
+		0x7E,             // ld a,(hl)
+		0x23,             // inc hl
+		0x06, 0x03,       // ld b,3
+		0x10, 0xFE,       // djnz $
+		0x06, 0x05,       // ld b,5
+		0x05,             // dec b
+		0x20, 0xFD,       // jr nz,$-1
+		0xFE, 0x00,       // cp 0
+		0x28, 0x02,       // jr z,+2
+		0x3E, 0x01,       // ld a,1
+		0xFE, 0x00,       // cp 0
+		0xCA, 0x00, 0x00  // jp z,0
+	};
+	long instructions = 0;
+
+	for (size_t i = 0; i < sizeof(program); i++) {
+		fused[i] = single[i] = program[i];
+	}
+	for (int i = 0; i < 4; i++) {
+		fused[0x00C0 + i] = single[0x00C0 + i] = 0x10 + i;
+	}
+
+	// count the instructions up to the jp z,0, one at a time
+	while (reference->pc.W != sizeof(program) - 3) {
+		g_assert(run(reference, single, 1, 0) == 1);
+		instructions++;
+	}
+	g_assert(run(reference, single, 1, 0) == 1);
+	instructions++;
+
+	g_assert(run(tf->test_cpu, fused, instructions, 0) == instructions);
+
+	g_assert(tf->test_cpu->pc.W == 0x0000);
+	g_assert(tf->test_cpu->pc.W == reference->pc.W);
+	g_assert(tf->test_cpu->a == reference->a);
+	g_assert(tf->test_cpu->flags == reference->flags);
+	g_assert(tf->test_cpu->bc.W == reference->bc.W);
+	g_assert(tf->test_cpu->de.W == reference->de.W);
+	g_assert(tf->test_cpu->hl.W == reference->hl.W);
+	g_assert(tf->test_cpu->counter == reference->counter);
+	g_assert(memcmp(fused, single, 0x0100) == 0);
+	g_assert(fused[0x0083] == 0x13);
+
+	free(reference);
+	free(fused);
+	free(single);
+}
+
+/**
+ * Checks that a fused loop stops at the requested instruction count
+ */
+static void test_fused_budget(test_fixture *tf, gconstpointer data) {
+	uint8_t memory[8] = {
+		0x06, 0x0A,       // ld b,10
+		0x05,             // dec b
+		0x20, 0xFD,       // jr nz,$-1
+		0x00, 0x00, 0x00
+	};
+
+	// ld b,10 and two iterations of the loop, stopping before dec b
+	g_assert(run(tf->test_cpu, memory, 5, 0) == 5);
+	g_assert(tf->test_cpu->pc.W == 0x0002);
+	g_assert(tf->test_cpu->bc.B.h == 8);
+	g_assert(tf->test_cpu->counter == INTERRUPT_PERIOD - (7 + 2 * (4 + 12)));
+
+	// the rest of the loop, leaving after the not taken jr
+	g_assert(run(tf->test_cpu, memory, 16, 0) == 16);
+	g_assert(tf->test_cpu->pc.W == 0x0005);
+	g_assert(tf->test_cpu->bc.B.h == 0);
+	g_assert(IS_SET(tf->test_cpu->flags, 4));
+}
+
+/**
+ * Runs the same program from the same state in one run() call, where
+ * block instructions repeat in bulk, and one instruction per call, where
+ * they don't, and checks that both end up in the same state
+ * \param bulk cpu to run in one call
+ * \param bulk_memory memory of the cpu run in one call
+ * \param single cpu to run one instruction at a time
+ * \param single_memory memory of the cpu run one instruction at a time
+ * \param instructions number of instructions to run
+ */
+static void assert_bulk_matches_single(z80 *bulk, uint8_t *bulk_memory, z80 *single, uint8_t *single_memory, long instructions) {
+	g_assert(run(bulk, bulk_memory, instructions, 0) == instructions);
+
+	for (long i = 0; i < instructions; i++) {
+		g_assert(run(single, single_memory, 1, 0) == 1);
+	}
+
+	g_assert(bulk->pc.W == single->pc.W);
+	g_assert(bulk->a == single->a);
+	g_assert(bulk->flags == single->flags);
+	g_assert(bulk->bc.W == single->bc.W);
+	g_assert(bulk->de.W == single->de.W);
+	g_assert(bulk->hl.W == single->hl.W);
+	g_assert(bulk->sp.W == single->sp.W);
+	g_assert(bulk->counter == single->counter);
+	g_assert(bulk->cycles == single->cycles);
+	g_assert(bulk->halted == single->halted);
+	g_assert(memcmp(bulk_memory, single_memory, 0x10000) == 0);
+}
+
+/** Port read handler returning the low byte of the port address plus a counter */
+static uint8_t test_port_in(void *context, uint16_t port) {
+	int *reads = context;
+	return (uint8_t)((port & 0xFF) + (*reads)++);
+}
+
+/** Port write handler summing the bytes written */
+static void test_port_out(void *context, uint16_t port, uint8_t value) {
+	int *sum = context;
+	(void)port;
+	*sum += value;
+}
+
+static void test_block_copy(test_fixture *tf, gconstpointer data) {
+	uint8_t *memory = calloc(0x10000, sizeof(uint8_t));
+	uint8_t program[] = {
+		0x21, 0x00, 0x10, // ld hl,0x1000
+		0x11, 0x01, 0x10, // ld de,0x1001
+		0x01, 0xFF, 0x00, // ld bc,0x00FF
+		0x36, 0xAA,       // ld (hl),0xAA
+		0xED, 0xB0,       // ldir
+		0x21, 0x02, 0x10, // ld hl,0x1002
+		0x11, 0x04, 0x20, // ld de,0x2004
+		0x01, 0x03, 0x00, // ld bc,3
+		0xED, 0xB8        // lddr
+	};
+
+	for (size_t i = 0; i < sizeof(program); i++) {
+		memory[i] = program[i];
+	}
+	memory[0x1002] = 0x55;
+
+	// the ldir fills 0x1000-0x10FF, overwriting the 0x55
+	g_assert(run(tf->test_cpu, memory, 4 + 0xFF, 0) == 4 + 0xFF);
+	g_assert(tf->test_cpu->pc.W == 0x000D);
+	g_assert(tf->test_cpu->bc.W == 0);
+	g_assert(tf->test_cpu->hl.W == 0x10FF);
+	g_assert(tf->test_cpu->de.W == 0x1100);
+	g_assert(memory[0x0FFF] == 0x00);
+	g_assert(memory[0x1002] == 0xAA);
+	g_assert(memory[0x10FF] == 0xAA);
+	g_assert(memory[0x1100] == 0x00);
+	g_assert(!IS_SET(tf->test_cpu->flags, 2));
+	g_assert(tf->test_cpu->counter == INTERRUPT_PERIOD - (10 + 10 + 10 + 10 + 21 * 0xFE + 16));
+
+	g_assert(run(tf->test_cpu, memory, 6, 0) == 6);
+	g_assert(tf->test_cpu->pc.W == 0x0018);
+	g_assert(tf->test_cpu->hl.W == 0x0FFF);
+	g_assert(tf->test_cpu->de.W == 0x2001);
+	g_assert(memory[0x2002] == 0xAA);
+	g_assert(memory[0x2004] == 0xAA);
+	g_assert(memory[0x2001] == 0x00);
+
+	free(memory);
+}
+
+static void test_block_bulk(test_fixture *tf, gconstpointer data) {
+	uint8_t *bulk_memory = calloc(0x10000, sizeof(uint8_t));
+	uint8_t *single_memory = calloc(0x10000, sizeof(uint8_t));
+	z80 *single = new_cpu();
+	int bulk_port = 0;
+	int single_port = 0;
+	uint8_t program[] = {
+		0x31, 0x00, 0x00, // ld sp,0
+		0xFB,             // ei
+		0x21, 0xF0, 0xFF, // ld hl,0xFFF0
+		0x11, 0x00, 0x30, // ld de,0x3000
+		0x01, 0x00, 0x08, // ld bc,0x0800
+		0xED, 0xB0,       // ldir, wrapping HL and taking interrupts
+		0x21, 0x00, 0x40, // ld hl,0x4000
+		0x01, 0x00, 0x10, // ld bc,0x1000
+		0x3E, 0x07,       // ld a,7
+		0xED, 0xB1,       // cpir
+		0xED, 0xB9,       // cpdr
+		0x21, 0x00, 0x50, // ld hl,0x5000
+		0x01, 0x10, 0x00, // ld bc,0x0010
+		0xED, 0xB2,       // inir
+		0x21, 0x00, 0x50, // ld hl,0x5000
+		0x06, 0x10,       // ld b,0x10
+		0xED, 0xB3,       // otir
+		0x21, 0x61, 0x00, // ld hl,0x0061
+		0x11, 0x34, 0x00, // ld de,0x0034
+		0x01, 0x10, 0x00, // ld bc,0x0010
+		0xED, 0xB8,       // lddr, turning itself into ldd
+		0x18, 0xFE        // jr $
+	};
+
+	for (size_t i = 0; i < sizeof(program); i++) {
+		bulk_memory[i] = single_memory[i] = program[i];
+	}
+	for (int i = 0; i < 0x1000; i++) {
+		bulk_memory[0x4000 + i] = single_memory[0x4000 + i] = (uint8_t)(i * 13);
+	}
+
+	// the interrupt handler only returns
+	bulk_memory[0x0038] = single_memory[0x0038] = 0xFB; // ei
+	bulk_memory[0x0039] = single_memory[0x0039] = 0xC9; // ret
+	bulk_memory[0x0060] = single_memory[0x0060] = 0xED;
+	bulk_memory[0x0061] = single_memory[0x0061] = 0xA8;
+
+	tf->test_cpu->im = 1;
+	single->im = 1;
+	tf->test_cpu->port_in = single->port_in = test_port_in;
+	tf->test_cpu->port_out = single->port_out = test_port_out;
+	tf->test_cpu->port_context = &bulk_port;
+	single->port_context = &single_port;
+
+	assert_bulk_matches_single(tf->test_cpu, bulk_memory, single, single_memory, 0x0800 + 50);
+	assert_bulk_matches_single(tf->test_cpu, bulk_memory, single, single_memory, 0x400);
+	assert_bulk_matches_single(tf->test_cpu, bulk_memory, single, single_memory, 0x400);
+	g_assert(bulk_port == single_port);
+	g_assert(tf->test_cpu->pc.W == 0x0035);
+	g_assert(tf->test_cpu->bc.W == 0x000E);
+	g_assert(bulk_memory[0x0033] == 0xED);
+	g_assert(bulk_memory[0x0034] == 0xA8);
+
+	free(single);
+	free(bulk_memory);
+	free(single_memory);
+}
+
+static void test_io(test_fixture *tf, gconstpointer data) {
+	uint8_t memory[8] = {
+		0x3E, 0x12,       // ld a,0x12
+		0xDB, 0x34,       // in a,(0x34)
+		0xD3, 0x56,       // out (0x56),a
+		0x00, 0x00
+	};
+	int context = 1;
+
+	// without handlers, reads float high and writes go nowhere
+	g_assert(run(tf->test_cpu, memory, 2, 0) == 2);
+	g_assert(tf->test_cpu->a == 0xFF);
+
+	tf->test_cpu->port_in = test_port_in;
+	tf->test_cpu->port_out = test_port_out;
+	tf->test_cpu->port_context = &context;
+	tf->test_cpu->pc.W = 0;
+
+	g_assert(run(tf->test_cpu, memory, 3, 0) == 3);
+	g_assert(tf->test_cpu->a == 0x35);
+	g_assert(context == 2 + 0x35);
+}
+
+static void test_halt(test_fixture *tf, gconstpointer data) {
+	uint8_t memory[8] = {
+		0x3E, 0x01,       // ld a,1
+		0x76,             // halt
+		0x3E, 0x02,       // ld a,2
+		0x00, 0x00, 0x00
+	};
+
+	// with interrupts disabled the halt runs nops in place for good
+	g_assert(run(tf->test_cpu, memory, 1000, 0) == 1000);
+	g_assert(tf->test_cpu->pc.W == 0x0002);
+	g_assert(tf->test_cpu->halted);
+	g_assert(tf->test_cpu->a == 0x01);
+	g_assert(tf->test_cpu->cycles == 7 + 4 * 999);
+	g_assert(tf->test_cpu->counter == INTERRUPT_PERIOD - (7 + 4 * 999));
+
+	reset_cpu(tf->test_cpu);
+	g_assert(!tf->test_cpu->halted);
+	g_assert(tf->test_cpu->cycles == 0);
+}
+
+static void test_idle_loops(test_fixture *tf, gconstpointer data) {
+	uint8_t *bulk_memory = calloc(0x10000, sizeof(uint8_t));
+	uint8_t *single_memory = calloc(0x10000, sizeof(uint8_t));
+	z80 *single = new_cpu();
+	uint8_t program[] = {
+		0x31, 0x00, 0x01, // ld sp,0x0100
+		0xED, 0x56,       // im 1
+		0xFB,             // ei
+		0x3A, 0x80, 0x00, // poll: ld a,(0x0080)
+		0xE6, 0x01,       // and 1
+		0x28, 0xF9,       // jr z,poll
+		0x76,             // halt
+		0x18, 0xFE        // jr $
+	};
+	uint8_t handler[] = {
+		0x3E, 0x01,       // ld a,1
+		0x32, 0x80, 0x00, // ld (0x0080),a
+		0xFB,             // ei
+		0xC9              // ret
+	};
+
+	for (size_t i = 0; i < sizeof(program); i++) {
+		bulk_memory[i] = single_memory[i] = program[i];
+	}
+	for (size_t i = 0; i < sizeof(handler); i++) {
+		bulk_memory[0x0038 + i] = single_memory[0x0038 + i] = handler[i];
+	}
+
+	// start a full interrupt period away
+	tf->test_cpu->counter = single->counter = INTERRUPT_PERIOD;
+
+	// the first interrupt ends the polling loop
+	assert_bulk_matches_single(tf->test_cpu, bulk_memory, single, single_memory, 600);
+	g_assert(tf->test_cpu->pc.W >= 0x0006 && tf->test_cpu->pc.W < 0x000D);
+	g_assert(tf->test_cpu->flags == (1 << 4 | 1 << 3 | 1 << 2));
+	assert_bulk_matches_single(tf->test_cpu, bulk_memory, single, single_memory, 1000);
+	g_assert(tf->test_cpu->halted);
+	g_assert(bulk_memory[0x0080] == 0x01);
+
+	// the second one ends the halt
+	assert_bulk_matches_single(tf->test_cpu, bulk_memory, single, single_memory, 3000);
+	g_assert(!tf->test_cpu->halted);
+	assert_bulk_matches_single(tf->test_cpu, bulk_memory, single, single_memory, 5000);
+	g_assert(tf->test_cpu->pc.W == 0x000E);
+	g_assert(tf->test_cpu->cycles > 3 * INTERRUPT_PERIOD);
+
+	free(single);
+	free(bulk_memory);
+	free(single_memory);
+}
+
+// trap handler standing in for adc a,e, declining anything else
+static int emulate_adc_a_e(void *context, z80 *cpu, uint8_t *memory, const z80_trap *trap) {
+	(void)memory;
+
+	if (trap->reason != TRAP_OPCODE || trap->bytes[0] != 0x8B) {
+		return -1;
+	}
+
+	++*(int *)context;
+	cpu->a += cpu->de.B.l + IS_SET(cpu->flags, 0);
+	cpu->pc.W++;
+	return 4;
+}
+
+// test that unimplemented instructions stop run() with a trap, or go to the handler
+static void test_trap(test_fixture *tf, gconstpointer data) {
+	uint8_t *memory = calloc(0x10000, sizeof(uint8_t));
+	int handled = 0;
+
+	// nop; nop; ED FF
+	memory[0x0002] = 0xED;
+	memory[0x0003] = 0xFF;
+	tf->test_cpu->counter = INTERRUPT_PERIOD;
+
+	g_assert(run(tf->test_cpu, memory, 5, 0) == -1);
+	g_assert(tf->test_cpu->trap.reason == TRAP_ED);
+	g_assert(tf->test_cpu->trap.pc == 0x0002);
+	g_assert(tf->test_cpu->trap.length == 2);
+	g_assert(tf->test_cpu->trap.bytes[0] == 0xED && tf->test_cpu->trap.bytes[1] == 0xFF);
+	g_assert(tf->test_cpu->trap.instructions == 2);
+	g_assert(tf->test_cpu->pc.W == 0x0002);
+	g_assert(tf->test_cpu->cycles == 8);
+
+	// running again stops on the same instruction
+	g_assert(run(tf->test_cpu, memory, 1, 0) == -1);
+	g_assert(tf->test_cpu->trap.instructions == 0);
+	g_assert(tf->test_cpu->pc.W == 0x0002);
+
+	// ld e,5; adc a,e; DD FF
+	reset_cpu(tf->test_cpu);
+	tf->test_cpu->counter = INTERRUPT_PERIOD;
+	memory[0x0000] = 0x1E;
+	memory[0x0001] = 0x05;
+	memory[0x0002] = 0x8B;
+	memory[0x0003] = 0xDD;
+	memory[0x0004] = 0xFF;
+
+	g_assert(run(tf->test_cpu, memory, 2, 0) == -1);
+	g_assert(tf->test_cpu->trap.reason == TRAP_OPCODE);
+	g_assert(tf->test_cpu->trap.length == 1);
+	g_assert(tf->test_cpu->pc.W == 0x0002);
+
+	// the handler emulates it and run() carries on to the next trap
+	tf->test_cpu->trap_handler = emulate_adc_a_e;
+	tf->test_cpu->trap_context = &handled;
+	g_assert(run(tf->test_cpu, memory, 1, 0) == 1);
+	g_assert(tf->test_cpu->trap.reason == TRAP_NONE);
+	g_assert(handled == 1);
+	g_assert(tf->test_cpu->a == 5);
+	g_assert(tf->test_cpu->pc.W == 0x0003);
+	g_assert(tf->test_cpu->cycles == 11);
+
+	g_assert(run(tf->test_cpu, memory, 2, 0) == -1);
+	g_assert(tf->test_cpu->trap.reason == TRAP_INDEX);
+	g_assert(tf->test_cpu->trap.pc == 0x0003);
+	g_assert(tf->test_cpu->pc.W == 0x0003);
+	g_assert(handled == 1);
+
+	free(memory);
+}
+
+// test that run() stops before a breakpoint, except where it started
+static void test_breakpoints(test_fixture *tf, gconstpointer data) {
+	uint8_t *memory = calloc(0x10000, sizeof(uint8_t));
+	uint8_t breakpoints[0x2000] = { 0 };
+
+	breakpoints[0x0005 >> 3] |= 1 << (0x0005 & 0x07);
+	tf->test_cpu->breakpoints = breakpoints;
+	tf->test_cpu->counter = INTERRUPT_PERIOD;
+
+	g_assert(run(tf->test_cpu, memory, 100, 0) == 5);
+	g_assert(tf->test_cpu->trap.reason == TRAP_BREAKPOINT);
+	g_assert(tf->test_cpu->trap.pc == 0x0005);
+	g_assert(tf->test_cpu->pc.W == 0x0005);
+	g_assert(tf->test_cpu->cycles == 20);
+
+	g_assert(run(tf->test_cpu, memory, 3, 0) == 3);
+	g_assert(tf->test_cpu->trap.reason == TRAP_NONE);
+	g_assert(tf->test_cpu->pc.W == 0x0008);
+
+	free(memory);
+}
+
+// test every documented opcode the interpreter runs against its row in opcodes.h
+static void test_opcode_table(test_fixture *tf, gconstpointer data) {
+	uint8_t *memory = calloc(0x10000, sizeof(uint8_t));
+	const struct {
+		uint8_t prefix;
+		const opcode *table;
+	} pages[] = { { 0x00, opcodes_base }, { 0xED, opcodes_ed }, { 0xDD, opcodes_dd }, { 0xFD, opcodes_fd } };
+	int checked = 0;
+
+	for (size_t p = 0; p < sizeof(pages) / sizeof(pages[0]); p++) {
+		for (int code = 0; code < 256; code++) {
+			const opcode *op = &pages[p].table[code];
+			int start = (pages[p].prefix != 0);
+
+			// only instructions that fall through have a known next pc
+			if (op->mnemonic == NULL || op->kind == OPCODE_JUMP || op->kind == OPCODE_BRANCH || op->kind == OPCODE_PREFIX) {
+				continue;
+			}
+
+			memset(memory, 0, 0x10000);
+			memory[0] = pages[p].prefix;
+			memory[start] = (uint8_t)code;
+
+			memset(tf->test_cpu, 0, sizeof(z80));
+			tf->test_cpu->sp.W = 0x8000;
+			tf->test_cpu->counter = INTERRUPT_PERIOD;
+
+			// block instructions run once: ini/outi count b, the others bc
+			tf->test_cpu->bc.W = (op->kind == OPCODE_REPEAT && (code & 0x02)) ? 0x0100 : 0x0001;
+
+			if (run(tf->test_cpu, memory, 1, 0) < 0) {
+				continue; // not implemented yet, and trapped
+			}
+
+			if (tf->test_cpu->pc.W != ((op->kind == OPCODE_HALT) ? 0 : op->length) || tf->test_cpu->cycles != op->tstates) {
+				g_test_message("%02X %02X %s: pc %04X, %lu T-states", pages[p].prefix, code, op->mnemonic,
+				               tf->test_cpu->pc.W, (unsigned long)tf->test_cpu->cycles);
+			}
+			g_assert_cmpint(tf->test_cpu->pc.W, ==, (op->kind == OPCODE_HALT) ? 0 : op->length);
+			g_assert_cmpint(tf->test_cpu->cycles, ==, op->tstates);
+			checked++;
+		}
+	}
+
+	// the unprefixed page is all implemented, bar cb
+	g_assert_cmpint(checked, >=, 200);
+
+	free(memory);
+}
+
+// index offsets are signed, and addresses wrap around the end of memory
+static void test_index_wraparound(test_fixture *tf, gconstpointer data) {
+	uint8_t *memory = calloc(0x10000, sizeof(uint8_t));
+	const uint8_t code[] = {
+		0xDD, 0x7E, 0xFE,       // ld a,(ix-2)
+		0xDD, 0x36, 0x80, 0x42, // ld (ix-128),0x42
+		0xFD, 0x77, 0x20,       // ld (iy+32),a
+		0xFD, 0x46, 0x10,       // ld b,(iy+16)
+		0xE3                    // ex (sp),hl
+	};
+
+	memcpy(&memory[0x0100], code, sizeof(code));
+	memory[0x0003] = 0x99;
+	memory[0x0000] = 0x12;
+	memory[0xFFFF] = 0x34;
+
+	tf->test_cpu->pc.W = 0x0100;
+	tf->test_cpu->ix.W = 0x0005;
+	tf->test_cpu->iy.W = 0xFFF0;
+	tf->test_cpu->sp.W = 0xFFFF;
+	tf->test_cpu->hl.W = 0xABCD;
+	tf->test_cpu->counter = INTERRUPT_PERIOD;
+
+	g_assert_cmpint(run(tf->test_cpu, memory, 5, 0), ==, 5);
+
+	g_assert_cmpint(tf->test_cpu->a, ==, 0x99);
+	g_assert_cmpint(memory[0xFF85], ==, 0x42);
+	g_assert_cmpint(memory[0x0010], ==, 0x99);
+	g_assert_cmpint(tf->test_cpu->bc.B.h, ==, 0x12);
+	g_assert_cmpint(tf->test_cpu->hl.W, ==, 0x1234);
+	g_assert_cmpint(memory[0xFFFF], ==, 0xCD);
+	g_assert_cmpint(memory[0x0000], ==, 0xAB);
+	g_assert(tf->test_cpu->dirty == (DIRTY_BIT(0xFF85) | DIRTY_BIT(0x0010) | DIRTY_BIT(0xFFFF) | DIRTY_BIT(0x0000)));
+
+	free(memory);
+}
+
 int main (int argc, char *argv[]) {
 	g_test_init (&argc, &argv, NULL);
 
 	g_test_add("/z80 functions/new_cpu()", test_fixture, NULL, setup_cpu, test_register_init, teardown_cpu);
 	g_test_add("/z80 functions/reset_cpu()", test_fixture, NULL, setup_cpu, test_cpu_reset, teardown_cpu);
+	g_test_add("/z80 functions/mark_dirty()", test_fixture, NULL, setup_cpu, test_mark_dirty, teardown_cpu);
 	g_test_add("/z80 helpers/_load_reg8_mem_pair()", test_fixture, NULL, setup_cpu, test_load_reg8_from_ram, teardown_cpu);
 	g_test_add("/z80 helpers/_load_reg8_mem_idx_offset()", test_fixture, NULL, setup_cpu, test_load_reg8_from_offset_idx, teardown_cpu);
 	g_test_add("/z80 helpers/_load_mem_idx_offset_reg8()", test_fixture, NULL, setup_cpu, test_load_mem_offset_idx_from_reg8, teardown_cpu);
@@ -452,6 +1128,20 @@ int main (int argc, char *argv[]) {
 	g_test_add("/z80 instructions/ld a 16-bit", test_fixture, "data/test_ld_a_16.bin", setup_cpu, test_ld_a_16, teardown_cpu);
 	g_test_add("/z80 instructions/add hl", test_fixture, NULL, setup_cpu, test_add_hl, teardown_cpu);
     g_test_add("/z80 instructions/add a", test_fixture, "data/test_add_a.bin", setup_cpu, test_add_a, teardown_cpu);
+	g_test_add("/z80 instructions/call ret", test_fixture, NULL, setup_cpu, test_call_ret, teardown_cpu);
+	g_test_add("/z80 instructions/call cc ret cc rst", test_fixture, NULL, setup_cpu, test_call_ret_cond, teardown_cpu);
+	g_test_add("/z80 instructions/interrupt mode 1", test_fixture, NULL, setup_cpu, test_interrupt_im1, teardown_cpu);
+	g_test_add("/z80 superinstructions/fused sequences", test_fixture, NULL, setup_cpu, test_fused_sequences, teardown_cpu);
+	g_test_add("/z80 superinstructions/instruction budget", test_fixture, NULL, setup_cpu, test_fused_budget, teardown_cpu);
+	g_test_add("/z80 instructions/ldir lddr", test_fixture, NULL, setup_cpu, test_block_copy, teardown_cpu);
+	g_test_add("/z80 instructions/block bulk vs single", test_fixture, NULL, setup_cpu, test_block_bulk, teardown_cpu);
+	g_test_add("/z80 instructions/in out", test_fixture, NULL, setup_cpu, test_io, teardown_cpu);
+	g_test_add("/z80 instructions/halt", test_fixture, NULL, setup_cpu, test_halt, teardown_cpu);
+	g_test_add("/z80 instructions/index wraparound", test_fixture, NULL, setup_cpu, test_index_wraparound, teardown_cpu);
+	g_test_add("/z80 idle loops/fast-forward", test_fixture, NULL, setup_cpu, test_idle_loops, teardown_cpu);
+	g_test_add("/z80 traps/unimplemented instructions", test_fixture, NULL, setup_cpu, test_trap, teardown_cpu);
+	g_test_add("/z80 traps/breakpoints", test_fixture, NULL, setup_cpu, test_breakpoints, teardown_cpu);
+	g_test_add("/z80 opcode table/lengths and timings", test_fixture, NULL, setup_cpu, test_opcode_table, teardown_cpu);
 
 	return g_test_run();
 }